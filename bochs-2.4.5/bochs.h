@@ -173,7 +173,11 @@ void print_tree(bx_param_c *node, int level = 0);
 #define BX_INP(addr, len)           bx_devices.inp(addr, len)
 #define BX_OUTP(addr, val, len)     bx_devices.outp(addr, val, len)
 #define BX_TICK1()                  bx_pc_system.tick1()
+#if BX_SUPPORT_SMP_THREADS
+#define BX_TICKN(n)                 bx_smp_tickn(n)
+#else
 #define BX_TICKN(n)                 bx_pc_system.tickn(n)
+#endif
 #define BX_INTR                     bx_pc_system.INTR
 #define BX_SET_INTR(b)              bx_pc_system.set_INTR(b)
 #define BX_CPU_C                    bx_cpu_c
@@ -478,6 +482,7 @@ BOCHSAPI extern bx_debug_t bx_dbg;
 
 #include "memory/memory.h"
 #include "pc_system.h"
+#include "smp.h"
 #include "plugin.h"
 #include "gui/gui.h"
 
@@ -227,7 +227,7 @@ void bx_init_options()
   int i;
   bx_list_c *menu;
   bx_list_c *deplist;
-  bx_param_num_c *ioaddr, *ioaddr2, *irq;
+  bx_param_num_c *ioaddr, *ioaddr2, *irq, *bmdma;
   bx_param_bool_c *enabled, *status;
   bx_param_enum_c *mode, *type, *ethmod;
   bx_param_string_c *macaddr, *ethdev;
@@ -290,6 +290,19 @@ void bx_init_options()
       "set benchmark mode",
       0, BX_MAX_BIT32U, 0);
 
+  // snapshot mode, set by command line arg
+  new bx_param_num_c(menu,
+      "snapshot_ticks",
+      "Snapshot after ticks",
+      "Save the Bochs state after this number of emulated ticks",
+      0, BX_MAX_BIT64S, 0);
+  new bx_param_string_c(menu,
+    "snapshot_path",
+    "Path to data for snapshot",
+    "Path to data for snapshot",
+    "",
+    BX_PATHNAME_LEN);
+
   // subtree for special menus
   bx_list_c *special_menus = new bx_list_c(root_param, "menu", "");
 
@@ -304,7 +317,7 @@ void bx_init_options()
 #endif
 
   // cpu subtree
-  bx_list_c *cpu_param = new bx_list_c(root_param, "cpu", "CPU Options", 8 + BX_SUPPORT_SMP);
+  bx_list_c *cpu_param = new bx_list_c(root_param, "cpu", "CPU Options", 8 + BX_SUPPORT_SMP + BX_SUPPORT_SMP_THREADS + BX_SUPPORT_JIT);
 
   // cpu options
   bx_param_num_c *nprocessors = new bx_param_num_c(cpu_param,
@@ -336,6 +349,30 @@ void bx_init_options()
       "Maximum amount of instructions allowed to execute before returning control to another CPU.",
       BX_SMP_QUANTUM_MIN, BX_SMP_QUANTUM_MAX,
       5);
+#endif
+#if BX_SUPPORT_SMP_THREADS
+  static const char *smp_mode_names[] = { "roundrobin", "threads", "lockstep", NULL };
+
+  new bx_param_enum_c(cpu_param,
+      "smp_mode", "SMP simulation mode",
+      "Interleave the CPUs on one host thread, run each CPU on its own host thread or run them in parallel in reproducible lock-step epochs.",
+      smp_mode_names,
+      BX_SMP_MODE_ROUNDROBIN,
+      BX_SMP_MODE_ROUNDROBIN);
+#endif
+#if BX_SUPPORT_TRACE_CACHE
+  new bx_param_num_c(cpu_param,
+      "trace_pool", "Trace cache pool size",
+      "Number of decoded instructions kept in the trace cache memory pool of each CPU.",
+      BX_ICACHE_POOL_MIN, BX_ICACHE_POOL_MAX,
+      BX_ICACHE_POOL_SIZE);
+#endif
+#if BX_SUPPORT_JIT
+  new bx_param_num_c(cpu_param,
+      "jit_threshold", "Trace translation threshold",
+      "Number of executions after which a trace is translated into host code, 0 disables the translation.",
+      0, BX_MAX_BIT32U,
+      BX_JIT_THRESHOLD);
 #endif
   new bx_param_bool_c(cpu_param,
       "reset_on_triple_fault", "Enable CPU reset on triple fault",
@@ -467,6 +504,12 @@ void bx_init_options()
   host_ramsize->set_ask_format("Enter memory size (MB): [%d] ");
   host_ramsize->set_options(ramsize->USE_SPIN_CONTROL);
 
+  path = new bx_param_filename_c(ram,
+      "file",
+      "RAM backing file",
+      "Pathname of a file which holds the guest RAM",
+      "", BX_PATHNAME_LEN);
+
   path = new bx_param_filename_c(rom,
       "path",
       "ROM BIOS image",
@@ -1061,7 +1104,7 @@ void bx_init_options()
     14, 15, 11, 9
   };
 
-  #define BXP_PARAMS_PER_ATA_DEVICE 12
+  #define BXP_PARAMS_PER_ATA_DEVICE (13 + BX_SUPPORT_ASYNC_DISK)
 
   bx_list_c *ata_menu[BX_MAX_ATA_CHANNEL];
   bx_list_c *ata_res[BX_MAX_ATA_CHANNEL];
@@ -1072,7 +1115,7 @@ void bx_init_options()
     sprintf(name, "%d", channel);
     ata_menu[channel] = new bx_list_c(ata, name, s_atachannel[channel]);
     ata_menu[channel]->set_options(bx_list_c::USE_TAB_WINDOW);
-    ata_res[channel] = new bx_list_c(ata_menu[channel], "resources", s_atachannel[channel], 8);
+    ata_res[channel] = new bx_list_c(ata_menu[channel], "resources", s_atachannel[channel], 9);
     ata_res[channel]->set_options(bx_list_c::SERIES_ASK);
 
     enabled = new bx_param_bool_c(ata_res[channel],
@@ -1109,6 +1152,15 @@ void bx_init_options()
     irq->set_ask_format("Enter new IRQ: [%d] ");
     irq->set_options(irq->USE_SPIN_CONTROL);
 
+    bmdma = new bx_param_num_c(ata_res[channel],
+      "bmdma",
+      "Bus master I/O address",
+      "IO adress of the bus master DMA registers, 0 = none",
+      0, 0xffff,
+      0);
+    bmdma->set_base(16);
+    bmdma->set_ask_format("Enter new bus master ioaddr: [0x%x] ");
+
     // all items in the ata[channel] menu depend on the enabled flag.
     // The menu list is complete, but a few dependent_list items will
     // be added later.  Use clone() to make a copy of the dependent_list
@@ -1170,11 +1222,35 @@ void bx_init_options()
         "Pathname of the journal file",
         "", BX_PATHNAME_LEN);
       journal->set_ask_format("Enter path of journal file: [%s]");
-      deplist = new bx_list_c(NULL, 1);
+
+      bx_param_bool_c *use_mmap = new bx_param_bool_c(menu,
+        "mmap",
+        "Map the image into memory",
+        "Access the flat or sparse image through a memory mapping",
+        0);
+      use_mmap->set_ask_format("Map the image into memory? [%s] ");
+
+      deplist = new bx_list_c(NULL, 2);
       deplist->add(journal);
+      deplist->add(use_mmap);
       mode->set_dependent_list(deplist, 0);
+      mode->set_dependent_bitmap(BX_ATA_MODE_FLAT, 2);
+      mode->set_dependent_bitmap(BX_ATA_MODE_SPARSE, 2);
       mode->set_dependent_bitmap(BX_ATA_MODE_UNDOABLE, 1);
       mode->set_dependent_bitmap(BX_ATA_MODE_VOLATILE, 1);
+#if BX_COMPRESSED_HD_SUPPORT
+      mode->set_dependent_bitmap(BX_ATA_MODE_Z_UNDOABLE, 1);
+      mode->set_dependent_bitmap(BX_ATA_MODE_Z_VOLATILE, 1);
+#endif
+
+#if BX_SUPPORT_ASYNC_DISK
+      bx_param_bool_c *async = new bx_param_bool_c(menu,
+        "async",
+        "Asynchronous transfers",
+        "Do the disk transfers on a host thread while the simulation goes on",
+        0);
+      async->set_ask_format("Use asynchronous transfers? [%s] ");
+#endif
 
       bx_param_num_c *cylinders = new bx_param_num_c(menu,
         "cylinders",
@@ -1247,6 +1323,9 @@ void bx_init_options()
         heads,
         spt,
         translation,
+#if BX_SUPPORT_ASYNC_DISK
+        async,
+#endif
         NULL
       };
       deplist = new bx_list_c(NULL, "deplist", "", type_deplist);
@@ -2322,7 +2401,7 @@ static int parse_line_formatted(const char *context, int num_params, char *param
       PARSE_ERR(("%s: ataX directive malformed.", context));
     }
 
-    if ((num_params < 2) || (num_params > 5)) {
+    if ((num_params < 2) || (num_params > 6)) {
       PARSE_ERR(("%s: ataX directive malformed.", context));
     }
     sprintf(tmpname, "ata.%d.resources", channel);
@@ -2365,6 +2444,18 @@ static int parse_line_formatted(const char *context, int num_params, char *param
         SIM->get_param_num("irq", base)->set(atol(&params[4][4]));
       }
     }
+
+    if (num_params > 5) {
+      if (strncmp(params[5], "bmdma=", 6)) {
+        PARSE_ERR(("%s: ataX directive malformed.", context));
+      }
+      else {
+        if ((params[5][6] == '0') && (params[5][7] == 'x'))
+          SIM->get_param_num("bmdma", base)->set(strtoul(&params[5][6], NULL, 16));
+        else
+          SIM->get_param_num("bmdma", base)->set(strtoul(&params[5][6], NULL, 10));
+      }
+    }
   }
 
   // ataX-master, ataX-slave
@@ -2395,10 +2486,10 @@ static int parse_line_formatted(const char *context, int num_params, char *param
         if (type < 0) {
           PARSE_ERR(("%s: ataX-master/slave: unknown type '%s'", context, &params[i][5]));
         }
-      } else if (!strcmp(params[i], "mode=z-undoable")) {
-        PARSE_ERR(("%s: ataX-master/slave mode 'z-undoable' not implemented yet", context));
-      } else if (!strcmp(params[i], "mode=z-volatile")) {
-        PARSE_ERR(("%s: ataX-master/slave mode 'z-volatile' not implemented yet", context));
+#if !BX_COMPRESSED_HD_SUPPORT
+      } else if (!strcmp(params[i], "mode=z-undoable") || !strcmp(params[i], "mode=z-volatile")) {
+        PARSE_ERR(("%s: ataX-master/slave %s requires compressed hard disk support", context, params[i]));
+#endif
       } else if (!strncmp(params[i], "mode=", 5)) {
         mode = SIM->get_param_enum("mode", base)->find_by_name(&params[i][5]);
         if (mode < 0) {
@@ -2437,6 +2528,12 @@ static int parse_line_formatted(const char *context, int num_params, char *param
         SIM->get_param_bool("status", base)->set(1);
       } else if (!strncmp(params[i], "journal=", 8)) {
         SIM->get_param_string("journal", base)->set(&params[i][8]);
+      } else if (!strncmp(params[i], "mmap=", 5)) {
+        SIM->get_param_bool("mmap", base)->set(atol(&params[i][5]));
+#if BX_SUPPORT_ASYNC_DISK
+      } else if (!strncmp(params[i], "async=", 6)) {
+        SIM->get_param_bool("async", base)->set(atol(&params[i][6]));
+#endif
       } else {
         PARSE_ERR(("%s: ataX-master/slave directive malformed.", context));
       }
@@ -2584,6 +2681,20 @@ static int parse_line_formatted(const char *context, int num_params, char *param
 #if BX_SUPPORT_SMP
       } else if (!strncmp(params[i], "quantum=", 8)) {
         SIM->get_param_num(BXPN_SMP_QUANTUM)->set(atol(&params[i][8]));
+#endif
+#if BX_SUPPORT_SMP_THREADS
+      } else if (!strncmp(params[i], "smp_mode=", 9)) {
+        if (!SIM->get_param_enum(BXPN_SMP_MODE)->set_by_name(&params[i][9])) {
+          PARSE_ERR(("%s: cpu directive malformed.", context));
+        }
+#endif
+#if BX_SUPPORT_TRACE_CACHE
+      } else if (!strncmp(params[i], "trace_pool=", 11)) {
+        SIM->get_param_num(BXPN_TRACE_POOL)->set(atol(&params[i][11]));
+#endif
+#if BX_SUPPORT_JIT
+      } else if (!strncmp(params[i], "jit_threshold=", 14)) {
+        SIM->get_param_num(BXPN_JIT_THRESHOLD)->set(atol(&params[i][14]));
 #endif
       } else if (!strncmp(params[i], "reset_on_triple_fault=", 22)) {
         if (parse_param_bool(params[i], 22, BXPN_RESET_ON_TRIPLE_FAULT) < 0) {
@@ -2682,6 +2793,8 @@ static int parse_line_formatted(const char *context, int num_params, char *param
         SIM->get_param_num(BXPN_HOST_MEM_SIZE)->set(atol(&params[i][5]));
       } else if (!strncmp(params[i], "guest=", 6)) {
         SIM->get_param_num(BXPN_MEM_SIZE)->set(atol(&params[i][6]));
+      } else if (!strncmp(params[i], "file=", 5)) {
+        SIM->get_param_string(BXPN_MEM_FILE)->set(&params[i][5]);
       } else {
         PARSE_ERR(("%s: memory directive malformed.", context));
       }
@@ -3413,6 +3526,9 @@ int bx_write_ata_options(FILE *fp, Bit8u channel, bx_list_c *base)
   if (SIM->get_param_bool("enabled", base)->get()) {
     fprintf(fp, ", ioaddr1=0x%x, ioaddr2=0x%x, irq=%d", SIM->get_param_num("ioaddr1", base)->get(),
       SIM->get_param_num("ioaddr2", base)->get(), SIM->get_param_num("irq", base)->get());
+    if (SIM->get_param_num("bmdma", base)->get() > 0) {
+      fprintf(fp, ", bmdma=0x%x", SIM->get_param_num("bmdma", base)->get());
+    }
     }
 
   fprintf(fp, "\n");
@@ -3439,6 +3555,13 @@ int bx_write_atadevice_options(FILE *fp, Bit8u channel, Bit8u drive, bx_list_c *
         if (strcmp(SIM->get_param_string("journal", base)->getptr(), "") != 0)
           fprintf(fp, ", journal=\"%s\"", SIM->get_param_string("journal", base)->getptr());
 
+      if (SIM->get_param_bool("mmap", base)->get())
+        fprintf(fp, ", mmap=1");
+#if BX_SUPPORT_ASYNC_DISK
+      if (SIM->get_param_bool("async", base)->get())
+        fprintf(fp, ", async=1");
+#endif
+
     } else if (SIM->get_param_enum("type", base)->get() == BX_ATA_DEVICE_CDROM) {
       fprintf(fp, "type=cdrom, path=\"%s\", status=%s",
         SIM->get_param_string("path", base)->getptr(),
@@ -3703,8 +3826,13 @@ int bx_write_configuration(const char *rc, int overwrite)
     fprintf(fp, ", options=\"%s\"\n", strptr);
   else
     fprintf(fp, "\n");
-  fprintf(fp, "memory: host=%d, guest=%d\n", SIM->get_param_num(BXPN_HOST_MEM_SIZE)->get(),
+  fprintf(fp, "memory: host=%d, guest=%d", SIM->get_param_num(BXPN_HOST_MEM_SIZE)->get(),
     SIM->get_param_num(BXPN_MEM_SIZE)->get());
+  strptr = SIM->get_param_string(BXPN_MEM_FILE)->getptr();
+  if (strlen(strptr) > 0)
+    fprintf(fp, ", file=\"%s\"\n", strptr);
+  else
+    fprintf(fp, "\n");
   strptr = SIM->get_param_string(BXPN_ROM_PATH)->getptr();
   if (strlen(strptr) > 0) {
     fprintf(fp, "romimage: file=\"%s\"", strptr);
@@ -3799,8 +3927,17 @@ int bx_write_configuration(const char *rc, int overwrite)
     SIM->get_param_num(BXPN_CPU_NPROCESSORS)->get(), SIM->get_param_num(BXPN_CPU_NCORES)->get(),
     SIM->get_param_num(BXPN_CPU_NTHREADS)->get(), SIM->get_param_num(BXPN_IPS)->get(),
     SIM->get_param_num(BXPN_SMP_QUANTUM)->get());
+#if BX_SUPPORT_SMP_THREADS
+  fprintf(fp, "smp_mode=%s, ", SIM->get_param_enum(BXPN_SMP_MODE)->get_selected());
+#endif
 #else
   fprintf(fp, "cpu: count=1, ips=%u, ", SIM->get_param_num(BXPN_IPS)->get());
+#endif
+#if BX_SUPPORT_TRACE_CACHE
+  fprintf(fp, "trace_pool=%u, ", SIM->get_param_num(BXPN_TRACE_POOL)->get());
+#endif
+#if BX_SUPPORT_JIT
+  fprintf(fp, "jit_threshold=%u, ", SIM->get_param_num(BXPN_JIT_THRESHOLD)->get());
 #endif
   fprintf(fp, "reset_on_triple_fault=%d",
     SIM->get_param_bool(BXPN_RESET_ON_TRIPLE_FAULT)->get());
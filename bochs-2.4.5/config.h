@@ -127,6 +127,7 @@
 #define BX_HAVE_REALTIME_USEC (BX_HAVE_GETTIMEOFDAY)
 #endif
 #define BX_HAVE_MKSTEMP 1
+#define BX_HAVE_PREADV 1
 #define BX_HAVE_SYS_MMAN_H 1
 #define BX_HAVE_XPM_H 0
 #define BX_HAVE_TIMELOCAL 1
@@ -146,9 +147,27 @@
 
 // Minimum and maximum values for SMP quantum variable. Defines
 // how many instructions each CPU could execute execute in one
-// shot (one cpu_loop call)
+// shot (one cpu_loop call). Large values are only useful with the
+// processors on their own host threads, where a quantum is the length
+// of a lock-step epoch.
 #define BX_SMP_QUANTUM_MIN  1
-#define BX_SMP_QUANTUM_MAX 16
+#define BX_SMP_QUANTUM_MAX  65536
+
+// Size and associativity of the decoded instruction cache. The number
+// of entries must be a power of 2, supported associativity is 1, 2 or 4
+// ways per set. A set first reuses a stale entry of the same address or
+// an entry no longer valid for its page, otherwise its ways are replaced
+// in round-robin order.
+#define BX_ICACHE_ENTRIES (64 * 1024)
+#define BX_ICACHE_WAYS 4
+
+// Default, minimum and maximum size of the trace cache memory pool of
+// each CPU in decoded instructions ('cpu: trace_pool=' option). The pool
+// is recycled segment by segment.
+#define BX_ICACHE_POOL_SEGMENTS 8
+#define BX_ICACHE_POOL_SIZE (384 * 1024)
+#define BX_ICACHE_POOL_MIN  (16 * 1024)
+#define BX_ICACHE_POOL_MAX  (64 * 1024 * 1024)
 
 // Use Static Member Funtions to eliminate 'this' pointer passing
 // If you want the efficiency of 'C', you can make all the
@@ -240,6 +259,10 @@
   #error You must have zlib to enable compressed hd support
 #endif
 
+// This option allows hard disk transfers to be done on host threads
+// while the simulation goes on ("async" option of the ata devices)
+#define BX_SUPPORT_ASYNC_DISK 0
+
 // This option defines the number of supported ATA channels.
 // There are up to two drives per ATA channel.
 #define BX_MAX_ATA_CHANNEL 4
@@ -696,7 +719,83 @@ typedef
 #define BX_SupportRepeatSpeedups 0
 #define BX_SupportHostAsms 0
 
+// Host specific inline assembly keeps the lazy flags as host flags, see
+// cpu/lazy_flags.h. It needs gcc style inline assembly on an x86-64 host,
+// other hosts use the portable lazy flags.
+#if BX_SupportHostAsms && defined(__GNUC__) && defined(__x86_64__)
+  #define BX_HOST_LAZY_FLAGS 1
+#else
+  #define BX_HOST_LAZY_FLAGS 0
+#endif
+
 #define BX_SUPPORT_TRACE_CACHE 0
+#define BX_SUPPORT_TRACE_LINKING 0
+
+#if BX_SUPPORT_TRACE_LINKING && BX_SUPPORT_TRACE_CACHE == 0
+  #error "Trace linking requires trace cache support"
+#endif
+
+#define BX_SUPPORT_INSTR_FUSION 0
+
+#if BX_SUPPORT_INSTR_FUSION
+  #if BX_SUPPORT_TRACE_CACHE == 0
+    #error "Instruction fusion requires trace cache support"
+  #endif
+  #if BX_DEBUGGER || BX_INSTRUMENTATION
+    #error "Instruction fusion can't be used with the debugger or instrumentation"
+  #endif
+#endif
+
+#define BX_SUPPORT_FLAGS_LIVENESS 0
+
+#if BX_SUPPORT_FLAGS_LIVENESS
+  #if BX_SUPPORT_TRACE_CACHE == 0
+    #error "Flags liveness analysis requires trace cache support"
+  #endif
+  #if BX_DEBUGGER || BX_INSTRUMENTATION
+    #error "Flags liveness analysis can't be used with the debugger or instrumentation"
+  #endif
+#endif
+
+#define BX_SUPPORT_JIT 0
+
+// Default number of executions of a trace before the JIT translates it
+// ('cpu: jit_threshold=' option)
+#define BX_JIT_THRESHOLD 64
+
+#if BX_SUPPORT_JIT
+  #if BX_SUPPORT_TRACE_CACHE == 0
+    #error "JIT requires trace cache support"
+  #endif
+  #if BX_USE_CPU_SMF == 0
+    #error "JIT requires static CPU member functions (no SMP)"
+  #endif
+  #if BX_DEBUGGER || BX_INSTRUMENTATION
+    #error "JIT can't be used with the debugger or instrumentation"
+  #endif
+  #if !defined(__x86_64__)
+    #error "JIT requires an x86-64 host"
+  #endif
+#endif
+
+#define BX_SUPPORT_HANDLERS_CHAINING 0
+
+#if BX_SUPPORT_HANDLERS_CHAINING
+  #if BX_SUPPORT_TRACE_CACHE == 0
+    #error "Handlers chaining requires trace cache support"
+  #endif
+  #if BX_USE_CPU_SMF == 0
+    #error "Handlers chaining requires static CPU member functions (no SMP)"
+  #endif
+  #if BX_DEBUGGER || BX_INSTRUMENTATION
+    #error "Handlers chaining can't be used with the debugger or instrumentation"
+  #endif
+  #if BX_SUPPORT_JIT
+    #error "Handlers chaining can't be combined with the JIT"
+  #endif
+#endif
+
+#define BX_SUPPORT_TLB_ASID 0
 
 #if BX_SUPPORT_3DNOW
   #define BX_CPU_VENDOR_INTEL 0
@@ -750,6 +849,19 @@ typedef
 // APIC_MAX_ID indicate broadcast so it can't be used as valid APIC ID
 #define BX_MAX_SMP_THREADS_SUPPORTED 0xfe /* leave APIC ID for I/O APIC */
 
+// Run each processor of an SMP configuration on its own host thread
+// instead of interleaving them on one thread (cpu: smp_mode=threads).
+// Devices are serialized with one big lock taken at the I/O boundaries.
+#define BX_SUPPORT_SMP_THREADS 0
+
+#if BX_SUPPORT_SMP_THREADS && !BX_SUPPORT_SMP
+  #error SMP threads support requires SMP support
+#endif
+
+#if BX_SUPPORT_SMP_THREADS && BX_DEBUGGER
+  #error SMP threads support is not compatible with the internal debugger
+#endif
+
 // include in APIC models, required for a multiprocessor system.
 #if BX_SUPPORT_SMP || BX_CPU_LEVEL >= 5
   #define BX_SUPPORT_APIC 1
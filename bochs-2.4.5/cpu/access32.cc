@@ -701,6 +701,7 @@ accessOK:
           pageWriteStampTable.decWriteStamp(tlbEntry->ppf);
           data = *hostAddr;
           BX_CPU_THIS_PTR address_xlation.pages = (bx_ptr_equiv_t) hostAddr;
+          BX_SMP_RMW_DATA(data);
           BX_INSTR_LIN_ACCESS(BX_CPU_ID, laddr, tlbEntry->ppf | pageOffset, 1, BX_RW);
           BX_DBG_LIN_MEMORY_ACCESS(BX_CPU_ID, laddr,
               tlbEntry->ppf | pageOffset, 1, CPL, BX_READ, (Bit8u*) &data);
@@ -752,6 +753,7 @@ accessOK:
           pageWriteStampTable.decWriteStamp(tlbEntry->ppf);
           ReadHostWordFromLittleEndian(hostAddr, data);
           BX_CPU_THIS_PTR address_xlation.pages = (bx_ptr_equiv_t) hostAddr;
+          BX_SMP_RMW_DATA(data);
           BX_INSTR_LIN_ACCESS(BX_CPU_ID, laddr, tlbEntry->ppf | pageOffset, 2, BX_RW);
           BX_DBG_LIN_MEMORY_ACCESS(BX_CPU_ID, laddr,
               tlbEntry->ppf | pageOffset, 2, CPL, BX_READ, (Bit8u*) &data);
@@ -813,6 +815,7 @@ accessOK:
           pageWriteStampTable.decWriteStamp(tlbEntry->ppf);
           ReadHostDWordFromLittleEndian(hostAddr, data);
           BX_CPU_THIS_PTR address_xlation.pages = (bx_ptr_equiv_t) hostAddr;
+          BX_SMP_RMW_DATA(data);
           BX_INSTR_LIN_ACCESS(BX_CPU_ID, laddr, tlbEntry->ppf | pageOffset, 4, BX_RW);
           BX_DBG_LIN_MEMORY_ACCESS(BX_CPU_ID, laddr,
               tlbEntry->ppf | pageOffset, 4, CPL, BX_READ, (Bit8u*) &data);
@@ -874,6 +877,7 @@ accessOK:
           pageWriteStampTable.decWriteStamp(tlbEntry->ppf);
           ReadHostQWordFromLittleEndian(hostAddr, data);
           BX_CPU_THIS_PTR address_xlation.pages = (bx_ptr_equiv_t) hostAddr;
+          BX_SMP_RMW_DATA(data);
           BX_INSTR_LIN_ACCESS(BX_CPU_ID, laddr, tlbEntry->ppf | pageOffset, 8, BX_RW);
           BX_DBG_LIN_MEMORY_ACCESS(BX_CPU_ID, laddr,
               tlbEntry->ppf | pageOffset, 8, CPL, BX_READ, (Bit8u*) &data);
@@ -913,6 +917,11 @@ BX_CPU_C::write_RMW_virtual_byte(Bit8u val8)
   if (BX_CPU_THIS_PTR address_xlation.pages > 2) {
     // Pages > 2 means it stores a host address for direct access.
     Bit8u *hostAddr = (Bit8u *) BX_CPU_THIS_PTR address_xlation.pages;
+#if BX_SUPPORT_SMP_THREADS
+    if (bx_smp_threads)
+      write_RMW_host_smp(hostAddr, 1, val8);
+    else
+#endif
     *hostAddr = val8;
   }
   else {
@@ -927,6 +936,11 @@ BX_CPU_C::write_RMW_virtual_word(Bit16u val16)
   if (BX_CPU_THIS_PTR address_xlation.pages > 2) {
     // Pages > 2 means it stores a host address for direct access.
     Bit16u *hostAddr = (Bit16u *) BX_CPU_THIS_PTR address_xlation.pages;
+#if BX_SUPPORT_SMP_THREADS
+    if (bx_smp_threads)
+      write_RMW_host_smp(hostAddr, 2, val16);
+    else
+#endif
     WriteHostWordToLittleEndian(hostAddr, val16);
     BX_DBG_PHY_MEMORY_ACCESS(BX_CPU_ID,
         BX_CPU_THIS_PTR address_xlation.paddress1, 2, BX_WRITE, (Bit8u*) &val16);
@@ -961,6 +975,11 @@ BX_CPU_C::write_RMW_virtual_dword(Bit32u val32)
   if (BX_CPU_THIS_PTR address_xlation.pages > 2) {
     // Pages > 2 means it stores a host address for direct access.
     Bit32u *hostAddr = (Bit32u *) BX_CPU_THIS_PTR address_xlation.pages;
+#if BX_SUPPORT_SMP_THREADS
+    if (bx_smp_threads)
+      write_RMW_host_smp(hostAddr, 4, val32);
+    else
+#endif
     WriteHostDWordToLittleEndian(hostAddr, val32);
     BX_DBG_PHY_MEMORY_ACCESS(BX_CPU_ID,
         BX_CPU_THIS_PTR address_xlation.paddress1, 4, BX_WRITE, (Bit8u*) &val32);
@@ -1007,6 +1026,11 @@ BX_CPU_C::write_RMW_virtual_qword(Bit64u val64)
   if (BX_CPU_THIS_PTR address_xlation.pages > 2) {
     // Pages > 2 means it stores a host address for direct access.
     Bit64u *hostAddr = (Bit64u *) BX_CPU_THIS_PTR address_xlation.pages;
+#if BX_SUPPORT_SMP_THREADS
+    if (bx_smp_threads)
+      write_RMW_host_smp(hostAddr, 8, val64);
+    else
+#endif
     WriteHostQWordToLittleEndian(hostAddr, val64);
     BX_DBG_PHY_MEMORY_ACCESS(BX_CPU_ID,
         BX_CPU_THIS_PTR address_xlation.paddress1, 8, BX_WRITE, (Bit8u*) &val64);
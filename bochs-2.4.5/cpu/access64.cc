@@ -592,6 +592,7 @@ BX_CPU_C::read_RMW_virtual_byte_64(unsigned s, Bit64u offset)
       pageWriteStampTable.decWriteStamp(tlbEntry->ppf);
       data = *hostAddr;
       BX_CPU_THIS_PTR address_xlation.pages = (bx_ptr_equiv_t) hostAddr;
+      BX_SMP_RMW_DATA(data);
       BX_INSTR_LIN_ACCESS(BX_CPU_ID, laddr, tlbEntry->ppf | pageOffset, 1, BX_RW);
       BX_DBG_LIN_MEMORY_ACCESS(BX_CPU_ID, laddr,
           tlbEntry->ppf | pageOffset, 1, CPL, BX_READ, (Bit8u*) &data);
@@ -633,6 +634,7 @@ BX_CPU_C::read_RMW_virtual_word_64(unsigned s, Bit64u offset)
       pageWriteStampTable.decWriteStamp(tlbEntry->ppf);
       ReadHostWordFromLittleEndian(hostAddr, data);
       BX_CPU_THIS_PTR address_xlation.pages = (bx_ptr_equiv_t) hostAddr;
+      BX_SMP_RMW_DATA(data);
       BX_INSTR_LIN_ACCESS(BX_CPU_ID, laddr, tlbEntry->ppf | pageOffset, 2, BX_RW);
       BX_DBG_LIN_MEMORY_ACCESS(BX_CPU_ID, laddr,
           tlbEntry->ppf | pageOffset, 2, CPL, BX_READ, (Bit8u*) &data);
@@ -688,6 +690,7 @@ BX_CPU_C::read_RMW_virtual_dword_64(unsigned s, Bit64u offset)
       pageWriteStampTable.decWriteStamp(tlbEntry->ppf);
       ReadHostDWordFromLittleEndian(hostAddr, data);
       BX_CPU_THIS_PTR address_xlation.pages = (bx_ptr_equiv_t) hostAddr;
+      BX_SMP_RMW_DATA(data);
       BX_INSTR_LIN_ACCESS(BX_CPU_ID, laddr, tlbEntry->ppf | pageOffset, 4, BX_RW);
       BX_DBG_LIN_MEMORY_ACCESS(BX_CPU_ID, laddr,
           tlbEntry->ppf | pageOffset, 4, CPL, BX_READ, (Bit8u*) &data);
@@ -743,6 +746,7 @@ BX_CPU_C::read_RMW_virtual_qword_64(unsigned s, Bit64u offset)
       pageWriteStampTable.decWriteStamp(tlbEntry->ppf);
       ReadHostQWordFromLittleEndian(hostAddr, data);
       BX_CPU_THIS_PTR address_xlation.pages = (bx_ptr_equiv_t) hostAddr;
+      BX_SMP_RMW_DATA(data);
       BX_INSTR_LIN_ACCESS(BX_CPU_ID, laddr, tlbEntry->ppf | pageOffset, 8, BX_RW);
       BX_DBG_LIN_MEMORY_ACCESS(BX_CPU_ID, laddr,
           tlbEntry->ppf | pageOffset, 8, CPL, BX_READ, (Bit8u*) &data);
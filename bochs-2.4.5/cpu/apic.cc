@@ -693,7 +693,7 @@ void bx_local_apic_c::service_local_apic(void)
   // return it.
   BX_DEBUG(("service_local_apic(): setting INTR=1 for vector 0x%02x", first_irr));
   INTR = 1;
-  cpu->async_event = 1;
+  BX_CPU_SIGNAL_EVENT(cpu, 1);
 }
 
 bx_bool bx_local_apic_c::deliver(Bit8u vector, Bit8u delivery_mode, Bit8u trig_mode)
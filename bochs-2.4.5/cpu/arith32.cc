@@ -574,3 +574,54 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::CMPXCHG8B(bxInstruction_c *i)
     clear_ZF();
   }
 }
+
+#if BX_SUPPORT_FLAGS_LIVENESS
+
+// Forms of the instructions whose lazy flags are overwritten by the next
+// instruction of the trace, see markDeadFlags()
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::ADD_GdEdR_NF(bxInstruction_c *i)
+{
+  if (deadFlagsObservable()) {
+    ADD_GdEdR(i);
+    return;
+  }
+
+  Bit32u sum_32 = BX_READ_32BIT_REG(i->nnn()) + BX_READ_32BIT_REG(i->rm());
+  BX_WRITE_32BIT_REGZ(i->nnn(), sum_32);
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::ADD_EdIdR_NF(bxInstruction_c *i)
+{
+  if (deadFlagsObservable()) {
+    ADD_EdIdR(i);
+    return;
+  }
+
+  Bit32u sum_32 = BX_READ_32BIT_REG(i->rm()) + i->Id();
+  BX_WRITE_32BIT_REGZ(i->rm(), sum_32);
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::SUB_GdEdR_NF(bxInstruction_c *i)
+{
+  if (deadFlagsObservable()) {
+    SUB_GdEdR(i);
+    return;
+  }
+
+  Bit32u diff_32 = BX_READ_32BIT_REG(i->nnn()) - BX_READ_32BIT_REG(i->rm());
+  BX_WRITE_32BIT_REGZ(i->nnn(), diff_32);
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::SUB_EdIdR_NF(bxInstruction_c *i)
+{
+  if (deadFlagsObservable()) {
+    SUB_EdIdR(i);
+    return;
+  }
+
+  Bit32u diff_32 = BX_READ_32BIT_REG(i->rm()) - i->Id();
+  BX_WRITE_32BIT_REGZ(i->rm(), diff_32);
+}
+
+#endif
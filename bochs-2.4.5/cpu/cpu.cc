@@ -26,35 +26,16 @@
 
 #include "iodev/iodev.h"
 
+#if BX_SUPPORT_JIT
+#include "dynamic/jit.h"
+#endif
+
 // Make code more tidy with a few macros.
 #if BX_SUPPORT_X86_64==0
 #define RIP EIP
 #define RCX ECX
 #endif
 
-#define InstrumentICACHE 0
-
-#if InstrumentICACHE
-static unsigned iCacheLookups=0;
-static unsigned iCacheMisses=0;
-
-#define InstrICache_StatsMask 0xffffff
-
-#define InstrICache_Stats() {\
-  if ((iCacheLookups & InstrICache_StatsMask) == 0) { \
-    BX_INFO(("ICACHE lookups: %u, misses: %u, hit rate = %6.2f%% ", \
-          iCacheLookups, \
-          iCacheMisses,  \
-          (iCacheLookups-iCacheMisses) * 100.0 / iCacheLookups)); \
-    iCacheLookups = iCacheMisses = 0; \
-  } \
-}
-#define InstrICache_Increment(v) (v)++
-#else
-#define InstrICache_Stats()
-#define InstrICache_Increment(v)
-#endif
-
 // The CHECK_MAX_INSTRUCTIONS macro allows cpu_loop to execute a few
 // instructions and then return so that the other processors have a chance to
 // run.  This is used by bochs internal debugger or when simulating
@@ -62,7 +43,13 @@ static unsigned iCacheMisses=0;
 //
 // If maximum instructions have been executed, return. The zero-count
 // means run forever.
-#if BX_SUPPORT_SMP || BX_DEBUGGER
+#if BX_SUPPORT_SMP_THREADS
+  #define CHECK_MAX_INSTRUCTIONS(count)               \
+    if (BX_CPU_THIS_PTR smp_instr_left > 0) {         \
+      BX_CPU_THIS_PTR smp_instr_left--;               \
+      if (BX_CPU_THIS_PTR smp_instr_left == 0) return; \
+    }
+#elif BX_SUPPORT_SMP || BX_DEBUGGER
   #define CHECK_MAX_INSTRUCTIONS(count) \
     if ((count) > 0) {                  \
       (count)--;                        \
@@ -72,6 +59,155 @@ static unsigned iCacheMisses=0;
   #define CHECK_MAX_INSTRUCTIONS(count)
 #endif
 
+#if BX_SUPPORT_TRACE_LINKING
+
+// Return the successor trace recorded in the link if it is still valid for
+// current RIP, fetch mode and code page write stamp. On a hit the prefetch
+// window saved with the link becomes the current one, so the caller could
+// continue execution of the successor trace right away.
+BX_CPP_INLINE bxICacheEntry_c *BX_CPU_C::lookupTraceLink(const bxTraceLink_c *link)
+{
+  if (link->traceLinkGen != BX_CPU_THIS_PTR traceLinkGen) return NULL;
+  if (link->fetchModeMask != BX_CPU_THIS_PTR fetchModeMask) return NULL;
+
+  bx_address eipBiased = RIP + link->eipPageBias;
+  if (eipBiased >= link->eipPageWindowSize) return NULL;
+
+  bxICacheEntry_c *entry = link->entry;
+  if ((entry->pAddr != link->pAddrPage + eipBiased) ||
+      (entry->writeStamp != *(link->pageWriteStampPtr))) return NULL;
+
+  BX_CPU_THIS_PTR eipPageBias = link->eipPageBias;
+  BX_CPU_THIS_PTR eipPageWindowSize = link->eipPageWindowSize;
+  BX_CPU_THIS_PTR eipFetchPtr = link->eipFetchPtr;
+  BX_CPU_THIS_PTR pAddrPage = link->pAddrPage;
+  BX_CPU_THIS_PTR iCachePageBias = link->iCachePageBias;
+  BX_CPU_THIS_PTR currPageWriteStampPtr = link->pageWriteStampPtr;
+
+  return entry;
+}
+
+BX_CPP_INLINE void BX_CPU_C::recordTraceLink(bxTraceLink_c *link, bxICacheEntry_c *entry)
+{
+  link->entry = entry;
+  link->traceLinkGen = BX_CPU_THIS_PTR traceLinkGen;
+  link->fetchModeMask = BX_CPU_THIS_PTR fetchModeMask;
+  link->eipPageBias = BX_CPU_THIS_PTR eipPageBias;
+  link->eipPageWindowSize = BX_CPU_THIS_PTR eipPageWindowSize;
+  link->eipFetchPtr = BX_CPU_THIS_PTR eipFetchPtr;
+  link->pAddrPage = BX_CPU_THIS_PTR pAddrPage;
+  link->iCachePageBias = BX_CPU_THIS_PTR iCachePageBias;
+  link->pageWriteStampPtr = BX_CPU_THIS_PTR currPageWriteStampPtr;
+}
+
+#endif
+
+#if BX_SUPPORT_JIT
+
+// Return host code of the trace, translating it once it got hot. Traces
+// are interpreted while instruction tracing or a gdbstub session is on,
+// also when they were translated before, and boundary fetch traces which
+// are not kept in the iCache are never translated.
+BX_CPP_INLINE bxJitCode_t BX_CPU_C::jitLookup(bxICacheEntry_c *entry)
+{
+#if BX_DISASM
+  if (BX_CPU_THIS_PTR trace) return NULL;
+#endif
+#if BX_GDBSTUB
+  if (bx_dbg.gdbstub_enabled) return NULL;
+#endif
+
+  if (entry->jitCode) return entry->jitCode;
+
+  if (! BX_CPU_THIS_PTR jit || entry->writeStamp == ICacheWriteStampInvalid)
+    return NULL;
+
+  if (++entry->jitCount < BX_CPU_THIS_PTR jitThreshold) return NULL;
+  entry->jitCount = 0;
+
+  entry->jitCode = BX_CPU_THIS_PTR jit->compile(entry);
+  return entry->jitCode;
+}
+
+#endif
+
+#if BX_SUPPORT_HANDLERS_CHAINING
+
+// plain handlers of the instructions, used when not running a chain
+extern struct bxIAOpcodeTable BxOpcodesTable[];
+
+// timer ticks one trace slot may take, a fused pair ticks twice
+#if BX_SUPPORT_INSTR_FUSION
+  #define BX_CHAIN_SLOT_TICKS 2
+#else
+  #define BX_CHAIN_SLOT_TICKS 1
+#endif
+
+// trace links one chain may follow
+#define BX_CHAIN_MAX_LINKS 64
+
+// The rest of the trace starting at i may run as a chain of handlers if
+// no timer can fire before the trace is left, so ticks charged at the end
+// of the trace are not noticed by anybody. Boundary fetch traces are not
+// chained and tracing or a gdbstub session wants control after every
+// instruction.
+BX_CPP_INLINE bx_bool BX_CPU_C::chainAllowed(bxICacheEntry_c *entry, bxInstruction_c *i, bxInstruction_c *last)
+{
+  if (entry->writeStamp == ICacheWriteStampInvalid ||
+      i->execute == &BX_CPU_C::BxEndChain) return 0;
+#if BX_DISASM
+  if (BX_CPU_THIS_PTR trace) return 0;
+#endif
+#if BX_GDBSTUB
+  if (bx_dbg.gdbstub_enabled) return 0;
+#endif
+
+  return bx_pc_system.getNumCpuTicksLeftNextEvent() > (Bit32u)(last - i) * BX_CHAIN_SLOT_TICKS;
+}
+
+// Leave the trace of the chain before instruction i: the handler of the
+// slot following the trace and the way out of a chained handler which
+// left async_event set. The ticks of the trace are charged and, if nothing
+// but the end of the trace was signalled, the chain continues with the
+// successor trace found through the trace link, so a loop of linked
+// traces runs without returning to cpu_loop(). Otherwise cpu_loop() ends
+// the trace as usual.
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::BxEndTrace(bxInstruction_c *i)
+{
+  Bit32u n = (Bit32u)(i - BX_CPU_THIS_PTR chainFirst);
+  BX_TICKN(n);
+  BX_CPU_THIS_PTR iCache.chainedInstructions += n;
+  BX_CPU_THIS_PTR chainFirst = i;
+  BX_CPU_THIS_PTR chainEnd = i;
+
+#if BX_SUPPORT_TRACE_LINKING
+  unsigned linkSlot = BX_TRACE_LINK_NOT_TAKEN;
+  if (BX_CPU_THIS_PTR async_event) {
+    if (BX_CPU_THIS_PTR async_event != BX_ASYNC_EVENT_STOP_TRACE) return;
+    linkSlot = BX_TRACE_LINK_TAKEN;
+  }
+
+  // the chain is bounded for compilers which do not turn the calls
+  // between the handlers into jumps
+  if (BX_CPU_THIS_PTR chainLinks == 0) return;
+
+  bxICacheEntry_c *entry = lookupTraceLink(&BX_CPU_THIS_PTR chainEntry->link[linkSlot]);
+  if (entry == NULL) return;
+  i = entry->i;
+  if (! chainAllowed(entry, i, i + entry->tlen)) return;
+
+  BX_CPU_THIS_PTR async_event = 0;
+  BX_CPU_THIS_PTR iCache.linkHits++;
+  BX_CPU_THIS_PTR chainLinks--;
+  BX_CPU_THIS_PTR chainEntry = entry;
+  BX_CPU_THIS_PTR chainFirst = i;
+  BX_CPU_THIS_PTR chainRip = RIP;
+  BX_CPU_CALL_METHOD(i->execute, (i));
+#endif
+}
+
+#endif
+
 void BX_CPU_C::cpu_loop(Bit32u max_instr_count)
 {
 #if BX_DEBUGGER
@@ -80,8 +216,22 @@ void BX_CPU_C::cpu_loop(Bit32u max_instr_count)
   BX_CPU_THIS_PTR stop_reason = STOP_NO_REASON;
 #endif
 
+#if BX_SUPPORT_SMP_THREADS
+  BX_CPU_THIS_PTR smp_instr_left = max_instr_count;
+#endif
+
   if (setjmp(BX_CPU_THIS_PTR jmp_buf_env)) {
+#if BX_SUPPORT_SMP_THREADS
+    // the instruction is left for the serial phase of the lock-step epoch
+    if (BX_CPU_THIS_PTR smp_serialized) return;
+#endif
     // only from exception function we can get here ...
+#if BX_SUPPORT_HANDLERS_CHAINING
+    // the instruction faulted inside of a chain, charge the ticks of the
+    // chained instructions before it
+    syncChainTicks();
+    BX_CPU_THIS_PTR chainFirst = NULL;
+#endif
     BX_INSTR_NEW_INSTRUCTION(BX_CPU_ID);
     BX_TICK1_IF_SINGLE_PROCESSOR();
 #if BX_DEBUGGER || BX_GDBSTUB
@@ -108,6 +258,13 @@ void BX_CPU_C::cpu_loop(Bit32u max_instr_count)
   BX_CPU_THIS_PTR speculative_rsp = 0;
   BX_CPU_THIS_PTR EXT = 0;
 
+#if BX_SUPPORT_TRACE_LINKING
+  // the trace executed last and the way it was left, used to record
+  // a direct link to its successor found through the iCache lookup
+  bxICacheEntry_c *linkFrom = NULL;
+  unsigned linkSlot = BX_TRACE_LINK_NOT_TAKEN;
+#endif
+
   while (1) {
 
     // check on events which occurred for previous instructions (traps)
@@ -119,6 +276,11 @@ void BX_CPU_C::cpu_loop(Bit32u max_instr_count)
       }
     }
 
+#if BX_SUPPORT_TRACE_LINKING
+    // do not link a trace to the interrupt handler or event it was left for
+    linkFrom = NULL;
+#endif
+
 no_async_event:
 
     bx_address eipBiased = RIP + BX_CPU_THIS_PTR eipPageBias;
@@ -129,28 +291,66 @@ no_async_event:
     }
 
     bx_phy_address pAddr = BX_CPU_THIS_PTR pAddrPage + eipBiased;
-    bxICacheEntry_c *entry = BX_CPU_THIS_PTR iCache.get_entry(pAddr, BX_CPU_THIS_PTR fetchModeMask);
-    bxInstruction_c *i = entry->i;
+    unsigned set = ((BX_CPU_THIS_PTR iCachePageBias + (Bit32u) eipBiased) & (BxICacheSets-1)) ^ BX_CPU_THIS_PTR fetchModeMask;
+    bxICacheEntry_c *entry = BX_CPU_THIS_PTR iCache.find_entry(set, pAddr,
+          *(BX_CPU_THIS_PTR currPageWriteStampPtr));
 
-    InstrICache_Increment(iCacheLookups);
-    InstrICache_Stats();
+    BX_CPU_THIS_PTR iCache.lookups++;
 
-    if ((entry->pAddr != pAddr) ||
-        (entry->writeStamp != *(BX_CPU_THIS_PTR currPageWriteStampPtr)))
-    {
+    if (entry == NULL) {
       // iCache miss. No validated instruction with matching fetch parameters
       // is in the iCache.
-      InstrICache_Increment(iCacheMisses);
-      serveICacheMiss(entry, (Bit32u) eipBiased, pAddr);
-      i = entry->i;
+      entry = serveICacheMiss((Bit32u) eipBiased, pAddr);
     }
 
+    bxInstruction_c *i = entry->i;
+
+#if BX_SUPPORT_TRACE_LINKING
+    if (linkFrom && entry->writeStamp != ICacheWriteStampInvalid)
+      recordTraceLink(&linkFrom->link[linkSlot], entry);
+#endif
+
 #if BX_SUPPORT_TRACE_CACHE
     bxInstruction_c *last = i + (entry->tlen);
 
+#if BX_SUPPORT_JIT
+    // a pending event is handled after the first instruction of the trace
+    if (! BX_CPU_THIS_PTR async_event && jitLookup(entry))
+      goto jit_trace;
+#endif
+
     for(;;) {
 #endif
 
+#if BX_SUPPORT_HANDLERS_CHAINING
+      if (chainAllowed(entry, i, last)) {
+        // Run the handlers of the trace, each calling the next one, until
+        // an instruction which is not chained or the end of a trace which
+        // is not linked to its successor. The timer ticks are charged per
+        // trace, when the chain leaves it.
+        BX_CPU_THIS_PTR chainEntry = entry;
+        BX_CPU_THIS_PTR chainFirst = i;
+        BX_CPU_THIS_PTR chainRip = RIP;
+        BX_CPU_THIS_PTR chainLinks = BX_CHAIN_MAX_LINKS;
+        BX_CPU_CALL_METHOD(i->execute, (i));
+        BX_CPU_THIS_PTR iCache.chains++;
+        // the chain could have continued in linked traces
+        entry = BX_CPU_THIS_PTR chainEntry;
+        last = entry->i + entry->tlen;
+        i = BX_CPU_THIS_PTR chainEnd;
+        Bit32u chained = (Bit32u)(i - BX_CPU_THIS_PTR chainFirst);
+        BX_TICKN(chained);
+        BX_CPU_THIS_PTR iCache.chainedInstructions += chained;
+        BX_CPU_THIS_PTR chainFirst = NULL;
+        // continue after the last executed instruction, an instruction
+        // which is not chained is executed below
+        if (i == last || BX_CPU_THIS_PTR async_event) {
+          i--;
+          goto chain_done;
+        }
+      }
+#endif
+
 #if BX_INSTRUMENTATION
       BX_INSTR_OPCODE(BX_CPU_ID, BX_CPU_THIS_PTR eipFetchPtr + (RIP + BX_CPU_THIS_PTR eipPageBias),
          i->ilen(), BX_CPU_THIS_PTR sregs[BX_SEG_REG_CS].cache.u.segment.d_b, long64_mode());
@@ -167,7 +367,12 @@ no_async_event:
       // want to allow changing of the instruction inside instrumentation callback
       BX_INSTR_BEFORE_EXECUTION(BX_CPU_ID, i);
       RIP += i->ilen();
+#if BX_SUPPORT_HANDLERS_CHAINING
+      // the handler in the trace could run the rest of the trace
+      BX_CPU_CALL_METHOD(BxOpcodesTable[i->getIaOpcode()].execute1, (i));
+#else
       BX_CPU_CALL_METHOD(i->execute, (i)); // might iterate repeat instruction
+#endif
       BX_CPU_THIS_PTR prev_rip = RIP; // commit new RIP
       BX_INSTR_AFTER_EXECUTION(BX_CPU_ID, i);
       BX_TICK1_IF_SINGLE_PROCESSOR();
@@ -183,13 +388,68 @@ no_async_event:
       CHECK_MAX_INSTRUCTIONS(max_instr_count);
 
 #if BX_SUPPORT_TRACE_CACHE
+#if BX_SUPPORT_HANDLERS_CHAINING
+chain_done:
+#endif
       if (BX_CPU_THIS_PTR async_event) {
         // clear stop trace magic indication that probably was set by repeat or branch32/64
+        BX_CPU_CLEAR_EVENT(BX_CPU_THIS, BX_ASYNC_EVENT_STOP_TRACE);
+#if BX_SUPPORT_TRACE_LINKING
+        if (! BX_CPU_THIS_PTR async_event) {
+          // nothing but the end of trace was signalled, chain to the successor
+          linkSlot = BX_TRACE_LINK_TAKEN;
+          goto chain_trace;
+        }
+#endif
+        break;
+      }
+
+      if (++i == last) {
+#if BX_SUPPORT_TRACE_LINKING
+        linkSlot = BX_TRACE_LINK_NOT_TAKEN;
+chain_trace:
+        linkFrom = entry;
+        entry = lookupTraceLink(&entry->link[linkSlot]);
+        if (entry) {
+          BX_CPU_THIS_PTR iCache.linkHits++;
+          i = entry->i;
+          last = i + (entry->tlen);
+#if BX_SUPPORT_JIT
+          if (jitLookup(entry)) goto jit_trace;
+#endif
+          continue;
+        }
+#endif
+        goto no_async_event;
+      }
+
+#if BX_SUPPORT_JIT
+      continue;
+
+jit_trace:
+      // The translated trace runs until its end or until an instruction
+      // leaves async_event set, with the same per instruction timer ticks
+      // and RIP/prev_rip updates as the loop above.
+      entry->jitCode();
+
+      if (BX_CPU_THIS_PTR async_event) {
         BX_CPU_THIS_PTR async_event &= ~BX_ASYNC_EVENT_STOP_TRACE;
+#if BX_SUPPORT_TRACE_LINKING
+        if (! BX_CPU_THIS_PTR async_event) {
+          linkSlot = BX_TRACE_LINK_TAKEN;
+          goto chain_trace;
+        }
+#endif
         break;
       }
 
-      if (++i == last) goto no_async_event;
+#if BX_SUPPORT_TRACE_LINKING
+      linkSlot = BX_TRACE_LINK_NOT_TAKEN;
+      goto chain_trace;
+#else
+      goto no_async_event;
+#endif
+#endif
     }
 #endif
   }  // while (1)
@@ -416,11 +676,61 @@ void BX_CPP_AttrRegparmN(2) BX_CPU_C::repeat_ZF(bxInstruction_c *i, BxExecutePtr
 #endif
 }
 
+// Does the processor have nothing to do until an interrupt arrives ?
+// Mirrors the wake up conditions of the halted loop in handleAsyncEvent().
+bx_bool BX_CPU_C::is_halted_idle(void)
+{
+  if (BX_CPU_THIS_PTR activity_state == BX_ACTIVITY_STATE_ACTIVE)
+    return 0;
+
+  if (BX_CPU_THIS_PTR pending_NMI || BX_CPU_THIS_PTR pending_SMI || BX_CPU_THIS_PTR pending_INIT)
+    return 0;
+
+  if (BX_CPU_INTR && (BX_CPU_THIS_PTR get_IF() ||
+      BX_CPU_THIS_PTR activity_state == BX_ACTIVITY_STATE_MWAIT_IF))
+    return 0;
+
+  // the bootstrap processor serves DMA requests also when halted
+  if (BX_CPU_THIS_PTR bx_cpuid == BX_BOOTSTRAP_PROCESSOR && BX_HRQ)
+    return 0;
+
+  return 1;
+}
+
 unsigned BX_CPU_C::handleAsyncEvent(void)
 {
   //
   // This area is where we process special conditions and events.
   //
+#if BX_SUPPORT_SMP_THREADS
+  // the events seen by this pass, others may be raised by the other
+  // processor threads at any time (BX_CPU_SIGNAL_EVENT)
+  Bit32u event = BX_CPU_THIS_PTR async_event;
+
+  if (BX_CPU_THIS_PTR smp_rmw_locked) {
+    // the R-M-W instruction which took the big lock is complete
+    BX_CPU_THIS_PTR smp_rmw_locked = 0;
+    BX_SMP_UNLOCK();
+  }
+
+  // Interrupts, DMA and debug traps are taken in the serial phase of a
+  // lock-step epoch, before anything below changed the processor state.
+  if (BX_CPU_INTR || BX_HRQ || BX_CPU_THIS_PTR debug_trap ||
+      BX_CPU_THIS_PTR pending_NMI || BX_CPU_THIS_PTR pending_SMI || BX_CPU_THIS_PTR pending_INIT)
+  {
+    BX_SMP_SERIALIZE();
+  }
+#endif
+
+#if BX_SUPPORT_ASYNC_DISK
+  // timers posted by the host I/O threads, e.g. a completed disk transfer
+  if (bx_pc_system.timers_posted()) {
+    BX_SMP_LOCK();
+    bx_pc_system.activate_posted_timers();
+    BX_SMP_UNLOCK();
+  }
+#endif
+
   if (BX_CPU_THIS_PTR activity_state) {
     // For one processor, pass the time as quickly as possible until
     // an interrupt wakes up the CPU.
@@ -447,7 +757,9 @@ unsigned BX_CPU_C::handleAsyncEvent(void)
 
       if (BX_HRQ && BX_DBG_ASYNC_DMA) {
         // handle DMA also when CPU is halted
+        BX_SMP_LOCK();
         DEV_dma_raise_hlda();
+        BX_SMP_UNLOCK();
       }
 
       // for multiprocessor simulation, even if this CPU is halted we still
@@ -469,12 +781,26 @@ unsigned BX_CPU_C::handleAsyncEvent(void)
         return 1; // Return to caller of cpu_loop.
 #endif
 
-      BX_TICK1();
+      if (bx_pc_system.kill_bochs_request)
+        return 1; // Return to caller of cpu_loop.
+
+      // Only a timer event can end the HALT condition of a single
+      // processor, so pass the time up to the next one in one step.
+      // DMA requests are still served tick by tick.
+      if (is_halted_idle())
+        BX_TICKN(bx_pc_system.getNumCpuTicksLeftNextEvent());
+      else
+        BX_TICK1();
     }
   } else if (bx_pc_system.kill_bochs_request) {
     // setting kill_bochs_request causes the cpu loop to return ASAP.
     return 1; // Return to caller of cpu_loop.
   }
+#if BX_SUPPORT_SMP_THREADS
+  else if (bx_smp_stop_pending()) {
+    return 1; // the processor threads are stopped
+  }
+#endif
 
   // VMLAUNCH/VMRESUME cannot be executed with interrupts inhibited.
   // Save inhibit interrupts state into shadow bits after clearing
@@ -568,6 +894,7 @@ unsigned BX_CPU_C::handleAsyncEvent(void)
     VMexit_ExtInterrupt();
 #endif
     // NOTE: similar code in ::take_irq()
+    BX_SMP_LOCK();
 #if BX_SUPPORT_APIC
     if (BX_CPU_THIS_PTR lapic.INTR)
       vector = BX_CPU_THIS_PTR lapic.acknowledge_int();
@@ -575,6 +902,7 @@ unsigned BX_CPU_C::handleAsyncEvent(void)
 #endif
       // if no local APIC, always acknowledge the PIC.
       vector = DEV_pic_iac(); // may set INTR with next interrupt
+    BX_SMP_UNLOCK();
     BX_CPU_THIS_PTR EXT = 1; /* external event */
 #if BX_SUPPORT_VMX
     VMexit_Event(0, BX_EXTERNAL_INTERRUPT, vector, 0, 0);
@@ -593,7 +921,9 @@ unsigned BX_CPU_C::handleAsyncEvent(void)
   else if (BX_HRQ && BX_DBG_ASYNC_DMA) {
     // NOTE: similar code in ::take_dma()
     // assert Hold Acknowledge (HLDA) and go into a bus hold state
+    BX_SMP_LOCK();
     DEV_dma_raise_hlda();
+    BX_SMP_UNLOCK();
   }
 
   // Priority 6: Faults from fetching next instruction
@@ -668,7 +998,23 @@ unsigned BX_CPU_C::handleAsyncEvent(void)
             ((BX_CPU_THIS_PTR dr7 >> 28) & 3) == 0))
 #endif
         ))
+  {
+#if BX_SUPPORT_SMP_THREADS
+    // Clear only the events seen above, then look again for the ones which
+    // another thread raised after they were checked.
+    BX_CPU_CLEAR_EVENT(BX_CPU_THIS, event);
+    if ((BX_CPU_INTR && BX_CPU_THIS_PTR get_IF()) ||
+        (BX_CPU_THIS_PTR pending_NMI && ! BX_CPU_THIS_PTR disable_NMI) ||
+        (BX_CPU_THIS_PTR pending_SMI && ! BX_CPU_THIS_PTR smm_mode()) ||
+        (BX_CPU_THIS_PTR pending_INIT && ! BX_CPU_THIS_PTR disable_INIT) ||
+         bx_smp_stop_pending())
+    {
+      BX_CPU_SIGNAL_EVENT(BX_CPU_THIS, 1);
+    }
+#else
     BX_CPU_THIS_PTR async_event = 0;
+#endif
+  }
 
   return 0; // Continue executing cpu_loop.
 }
@@ -757,10 +1103,16 @@ void BX_CPU_C::prefetch(void)
   }
 
   BX_CPU_THIS_PTR currPageWriteStampPtr = pageWriteStampTable.getPageWriteStampPtr(BX_CPU_THIS_PTR pAddrPage);
+  BX_CPU_THIS_PTR iCachePageBias = BX_CPU_THIS_PTR iCache.pageBias(BX_CPU_THIS_PTR pAddrPage);
 }
 
 void BX_CPU_C::deliver_SIPI(unsigned vector)
 {
+#if BX_SUPPORT_SMP_THREADS
+  // the processor state may only be changed by its own thread
+  if (bx_smp_defer_SIPI(BX_CPU_THIS_PTR bx_cpuid, vector)) return;
+#endif
+
   if (BX_CPU_THIS_PTR activity_state == BX_ACTIVITY_STATE_WAIT_FOR_SIPI) {
     BX_CPU_THIS_PTR activity_state = BX_ACTIVITY_STATE_ACTIVE;
     RIP = 0;
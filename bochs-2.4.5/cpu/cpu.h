@@ -395,10 +395,33 @@ extern const char* cpu_mode_string(unsigned cpu_mode);
   #define BX_CPU_INTR  (BX_CPU_THIS_PTR INTR)
 #endif
 
+#if BX_SUPPORT_SMP_THREADS
+  // remember the value read by a R-M-W access through a host pointer
+  #define BX_SMP_RMW_DATA(data) \
+    BX_CPU_THIS_PTR address_xlation.rmw_data = (data)
+#else
+  #define BX_SMP_RMW_DATA(data) /* empty */
+#endif
+
+#if BX_SUPPORT_SMP_THREADS
+  // raise an event for a processor which may be running on another host
+  // thread and updating its own async_event at the same time
+  #define BX_CPU_SIGNAL_EVENT(cpu, event) \
+    __sync_fetch_and_or(&(cpu)->async_event, (event))
+  #define BX_CPU_CLEAR_EVENT(cpu, event) \
+    __sync_fetch_and_and(&(cpu)->async_event, ~(event))
+#else
+  #define BX_CPU_SIGNAL_EVENT(cpu, event) ((cpu)->async_event |= (event))
+  #define BX_CPU_CLEAR_EVENT(cpu, event) ((cpu)->async_event &= ~(event))
+#endif
+
 #define CACHE_LINE_SIZE 64
 
 class BX_CPU_C;
 class BX_MEM_C;
+#if BX_SUPPORT_JIT
+class bxJitCompiler;
+#endif
 
 #if BX_USE_CPU_SMF == 0
 // normal member functions.  This can ONLY be used within BX_CPU_C classes.
@@ -666,6 +689,58 @@ typedef struct {
   Bit32u lpf_mask;      // linear address mask of the page size
 } bx_TLB_entry;
 
+// Number of first level TLB slots remembered since the last TLB flush.
+// A flush invalidates only the remembered slots, the whole TLB is walked
+// only when more translations were filled since the previous flush.
+#define BX_TLB_FILL_LOG_SIZE 128
+
+// The second level TLB is looked up by translate_linear() on a first
+// level TLB miss, before the page tables are walked. It keeps the results
+// of page walks: 4K pages in a set-associative array and large pages
+// (2M, 4M and 1G) natively, one entry for the whole large page, in a small
+// fully associative array. Entries are tagged with the TLB generation
+// they were filled in, so flushing the second level TLB is O(1).
+#define BX_TLB_L2_SIZE 4096
+#define BX_TLB_L2_WAYS 4
+#define BX_TLB_L2_SETS (BX_TLB_L2_SIZE / BX_TLB_L2_WAYS)
+#define BX_TLB_L2_SET_OF(lpf) \
+  ((((Bit32u)((lpf) >> 12) * 0x9E3779B1) >> 16) & (BX_TLB_L2_SETS-1))
+#define BX_TLB_LARGE_SIZE 16
+
+typedef struct {
+  bx_address lpf;          // linear frame, aligned to the page size
+  bx_phy_address ppf;      // physical frame, aligned to the page size
+  Bit32u lpf_mask;         // linear address mask of the page size
+  Bit32u combined_access;  // U/S, R/W and G bits collected by the page walk
+  Bit32u gen;              // TLB generation the entry belongs to
+  Bit32u flags;
+} bx_TLB_L2_entry;
+
+#define TLB_L2_Dirty     (0x1) /* page walk has set the dirty bit */
+#define TLB_L2_Execute   (0x2) /* page walk has checked execute permission */
+
+#if BX_SUPPORT_TLB_ASID
+// Non global second level TLB entries of the last BX_TLB_ASIDS address
+// spaces (CR3 values) survive a CR3 load. Each address space has its own
+// TLB generation and remembers up to BX_TLB_ASID_PAGES page table pages
+// used by its page walks together with their page write stamps. When CR3
+// is loaded again the address space is reused only if none of these pages
+// was written in the meantime, otherwise it starts with a new generation.
+#define BX_TLB_ASIDS 4
+#define BX_TLB_ASID_PAGES 64
+
+typedef struct {
+  bx_address cr3;
+  Bit32u gen;              // TLB generation, 0 when the slot is free
+  Bit32u lastUse;
+  // page table pages walked, pages is greater than BX_TLB_ASID_PAGES
+  // when the address space can not be reused
+  unsigned pages;
+  bx_phy_address page[BX_TLB_ASID_PAGES];
+  Bit32u stamp[BX_TLB_ASID_PAGES];
+} bx_TLB_ASID;
+#endif
+
 // general purpose register
 #if BX_SUPPORT_X86_64
 
@@ -981,6 +1056,7 @@ public: // for now...
   Bit32u     eipPageWindowSize;
   const Bit8u *eipFetchPtr;
   bx_phy_address pAddrPage; // Guest physical address of current instruction page
+  Bit32u iCachePageBias;    // iCache set index bias of current instruction page
 
 #if BX_CPU_LEVEL >= 4 && BX_SUPPORT_ALIGNMENT_CHECK
   unsigned alignment_check_mask;
@@ -1004,6 +1080,37 @@ public: // for now...
     bx_TLB_entry entry[BX_TLB_SIZE] BX_CPP_AlignN(16);
 #if BX_CPU_LEVEL >= 5
     bx_bool split_large;
+#endif
+    // first level TLB slots filled since the last flush, fillCount is
+    // greater than BX_TLB_FILL_LOG_SIZE once the log has overflowed
+    Bit16u fillLog[BX_TLB_FILL_LOG_SIZE];
+    unsigned fillCount;
+
+    bx_TLB_L2_entry l2[BX_TLB_L2_SIZE];
+    bx_TLB_L2_entry large[BX_TLB_LARGE_SIZE];
+    bx_bool l2_large;    // large page entries were filled since the last flush
+    Bit8u l2victim[BX_TLB_L2_SETS];
+    unsigned largeVictim;
+    // global pages belong to globalGen, all other pages to gen
+    Bit32u gen;
+    Bit32u globalGen;
+#if BX_SUPPORT_TLB_ASID
+    bx_TLB_ASID asid[BX_TLB_ASIDS];
+    unsigned curASID;    // BX_TLB_ASIDS when the address space is not kept
+    Bit32u lastGen;      // last generation given to an address space
+    Bit32u asidClock;
+    // page table entries read by the current page walk
+    unsigned walkPages;
+    bx_phy_address walkPage[4];
+    Bit32u walkStamp[4];
+#endif
+
+    // TLB statistics, reported at exit
+    Bit64u walks;        // page walks
+    Bit64u l2hits;       // first level misses served by the second level
+    Bit64u flushes;      // global and non global flushes
+#if BX_SUPPORT_TLB_ASID
+    Bit64u asidReuses;   // CR3 loads which kept the address space
 #endif
   } TLB;
 
@@ -1031,6 +1138,29 @@ public: // for now...
   bxICache_c iCache BX_CPP_AlignN(32);
   Bit32u fetchModeMask;
   const Bit32u *currPageWriteStampPtr;
+#if BX_SUPPORT_TRACE_LINKING
+  // Prefetch generation, advanced each time the prefetch queue is
+  // invalidated. Trace links recorded in older generations are stale.
+  Bit64u traceLinkGen;
+#endif
+#if BX_SUPPORT_JIT
+  // Translator of hot traces and the number of executions after which
+  // a trace is translated, NULL when disabled
+  bxJitCompiler *jit;
+  Bit32u jitThreshold;
+#endif
+#if BX_SUPPORT_HANDLERS_CHAINING
+  // Chain of handlers running in cpu_loop(): the trace being executed,
+  // its first instruction whose timer tick is not charged yet and the RIP
+  // of it, NULL outside of a chain. chainEnd is the first instruction the
+  // chain did not execute and chainLinks the number of trace links the
+  // chain may still follow.
+  bxICacheEntry_c *chainEntry;
+  bxInstruction_c *chainFirst;
+  bx_address chainRip;
+  bxInstruction_c *chainEnd;
+  unsigned chainLinks;
+#endif
 
   struct {
     bx_address rm_addr;       // The address offset after resolution
@@ -1046,8 +1176,26 @@ public: // for now...
                               // is greated than 2 (the maximum possible for
                               // normal cases) it is a native pointer and is used
                               // for a direct write access.
+#if BX_SUPPORT_SMP_THREADS
+    Bit64u rmw_data;          // Value read through the native host pointer,
+                              // compared against memory when it is written
+                              // back so that the R-M-W is atomic against
+                              // the other processor threads.
+#endif
   } address_xlation;
 
+#if BX_SUPPORT_SMP_THREADS
+  // The big SMP lock is held from a R-M-W access which could not get a
+  // native host pointer until the next instruction boundary.
+  bx_bool smp_rmw_locked;
+  // Instructions left to execute in the current cpu loop.  Kept here rather
+  // than in cpu_loop() so the count survives exceptions and tells the rest
+  // of a lock-step epoch.
+  Bit32u smp_instr_left;
+  // The cpu loop was left for the serial phase of a lock-step epoch.
+  bx_bool smp_serialized;
+#endif
+
   BX_SMF void setEFlags(Bit32u val) BX_CPP_AttrRegparmN(1);
 
 #define ArithmeticalFlag(flag, lfMask, eflagsBitShift) \
@@ -2781,6 +2929,34 @@ public: // for now...
   BX_SMF void UndefinedOpcode(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
   BX_SMF void BxError(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
 
+#if BX_SUPPORT_INSTR_FUSION
+  BX_SMF void CMP_GdEdR_Jcc(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void TEST_EdGdR_Jcc(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void PUSH_EBP_MOV_EBP_ESP(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void MOV_GdEdR_ADD_GdId(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void MOV32_GdEdM_ADD_GdId(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+#endif
+
+#if BX_SUPPORT_FLAGS_LIVENESS
+  BX_SMF void ADD_GdEdR_NF(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void ADD_EdIdR_NF(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void SUB_GdEdR_NF(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void SUB_EdIdR_NF(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void AND_GdEdR_NF(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void AND_EdIdR_NF(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void OR_GdEdR_NF(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void OR_EdIdR_NF(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void XOR_GdEdR_NF(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void XOR_EdIdR_NF(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+#endif
+
+#if BX_SUPPORT_HANDLERS_CHAINING
+  template <BxExecutePtr_tR handler>
+  BX_SMF void BxChain(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void BxEndChain(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void BxEndTrace(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+#endif
+
   BX_SMF bx_address BxResolve16BaseIndex(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
   BX_SMF bx_address BxResolve32Base(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
   BX_SMF bx_address BxResolve32BaseIndex(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
@@ -2817,15 +2993,36 @@ public: // for now...
   // now for some ancillary functions...
   BX_SMF void cpu_loop(Bit32u max_instr_count);
   BX_SMF unsigned handleAsyncEvent(void);
+  BX_SMF bx_bool is_halted_idle(void);
 
   BX_SMF int fetchDecode32(const Bit8u *fetchPtr, bxInstruction_c *i, unsigned remainingInPage) BX_CPP_AttrRegparmN(3);
 #if BX_SUPPORT_X86_64
   BX_SMF int fetchDecode64(const Bit8u *fetchPtr, bxInstruction_c *i, unsigned remainingInPage) BX_CPP_AttrRegparmN(3);
 #endif
   BX_SMF void boundaryFetch(const Bit8u *fetchPtr, unsigned remainingInPage, bxInstruction_c *);
-  BX_SMF void serveICacheMiss(bxICacheEntry_c *entry, Bit32u eipBiased, bx_phy_address pAddr);
+  BX_SMF bxICacheEntry_c* serveICacheMiss(Bit32u eipBiased, bx_phy_address pAddr);
 #if BX_SUPPORT_TRACE_CACHE
   BX_SMF bx_bool mergeTraces(bxICacheEntry_c *entry, bxInstruction_c *i, bx_phy_address pAddr);
+#if BX_SUPPORT_INSTR_FUSION
+  BX_SMF bx_bool fuseInstructions(bxInstruction_c *first, const bxInstruction_c *second);
+  BX_SMF BX_CPP_INLINE bx_bool commitFusedFirst(bxInstruction_c *i);
+#endif
+#if BX_SUPPORT_FLAGS_LIVENESS
+  BX_SMF void markDeadFlags(bxICacheEntry_c *entry);
+  BX_SMF BX_CPP_INLINE bx_bool deadFlagsObservable(void);
+#endif
+#if BX_SUPPORT_TRACE_LINKING
+  BX_SMF BX_CPP_INLINE bxICacheEntry_c *lookupTraceLink(const bxTraceLink_c *link);
+  BX_SMF BX_CPP_INLINE void recordTraceLink(bxTraceLink_c *link, bxICacheEntry_c *entry);
+#endif
+#if BX_SUPPORT_JIT
+  BX_SMF BX_CPP_INLINE bxJitCode_t jitLookup(bxICacheEntry_c *entry);
+#endif
+#if BX_SUPPORT_HANDLERS_CHAINING
+  BX_SMF void chainTrace(bxICacheEntry_c *entry);
+  BX_SMF BX_CPP_INLINE bx_bool chainAllowed(bxICacheEntry_c *entry, bxInstruction_c *i, bxInstruction_c *last);
+  BX_SMF void syncChainTicks(void);
+#endif
 #else
   BX_SMF bx_bool fetchInstruction(bxInstruction_c *iStorage, Bit32u eipBiased);
 #endif
@@ -2834,6 +3031,9 @@ public: // for now...
   BX_SMF BX_CPP_INLINE void invalidate_prefetch_q(void)
   {
     BX_CPU_THIS_PTR eipPageWindowSize = 0;
+#if BX_SUPPORT_TRACE_LINKING
+    BX_CPU_THIS_PTR traceLinkGen++;
+#endif
   }
 
   BX_SMF bx_bool write_virtual_checks(bx_segment_reg_t *seg, Bit32u offset, unsigned len) BX_CPP_AttrRegparmN(3);
@@ -3101,9 +3301,14 @@ public: // for now...
   BX_SMF void access_write_physical(bx_phy_address paddr, unsigned len, void *data);
 
   BX_SMF bx_hostpageaddr_t getHostMemAddr(bx_phy_address addr, unsigned rw);
+#if BX_SUPPORT_SMP_THREADS
+  BX_SMF void write_RMW_host_smp(void *hostAddr, unsigned len, Bit64u val);
+  BX_SMF void smp_serialize(void) BX_CPP_AttrNoReturn();
+#endif
 
   // linear address for translate_linear expected to be canonical !
   BX_SMF bx_phy_address translate_linear(bx_address laddr, unsigned curr_pl, unsigned rw);
+  BX_SMF bx_phy_address translate_linear_walk(bx_address laddr, Bit32u &lpf_mask, Bit32u &combined_access, unsigned curr_pl, unsigned rw);
 #if BX_CPU_LEVEL >= 6
   BX_SMF bx_phy_address translate_linear_PAE(bx_address laddr, Bit32u &lpf_mask, Bit32u &combined_access, unsigned curr_pl, unsigned rw);
   BX_SMF int check_entry_PAE(const char *s, Bit64u entry, Bit64u reserved, unsigned rw, bx_bool *nx_fault);
@@ -3124,6 +3329,18 @@ public: // for now...
 #endif
   BX_SMF void TLB_flush(void);
   BX_SMF void TLB_invlpg(bx_address laddr);
+  BX_SMF void TLB_init(void);
+  BX_SMF void TLB_L2_reset(void);
+  BX_SMF bx_bool TLB_L2_lookup(bx_address laddr, bx_phy_address &ppf, Bit32u &lpf_mask, Bit32u &combined_access, unsigned pl, unsigned rw);
+  BX_SMF void TLB_L2_fill(bx_address laddr, bx_phy_address ppf, Bit32u lpf_mask, Bit32u combined_access, unsigned rw);
+  BX_SMF void TLB_L2_invlpg(bx_address laddr);
+#if BX_SUPPORT_TLB_ASID
+  BX_SMF void TLB_ASID_reset(void);
+  BX_SMF bx_bool TLB_ASID_kept(Bit32u gen);
+  BX_SMF void TLB_ASID_switch(void);
+  BX_SMF void TLB_ASID_track(bx_TLB_ASID *as, bx_phy_address paddr, Bit32u stamp);
+  BX_SMF void TLB_ASID_walked(void);
+#endif
   BX_SMF void set_INTR(bx_bool value);
   BX_SMF const char *strseg(bx_segment_reg_t *seg);
   BX_SMF void interrupt(Bit8u vector, unsigned type, bx_bool push_error,
@@ -3522,6 +3739,53 @@ BX_CPP_INLINE void BX_CPU_C::updateFetchModeMask(void)
      (BX_CPU_THIS_PTR sregs[BX_SEG_REG_CS].selector.rpl == 3);
 }
 
+#if BX_SUPPORT_INSTR_FUSION
+// Commit the first instruction of a fused pair (see fuseInstructions()) the
+// way cpu_loop() would and tell whether the second one may follow. When an
+// event is pending, or the timer tick of the first instruction would fire a
+// timer, the pair is split: RIP is moved back to the second instruction and
+// the trace is left, so cpu_loop() ticks and handles the event as if the
+// first instruction had been executed alone. A fault of the first
+// instruction is taken at its own RIP, before its tick, and a fault of the
+// second one finds prev_rip pointing to the second instruction.
+BX_CPP_INLINE bx_bool BX_CPU_C::commitFusedFirst(bxInstruction_c *i)
+{
+#if BX_SUPPORT_X86_64
+  bx_address &rip = BX_CPU_THIS_PTR gen_reg[BX_64BIT_REG_RIP].rrx;
+#else
+  bx_address &rip = BX_CPU_THIS_PTR gen_reg[BX_32BIT_REG_EIP].dword.erx;
+#endif
+
+  if (BX_CPU_THIS_PTR async_event || bx_pc_system.getNumCpuTicksLeftNextEvent() <= 1) {
+    rip -= i->fusedILen();
+    BX_CPU_THIS_PTR async_event |= BX_ASYNC_EVENT_STOP_TRACE;
+    BX_CPU_THIS_PTR iCache.fusedSplits++;
+    return 0;
+  }
+
+  BX_CPU_THIS_PTR prev_rip = rip - i->fusedILen();
+  BX_TICK1_IF_SINGLE_PROCESSOR();
+  return 1;
+}
+#endif
+
+#if BX_SUPPORT_FLAGS_LIVENESS
+// The lazy flags of an instruction switched to its _NF form by
+// markDeadFlags() are overwritten by the next instruction, which can't
+// fault. They could still be seen by an interrupt or a timer event taken
+// between the two; when one may be, the _NF form computes the flags after
+// all, the same check commitFusedFirst() makes.
+BX_CPP_INLINE bx_bool BX_CPU_C::deadFlagsObservable(void)
+{
+  if (BX_CPU_THIS_PTR async_event || bx_pc_system.getNumCpuTicksLeftNextEvent() <= 1) {
+    BX_CPU_THIS_PTR iCache.deadFlagsKept++;
+    return 1;
+  }
+
+  return 0;
+}
+#endif
+
 #if BX_X86_DEBUGGER
 #define BX_HWDebugInstruction   0x00
 #define BX_HWDebugMemW          0x01
@@ -3707,6 +3971,25 @@ BX_CPP_INLINE void BX_CPU_C::set_PF_base(Bit8u val)
   BX_CPU_THIS_PTR eflags |= val<<2;
 }
 
+#if BX_HOST_LAZY_FLAGS
+
+//
+// host flags lazy flags implementation, see lazy_flags.h
+//
+#define IMPLEMENT_HOST_LAZY_FLAG(flag)                                  \
+  BX_CPP_INLINE bx_bool BX_CPU_C::get_##flag##Lazy(void) {             \
+    return (BX_CPU_THIS_PTR oszapc.flags >> BX_LF_HOST_##flag##_BIT) & 1; \
+  }
+
+IMPLEMENT_HOST_LAZY_FLAG(OF)
+IMPLEMENT_HOST_LAZY_FLAG(SF)
+IMPLEMENT_HOST_LAZY_FLAG(ZF)
+IMPLEMENT_HOST_LAZY_FLAG(AF)
+IMPLEMENT_HOST_LAZY_FLAG(PF)
+IMPLEMENT_HOST_LAZY_FLAG(CF)
+
+#else
+
 //
 // inline simple lazy flags implementation methods
 //
@@ -3725,6 +4008,8 @@ BX_CPP_INLINE bx_bool BX_CPU_C::get_PFLazy(void)
   return bx_parity_lookup[(Bit8u) BX_CPU_THIS_PTR oszapc.result];
 }
 
+#endif
+
 IMPLEMENT_EFLAG_ACCESSOR   (ID,  21)
 IMPLEMENT_EFLAG_ACCESSOR   (VIP, 20)
 IMPLEMENT_EFLAG_ACCESSOR   (VIF, 19)
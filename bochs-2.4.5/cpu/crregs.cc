@@ -1040,7 +1040,9 @@ bx_bool BX_CPP_AttrRegparmN(1) BX_CPU_C::SetCR3(bx_address val)
 
   // flush TLB even if value does not change
 #if BX_CPU_LEVEL >= 6
-  if (BX_CPU_THIS_PTR cr4.get_PGE())
+  // without CR4.PGE there are no global entries, but TLB_flushNonGlobal()
+  // keeps second level TLB entries of recently used address spaces
+  if (BX_CPU_THIS_PTR cr4.get_PGE() || BX_SUPPORT_TLB_ASID)
     TLB_flushNonGlobal(); // Don't flush Global entries.
   else
 #endif
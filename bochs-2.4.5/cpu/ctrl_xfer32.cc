@@ -826,4 +826,83 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::LOOP32_Jb(bxInstruction_c *i)
   }
 }
 
+#if BX_SUPPORT_INSTR_FUSION
+
+// Evaluate Jcc condition cc (the low nibble of the Jcc opcode) directly on
+// the operands and the result of the preceding op1 - op2 comparison. TEST
+// is handled as a comparison of its result with zero.
+static BX_CPP_INLINE bx_bool fusedJccCondition(unsigned cc, Bit32u op1_32, Bit32u op2_32, Bit32u diff_32)
+{
+  bx_bool cond;
+
+  switch((cc >> 1) & 0x7) {
+    case 0:  // O
+      cond = ((op1_32 ^ op2_32) & (op1_32 ^ diff_32)) >> 31;
+      break;
+    case 1:  // B
+      cond = (op1_32 < op2_32);
+      break;
+    case 2:  // Z
+      cond = (diff_32 == 0);
+      break;
+    case 3:  // BE
+      cond = (op1_32 <= op2_32);
+      break;
+    case 4:  // S
+      cond = diff_32 >> 31;
+      break;
+    case 5:  // P
+      cond = bx_parity_lookup[(Bit8u) diff_32];
+      break;
+    case 6:  // L
+      cond = ((Bit32s) op1_32 < (Bit32s) op2_32);
+      break;
+    default: // LE
+      cond = ((Bit32s) op1_32 <= (Bit32s) op2_32);
+      break;
+  }
+
+  return cond ^ (cc & 1);
+}
+
+// Fused CMP Gd, Ed + Jcc Jd, b1() holds the Jcc opcode
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::CMP_GdEdR_Jcc(bxInstruction_c *i)
+{
+  Bit32u op1_32, op2_32, diff_32;
+
+  op1_32 = BX_READ_32BIT_REG(i->nnn());
+  op2_32 = BX_READ_32BIT_REG(i->rm());
+  diff_32 = op1_32 - op2_32;
+
+  SET_FLAGS_OSZAPC_SUB_32(op1_32, op2_32, diff_32);
+
+  if (! commitFusedFirst(i)) return;
+
+  if (fusedJccCondition(i->b1(), op1_32, op2_32, diff_32)) {
+    Bit32u new_EIP = EIP + (Bit32s) i->Id();
+    branch_near32(new_EIP);
+  }
+}
+
+// Fused TEST Ed, Gd + Jcc Jd, b1() holds the Jcc opcode
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::TEST_EdGdR_Jcc(bxInstruction_c *i)
+{
+  Bit32u op1_32, op2_32;
+
+  op1_32 = BX_READ_32BIT_REG(i->rm());
+  op2_32 = BX_READ_32BIT_REG(i->nnn());
+  op1_32 &= op2_32;
+
+  SET_FLAGS_OSZAPC_LOGIC_32(op1_32);
+
+  if (! commitFusedFirst(i)) return;
+
+  if (fusedJccCondition(i->b1(), op1_32, 0, op1_32)) {
+    Bit32u new_EIP = EIP + (Bit32s) i->Id();
+    branch_near32(new_EIP);
+  }
+}
+
+#endif // BX_SUPPORT_INSTR_FUSION
+
 #endif
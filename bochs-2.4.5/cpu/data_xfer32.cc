@@ -66,6 +66,41 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::MOV32_GdEdM(bxInstruction_c *i)
   BX_WRITE_32BIT_REGZ(i->nnn(), val32);
 }
 
+#if BX_SUPPORT_INSTR_FUSION
+// Fused MOV Gd, Ed + ADD Gd, Id
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::MOV_GdEdR_ADD_GdId(bxInstruction_c *i)
+{
+  Bit32u op1_32 = BX_READ_32BIT_REG(i->rm());
+  BX_WRITE_32BIT_REGZ(i->nnn(), op1_32);
+
+  if (commitFusedFirst(i)) {
+    Bit32u op2_32 = i->Id();
+    Bit32u sum_32 = op1_32 + op2_32;
+
+    BX_WRITE_32BIT_REGZ(i->nnn(), sum_32);
+
+    SET_FLAGS_OSZAPC_ADD_32(op1_32, op2_32, sum_32);
+  }
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::MOV32_GdEdM_ADD_GdId(bxInstruction_c *i)
+{
+  Bit32u eaddr = (Bit32u) BX_CPU_CALL_METHODR(i->ResolveModrm, (i));
+
+  Bit32u op1_32 = read_virtual_dword_32(i->seg(), eaddr);
+  BX_WRITE_32BIT_REGZ(i->nnn(), op1_32);
+
+  if (commitFusedFirst(i)) {
+    Bit32u op2_32 = i->Id();
+    Bit32u sum_32 = op1_32 + op2_32;
+
+    BX_WRITE_32BIT_REGZ(i->nnn(), sum_32);
+
+    SET_FLAGS_OSZAPC_ADD_32(op1_32, op2_32, sum_32);
+  }
+}
+#endif
+
 void BX_CPP_AttrRegparmN(1) BX_CPU_C::LEA_GdM(bxInstruction_c *i)
 {
   bx_address eaddr = BX_CPU_CALL_METHODR(i->ResolveModrm, (i));
@@ -25,6 +25,10 @@
 #include "cpu.h"
 #define LOG_THIS BX_CPU_THIS_PTR
 
+#if BX_SUPPORT_JIT
+#include "dynamic/jit.h"
+#endif
+
 #if BX_DISASM
 
 #include "disasm/disasm.h"
@@ -389,4 +393,44 @@ void BX_CPU_C::dbg_get_idtr(bx_dbg_global_sreg_t *sreg)
 void BX_CPU_C::atexit(void)
 {
   debug(BX_CPU_THIS_PTR prev_rip);
+
+  Bit64u lookups = BX_CPU_THIS_PTR iCache.lookups;
+  Bit64u misses = BX_CPU_THIS_PTR iCache.misses;
+  BX_INFO(("iCache: %u entries, %u-way, " FMT_LL "u lookups, " FMT_LL "u misses (hit rate %.2f%%), " FMT_LL "u valid entries replaced",
+     BxICacheEntries, BxICacheWays, lookups, misses,
+     lookups ? (lookups - misses) * 100.0 / lookups : 0.0,
+     BX_CPU_THIS_PTR iCache.replacements));
+  BX_INFO(("TLB: " FMT_LL "u page walks, " FMT_LL "u second level TLB hits, " FMT_LL "u flushes",
+     BX_CPU_THIS_PTR TLB.walks, BX_CPU_THIS_PTR TLB.l2hits, BX_CPU_THIS_PTR TLB.flushes));
+#if BX_SUPPORT_TLB_ASID
+  BX_INFO(("TLB: " FMT_LL "u CR3 loads kept the address space",
+     BX_CPU_THIS_PTR TLB.asidReuses));
+#endif
+#if BX_SUPPORT_TRACE_CACHE
+  BX_INFO(("trace cache: pool of %u instructions, " FMT_LL "u segment evictions",
+     BX_CPU_THIS_PTR iCache.mpoolSize, BX_CPU_THIS_PTR iCache.evictions));
+#endif
+#if BX_SUPPORT_TRACE_LINKING
+  BX_INFO(("trace linking: " FMT_LL "u traces entered through links",
+     BX_CPU_THIS_PTR iCache.linkHits));
+#endif
+#if BX_SUPPORT_INSTR_FUSION
+  BX_INFO(("instruction fusion: " FMT_LL "u pairs fused, " FMT_LL "u split executions",
+     BX_CPU_THIS_PTR iCache.fusedPairs, BX_CPU_THIS_PTR iCache.fusedSplits));
+#endif
+#if BX_SUPPORT_FLAGS_LIVENESS
+  BX_INFO(("flags liveness: " FMT_LL "u instructions without lazy flags, " FMT_LL "u executions computed them",
+     BX_CPU_THIS_PTR iCache.deadFlags, BX_CPU_THIS_PTR iCache.deadFlagsKept));
+#endif
+#if BX_SUPPORT_HANDLERS_CHAINING
+  BX_INFO(("handlers chaining: " FMT_LL "u chains, " FMT_LL "u instructions executed by chains",
+     BX_CPU_THIS_PTR iCache.chains, BX_CPU_THIS_PTR iCache.chainedInstructions));
+#endif
+#if BX_SUPPORT_JIT
+  bxJitCompiler *jit = BX_CPU_THIS_PTR jit;
+  if (jit) {
+    BX_INFO(("JIT: " FMT_LL "u traces translated, " FMT_LL "u instructions inlined, " FMT_LL "u handler calls, " FMT_LL "u code buffer flushes",
+       jit->traces, jit->inlined, jit->called, jit->flushes));
+  }
+#endif
 }
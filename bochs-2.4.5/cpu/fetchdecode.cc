@@ -2892,6 +2892,183 @@ modrm_done:
   return(0);
 }
 
+#if BX_SUPPORT_INSTR_FUSION
+
+static BX_CPP_INLINE bx_bool isJccJd(unsigned ia_opcode)
+{
+  switch(ia_opcode) {
+    case BX_IA_JO_Jd:
+    case BX_IA_JNO_Jd:
+    case BX_IA_JB_Jd:
+    case BX_IA_JNB_Jd:
+    case BX_IA_JZ_Jd:
+    case BX_IA_JNZ_Jd:
+    case BX_IA_JBE_Jd:
+    case BX_IA_JNBE_Jd:
+    case BX_IA_JS_Jd:
+    case BX_IA_JNS_Jd:
+    case BX_IA_JP_Jd:
+    case BX_IA_JNP_Jd:
+    case BX_IA_JL_Jd:
+    case BX_IA_JNL_Jd:
+    case BX_IA_JLE_Jd:
+    case BX_IA_JNLE_Jd:
+      return 1;
+  }
+
+  return 0;
+}
+
+// Fuse two consecutive instructions of a trace into the first one if they
+// form one of the pairs most frequently executed by 32-bit guest code:
+//
+//   CMP  Gd, Ed       + Jcc Jd   ->  CMP_GdEdR_Jcc
+//   TEST Ed, Gd       + Jcc Jd   ->  TEST_EdGdR_Jcc
+//   PUSH EBP          + MOV EBP, ESP  ->  PUSH_EBP_MOV_EBP_ESP
+//   MOV  Gd, Ed (reg) + ADD Gd, Id    ->  MOV_GdEdR_ADD_GdId
+//   MOV  Gd, Ed (mem) + ADD Gd, Id    ->  MOV32_GdEdM_ADD_GdId
+//
+// The fields of the second instruction are moved into fields the first one
+// does not use; the caller drops the second instruction from the trace.
+// The fused handlers live next to the handler of their first instruction.
+bx_bool BX_CPU_C::fuseInstructions(bxInstruction_c *first, const bxInstruction_c *second)
+{
+  // The fused handlers tick the system timer between the two instructions,
+  // which matches cpu_loop() only when a single processor is simulated.
+  // A gdbstub session checks for breakpoints after every instruction.
+  if (BX_SMP_PROCESSORS != 1) return 0;
+#if BX_GDBSTUB
+  if (bx_dbg.gdbstub_enabled) return 0;
+#endif
+
+  unsigned ia_opcode;
+
+  switch(first->getIaOpcode()) {
+    case BX_IA_CMP_GdEdR:
+    case BX_IA_TEST_EdGdR:
+      if (! isJccJd(second->getIaOpcode())) return 0;
+      ia_opcode = (first->getIaOpcode() == BX_IA_CMP_GdEdR) ?
+          BX_IA_CMP_GdEdR_Jcc : BX_IA_TEST_EdGdR_Jcc;
+      // the low nibble of the Jcc opcode is the condition
+      first->setB1(second->b1());
+      first->modRMForm.Id = second->Id();
+      break;
+
+    case BX_IA_PUSH_ERX:
+      if (first->opcodeReg() != BX_32BIT_REG_EBP ||
+          second->getIaOpcode() != BX_IA_MOV_GdEdR ||
+          second->nnn() != BX_32BIT_REG_EBP || second->rm() != BX_32BIT_REG_ESP) return 0;
+      ia_opcode = BX_IA_PUSH_EBP_MOV_EBP_ESP;
+      break;
+
+    case BX_IA_MOV_GdEdR:
+    case BX_IA_MOV32_GdEdM:
+      if (second->getIaOpcode() != BX_IA_ADD_EdIdR || second->rm() != first->nnn()) return 0;
+      ia_opcode = (first->getIaOpcode() == BX_IA_MOV_GdEdR) ?
+          BX_IA_MOV_GdEdR_ADD_GdId : BX_IA_MOV32_GdEdM_ADD_GdId;
+      first->modRMForm.Id = second->Id();
+      break;
+
+    default:
+      return 0;
+  }
+
+  first->execute = BxOpcodesTable[ia_opcode].execute1;
+  first->setIaOpcode(ia_opcode);
+  first->setFusedILen(second->ilen());
+  first->setILen(first->ilen() + second->ilen());
+
+  return 1;
+}
+
+#endif
+
+#if BX_SUPPORT_FLAGS_LIVENESS
+
+// instructions with a form which leaves the lazy flags alone
+static const Bit16u BxNoFlagsOpcodes[][2] = {
+  { BX_IA_ADD_GdEdR, BX_IA_ADD_GdEdR_NF },
+  { BX_IA_ADD_EdIdR, BX_IA_ADD_EdIdR_NF },
+  { BX_IA_SUB_GdEdR, BX_IA_SUB_GdEdR_NF },
+  { BX_IA_SUB_EdIdR, BX_IA_SUB_EdIdR_NF },
+  { BX_IA_AND_GdEdR, BX_IA_AND_GdEdR_NF },
+  { BX_IA_AND_EdIdR, BX_IA_AND_EdIdR_NF },
+  { BX_IA_OR_GdEdR,  BX_IA_OR_GdEdR_NF  },
+  { BX_IA_OR_EdIdR,  BX_IA_OR_EdIdR_NF  },
+  { BX_IA_XOR_GdEdR, BX_IA_XOR_GdEdR_NF },
+  { BX_IA_XOR_EdIdR, BX_IA_XOR_EdIdR_NF }
+};
+
+// Instructions which write all of OSZAPC without reading any of them and
+// can't fault before the flags are written
+static bx_bool killsFlags(unsigned ia_opcode)
+{
+  switch(ia_opcode) {
+    case BX_IA_CMP_GdEdR:
+    case BX_IA_CMP_EdIdR:
+    case BX_IA_TEST_EdGdR:
+    case BX_IA_TEST_EdIdR:
+    case BX_IA_ADD_EAXId:
+    case BX_IA_SUB_EAXId:
+    case BX_IA_CMP_EAXId:
+    case BX_IA_AND_EAXId:
+    case BX_IA_OR_EAXId:
+    case BX_IA_XOR_EAXId:
+    case BX_IA_TEST_EAXId:
+#if BX_SUPPORT_INSTR_FUSION
+    // the flags are written before the pair may be split
+    case BX_IA_CMP_GdEdR_Jcc:
+    case BX_IA_TEST_EdGdR_Jcc:
+#endif
+      return 1;
+  }
+
+  for (unsigned n=0; n < sizeof(BxNoFlagsOpcodes) / sizeof(BxNoFlagsOpcodes[0]); n++) {
+    if (ia_opcode == BxNoFlagsOpcodes[n][0] || ia_opcode == BxNoFlagsOpcodes[n][1])
+      return 1;
+  }
+
+  return 0;
+}
+
+// Flags liveness pass over a new trace. An instruction whose lazy flags
+// are overwritten by the next instruction of the trace before anything
+// reads them is switched to its _NF form, which skips the lazy flags
+// stores (see deadFlagsObservable() for the cases it keeps them). The
+// instructions merged from another trace are checked again, their
+// successor may have been cut off.
+void BX_CPU_C::markDeadFlags(bxICacheEntry_c *entry)
+{
+  // An _NF instruction relies on the next one being executed right after
+  // it, which is not true when the timer is shared between processors or
+  // a gdbstub session may stop after every instruction.
+  if (BX_SMP_PROCESSORS != 1) return;
+#if BX_GDBSTUB
+  if (bx_dbg.gdbstub_enabled) return;
+#endif
+
+  bxInstruction_c *i = entry->i;
+
+  for (unsigned n=0; n < entry->tlen; n++, i++) {
+    unsigned ia_opcode = i->getIaOpcode();
+
+    for (unsigned k=0; k < sizeof(BxNoFlagsOpcodes) / sizeof(BxNoFlagsOpcodes[0]); k++) {
+      if (ia_opcode != BxNoFlagsOpcodes[k][0] && ia_opcode != BxNoFlagsOpcodes[k][1])
+        continue;
+
+      bx_bool dead = (n+1 < entry->tlen) && killsFlags((i+1)->getIaOpcode());
+      ia_opcode = BxNoFlagsOpcodes[k][dead];
+      i->execute = BxOpcodesTable[ia_opcode].execute1;
+      i->setIaOpcode(ia_opcode);
+      if (dead)
+        BX_CPU_THIS_PTR iCache.deadFlags++;
+      break;
+    }
+  }
+}
+
+#endif
+
 void BX_CPP_AttrRegparmN(1) BX_CPU_C::BxError(bxInstruction_c *i)
 {
   unsigned ia_opcode = i->getIaOpcode();
@@ -59,11 +59,6 @@ BX_CPP_INLINE Bit64u FetchQWORD(const Bit8u *iptr)
 }
 #endif
 
-struct bxIAOpcodeTable {
-  BxExecutePtr_tR execute1;
-  BxExecutePtr_tR execute2;
-};
-
 //
 // Common FetchDecode Opcode Tables
 //
@@ -1642,3 +1642,26 @@ bx_define_opcode(BX_IA_VMWRITE_GqEq, &BX_CPU_C::VMWRITE, NULL, BX_CPU_X86_64 | B
 bx_define_opcode(BX_IA_INVEPT, &BX_CPU_C::INVEPT, NULL, BX_CPU_X86_64 | BX_CPU_VMX)
 bx_define_opcode(BX_IA_INVVPID, &BX_CPU_C::INVVPID, NULL, BX_CPU_X86_64 | BX_CPU_VMX)
 // VMX
+
+#if BX_SUPPORT_INSTR_FUSION
+// fused instruction pairs, see fuseInstructions()
+bx_define_opcode(BX_IA_CMP_GdEdR_Jcc, &BX_CPU_C::CMP_GdEdR_Jcc, NULL, 0)
+bx_define_opcode(BX_IA_TEST_EdGdR_Jcc, &BX_CPU_C::TEST_EdGdR_Jcc, NULL, 0)
+bx_define_opcode(BX_IA_PUSH_EBP_MOV_EBP_ESP, &BX_CPU_C::PUSH_EBP_MOV_EBP_ESP, NULL, 0)
+bx_define_opcode(BX_IA_MOV_GdEdR_ADD_GdId, &BX_CPU_C::MOV_GdEdR_ADD_GdId, NULL, 0)
+bx_define_opcode(BX_IA_MOV32_GdEdM_ADD_GdId, &BX_CPU_C::MOV32_GdEdM_ADD_GdId, NULL, 0)
+#endif
+
+#if BX_SUPPORT_FLAGS_LIVENESS
+// forms leaving the lazy flags alone, see markDeadFlags()
+bx_define_opcode(BX_IA_ADD_GdEdR_NF, &BX_CPU_C::ADD_GdEdR_NF, NULL, 0)
+bx_define_opcode(BX_IA_ADD_EdIdR_NF, &BX_CPU_C::ADD_EdIdR_NF, NULL, 0)
+bx_define_opcode(BX_IA_SUB_GdEdR_NF, &BX_CPU_C::SUB_GdEdR_NF, NULL, 0)
+bx_define_opcode(BX_IA_SUB_EdIdR_NF, &BX_CPU_C::SUB_EdIdR_NF, NULL, 0)
+bx_define_opcode(BX_IA_AND_GdEdR_NF, &BX_CPU_C::AND_GdEdR_NF, NULL, 0)
+bx_define_opcode(BX_IA_AND_EdIdR_NF, &BX_CPU_C::AND_EdIdR_NF, NULL, 0)
+bx_define_opcode(BX_IA_OR_GdEdR_NF, &BX_CPU_C::OR_GdEdR_NF, NULL, 0)
+bx_define_opcode(BX_IA_OR_EdIdR_NF, &BX_CPU_C::OR_EdIdR_NF, NULL, 0)
+bx_define_opcode(BX_IA_XOR_GdEdR_NF, &BX_CPU_C::XOR_GdEdR_NF, NULL, 0)
+bx_define_opcode(BX_IA_XOR_EdIdR_NF, &BX_CPU_C::XOR_EdIdR_NF, NULL, 0)
+#endif
@@ -39,7 +39,7 @@ void flushICaches(void)
     BX_CPU(i)->iCache.flushICacheEntries();
     BX_CPU(i)->invalidate_prefetch_q();
 #if BX_SUPPORT_TRACE_CACHE
-    BX_CPU(i)->async_event |= BX_ASYNC_EVENT_STOP_TRACE;
+    BX_CPU_SIGNAL_EVENT(BX_CPU(i), BX_ASYNC_EVENT_STOP_TRACE);
 #endif
   }
 
@@ -56,16 +56,52 @@ void purgeICaches(void)
 void handleSMC(void)
 {
   for (unsigned i=0; i<BX_SMP_PROCESSORS; i++)
-    BX_CPU(i)->async_event |= BX_ASYNC_EVENT_STOP_TRACE;
+    BX_CPU_SIGNAL_EVENT(BX_CPU(i), BX_ASYNC_EVENT_STOP_TRACE);
 }
 
-void BX_CPU_C::serveICacheMiss(bxICacheEntry_c *entry, Bit32u eipBiased, bx_phy_address pAddr)
+void bxICache_c::allocPool(unsigned size)
 {
+  delete [] mpool;
+  delete [] mpoolOwner;
+
+  mpoolSegSize = size / BxICacheMemPoolSegments;
+  mpoolSize = mpoolSegSize * BxICacheMemPoolSegments;
+  mpool = new bxInstruction_c[mpoolSize];
+  mpoolOwner = new bxICacheEntry_c*[mpoolSize];
+  memset(mpoolOwner, 0, sizeof(bxICacheEntry_c*) * mpoolSize);
+
+  flushICacheEntries();
+}
+
+void bxICache_c::evictPoolSegment(unsigned start, unsigned end)
+{
+  for (unsigned n=start; n<end; n++) {
+    bxICacheEntry_c *e = mpoolOwner[n];
+    if (e) {
+      // the entry could already hold a newer trace allocated elsewhere
+      if (e->i == &mpool[n])
+        e->writeStamp = ICacheWriteStampInvalid;
+      mpoolOwner[n] = NULL;
+    }
+  }
+
+  evictions++;
+}
+
+bxICacheEntry_c* BX_CPU_C::serveICacheMiss(Bit32u eipBiased, bx_phy_address pAddr)
+{
+  bxICacheEntry_c *entry = BX_CPU_THIS_PTR iCache.get_victim(pAddr, BX_CPU_THIS_PTR fetchModeMask);
+
+  BX_CPU_THIS_PTR iCache.misses++;
   BX_CPU_THIS_PTR iCache.alloc_trace(entry);
 
   // Cache miss. We weren't so lucky, but let's be optimistic - try to build 
   // trace from incoming instruction bytes stream !
   entry->pAddr = pAddr;
+#if BX_SUPPORT_JIT
+  entry->jitCode = NULL;
+  entry->jitCount = 0;
+#endif
   pageWriteStampTable.markICache(pAddr);
   entry->writeStamp = *(BX_CPU_THIS_PTR currPageWriteStampPtr);
 
@@ -97,32 +133,54 @@ void BX_CPU_C::serveICacheMiss(bxICacheEntry_c *entry, Bit32u eipBiased, bx_phy_
       entry->writeStamp = ICacheWriteStampInvalid;
       entry->tlen = 1;
       boundaryFetch(fetchPtr, remainingInPage, i);
-      return;
+      return entry;
     }
 
     // add instruction to the trace
     unsigned iLen = i->ilen();
-    entry->tlen++;
+#if BX_SUPPORT_INSTR_FUSION
+    // a pair fused into the previous instruction takes a single slot,
+    // the next instruction is decoded into the slot of the second one
+    bx_bool fused = (n > 0) && fuseInstructions(i-1, i);
+    if (fused)
+      BX_CPU_THIS_PTR iCache.fusedPairs++;
+    else
+#endif
+      entry->tlen++;
 
     // continue to the next instruction
     remainingInPage -= iLen;
     if (ret != 0 /* stop trace indication */ || remainingInPage == 0) break;
     pAddr += iLen;
     fetchPtr += iLen;
-    i++;
+#if BX_SUPPORT_INSTR_FUSION
+    if (! fused)
+#endif
+      i++;
 
     // try to find a trace starting from current pAddr and merge
     if (mergeTraces(entry, i, pAddr)) break;
   }
 
+#if BX_SUPPORT_FLAGS_LIVENESS
+  markDeadFlags(entry);
+#endif
+#if BX_SUPPORT_HANDLERS_CHAINING
+  chainTrace(entry);
+  BX_CPU_THIS_PTR iCache.commit_trace(entry->tlen + 1);
+#else
   BX_CPU_THIS_PTR iCache.commit_trace(entry->tlen);
+#endif
+
+  return entry;
 }
 
 bx_bool BX_CPU_C::mergeTraces(bxICacheEntry_c *entry, bxInstruction_c *i, bx_phy_address pAddr)
 {
-  bxICacheEntry_c *e = BX_CPU_THIS_PTR iCache.get_entry(pAddr, BX_CPU_THIS_PTR fetchModeMask);
+  bxICacheEntry_c *e = BX_CPU_THIS_PTR iCache.find_entry(
+      BX_CPU_THIS_PTR iCache.hash(pAddr, BX_CPU_THIS_PTR fetchModeMask), pAddr, entry->writeStamp);
 
-  if ((e->pAddr == pAddr) && (e->writeStamp == entry->writeStamp))
+  if (e != NULL)
   {
     // determine max amount of instruction to take from another entry
     unsigned max_length = e->tlen;
@@ -140,6 +198,150 @@ bx_bool BX_CPU_C::mergeTraces(bxICacheEntry_c *entry, bxInstruction_c *i, bx_phy
   return 0;
 }
 
+#if BX_SUPPORT_HANDLERS_CHAINING
+
+// table of all Bochs opcodes, see fetchdecode.cc
+extern struct bxIAOpcodeTable BxOpcodesTable[];
+
+// Handler of an instruction of a chained trace, see cpu_loop(). Does what
+// cpu_loop() does for one instruction except the timer tick, which is
+// charged when the trace is left, and continues with the handler of the
+// next instruction by a tail call. Every handler has its own copy of the
+// indirect jump, which lets the host predict the next handler from the
+// current one.
+template <BxExecutePtr_tR handler>
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::BxChain(bxInstruction_c *i)
+{
+  RIP += i->ilen();
+  BX_CPU_CALL_METHOD(handler, (i));
+  BX_CPU_THIS_PTR prev_rip = RIP; // commit new RIP
+
+  if (BX_CPU_THIS_PTR async_event) {
+    BxEndTrace(i + 1);
+    return;
+  }
+
+  i++;
+  BX_CPU_CALL_METHOD(i->execute, (i));
+}
+
+// Handler of the instructions which are not chained; returns to cpu_loop()
+// without executing the instruction.
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::BxEndChain(bxInstruction_c *i)
+{
+  BX_CPU_THIS_PTR chainEnd = i;
+}
+
+static BxExecutePtr_tR BxChainedHandlers[] = {
+#define bx_define_opcode(a, b, c, d) &BX_CPU_C::BxChain<b>,
+#include "ia_opcodes.h"
+};
+#undef  bx_define_opcode
+
+// Instructions which read the simulation time or tick the timer
+// themselves can't run with uncharged ticks and end the chain, cpu_loop()
+// executes them on its own.
+static bx_bool isChainBarrier(unsigned ia_opcode)
+{
+  switch(ia_opcode) {
+    case BX_IA_IN_ALIb:
+    case BX_IA_IN_AXIb:
+    case BX_IA_IN_EAXIb:
+    case BX_IA_IN_ALDX:
+    case BX_IA_IN_AXDX:
+    case BX_IA_IN_EAXDX:
+    case BX_IA_OUT_IbAL:
+    case BX_IA_OUT_IbAX:
+    case BX_IA_OUT_IbEAX:
+    case BX_IA_OUT_DXAL:
+    case BX_IA_OUT_DXAX:
+    case BX_IA_OUT_DXEAX:
+    // the repeated forms tick the timer every iteration
+    case BX_IA_REP_INSB_YbDX:
+    case BX_IA_REP_INSW_YwDX:
+    case BX_IA_REP_INSD_YdDX:
+    case BX_IA_REP_OUTSB_DXXb:
+    case BX_IA_REP_OUTSW_DXXw:
+    case BX_IA_REP_OUTSD_DXXd:
+    case BX_IA_REP_MOVSB_XbYb:
+    case BX_IA_REP_MOVSW_XwYw:
+    case BX_IA_REP_MOVSD_XdYd:
+    case BX_IA_REP_CMPSB_XbYb:
+    case BX_IA_REP_CMPSW_XwYw:
+    case BX_IA_REP_CMPSD_XdYd:
+    case BX_IA_REP_STOSB_YbAL:
+    case BX_IA_REP_STOSW_YwAX:
+    case BX_IA_REP_STOSD_YdEAX:
+    case BX_IA_REP_LODSB_ALXb:
+    case BX_IA_REP_LODSW_AXXw:
+    case BX_IA_REP_LODSD_EAXXd:
+    case BX_IA_REP_SCASB_ALXb:
+    case BX_IA_REP_SCASW_AXXw:
+    case BX_IA_REP_SCASD_EAXXd:
+#if BX_SUPPORT_X86_64
+    case BX_IA_REP_MOVSQ_XqYq:
+    case BX_IA_REP_CMPSQ_XqYq:
+    case BX_IA_REP_STOSQ_YqRAX:
+    case BX_IA_REP_LODSQ_RAXXq:
+    case BX_IA_REP_SCASQ_RAXXq:
+    case BX_IA_RDTSCP:
+#endif
+    case BX_IA_HLT:
+    case BX_IA_RDTSC:
+    case BX_IA_RDMSR:
+    case BX_IA_WRMSR:
+    case BX_IA_MWAIT:
+      return 1;
+  }
+
+  return 0;
+}
+
+// Switch the instructions of a new trace to their chained handlers, the
+// pool slot following the trace leaves it through BxEndTrace(). Opcodes
+// disabled for the configured CPU keep BxError and are not chained.
+void BX_CPU_C::chainTrace(bxICacheEntry_c *entry)
+{
+  bxInstruction_c *i = entry->i;
+
+  for (unsigned n=0; n < entry->tlen; n++, i++) {
+    unsigned ia_opcode = i->getIaOpcode();
+    if (isChainBarrier(ia_opcode) || i->execute == &BX_CPU_C::BxError)
+      i->execute = &BX_CPU_C::BxEndChain;
+    else
+      i->execute = BxChainedHandlers[ia_opcode];
+  }
+
+  i->execute = &BX_CPU_C::BxEndTrace;
+}
+
+// Charge the ticks of the chained instructions completed so far, before
+// the current instruction reads the simulation time or after it faulted.
+// The instructions of a trace are consecutive in memory, so the completed
+// ones are those which end at or before prev_rip.
+void BX_CPU_C::syncChainTicks(void)
+{
+  bxInstruction_c *i = BX_CPU_THIS_PTR chainFirst;
+  if (i == NULL) return;
+
+  bx_address rip = BX_CPU_THIS_PTR chainRip;
+  Bit32u n = 0;
+
+  while (i->execute != &BX_CPU_C::BxEndChain && i->execute != &BX_CPU_C::BxEndTrace &&
+         (rip + i->ilen()) <= BX_CPU_THIS_PTR prev_rip)
+  {
+    rip += i->ilen();
+    i++;
+    n++;
+  }
+
+  BX_TICKN(n);
+  BX_CPU_THIS_PTR chainFirst = i;
+  BX_CPU_THIS_PTR chainRip = rip;
+}
+
+#endif
+
 #else // BX_SUPPORT_TRACE_CACHE == 0
 
 bx_bool BX_CPU_C::fetchInstruction(bxInstruction_c *iStorage, Bit32u eipBiased)
@@ -169,8 +371,12 @@ bx_bool BX_CPU_C::fetchInstruction(bxInstruction_c *iStorage, Bit32u eipBiased)
   return 1;
 }
 
-void BX_CPU_C::serveICacheMiss(bxICacheEntry_c *entry, Bit32u eipBiased, bx_phy_address pAddr)
+bxICacheEntry_c* BX_CPU_C::serveICacheMiss(Bit32u eipBiased, bx_phy_address pAddr)
 {
+  bxICacheEntry_c *entry = BX_CPU_THIS_PTR iCache.get_victim(pAddr, BX_CPU_THIS_PTR fetchModeMask);
+
+  BX_CPU_THIS_PTR iCache.misses++;
+
   // The entry will be marked valid if fetchdecode will succeed
   entry->writeStamp = ICacheWriteStampInvalid;
 
@@ -179,6 +385,8 @@ void BX_CPU_C::serveICacheMiss(bxICacheEntry_c *entry, Bit32u eipBiased, bx_phy_
     entry->writeStamp = *(BX_CPU_THIS_PTR currPageWriteStampPtr);
     pageWriteStampTable.markICache(pAddr);
   }
+
+  return entry;
 }
 
 #endif
@@ -24,10 +24,20 @@
 #ifndef BX_ICACHE_H
 #define BX_ICACHE_H
 
-// bit 31 indicates code page
+// bit 31 indicates code page, bit 30 a page table page remembered by
+// the address spaces of the TLB (BX_SUPPORT_TLB_ASID)
 const Bit32u ICacheWriteStampInvalid  = 0xffffffff;
+#if BX_SUPPORT_TLB_ASID
+const Bit32u ICacheWriteStampStart    = 0x3fffffff;
+const Bit32u ICacheWriteStampPageTableMask = 0x40000000;
+#else
 const Bit32u ICacheWriteStampStart    = 0x7fffffff;
-const Bit32u ICacheWriteStampFetchModeMask = ~ICacheWriteStampStart;
+const Bit32u ICacheWriteStampPageTableMask = 0;
+#endif
+const Bit32u ICacheWriteStampFetchModeMask = 0x80000000;
+// a write to a page with any of these bits changes its write stamp
+const Bit32u ICacheWriteStampTrackMask =
+    ICacheWriteStampFetchModeMask | ICacheWriteStampPageTableMask;
 
 #if BX_SUPPORT_TRACE_CACHE
 extern void handleSMC(void);
@@ -76,19 +86,49 @@ public:
 
   BX_CPP_INLINE void markICache(bx_phy_address pAddr)
   {
+#if BX_SUPPORT_SMP_THREADS
+    // the table is shared by the processor threads
+    __sync_fetch_and_or(&pageWriteStampTable[hash(pAddr)], ICacheWriteStampFetchModeMask);
+#else
     pageWriteStampTable[hash(pAddr)] |= ICacheWriteStampFetchModeMask;
+#endif
   }
 
+#if BX_SUPPORT_TLB_ASID
+  // Page table pages get their own mark, a write to them changes the page
+  // write stamp without stopping the traces of the CPUs.
+  BX_CPP_INLINE void markPageTable(bx_phy_address pAddr)
+  {
+#if BX_SUPPORT_SMP_THREADS
+    __sync_fetch_and_or(&pageWriteStampTable[hash(pAddr)], ICacheWriteStampPageTableMask);
+#else
+    pageWriteStampTable[hash(pAddr)] |= ICacheWriteStampPageTableMask;
+#endif
+  }
+#endif
+
   BX_CPP_INLINE void decWriteStamp(bx_phy_address pAddr)
   {
     Bit32u index = hash(pAddr);
-    if (pageWriteStampTable[index] & ICacheWriteStampFetchModeMask) {
+    if (pageWriteStampTable[index] & ICacheWriteStampTrackMask) {
 #if BX_SUPPORT_TRACE_CACHE
-      handleSMC(); // one of the CPUs might be running trace from this page
+#if BX_SUPPORT_TLB_ASID
+      if (pageWriteStampTable[index] & ICacheWriteStampFetchModeMask)
+#endif
+        handleSMC(); // one of the CPUs might be running trace from this page
 #endif
       // Decrement page write stamp, so iCache entries with older stamps are
       // effectively invalidated.
-      pageWriteStampTable[index] = (pageWriteStampTable[index] - 1) & ~ICacheWriteStampFetchModeMask;
+#if BX_SUPPORT_SMP_THREADS
+      Bit32u stamp;
+      do {
+        stamp = pageWriteStampTable[index];
+        if (! (stamp & ICacheWriteStampTrackMask)) break;
+      } while (! __sync_bool_compare_and_swap(&pageWriteStampTable[index],
+                    stamp, (stamp - 1) & ~ICacheWriteStampTrackMask));
+#else
+      pageWriteStampTable[index] = (pageWriteStampTable[index] - 1) & ~ICacheWriteStampTrackMask;
+#endif
     }
   }
 
@@ -104,11 +144,69 @@ BX_CPP_INLINE void bxPageWriteStampTable::resetWriteStamps(void)
 
 extern bxPageWriteStampTable pageWriteStampTable;
 
-#define BxICacheEntries (64 * 1024)  // Must be a power of 2.
-#define BxICacheMemPool (384 * 1024)
+#define BxICacheEntries (BX_ICACHE_ENTRIES)  // Must be a power of 2.
+#define BxICacheWays    (BX_ICACHE_WAYS)     // 1, 2 or 4
+#define BxICacheSets    (BxICacheEntries / BxICacheWays)
+
+#if BxICacheWays != 1 && BxICacheWays != 2 && BxICacheWays != 4
+  #error "BX_ICACHE_WAYS must be 1, 2 or 4"
+#endif
+
+#define BxICacheMemPool (BX_ICACHE_POOL_SIZE)  // Default trace pool size (instructions)
 
 #if BX_SUPPORT_TRACE_CACHE
   #define BX_MAX_TRACE_LENGTH 32
+
+  // With handlers chaining each trace is followed by one more pool slot,
+  // its handler ends the chain (see BX_CPU_C::chainTrace)
+#if BX_SUPPORT_HANDLERS_CHAINING
+  #define BX_TRACE_POOL_SLOTS (BX_MAX_TRACE_LENGTH + 1)
+#else
+  #define BX_TRACE_POOL_SLOTS (BX_MAX_TRACE_LENGTH)
+#endif
+
+  // The trace pool is divided into segments which are reused in FIFO order.
+  // When the pool runs out of space only the oldest segment is recycled and
+  // only the traces stored inside it are invalidated.
+  #define BxICacheMemPoolSegments (BX_ICACHE_POOL_SEGMENTS)
+  #define BxICacheMemPoolMin (BX_ICACHE_POOL_MIN)
+  #define BxICacheMemPoolMax (BX_ICACHE_POOL_MAX)
+
+#if BxICacheMemPoolMin < (BxICacheMemPoolSegments * BX_MAX_TRACE_LENGTH * 64)
+  #error "BX_ICACHE_POOL_MIN is too small for the trace pool segments"
+#endif
+#endif
+
+#if BX_SUPPORT_TRACE_LINKING
+
+struct bxICacheEntry_c;
+
+// Direct link from a trace to one of its successor traces. Together with
+// the successor entry the link keeps the prefetch window of the page the
+// successor was found on, so following a link skips both the iCache hash
+// lookup and prefetch(). The window is only trusted while the prefetch
+// generation of the CPU is the one the link was recorded in.
+struct bxTraceLink_c
+{
+  bxICacheEntry_c *entry;       // successor trace
+  Bit64u traceLinkGen;          // prefetch generation the link was recorded in
+  Bit32u fetchModeMask;
+  Bit32u eipPageWindowSize;
+  bx_address eipPageBias;
+  const Bit8u *eipFetchPtr;
+  bx_phy_address pAddrPage;
+  Bit32u iCachePageBias;
+  const Bit32u *pageWriteStampPtr;
+};
+
+#define BX_TRACE_LINK_NOT_TAKEN 0  // trace executed up to its last instruction
+#define BX_TRACE_LINK_TAKEN     1  // trace left by a taken branch
+
+#endif
+
+#if BX_SUPPORT_JIT
+// host code of a trace translated by the JIT, see dynamic/jit.h
+typedef void (*bxJitCode_t)(void);
 #endif
 
 struct bxICacheEntry_c
@@ -119,6 +217,13 @@ struct bxICacheEntry_c
 #if BX_SUPPORT_TRACE_CACHE
   Bit32u tlen;          // Trace length in instructions
   bxInstruction_c *i;
+#if BX_SUPPORT_TRACE_LINKING
+  bxTraceLink_c link[2]; // Not taken / taken successor traces
+#endif
+#if BX_SUPPORT_JIT
+  bxJitCode_t jitCode;  // Translated trace or NULL
+  Bit32u jitCount;      // Executions of the trace while not translated
+#endif
 #else
   // ... define as array of 1 to simplify merge with trace cache code
   bxInstruction_c i[1];
@@ -127,29 +232,103 @@ struct bxICacheEntry_c
 
 class BOCHSAPI bxICache_c {
 public:
+  // BxICacheWays consecutive entries form one set
   bxICacheEntry_c entry[BxICacheEntries];
+#if BxICacheWays > 1
+  // next way of each set to be replaced when all of its ways are valid
+  Bit8u victim[BxICacheSets];
+#endif
+
+  // iCache statistics, reported at exit
+  Bit64u lookups;        // iCache lookups by physical address
+  Bit64u misses;         // lookups which found no valid entry
+  Bit64u replacements;   // misses which evicted an entry still valid for its page
+#if BX_SUPPORT_TRACE_LINKING
+  Bit64u linkHits;       // traces entered through a trace link
+#endif
+#if BX_SUPPORT_INSTR_FUSION
+  Bit64u fusedPairs;     // instruction pairs fused while building traces
+  Bit64u fusedSplits;    // fused pairs executed one instruction at a time
+#endif
+#if BX_SUPPORT_FLAGS_LIVENESS
+  Bit64u deadFlags;      // instructions switched to forms without lazy flags
+  Bit64u deadFlagsKept;  // executions of those which computed the flags anyway
+#endif
+#if BX_SUPPORT_HANDLERS_CHAINING
+  Bit64u chains;         // chains of handlers run by cpu_loop()
+  Bit64u chainedInstructions; // trace slots executed by chains
+#endif
+
 #if BX_SUPPORT_TRACE_CACHE
-  bxInstruction_c mpool[BxICacheMemPool];
-  unsigned mpindex;
+  bxInstruction_c *mpool;
+  // iCache entry which allocated the trace starting at each pool slot
+  bxICacheEntry_c **mpoolOwner;
+  unsigned mpoolSize;    // pool size in instructions
+  unsigned mpoolSegSize; // pool segment size in instructions
+  unsigned mpindex;      // next free pool slot
+  unsigned mpsegEnd;     // end of the pool segment currently filled
+  Bit64u evictions;      // pool segments recycled
 #endif
 
 public:
-  bxICache_c() { flushICacheEntries(); }
+#if BX_SUPPORT_TRACE_CACHE
+  bxICache_c(): mpool(NULL), mpoolOwner(NULL), mpoolSize(0), mpoolSegSize(0),
+      evictions(0) { resetStats(); flushICacheEntries(); }
+ ~bxICache_c() {
+    delete [] mpool;
+    delete [] mpoolOwner;
+  }
+
+  void allocPool(unsigned size);
+  void evictPoolSegment(unsigned start, unsigned end);
+#else
+  bxICache_c() { resetStats(); flushICacheEntries(); }
+#endif
+
+  BX_CPP_INLINE void resetStats(void)
+  {
+    lookups = misses = replacements = 0;
+#if BX_SUPPORT_TRACE_LINKING
+    linkHits = 0;
+#endif
+#if BX_SUPPORT_INSTR_FUSION
+    fusedPairs = fusedSplits = 0;
+#endif
+#if BX_SUPPORT_FLAGS_LIVENESS
+    deadFlags = deadFlagsKept = 0;
+#endif
+#if BX_SUPPORT_HANDLERS_CHAINING
+    chains = chainedInstructions = 0;
+#endif
+  }
+
+  // The page number is scrambled into the set index so that code at the
+  // same page offset in different pages (e.g. user code and kernel code)
+  // does not fight for the same set, while consecutive addresses of one
+  // page still map to consecutive sets. The CPU computes the page part
+  // once per prefetch() and keeps it in iCachePageBias.
+  BX_CPP_INLINE Bit32u pageBias(bx_phy_address pAddrPage) const
+  {
+    return (Bit32u)(pAddrPage) + (((Bit32u)(pAddrPage >> 12) * 0x9E3779B1) >> 16);
+  }
 
   BX_CPP_INLINE unsigned hash(bx_phy_address pAddr, unsigned fetchModeMask) const
   {
-//  return ((pAddr + (pAddr << 2) + (pAddr>>6)) & (BxICacheEntries-1)) ^ fetchModeMask;
-    return ((pAddr) & (BxICacheEntries-1)) ^ fetchModeMask;
+    return ((pageBias(pAddr & ~(bx_phy_address)0xfff) + (Bit32u)(pAddr & 0xfff)) & (BxICacheSets-1)) ^ fetchModeMask;
   }
 
 #if BX_SUPPORT_TRACE_CACHE
   BX_CPP_INLINE void alloc_trace(bxICacheEntry_c *e)
   {
-    if (mpindex + BX_MAX_TRACE_LENGTH > BxICacheMemPool) {
-      flushICacheEntries();
+    if (mpindex + BX_TRACE_POOL_SLOTS > mpsegEnd) {
+      // current segment is full, recycle the oldest one which is next to it
+      mpindex = (mpsegEnd + mpoolSegSize > mpoolSize) ? 0 : mpsegEnd;
+      mpsegEnd = mpindex + mpoolSegSize;
+      evictPoolSegment(mpindex, mpsegEnd);
     }
     e->i = &mpool[mpindex];
     e->tlen = 0;
+    mpoolOwner[mpindex] = e;
   }
 
   BX_CPP_INLINE void commit_trace(unsigned len) { mpindex += len; }
@@ -158,9 +337,43 @@ public:
   BX_CPP_INLINE void purgeICacheEntries(void);
   BX_CPP_INLINE void flushICacheEntries(void);
 
-  BX_CPP_INLINE bxICacheEntry_c* get_entry(bx_phy_address pAddr, unsigned fetchModeMask)
+  // Returns the valid entry for pAddr in the set or NULL on iCache miss
+  BX_CPP_INLINE bxICacheEntry_c* find_entry(unsigned set, bx_phy_address pAddr, Bit32u writeStamp)
+  {
+    bxICacheEntry_c *e = &entry[set * BxICacheWays];
+    for (unsigned way=0; way < BxICacheWays; way++, e++) {
+      if (e->pAddr == pAddr && e->writeStamp == writeStamp) return e;
+    }
+    return NULL;
+  }
+
+  // Returns the entry to be replaced by a new entry for pAddr. A stale copy
+  // of pAddr is reused first, then any way which is no longer valid for its
+  // page, otherwise the ways of the set are replaced in round-robin order.
+  // Hits do not update any replacement state, which keeps find_entry() free
+  // of stores. Entries never move between ways, so trace links keep pointing
+  // at the same entry.
+  BX_CPP_INLINE bxICacheEntry_c* get_victim(bx_phy_address pAddr, unsigned fetchModeMask)
   {
-    return &(entry[hash(pAddr, fetchModeMask)]);
+    unsigned set = hash(pAddr, fetchModeMask);
+    bxICacheEntry_c *e = &entry[set * BxICacheWays];
+    unsigned way;
+    for (way=0; way < BxICacheWays; way++) {
+      if (e[way].pAddr == pAddr) return &e[way];
+    }
+    for (way=0; way < BxICacheWays; way++) {
+      if (e[way].writeStamp == ICacheWriteStampInvalid ||
+          e[way].writeStamp != pageWriteStampTable.getPageWriteStamp(e[way].pAddr))
+        return &e[way];
+    }
+    replacements++;
+#if BxICacheWays > 1
+    way = victim[set];
+    victim[set] = (way + 1) & (BxICacheWays-1);
+#else
+    way = 0;
+#endif
+    return &e[way];
   }
 
 };
@@ -170,9 +383,22 @@ BX_CPP_INLINE void bxICache_c::flushICacheEntries(void)
   bxICacheEntry_c* e = entry;
   for (unsigned i=0; i<BxICacheEntries; i++, e++) {
     e->writeStamp = ICacheWriteStampInvalid;
+#if BX_SUPPORT_TRACE_LINKING
+    // CPU prefetch generations start from 1, generation 0 never matches
+    e->link[BX_TRACE_LINK_NOT_TAKEN].traceLinkGen = 0;
+    e->link[BX_TRACE_LINK_TAKEN].traceLinkGen = 0;
+#endif
+#if BX_SUPPORT_JIT
+    e->jitCode = NULL;
+    e->jitCount = 0;
+#endif
   }
+#if BxICacheWays > 1
+  for (unsigned i=0; i<BxICacheSets; i++) victim[i] = 0;
+#endif
 #if BX_SUPPORT_TRACE_CACHE
   mpindex = 0;
+  mpsegEnd = mpoolSegSize;
 #endif
 }
 
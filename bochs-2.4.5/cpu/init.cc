@@ -27,6 +27,10 @@
 
 #include "param_names.h"
 
+#if BX_SUPPORT_JIT
+#include "dynamic/jit.h"
+#endif
+
 #if BX_SUPPORT_X86_64==0
 // Make life easier merging cpu64 & cpu code.
 #define RIP EIP
@@ -169,6 +173,32 @@ void BX_CPU_C::initialize(void)
   init_VMCS();
 #endif
 
+  TLB_init();
+
+#if BX_SUPPORT_SMP_THREADS
+  BX_CPU_THIS_PTR smp_rmw_locked = 0;
+  BX_CPU_THIS_PTR smp_instr_left = 0;
+  BX_CPU_THIS_PTR smp_serialized = 0;
+#endif
+
+#if BX_SUPPORT_TRACE_CACHE
+  BX_CPU_THIS_PTR iCache.allocPool(SIM->get_param_num(BXPN_TRACE_POOL)->get());
+#endif
+
+#if BX_SUPPORT_TRACE_LINKING
+  // generation 0 is reserved for never recorded trace links
+  BX_CPU_THIS_PTR traceLinkGen = 1;
+#endif
+
+#if BX_SUPPORT_JIT
+  BX_CPU_THIS_PTR jitThreshold = SIM->get_param_num(BXPN_JIT_THRESHOLD)->get();
+  BX_CPU_THIS_PTR jit = (BX_CPU_THIS_PTR jitThreshold > 0) ? new bxJitCompiler : NULL;
+#endif
+
+#if BX_SUPPORT_HANDLERS_CHAINING
+  BX_CPU_THIS_PTR chainFirst = NULL;
+#endif
+
 #if BX_WITH_WX
   register_wx_state();
 #endif
@@ -693,6 +723,12 @@ void BX_CPU_C::after_restore_state(void)
     if (BX_CPU_THIS_PTR cpu_mode == BX_MODE_IA32_V8086) CPL = 3;
   }
 
+  // a null selector is a valid segment in real and v8086 modes
+  if (real_mode() || v8086_mode()) {
+    for (unsigned n=0; n<6; n++)
+      BX_CPU_THIS_PTR sregs[n].cache.valid = 1;
+  }
+
   TLB_flush();
 
 #if BX_CPU_LEVEL >= 4 && BX_SUPPORT_ALIGNMENT_CHECK
@@ -712,6 +748,9 @@ void BX_CPU_C::after_restore_state(void)
 
 BX_CPU_C::~BX_CPU_C()
 {
+#if BX_SUPPORT_JIT
+  delete BX_CPU_THIS_PTR jit;
+#endif
   BX_INSTR_EXIT(BX_CPU_ID);
   BX_DEBUG(("Exit."));
 }
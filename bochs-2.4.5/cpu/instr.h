@@ -36,6 +36,11 @@ typedef bx_address (BX_CPU_C::*BxResolvePtr_tR)(bxInstruction_c *) BX_CPP_AttrRe
 #endif
 // <TAG-TYPE-EXECUTEPTR-END>
 
+struct bxIAOpcodeTable {
+  BxExecutePtr_tR execute1;
+  BxExecutePtr_tR execute2;
+};
+
 // <TAG-CLASS-INSTRUCTION-START>
 class bxInstruction_c {
 public:
@@ -244,6 +249,17 @@ public:
     metaInfo.metaInfo2 = ilen;
   }
 
+#if BX_SUPPORT_INSTR_FUSION
+  // Length of the second instruction of a fused pair, ilen() covers both.
+  // The modrm byte is kept only for the decoder and is free to hold it.
+  BX_CPP_INLINE unsigned fusedILen(void) const {
+    return metaData[BX_INSTR_METADATA_MODRM];
+  }
+  BX_CPP_INLINE void setFusedILen(unsigned ilen) {
+    metaData[BX_INSTR_METADATA_MODRM] = ilen;
+  }
+#endif
+
   BX_CPP_INLINE unsigned getIaOpcode(void) const {
     return metaInfo.ia_opcode;
   }
@@ -82,6 +82,9 @@ Bit32u BX_CPU_C::FastRepINSW(bxInstruction_c *i, bx_address dstOff, Bit16u port,
 
   // If after all the restrictions, there is anything left to do...
   if (wordCount) {
+    // the bulk I/O fields of bx_devices are shared by the processors
+    BX_SMP_SERIALIZE();
+    BX_SMP_LOCK();
     for (count=0; count<wordCount; ) {
       bx_devices.bulkIOQuantumsTransferred = 0;
       if (BX_CPU_THIS_PTR get_DF()==0) { // Only do accel for DF=0
@@ -106,6 +109,7 @@ Bit32u BX_CPU_C::FastRepINSW(bxInstruction_c *i, bx_address dstOff, Bit16u port,
 
     // Reset for next non-bulk IO
     bx_devices.bulkIOQuantumsRequested = 0;
+    BX_SMP_UNLOCK();
 
     return count;
   }
@@ -156,6 +160,9 @@ Bit32u BX_CPU_C::FastRepOUTSW(bxInstruction_c *i, unsigned srcSeg, bx_address sr
 
   // If after all the restrictions, there is anything left to do...
   if (wordCount) {
+    // the bulk I/O fields of bx_devices are shared by the processors
+    BX_SMP_SERIALIZE();
+    BX_SMP_LOCK();
     for (count=0; count<wordCount; ) {
       bx_devices.bulkIOQuantumsTransferred = 0;
       if (BX_CPU_THIS_PTR get_DF()==0) { // Only do accel for DF=0
@@ -181,6 +188,7 @@ Bit32u BX_CPU_C::FastRepOUTSW(bxInstruction_c *i, unsigned srcSeg, bx_address sr
 
     // Reset for next non-bulk IO
     bx_devices.bulkIOQuantumsRequested = 0;
+    BX_SMP_UNLOCK();
 
     return count;
   }
@@ -46,6 +46,9 @@ const Bit8u bx_parity_lookup[256] = {
   1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1
 };
 
+// the host flags are read in cpu.h
+#if BX_HOST_LAZY_FLAGS == 0
+
 #define op1_8     ((Bit8u)(BX_CPU_THIS_PTR oszapc.op1))
 #define op2_8     ((Bit8u)(BX_CPU_THIS_PTR oszapc.op2))
 #define result_8  ((Bit8u)(BX_CPU_THIS_PTR oszapc.result))
@@ -297,3 +300,5 @@ bx_bool BX_CPU_C::get_OFLazy(void)
 
     return(of);
 }
+
+#endif
@@ -83,6 +83,79 @@
   #define BX_LF_SIGN_BIT  31
 #endif
 
+#if BX_HOST_LAZY_FLAGS
+
+// The lazy flags are the flags of the host running the operation once
+// more, as LAHF and SETO leave them in AX: AH holds SF:ZF:0:AF:0:PF:1:CF
+// (the low byte of EFLAGS) and AL holds OF. Reading a flag is a bit test
+// instead of the evaluation in lazy_flags.cc. Only the low 16 bits of the
+// word are meaningful.
+typedef struct {
+  Bit32u flags;
+} bx_lf_flags_entry;
+
+#define BX_LF_HOST_OF_BIT   0
+#define BX_LF_HOST_CF_BIT   8
+#define BX_LF_HOST_PF_BIT  10
+#define BX_LF_HOST_AF_BIT  12
+#define BX_LF_HOST_ZF_BIT  14
+#define BX_LF_HOST_SF_BIT  15
+
+#define BX_LF_HOST_CAPTURE "\n\tlahf\n\tseto %%al"
+
+#define BX_LF_HOST_BINARY(name, insn, type)                             \
+  BX_CPP_INLINE Bit32u name(type op1, type op2) {                      \
+    Bit32u flags;                                                      \
+    __asm__ (insn " %2, %1" BX_LF_HOST_CAPTURE                         \
+      : "=&a" (flags), "+r" (op1) : "r" (op2) : "cc");                 \
+    return flags;                                                      \
+  }
+
+#define BX_LF_HOST_UNARY(name, insn, type)                              \
+  BX_CPP_INLINE Bit32u name(type op1) {                                \
+    Bit32u flags;                                                      \
+    __asm__ (insn " %1" BX_LF_HOST_CAPTURE                             \
+      : "=&a" (flags), "+r" (op1) : : "cc");                           \
+    return flags;                                                      \
+  }
+
+// Host flags of an operation from the operands the handlers pass to the
+// SET_FLAGS_* macros. ADC and SBB are only recorded with a carry in,
+// NEG, INC and DEC only pass the result and LOGIC sets AF to 0. The
+// instruction is a constant in all handlers but ADC and SBB, so the
+// switch is folded away.
+#define BX_LF_HOST_FLAGS(size, sfx)                                     \
+  BX_LF_HOST_BINARY(bx_host_add##size, "add" sfx, Bit##size##u)        \
+  BX_LF_HOST_BINARY(bx_host_adc##size, "stc\n\tadc" sfx, Bit##size##u) \
+  BX_LF_HOST_BINARY(bx_host_sub##size, "sub" sfx, Bit##size##u)        \
+  BX_LF_HOST_BINARY(bx_host_sbb##size, "stc\n\tsbb" sfx, Bit##size##u) \
+  BX_LF_HOST_UNARY(bx_host_neg##size, "neg" sfx, Bit##size##u)         \
+  BX_LF_HOST_UNARY(bx_host_inc##size, "inc" sfx, Bit##size##u)         \
+  BX_LF_HOST_UNARY(bx_host_dec##size, "dec" sfx, Bit##size##u)         \
+  BX_LF_HOST_BINARY(bx_host_test##size, "test" sfx, Bit##size##u)      \
+  BX_CPP_INLINE Bit32u bx_host_flags##size(Bit##size##u op1, Bit##size##u op2, Bit##size##u result, unsigned ins) { \
+    switch(ins) {                                                      \
+      case BX_LF_INSTR_ADD##size: return bx_host_add##size(op1, op2);  \
+      case BX_LF_INSTR_ADC##size: return bx_host_adc##size(op1, op2);  \
+      case BX_LF_INSTR_SUB##size: return bx_host_sub##size(op1, op2);  \
+      case BX_LF_INSTR_SBB##size: return bx_host_sbb##size(op1, op2);  \
+      case BX_LF_INSTR_NEG##size: return bx_host_neg##size(0 - result); \
+      case BX_LF_INSTR_INC##size: return bx_host_inc##size(result - 1); \
+      case BX_LF_INSTR_DEC##size: return bx_host_dec##size(result + 1); \
+      default:                                                         \
+        return bx_host_test##size(result, result) & ~(1 << BX_LF_HOST_AF_BIT); \
+    }                                                                  \
+  }
+
+BX_LF_HOST_FLAGS(8,  "b")
+BX_LF_HOST_FLAGS(16, "w")
+BX_LF_HOST_FLAGS(32, "l")
+#if BX_SUPPORT_X86_64
+BX_LF_HOST_FLAGS(64, "q")
+#endif
+
+#else
+
 typedef struct {
   bx_address op1;
   bx_address op2;
@@ -90,11 +163,20 @@ typedef struct {
   unsigned instr;
 } bx_lf_flags_entry;
 
+#endif
+
 // *******************
 // OSZAPC
 // *******************
 
 /* op1, op2, result */
+#if BX_HOST_LAZY_FLAGS
+#define SET_FLAGS_OSZAPC_SIZE(size, lf_op1, lf_op2, lf_result, ins) { \
+  BX_CPU_THIS_PTR oszapc.flags = bx_host_flags##size( \
+      (Bit##size##u)(lf_op1), (Bit##size##u)(lf_op2), (Bit##size##u)(lf_result), (ins)); \
+  BX_CPU_THIS_PTR lf_flags_status = EFlagsOSZAPCMask; \
+}
+#else
 #define SET_FLAGS_OSZAPC_SIZE(size, lf_op1, lf_op2, lf_result, ins) { \
   BX_CPU_THIS_PTR oszapc.op1    = (bx_address)(Bit##size##s)(lf_op1); \
   BX_CPU_THIS_PTR oszapc.op2    = (bx_address)(Bit##size##s)(lf_op2); \
@@ -102,6 +184,7 @@ typedef struct {
   BX_CPU_THIS_PTR oszapc.instr = (ins); \
   BX_CPU_THIS_PTR lf_flags_status = EFlagsOSZAPCMask; \
 }
+#endif
 
 #define SET_FLAGS_OSZAPC_8(op1, op2, result, ins) \
   SET_FLAGS_OSZAPC_SIZE(8, op1, op2, result, ins)
@@ -114,6 +197,9 @@ typedef struct {
   SET_FLAGS_OSZAPC_SIZE(64, op1, op2, result, ins)
 #endif
 
+// the host flags need both operands
+#if BX_HOST_LAZY_FLAGS == 0
+
 /* op1 and result only */
 #define SET_FLAGS_OSZAPC_S1_SIZE(size, lf_op1, lf_result, ins) { \
   BX_CPU_THIS_PTR oszapc.op1    = (bx_address)(Bit##size##s)(lf_op1); \
@@ -152,12 +238,19 @@ typedef struct {
   SET_FLAGS_OSZAPC_S2_SIZE(64, op2, result, ins)
 #endif
 
+#endif
+
 /* result only */
+#if BX_HOST_LAZY_FLAGS
+#define SET_FLAGS_OSZAPC_RESULT_SIZE(size, lf_result, ins) \
+  SET_FLAGS_OSZAPC_SIZE(size, 0, 0, lf_result, ins)
+#else
 #define SET_FLAGS_OSZAPC_RESULT_SIZE(size, lf_result, ins) { \
   BX_CPU_THIS_PTR oszapc.result = (Bit##size##s)(lf_result); \
   BX_CPU_THIS_PTR oszapc.instr = (ins); \
   BX_CPU_THIS_PTR lf_flags_status = EFlagsOSZAPCMask; \
 }
+#endif
 
 #define SET_FLAGS_OSZAPC_RESULT_8(result, ins) \
   SET_FLAGS_OSZAPC_RESULT_SIZE(8, result, ins)
@@ -175,12 +268,20 @@ typedef struct {
 // *******************
 
 /* result only */
+#if BX_HOST_LAZY_FLAGS
+#define SET_FLAGS_OSZAP_RESULT_SIZE(size, lf_result, ins) { \
+  force_CF(); \
+  BX_CPU_THIS_PTR oszapc.flags = bx_host_flags##size(0, 0, (Bit##size##u)(lf_result), (ins)); \
+  BX_CPU_THIS_PTR lf_flags_status = EFlagsOSZAPMask; \
+}
+#else
 #define SET_FLAGS_OSZAP_RESULT_SIZE(size, lf_result, ins) { \
   force_CF(); \
   BX_CPU_THIS_PTR oszapc.result = (Bit##size##s)(lf_result); \
   BX_CPU_THIS_PTR oszapc.instr = (ins); \
   BX_CPU_THIS_PTR lf_flags_status = EFlagsOSZAPMask; \
 }
+#endif
 
 #define SET_FLAGS_OSZAP_RESULT_8(result, ins) \
   SET_FLAGS_OSZAP_RESULT_SIZE(8, result, ins)
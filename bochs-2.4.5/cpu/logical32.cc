@@ -254,3 +254,76 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::TEST_EdIdR(bxInstruction_c *i)
   op1_32 &= i->Id();
   SET_FLAGS_OSZAPC_LOGIC_32(op1_32);
 }
+
+#if BX_SUPPORT_FLAGS_LIVENESS
+
+// Forms of the instructions whose lazy flags are overwritten by the next
+// instruction of the trace, see markDeadFlags()
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::XOR_GdEdR_NF(bxInstruction_c *i)
+{
+  if (deadFlagsObservable()) {
+    XOR_GdEdR(i);
+    return;
+  }
+
+  Bit32u op1_32 = BX_READ_32BIT_REG(i->nnn()) ^ BX_READ_32BIT_REG(i->rm());
+  BX_WRITE_32BIT_REGZ(i->nnn(), op1_32);
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::XOR_EdIdR_NF(bxInstruction_c *i)
+{
+  if (deadFlagsObservable()) {
+    XOR_EdIdR(i);
+    return;
+  }
+
+  Bit32u op1_32 = BX_READ_32BIT_REG(i->rm()) ^ i->Id();
+  BX_WRITE_32BIT_REGZ(i->rm(), op1_32);
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::OR_GdEdR_NF(bxInstruction_c *i)
+{
+  if (deadFlagsObservable()) {
+    OR_GdEdR(i);
+    return;
+  }
+
+  Bit32u op1_32 = BX_READ_32BIT_REG(i->nnn()) | BX_READ_32BIT_REG(i->rm());
+  BX_WRITE_32BIT_REGZ(i->nnn(), op1_32);
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::OR_EdIdR_NF(bxInstruction_c *i)
+{
+  if (deadFlagsObservable()) {
+    OR_EdIdR(i);
+    return;
+  }
+
+  Bit32u op1_32 = BX_READ_32BIT_REG(i->rm()) | i->Id();
+  BX_WRITE_32BIT_REGZ(i->rm(), op1_32);
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::AND_GdEdR_NF(bxInstruction_c *i)
+{
+  if (deadFlagsObservable()) {
+    AND_GdEdR(i);
+    return;
+  }
+
+  Bit32u op1_32 = BX_READ_32BIT_REG(i->nnn()) & BX_READ_32BIT_REG(i->rm());
+  BX_WRITE_32BIT_REGZ(i->nnn(), op1_32);
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::AND_EdIdR_NF(bxInstruction_c *i)
+{
+  if (deadFlagsObservable()) {
+    AND_EdIdR(i);
+    return;
+  }
+
+  Bit32u op1_32 = BX_READ_32BIT_REG(i->rm()) & i->Id();
+  BX_WRITE_32BIT_REGZ(i->rm(), op1_32);
+}
+
+#endif
@@ -24,6 +24,12 @@
 #include "cpu.h"
 #define LOG_THIS BX_CPU_THIS_PTR
 
+#if BX_SUPPORT_X86_64==0
+// Make life easier merging cpu64 & cpu code.
+#define RIP EIP
+#define RSP ESP
+#endif
+
 // X86 Registers Which Affect Paging:
 // ==================================
 //
@@ -367,6 +373,324 @@ static unsigned tlbNonGlobalFlushes=0;
 
 // ==============================================================
 
+// Remember first level TLB slot which became valid, so the next flush
+// does not have to walk the whole TLB
+#define TLB_LogFill(index) {                                           \
+  if (BX_CPU_THIS_PTR TLB.fillCount < BX_TLB_FILL_LOG_SIZE)            \
+    BX_CPU_THIS_PTR TLB.fillLog[BX_CPU_THIS_PTR TLB.fillCount++] = (index); \
+  else                                                                 \
+    BX_CPU_THIS_PTR TLB.fillCount = BX_TLB_FILL_LOG_SIZE + 1;          \
+}
+
+// Second level TLB entry is valid while the generation of its kind of
+// pages (global or non global) did not change
+#define TLB_L2_Valid(e) ((e)->gen == (((e)->combined_access & 0x100) ? \
+    BX_CPU_THIS_PTR TLB.globalGen : BX_CPU_THIS_PTR TLB.gen))
+
+#if BX_SUPPORT_TLB_ASID
+// Entries of address spaces which are not current are kept as well
+#define TLB_L2_Live(e) (TLB_L2_Valid(e) || \
+    (!((e)->combined_access & 0x100) && TLB_ASID_kept((e)->gen)))
+#else
+#define TLB_L2_Live(e) TLB_L2_Valid(e)
+#endif
+
+void BX_CPU_C::TLB_init(void)
+{
+  for (unsigned n=0; n<BX_TLB_SIZE; n++) {
+    BX_CPU_THIS_PTR TLB.entry[n].lpf = BX_INVALID_TLB_ENTRY;
+  }
+  BX_CPU_THIS_PTR TLB.fillCount = 0;
+#if BX_CPU_LEVEL >= 5
+  BX_CPU_THIS_PTR TLB.split_large = 0;
+#endif
+
+  TLB_L2_reset();
+
+  for (unsigned n=0; n<BX_TLB_L2_SETS; n++) {
+    BX_CPU_THIS_PTR TLB.l2victim[n] = 0;
+  }
+  BX_CPU_THIS_PTR TLB.largeVictim = 0;
+
+  BX_CPU_THIS_PTR TLB.walks = 0;
+  BX_CPU_THIS_PTR TLB.l2hits = 0;
+  BX_CPU_THIS_PTR TLB.flushes = 0;
+#if BX_SUPPORT_TLB_ASID
+  BX_CPU_THIS_PTR TLB.asidClock = 0;
+  BX_CPU_THIS_PTR TLB.asidReuses = 0;
+#endif
+}
+
+// Invalidate all second level TLB entries, called on initialization
+// and when a generation counter wraps around
+void BX_CPU_C::TLB_L2_reset(void)
+{
+  unsigned n;
+
+  for (n=0; n<BX_TLB_L2_SIZE; n++) {
+    BX_CPU_THIS_PTR TLB.l2[n].gen = 0;
+  }
+  for (n=0; n<BX_TLB_LARGE_SIZE; n++) {
+    BX_CPU_THIS_PTR TLB.large[n].gen = 0;
+  }
+
+  BX_CPU_THIS_PTR TLB.gen = 1;
+  BX_CPU_THIS_PTR TLB.globalGen = 1;
+  BX_CPU_THIS_PTR TLB.l2_large = 0;
+#if BX_SUPPORT_TLB_ASID
+  BX_CPU_THIS_PTR TLB.lastGen = 1;
+  TLB_ASID_reset();
+#endif
+}
+
+// Look up the page walk result for the linear address in the second level
+// TLB. Returns 0 when the page tables have to be walked: no valid entry is
+// found, or the access has to set the dirty bit, check execute permission
+// or take a page fault.
+bx_bool BX_CPU_C::TLB_L2_lookup(bx_address laddr, bx_phy_address &ppf, Bit32u &lpf_mask, Bit32u &combined_access, unsigned pl, unsigned rw)
+{
+  bx_address lpf = LPFOf(laddr);
+  bx_TLB_L2_entry *e = &BX_CPU_THIS_PTR TLB.l2[BX_TLB_L2_SET_OF(lpf) * BX_TLB_L2_WAYS];
+  unsigned n;
+
+  for (n=0; n<BX_TLB_L2_WAYS; n++, e++) {
+    if (e->lpf == lpf && TLB_L2_Valid(e)) break;
+  }
+
+  if (n == BX_TLB_L2_WAYS) {
+    if (! BX_CPU_THIS_PTR TLB.l2_large) return 0;
+    e = BX_CPU_THIS_PTR TLB.large;
+    for (n=0; n<BX_TLB_LARGE_SIZE; n++, e++) {
+      if ((lpf & ~((bx_address) e->lpf_mask)) == e->lpf && TLB_L2_Valid(e)) break;
+    }
+    if (n == BX_TLB_LARGE_SIZE) return 0;
+  }
+
+  bx_bool isWrite = rw & 1;
+  if (isWrite && !(e->flags & TLB_L2_Dirty)) return 0;
+  if (rw == BX_EXECUTE && !(e->flags & TLB_L2_Execute)) return 0;
+
+  unsigned priv_index =
+#if BX_CPU_LEVEL >= 4
+    (BX_CPU_THIS_PTR cr0.get_WP() << 4) |   // bit 4
+#endif
+    (pl<<3) |                               // bit 3
+    ((e->combined_access & 0x06) | isWrite); // bit 2,1,0
+
+  if (!priv_check[priv_index]) return 0;
+
+  ppf = e->ppf | (bx_phy_address)(laddr & e->lpf_mask & ~((bx_address) 0xfff));
+  lpf_mask = e->lpf_mask;
+  combined_access = e->combined_access;
+
+  return 1;
+}
+
+// Store result of a successful page walk into the second level TLB
+void BX_CPU_C::TLB_L2_fill(bx_address laddr, bx_phy_address ppf, Bit32u lpf_mask, Bit32u combined_access, unsigned rw)
+{
+  bx_address lpf = laddr & ~((bx_address) lpf_mask);
+  bx_TLB_L2_entry *e;
+  unsigned n;
+
+  if (lpf_mask > 0xfff) {
+    BX_CPU_THIS_PTR TLB.l2_large = 1;
+    e = BX_CPU_THIS_PTR TLB.large;
+    for (n=0; n<BX_TLB_LARGE_SIZE; n++) {
+      if (e[n].lpf == lpf && e[n].lpf_mask == lpf_mask && TLB_L2_Valid(&e[n])) break;
+    }
+    if (n == BX_TLB_LARGE_SIZE) {
+      n = BX_CPU_THIS_PTR TLB.largeVictim;
+      BX_CPU_THIS_PTR TLB.largeVictim = (n + 1) % BX_TLB_LARGE_SIZE;
+    }
+  }
+  else {
+    unsigned set = BX_TLB_L2_SET_OF(lpf);
+    e = &BX_CPU_THIS_PTR TLB.l2[set * BX_TLB_L2_WAYS];
+    // replace the entry of the same page or an invalid one if possible
+    for (n=0; n<BX_TLB_L2_WAYS; n++) {
+      if (e[n].lpf == lpf && TLB_L2_Valid(&e[n])) break;
+    }
+    if (n == BX_TLB_L2_WAYS) {
+      for (n=0; n<BX_TLB_L2_WAYS; n++) {
+        if (! TLB_L2_Live(&e[n])) break;
+      }
+    }
+    if (n == BX_TLB_L2_WAYS) {
+      n = BX_CPU_THIS_PTR TLB.l2victim[set];
+      BX_CPU_THIS_PTR TLB.l2victim[set] = (n + 1) & (BX_TLB_L2_WAYS-1);
+    }
+  }
+
+  e += n;
+  e->lpf = lpf;
+  e->ppf = ppf & ~((bx_phy_address) lpf_mask);
+  e->lpf_mask = lpf_mask;
+  e->combined_access = combined_access;
+  e->gen = (combined_access & 0x100) ? BX_CPU_THIS_PTR TLB.globalGen : BX_CPU_THIS_PTR TLB.gen;
+  e->flags = 0;
+  if (rw & 1)
+    e->flags |= TLB_L2_Dirty;
+  // without PAE the page tables have no execute disable bit, otherwise
+  // only a walk on behalf of instruction fetch checked it
+#if BX_CPU_LEVEL >= 6
+  if (! BX_CPU_THIS_PTR cr4.get_PAE() || rw == BX_EXECUTE)
+#endif
+    e->flags |= TLB_L2_Execute;
+}
+
+void BX_CPU_C::TLB_L2_invlpg(bx_address laddr)
+{
+  bx_address lpf = LPFOf(laddr);
+  bx_TLB_L2_entry *e = &BX_CPU_THIS_PTR TLB.l2[BX_TLB_L2_SET_OF(lpf) * BX_TLB_L2_WAYS];
+  unsigned n;
+
+  for (n=0; n<BX_TLB_L2_WAYS; n++, e++) {
+    if (e->lpf == lpf) e->gen = 0;
+  }
+
+  e = BX_CPU_THIS_PTR TLB.large;
+  for (n=0; n<BX_TLB_LARGE_SIZE; n++, e++) {
+    if ((lpf & ~((bx_address) e->lpf_mask)) == e->lpf) e->gen = 0;
+  }
+}
+
+#if BX_SUPPORT_TLB_ASID
+
+// Remember page table page read by the current page walk
+#define TLB_LogWalk(pt_addr) {                                         \
+  unsigned n = BX_CPU_THIS_PTR TLB.walkPages++;                        \
+  BX_CPU_THIS_PTR TLB.walkPage[n] = (pt_addr);                         \
+  BX_CPU_THIS_PTR TLB.walkStamp[n] = pageWriteStampTable.getPageWriteStamp(pt_addr); \
+}
+
+// Forget all address spaces, the current one is not kept until the
+// next CR3 load
+void BX_CPU_C::TLB_ASID_reset(void)
+{
+  for (unsigned n=0; n<BX_TLB_ASIDS; n++) {
+    BX_CPU_THIS_PTR TLB.asid[n].gen = 0;
+    BX_CPU_THIS_PTR TLB.asid[n].lastUse = 0;
+  }
+  BX_CPU_THIS_PTR TLB.curASID = BX_TLB_ASIDS;
+}
+
+bx_bool BX_CPU_C::TLB_ASID_kept(Bit32u gen)
+{
+  if (gen == 0) return 0;  // invalidated entry or free slot
+
+  for (unsigned n=0; n<BX_TLB_ASIDS; n++) {
+    if (BX_CPU_THIS_PTR TLB.asid[n].gen == gen) return 1;
+  }
+  return 0;
+}
+
+// Remember page table page of the address space. The stamp is the page
+// write stamp seen when the page was read, if it differs from the one
+// remembered the page was written and the address space is not reused.
+void BX_CPU_C::TLB_ASID_track(bx_TLB_ASID *as, bx_phy_address paddr, Bit32u stamp)
+{
+  bx_phy_address page = paddr & ~((bx_phy_address) 0xfff);
+  unsigned n;
+
+  if (as->pages > BX_TLB_ASID_PAGES) return;
+
+  for (n=0; n<as->pages; n++) {
+    if (as->page[n] == page) break;
+  }
+
+  if (n < as->pages) {
+    if (as->stamp[n] != stamp) {
+      as->pages = BX_TLB_ASID_PAGES + 1;
+      return;
+    }
+  }
+  else {
+    if (n == BX_TLB_ASID_PAGES) {
+      as->pages = BX_TLB_ASID_PAGES + 1;
+      return;
+    }
+    as->page[n] = page;
+    as->pages++;
+  }
+
+  // any later write to the page changes its page write stamp
+  pageWriteStampTable.markPageTable(page);
+  as->stamp[n] = pageWriteStampTable.getPageWriteStamp(page);
+}
+
+// Track page table pages read by the page walk just completed. Their
+// stamps are taken again after the walk, so accessed and dirty bits set
+// by the walk itself do not count as a modification.
+void BX_CPU_C::TLB_ASID_walked(void)
+{
+  unsigned cur = BX_CPU_THIS_PTR TLB.curASID;
+  if (cur == BX_TLB_ASIDS) return;
+
+  bx_TLB_ASID *as = &BX_CPU_THIS_PTR TLB.asid[cur];
+  unsigned count = BX_CPU_THIS_PTR TLB.walkPages;
+  for (unsigned n=0; n<count; n++) {
+    bx_phy_address page = BX_CPU_THIS_PTR TLB.walkPage[n] & ~((bx_phy_address) 0xfff);
+    // self-referencing page tables read the same page more than once
+    unsigned i;
+    for (i=0; i<n; i++) {
+      if ((BX_CPU_THIS_PTR TLB.walkPage[i] & ~((bx_phy_address) 0xfff)) == page) break;
+    }
+    if (i == n)
+      TLB_ASID_track(as, page, BX_CPU_THIS_PTR TLB.walkStamp[n]);
+  }
+}
+
+// Called on CR3 load after the first level TLB was flushed. Make the
+// address space of the new CR3 value current: reuse its generation if
+// it is kept and its page tables were not written, otherwise give it a
+// new generation in the least recently used slot.
+void BX_CPU_C::TLB_ASID_switch(void)
+{
+  bx_address cr3 = BX_CPU_THIS_PTR cr3;
+  bx_TLB_ASID *as = BX_CPU_THIS_PTR TLB.asid;
+  unsigned n, i, victim = 0;
+  bx_bool reuse = 0;
+
+  for (n=0; n<BX_TLB_ASIDS; n++) {
+    if (as[n].gen && as[n].cr3 == cr3) break;
+    if (as[n].lastUse < as[victim].lastUse) victim = n;
+  }
+
+  if (n < BX_TLB_ASIDS && as[n].pages <= BX_TLB_ASID_PAGES) {
+    for (i=0; i<as[n].pages; i++) {
+      if (pageWriteStampTable.getPageWriteStamp(as[n].page[i]) != as[n].stamp[i])
+        break;
+    }
+    reuse = (i == as[n].pages);
+  }
+
+  if (reuse) {
+    BX_CPU_THIS_PTR TLB.asidReuses++;
+  }
+  else {
+    if (n == BX_TLB_ASIDS) n = victim;
+    if (++BX_CPU_THIS_PTR TLB.lastGen == 0)
+      TLB_L2_reset();
+    as[n].cr3 = cr3;
+    as[n].gen = BX_CPU_THIS_PTR TLB.lastGen;
+    as[n].pages = 0;
+    // PAE page directory pointers are loaded from memory together with CR3
+    TLB_ASID_track(&as[n], (bx_phy_address) cr3,
+        pageWriteStampTable.getPageWriteStamp((bx_phy_address) cr3));
+  }
+
+  as[n].lastUse = ++BX_CPU_THIS_PTR TLB.asidClock;
+  BX_CPU_THIS_PTR TLB.curASID = n;
+  BX_CPU_THIS_PTR TLB.gen = as[n].gen;
+}
+
+#else
+
+#define TLB_LogWalk(pt_addr)
+
+#endif // BX_SUPPORT_TLB_ASID
+
 void BX_CPU_C::TLB_flush(void)
 {
 #if InstrumentTLB
@@ -375,9 +699,28 @@ void BX_CPU_C::TLB_flush(void)
 
   invalidate_prefetch_q();
 
-  for (unsigned n=0; n<BX_TLB_SIZE; n++) {
-    BX_CPU_THIS_PTR TLB.entry[n].lpf = BX_INVALID_TLB_ENTRY;
+  if (BX_CPU_THIS_PTR TLB.fillCount > BX_TLB_FILL_LOG_SIZE) {
+    for (unsigned n=0; n<BX_TLB_SIZE; n++) {
+      BX_CPU_THIS_PTR TLB.entry[n].lpf = BX_INVALID_TLB_ENTRY;
+    }
+  }
+  else {
+    for (unsigned n=0; n<BX_CPU_THIS_PTR TLB.fillCount; n++) {
+      BX_CPU_THIS_PTR TLB.entry[BX_CPU_THIS_PTR TLB.fillLog[n]].lpf = BX_INVALID_TLB_ENTRY;
+    }
   }
+  BX_CPU_THIS_PTR TLB.fillCount = 0;
+
+  BX_CPU_THIS_PTR TLB.flushes++;
+  BX_CPU_THIS_PTR TLB.l2_large = 0;
+#if BX_SUPPORT_TLB_ASID
+  TLB_ASID_reset();
+  BX_CPU_THIS_PTR TLB.gen = ++BX_CPU_THIS_PTR TLB.lastGen;
+#else
+  BX_CPU_THIS_PTR TLB.gen++;
+#endif
+  if (++BX_CPU_THIS_PTR TLB.globalGen == 0 || BX_CPU_THIS_PTR TLB.gen == 0)
+    TLB_L2_reset();
 
 #if BX_CPU_LEVEL >= 5
   BX_CPU_THIS_PTR TLB.split_large = 0;  // flush whole TLB
@@ -401,17 +744,34 @@ void BX_CPU_C::TLB_flushNonGlobal(void)
 
   BX_CPU_THIS_PTR TLB.split_large = 0;
 
-  for (unsigned n=0; n<BX_TLB_SIZE; n++) {
+  // global translations stay valid and are logged again
+  unsigned count = BX_CPU_THIS_PTR TLB.fillCount;
+  bx_bool walk = (count > BX_TLB_FILL_LOG_SIZE);
+  if (walk) count = BX_TLB_SIZE;
+  BX_CPU_THIS_PTR TLB.fillCount = 0;
+
+  for (unsigned i=0; i<count; i++) {
+    unsigned n = walk ? i : BX_CPU_THIS_PTR TLB.fillLog[i];
     bx_TLB_entry *tlbEntry = &BX_CPU_THIS_PTR TLB.entry[n];
+    if (tlbEntry->lpf == BX_INVALID_TLB_ENTRY) continue;
     if (!(tlbEntry->accessBits & TLB_GlobalPage)) {
       tlbEntry->lpf = BX_INVALID_TLB_ENTRY;
     }
     else {
+      TLB_LogFill(n);
       if (tlbEntry->lpf_mask > 0xfff)
         BX_CPU_THIS_PTR TLB.split_large = 1;
     }
   }
 
+  BX_CPU_THIS_PTR TLB.flushes++;
+#if BX_SUPPORT_TLB_ASID
+  TLB_ASID_switch();
+#else
+  if (++BX_CPU_THIS_PTR TLB.gen == 0)
+    TLB_L2_reset();
+#endif
+
 #if BX_SUPPORT_MONITOR_MWAIT
   // invalidating of the TLB might change translation for monitored page
   // and cause subsequent MWAIT instruction to wait forever
@@ -426,6 +786,8 @@ void BX_CPU_C::TLB_invlpg(bx_address laddr)
 
   BX_DEBUG(("TLB_invlpg(0x"FMT_ADDRX"): invalidate TLB entry", laddr));
 
+  TLB_L2_invlpg(laddr);
+
 #if BX_CPU_LEVEL >= 5
   bx_bool large = 0;
 
@@ -670,6 +1032,7 @@ bx_phy_address BX_CPU_C::translate_linear_long_mode(bx_address laddr, Bit32u &lp
 #endif
     access_read_physical(entry_addr[leaf], 8, &entry[leaf]);
     BX_DBG_PHY_MEMORY_ACCESS(BX_CPU_ID, entry_addr[leaf], 8, (BX_PTE_ACCESS + (leaf<<4)) | BX_READ, (Bit8u*)(&entry[leaf]));
+    TLB_LogWalk(entry_addr[leaf]);
 
     Bit64u curr_entry = entry[leaf];
     int fault = check_entry_PAE(bx_paging_level[leaf], curr_entry, PAGING_PAE_RESERVED_BITS, rw, &nx_fault);
@@ -850,6 +1213,7 @@ bx_phy_address BX_CPU_C::translate_linear_PAE(bx_address laddr, Bit32u &lpf_mask
 #endif
   access_read_physical(entry_addr[BX_LEVEL_PDE], 8, &entry[BX_LEVEL_PDE]);
   BX_DBG_PHY_MEMORY_ACCESS(BX_CPU_ID, entry_addr[BX_LEVEL_PDE], 8, BX_PDE_ACCESS | BX_READ, (Bit8u*)(&entry[BX_LEVEL_PDE]));
+  TLB_LogWalk(entry_addr[BX_LEVEL_PDE]);
 
   fault = check_entry_PAE("PDE", entry[BX_LEVEL_PDE], PAGING_PAE_RESERVED_BITS, rw, &nx_fault);
   if (fault >= 0)
@@ -880,6 +1244,7 @@ bx_phy_address BX_CPU_C::translate_linear_PAE(bx_address laddr, Bit32u &lpf_mask
 #endif
     access_read_physical(entry_addr[BX_LEVEL_PTE], 8, &entry[BX_LEVEL_PTE]);
     BX_DBG_PHY_MEMORY_ACCESS(BX_CPU_ID, entry_addr[BX_LEVEL_PTE], 8, BX_PTE_ACCESS | BX_READ, (Bit8u*)(&entry[BX_LEVEL_PTE]));
+    TLB_LogWalk(entry_addr[BX_LEVEL_PTE]);
 
     fault = check_entry_PAE("PTE", entry[BX_LEVEL_PTE], PAGING_PAE_RESERVED_BITS, rw, &nx_fault);
     if (fault >= 0)
@@ -953,7 +1318,6 @@ bx_phy_address BX_CPU_C::translate_linear(bx_address laddr, unsigned curr_pl, un
 {
   Bit32u combined_access = 0x06;
   Bit32u lpf_mask = 0xfff; // 4K pages
-  unsigned priv_index;
 
   // note - we assume physical memory < 4gig so for brevity & speed, we'll use
   // 32 bit entries although cr3 is expanded to 64 bits.
@@ -985,133 +1349,15 @@ bx_phy_address BX_CPU_C::translate_linear(bx_address laddr, unsigned curr_pl, un
 
   if(BX_CPU_THIS_PTR cr0.get_PG())
   {
-    InstrTLB_Increment(tlbMisses);
-
-    BX_DEBUG(("page walk for address 0x" FMT_LIN_ADDRX, laddr));
-
-#if BX_CPU_LEVEL >= 6
-    if (BX_CPU_THIS_PTR cr4.get_PAE()) {
-      ppf = translate_linear_PAE(laddr, lpf_mask, combined_access, curr_pl, rw);
+    if (TLB_L2_lookup(laddr, ppf, lpf_mask, combined_access, pl, rw)) {
+      BX_CPU_THIS_PTR TLB.l2hits++;
     }
-    else
-#endif 
-    {
-      // CR4.PAE==0 (and EFER.LMA==0)
-      Bit32u pde, pte, cr3_masked = BX_CPU_THIS_PTR cr3 & BX_CR3_PAGING_MASK;
-
-      bx_phy_address pde_addr = (bx_phy_address) (cr3_masked | ((laddr & 0xffc00000) >> 20));
-#if BX_SUPPORT_VMX >= 2
-      if (BX_CPU_THIS_PTR in_vmx_guest) {
-        if (SECONDARY_VMEXEC_CONTROL(VMX_VM_EXEC_CTRL3_EPT_ENABLE))
-          pde_addr = translate_guest_physical(pde_addr, laddr, 1, 1, rw);
-      }
-#endif
-      access_read_physical(pde_addr, 4, &pde);
-      BX_DBG_PHY_MEMORY_ACCESS(BX_CPU_ID, pde_addr, 4, BX_PDE_ACCESS | BX_READ, (Bit8u*)(&pde));
-
-      if (!(pde & 0x1)) {
-        BX_DEBUG(("PDE: entry not present"));
-        page_fault(ERROR_NOT_PRESENT, laddr, pl, rw);
-      }
-
-#if BX_CPU_LEVEL >= 5
-      if ((pde & 0x80) && BX_CPU_THIS_PTR cr4.get_PSE()) {
-        // 4M paging, only if CR4.PSE enabled, ignore PDE.PS otherwise
-        if (pde & PAGING_PDE4M_RESERVED_BITS) {
-          BX_DEBUG(("PSE PDE4M: reserved bit is set: PDE=0x%08x", pde));
-          page_fault(ERROR_RESERVED | ERROR_PROTECTION, laddr, pl, rw);
-        }
-
-        // Combined access is just access from the pde (no pte involved).
-        combined_access = pde & 0x06; // U/S and R/W
-
-        priv_index =
-          (BX_CPU_THIS_PTR cr0.get_WP() << 4) |  // bit 4
-          (pl<<3) |                              // bit 3
-          (combined_access | isWrite);           // bit 2,1,0
-
-        if (!priv_check[priv_index])
-          page_fault(ERROR_PROTECTION, laddr, pl, rw);
-
-#if BX_CPU_LEVEL >= 6
-        if (BX_CPU_THIS_PTR cr4.get_PGE())
-          combined_access |= pde & 0x100;        // G
-#endif
-
-        // Update PDE A/D bits if needed.
-        if (!(pde & 0x20) || (isWrite && !(pde & 0x40))) {
-          pde |= (0x20 | (isWrite<<6)); // Update A and possibly D bits
-          access_write_physical(pde_addr, 4, &pde);
-          BX_DBG_PHY_MEMORY_ACCESS(BX_CPU_ID, pde_addr, 4, BX_PDE_ACCESS | BX_WRITE, (Bit8u*)(&pde));
-        }
-
-        // make up the physical frame number
-        ppf = (pde & 0xffc00000) | (laddr & 0x003ff000);
-#if BX_PHY_ADDRESS_WIDTH > 32
-        ppf |= ((bx_phy_address)(pde & 0x003fe000)) << 19;
-#endif
-        lpf_mask = 0x3fffff;
-      }
-      else // else normal 4K page...
-#endif
-      {
-        // Get page table entry
-        bx_phy_address pte_addr = (bx_phy_address)((pde & 0xfffff000) | ((laddr & 0x003ff000) >> 10));
-#if BX_SUPPORT_VMX >= 2
-        if (BX_CPU_THIS_PTR in_vmx_guest) {
-          if (SECONDARY_VMEXEC_CONTROL(VMX_VM_EXEC_CTRL3_EPT_ENABLE))
-            pte_addr = translate_guest_physical(pte_addr, laddr, 1, 1, rw);
-        }
-#endif
-        access_read_physical(pte_addr, 4, &pte);
-        BX_DBG_PHY_MEMORY_ACCESS(BX_CPU_ID, pte_addr, 4, BX_PTE_ACCESS | BX_READ, (Bit8u*)(&pte));
-
-        if (!(pte & 0x1)) {
-          BX_DEBUG(("PTE: entry not present"));
-          page_fault(ERROR_NOT_PRESENT, laddr, pl, rw);
-        }
-
-        // 386 and 486+ have different behaviour for combining
-        // privilege from PDE and PTE.
-#if BX_CPU_LEVEL == 3
-        combined_access  = (pde | pte) & 0x04; // U/S
-        combined_access |= (pde & pte) & 0x02; // R/W
-#else // 486+
-        combined_access  = (pde & pte) & 0x06; // U/S and R/W
-#endif
-
-        priv_index =
-#if BX_CPU_LEVEL >= 4
-          (BX_CPU_THIS_PTR cr0.get_WP() << 4) |  // bit 4
-#endif
-          (pl<<3) |                              // bit 3
-          (combined_access | isWrite);           // bit 2,1,0
-
-        if (!priv_check[priv_index])
-          page_fault(ERROR_PROTECTION, laddr, pl, rw);
-
-#if BX_CPU_LEVEL >= 6
-        if (BX_CPU_THIS_PTR cr4.get_PGE())
-          combined_access |= (pte & 0x100);      // G
+    else {
+      ppf = translate_linear_walk(laddr, lpf_mask, combined_access, curr_pl, rw);
+#if BX_SUPPORT_TLB_ASID
+      TLB_ASID_walked();
 #endif
-
-        // Update PDE A bit if needed.
-        if (!(pde & 0x20)) {
-          pde |= 0x20;
-          access_write_physical(pde_addr, 4, &pde);
-          BX_DBG_PHY_MEMORY_ACCESS(BX_CPU_ID, pde_addr, 4, BX_PDE_ACCESS | BX_WRITE, (Bit8u*)(&pde));
-        }
-
-        // Update PTE A/D bits if needed.
-        if (!(pte & 0x20) || (isWrite && !(pte & 0x40))) {
-          pte |= (0x20 | (isWrite<<6)); // Update A and possibly D bits
-          access_write_physical(pte_addr, 4, &pte);
-          BX_DBG_PHY_MEMORY_ACCESS(BX_CPU_ID, pte_addr, 4, BX_PTE_ACCESS | BX_WRITE, (Bit8u*)(&pte));
-        }
-
-        // Make up the physical page frame address.
-        ppf = pte & 0xfffff000;
-      }
+      TLB_L2_fill(laddr, ppf, lpf_mask, combined_access, rw);
     }
 
 #if BX_CPU_LEVEL >= 5
@@ -1135,6 +1381,10 @@ bx_phy_address BX_CPU_C::translate_linear(bx_address laddr, unsigned curr_pl, un
   // Calculate physical memory address and fill in TLB cache entry
   paddress = ppf | poffset;
 
+  // a valid slot is already in the fill log
+  if (tlbEntry->lpf == BX_INVALID_TLB_ENTRY)
+    TLB_LogFill(TLB_index);
+
   // direct memory access is NOT allowed by default
   tlbEntry->lpf = lpf | TLB_HostPtr;
   tlbEntry->lpf_mask = lpf_mask;
@@ -1181,6 +1431,152 @@ bx_phy_address BX_CPU_C::translate_linear(bx_address laddr, unsigned curr_pl, un
   return paddress;
 }
 
+// Walk the page tables for a linear address, paging must be enabled
+bx_phy_address BX_CPU_C::translate_linear_walk(bx_address laddr, Bit32u &lpf_mask, Bit32u &combined_access, unsigned curr_pl, unsigned rw)
+{
+  bx_phy_address ppf;
+  unsigned priv_index;
+  bx_bool isWrite = rw & 1; // write or r-m-w
+  unsigned pl = (curr_pl == 3);
+
+  InstrTLB_Increment(tlbMisses);
+  BX_CPU_THIS_PTR TLB.walks++;
+#if BX_SUPPORT_TLB_ASID
+  BX_CPU_THIS_PTR TLB.walkPages = 0;
+#endif
+
+  BX_DEBUG(("page walk for address 0x" FMT_LIN_ADDRX, laddr));
+
+#if BX_CPU_LEVEL >= 6
+  if (BX_CPU_THIS_PTR cr4.get_PAE()) {
+    ppf = translate_linear_PAE(laddr, lpf_mask, combined_access, curr_pl, rw);
+  }
+  else
+#endif 
+  {
+    // CR4.PAE==0 (and EFER.LMA==0)
+    Bit32u pde, pte, cr3_masked = BX_CPU_THIS_PTR cr3 & BX_CR3_PAGING_MASK;
+
+    bx_phy_address pde_addr = (bx_phy_address) (cr3_masked | ((laddr & 0xffc00000) >> 20));
+#if BX_SUPPORT_VMX >= 2
+    if (BX_CPU_THIS_PTR in_vmx_guest) {
+      if (SECONDARY_VMEXEC_CONTROL(VMX_VM_EXEC_CTRL3_EPT_ENABLE))
+        pde_addr = translate_guest_physical(pde_addr, laddr, 1, 1, rw);
+    }
+#endif
+    access_read_physical(pde_addr, 4, &pde);
+    BX_DBG_PHY_MEMORY_ACCESS(BX_CPU_ID, pde_addr, 4, BX_PDE_ACCESS | BX_READ, (Bit8u*)(&pde));
+    TLB_LogWalk(pde_addr);
+
+    if (!(pde & 0x1)) {
+      BX_DEBUG(("PDE: entry not present"));
+      page_fault(ERROR_NOT_PRESENT, laddr, pl, rw);
+    }
+
+#if BX_CPU_LEVEL >= 5
+    if ((pde & 0x80) && BX_CPU_THIS_PTR cr4.get_PSE()) {
+      // 4M paging, only if CR4.PSE enabled, ignore PDE.PS otherwise
+      if (pde & PAGING_PDE4M_RESERVED_BITS) {
+        BX_DEBUG(("PSE PDE4M: reserved bit is set: PDE=0x%08x", pde));
+        page_fault(ERROR_RESERVED | ERROR_PROTECTION, laddr, pl, rw);
+      }
+
+      // Combined access is just access from the pde (no pte involved).
+      combined_access = pde & 0x06; // U/S and R/W
+
+      priv_index =
+        (BX_CPU_THIS_PTR cr0.get_WP() << 4) |  // bit 4
+        (pl<<3) |                              // bit 3
+        (combined_access | isWrite);           // bit 2,1,0
+
+      if (!priv_check[priv_index])
+        page_fault(ERROR_PROTECTION, laddr, pl, rw);
+
+#if BX_CPU_LEVEL >= 6
+      if (BX_CPU_THIS_PTR cr4.get_PGE())
+        combined_access |= pde & 0x100;        // G
+#endif
+
+      // Update PDE A/D bits if needed.
+      if (!(pde & 0x20) || (isWrite && !(pde & 0x40))) {
+        pde |= (0x20 | (isWrite<<6)); // Update A and possibly D bits
+        access_write_physical(pde_addr, 4, &pde);
+        BX_DBG_PHY_MEMORY_ACCESS(BX_CPU_ID, pde_addr, 4, BX_PDE_ACCESS | BX_WRITE, (Bit8u*)(&pde));
+      }
+
+      // make up the physical frame number
+      ppf = (pde & 0xffc00000) | (laddr & 0x003ff000);
+#if BX_PHY_ADDRESS_WIDTH > 32
+      ppf |= ((bx_phy_address)(pde & 0x003fe000)) << 19;
+#endif
+      lpf_mask = 0x3fffff;
+    }
+    else // else normal 4K page...
+#endif
+    {
+      // Get page table entry
+      bx_phy_address pte_addr = (bx_phy_address)((pde & 0xfffff000) | ((laddr & 0x003ff000) >> 10));
+#if BX_SUPPORT_VMX >= 2
+      if (BX_CPU_THIS_PTR in_vmx_guest) {
+        if (SECONDARY_VMEXEC_CONTROL(VMX_VM_EXEC_CTRL3_EPT_ENABLE))
+          pte_addr = translate_guest_physical(pte_addr, laddr, 1, 1, rw);
+      }
+#endif
+      access_read_physical(pte_addr, 4, &pte);
+      BX_DBG_PHY_MEMORY_ACCESS(BX_CPU_ID, pte_addr, 4, BX_PTE_ACCESS | BX_READ, (Bit8u*)(&pte));
+      TLB_LogWalk(pte_addr);
+
+      if (!(pte & 0x1)) {
+        BX_DEBUG(("PTE: entry not present"));
+        page_fault(ERROR_NOT_PRESENT, laddr, pl, rw);
+      }
+
+      // 386 and 486+ have different behaviour for combining
+      // privilege from PDE and PTE.
+#if BX_CPU_LEVEL == 3
+      combined_access  = (pde | pte) & 0x04; // U/S
+      combined_access |= (pde & pte) & 0x02; // R/W
+#else // 486+
+      combined_access  = (pde & pte) & 0x06; // U/S and R/W
+#endif
+
+      priv_index =
+#if BX_CPU_LEVEL >= 4
+        (BX_CPU_THIS_PTR cr0.get_WP() << 4) |  // bit 4
+#endif
+        (pl<<3) |                              // bit 3
+        (combined_access | isWrite);           // bit 2,1,0
+
+      if (!priv_check[priv_index])
+        page_fault(ERROR_PROTECTION, laddr, pl, rw);
+
+#if BX_CPU_LEVEL >= 6
+      if (BX_CPU_THIS_PTR cr4.get_PGE())
+        combined_access |= (pte & 0x100);      // G
+#endif
+
+      // Update PDE A bit if needed.
+      if (!(pde & 0x20)) {
+        pde |= 0x20;
+        access_write_physical(pde_addr, 4, &pde);
+        BX_DBG_PHY_MEMORY_ACCESS(BX_CPU_ID, pde_addr, 4, BX_PDE_ACCESS | BX_WRITE, (Bit8u*)(&pde));
+      }
+
+      // Update PTE A/D bits if needed.
+      if (!(pte & 0x20) || (isWrite && !(pte & 0x40))) {
+        pte |= (0x20 | (isWrite<<6)); // Update A and possibly D bits
+        access_write_physical(pte_addr, 4, &pte);
+        BX_DBG_PHY_MEMORY_ACCESS(BX_CPU_ID, pte_addr, 4, BX_PTE_ACCESS | BX_WRITE, (Bit8u*)(&pte));
+      }
+
+      // Make up the physical page frame address.
+      ppf = pte & 0xfffff000;
+    }
+  }
+
+  return ppf;
+}
+
 #if BX_SUPPORT_VMX >= 2
 
 /* EPT access type */
@@ -1571,6 +1967,33 @@ void BX_CPU_C::access_read_linear(bx_address laddr, unsigned len, unsigned curr_
     BX_CPU_THIS_PTR address_xlation.paddress1 =
         dtranslate_linear(laddr, curr_pl, xlate_rw);
     BX_CPU_THIS_PTR address_xlation.pages     = 1;
+#if BX_SUPPORT_SMP_THREADS
+    if (xlate_rw == BX_RW && bx_smp_threads) {
+      // use a host pointer for the write back if possible so that it can
+      // be done atomically, see write_RMW_host_smp()
+      Bit8u *hostAddr = (Bit8u*) getHostMemAddr(
+          LPFOf(BX_CPU_THIS_PTR address_xlation.paddress1), BX_WRITE);
+      if (hostAddr) {
+        hostAddr += pageOffset;
+        access_read_physical(BX_CPU_THIS_PTR address_xlation.paddress1, len, data);
+        pageWriteStampTable.decWriteStamp(BX_CPU_THIS_PTR address_xlation.paddress1);
+        BX_CPU_THIS_PTR address_xlation.pages = (bx_ptr_equiv_t) hostAddr;
+        switch (len) {
+          case 1: BX_SMP_RMW_DATA(*(Bit8u*) data); break;
+          case 2: BX_SMP_RMW_DATA(*(Bit16u*) data); break;
+          case 4: BX_SMP_RMW_DATA(*(Bit32u*) data); break;
+          case 8: BX_SMP_RMW_DATA(*(Bit64u*) data); break;
+        }
+      }
+      else if (! BX_CPU_THIS_PTR smp_rmw_locked) {
+        // devices or the local APIC, hold the big lock till the write back
+        BX_SMP_LOCK();
+        BX_CPU_THIS_PTR smp_rmw_locked = 1;
+        BX_CPU_THIS_PTR async_event = 1;
+      }
+    }
+    if (BX_CPU_THIS_PTR address_xlation.pages == 1)
+#endif
     access_read_physical(BX_CPU_THIS_PTR address_xlation.paddress1, len, data);
     BX_INSTR_LIN_ACCESS(BX_CPU_ID, laddr,
         BX_CPU_THIS_PTR address_xlation.paddress1, len, xlate_rw);
@@ -1590,6 +2013,17 @@ void BX_CPU_C::access_read_linear(bx_address laddr, unsigned len, unsigned curr_
     BX_CPU_THIS_PTR address_xlation.paddress2 =
         dtranslate_linear(laddr2, curr_pl, xlate_rw);
 
+#if BX_SUPPORT_SMP_THREADS
+    if (xlate_rw == BX_RW && bx_smp_threads && ! BX_CPU_THIS_PTR smp_rmw_locked) {
+      // no single host pointer covers both pages, hold the big lock till
+      // the write back (the other processors take it for their split
+      // R-M-W accesses as well)
+      BX_SMP_LOCK();
+      BX_CPU_THIS_PTR smp_rmw_locked = 1;
+      BX_CPU_THIS_PTR async_event = 1;
+    }
+#endif
+
 #ifdef BX_LITTLE_ENDIAN
     access_read_physical(BX_CPU_THIS_PTR address_xlation.paddress1,
         BX_CPU_THIS_PTR address_xlation.len1, data);
@@ -1641,7 +2075,13 @@ void BX_CPU_C::access_write_physical(bx_phy_address paddr, unsigned len, void *d
 
 #if BX_SUPPORT_APIC
   if (BX_CPU_THIS_PTR lapic.is_selected(paddr)) {
+#if BX_SUPPORT_HANDLERS_CHAINING
+    syncChainTicks(); // the APIC timer registers depend on the current time
+#endif
+    BX_SMP_SERIALIZE();
+    BX_SMP_LOCK();
     BX_CPU_THIS_PTR lapic.write(paddr, data, len);
+    BX_SMP_UNLOCK();
     return;
   }
 #endif
@@ -1660,7 +2100,13 @@ void BX_CPU_C::access_read_physical(bx_phy_address paddr, unsigned len, void *da
 
 #if BX_SUPPORT_APIC
   if (BX_CPU_THIS_PTR lapic.is_selected(paddr)) {
+#if BX_SUPPORT_HANDLERS_CHAINING
+    syncChainTicks(); // the APIC timer registers depend on the current time
+#endif
+    BX_SMP_SERIALIZE();
+    BX_SMP_LOCK();
     BX_CPU_THIS_PTR lapic.read(paddr, data, len);
+    BX_SMP_UNLOCK();
     return;
   }
 #endif
@@ -1668,6 +2114,70 @@ void BX_CPU_C::access_read_physical(bx_phy_address paddr, unsigned len, void *da
   BX_MEM(0)->readPhysicalPage(BX_CPU_THIS, paddr, len, data);
 }
 
+#if BX_SUPPORT_SMP_THREADS
+// Write back the result of a R-M-W instruction through the host pointer
+// found by its read.  The other processor threads access the guest memory
+// directly as well, so the write only succeeds when the location still
+// holds the value read; otherwise the instruction is restarted, the same
+// way a locked bus cycle would have kept the other processor waiting.
+// Note that INS uses a R-M-W access to probe its destination, when the
+// guest races on the buffer the port read may be repeated.
+void BX_CPU_C::write_RMW_host_smp(void *hostAddr, unsigned len, Bit64u val)
+{
+  Bit64u data = BX_CPU_THIS_PTR address_xlation.rmw_data;
+  bx_bool done = 0;
+
+  switch (len) {
+    case 1:
+      done = __sync_bool_compare_and_swap((Bit8u*) hostAddr, (Bit8u) data, (Bit8u) val);
+      break;
+    case 2: {
+      Bit16u old16, new16;
+      WriteHostWordToLittleEndian(&old16, (Bit16u) data);
+      WriteHostWordToLittleEndian(&new16, (Bit16u) val);
+      done = __sync_bool_compare_and_swap((Bit16u*) hostAddr, old16, new16);
+      break;
+    }
+    case 4: {
+      Bit32u old32, new32;
+      WriteHostDWordToLittleEndian(&old32, (Bit32u) data);
+      WriteHostDWordToLittleEndian(&new32, (Bit32u) val);
+      done = __sync_bool_compare_and_swap((Bit32u*) hostAddr, old32, new32);
+      break;
+    }
+    case 8: {
+      Bit64u old64, new64;
+      WriteHostQWordToLittleEndian(&old64, data);
+      WriteHostQWordToLittleEndian(&new64, val);
+      done = __sync_bool_compare_and_swap((Bit64u*) hostAddr, old64, new64);
+      break;
+    }
+  }
+
+  if (! done) {
+    RIP = BX_CPU_THIS_PTR prev_rip;
+    if (BX_CPU_THIS_PTR speculative_rsp)
+      RSP = BX_CPU_THIS_PTR prev_rsp;
+    longjmp(BX_CPU_THIS_PTR jmp_buf_env, 1); // go back to main decode loop
+  }
+}
+
+// Leave the cpu loop in the parallel phase of a lock-step epoch, before the
+// current instruction made an access which has to wait for the serial
+// phase.  The instruction is restarted there the same way as after a fault.
+void BX_CPU_C::smp_serialize(void)
+{
+  // might be called from prefetch() before the fetch window was complete
+  invalidate_prefetch_q();
+
+  RIP = BX_CPU_THIS_PTR prev_rip;
+  if (BX_CPU_THIS_PTR speculative_rsp)
+    RSP = BX_CPU_THIS_PTR prev_rsp;
+  BX_CPU_THIS_PTR smp_serialized = 1;
+  longjmp(BX_CPU_THIS_PTR jmp_buf_env, 1); // go back to main decode loop
+}
+#endif
+
 bx_hostpageaddr_t BX_CPU_C::getHostMemAddr(bx_phy_address ppf, unsigned rw)
 {
 #if BX_SUPPORT_VMX >= 2
@@ -1680,5 +2190,8 @@ bx_hostpageaddr_t BX_CPU_C::getHostMemAddr(bx_phy_address ppf, unsigned rw)
     return 0; // Vetoed!  APIC address space
 #endif
 
+  // lock-step SMP: the page has to be owned or shared for the access
+  BX_SMP_ACCESS(BX_CPU_ID, ppf, rw);
+
   return (bx_hostpageaddr_t) BX_MEM(0)->getHostMemAddr(BX_CPU_THIS, ppf, rw);
 }
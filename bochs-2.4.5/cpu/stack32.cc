@@ -55,6 +55,17 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::POP_ERX(bxInstruction_c *i)
   BX_WRITE_32BIT_REGZ(i->opcodeReg(), pop_32());
 }
 
+#if BX_SUPPORT_INSTR_FUSION
+// Fused PUSH EBP + MOV EBP, ESP
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::PUSH_EBP_MOV_EBP_ESP(bxInstruction_c *i)
+{
+  push_32(EBP);
+
+  if (commitFusedFirst(i))
+    BX_WRITE_32BIT_REGZ(BX_32BIT_REG_EBP, ESP);
+}
+#endif
+
 void BX_CPP_AttrRegparmN(1) BX_CPU_C::PUSH32_CS(bxInstruction_c *i)
 {
   push_32(BX_CPU_THIS_PTR sregs[BX_SEG_REG_CS].selector.value);
@@ -125,6 +125,9 @@ void BX_CPU_C::task_switch(bxInstruction_c *i, bx_selector_t *tss_selector,
 
   BX_DEBUG(("TASKING: ENTER"));
 
+  // the old task state is saved before the new one is checked
+  BX_SMP_SERIALIZE();
+
   invalidate_prefetch_q();
 
   // Discard any traps and inhibits for new context; traps will
@@ -0,0 +1,713 @@
+/////////////////////////////////////////////////////////////////////////
+// $Id$
+/////////////////////////////////////////////////////////////////////////
+//
+//  Copyright (C) 2010  The Bochs Project
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA B 02110-1301 USA
+//
+/////////////////////////////////////////////////////////////////////////
+
+#define NEED_CPU_REG_SHORTCUTS 1
+#include "bochs.h"
+#include "cpu/cpu.h"
+#define LOG_THIS BX_CPU_THIS_PTR
+
+#if BX_SUPPORT_JIT
+
+#include "jit.h"
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+// Host registers. While a translated trace runs RBX points to the CPU,
+// R12 to the countdown of the system timer and R13D caches the countdown
+// value. All three are callee saved, the countdown is written back before
+// any call out of the translated code and reloaded after it.
+enum {
+  HOST_RAX, HOST_RCX, HOST_RDX, HOST_RBX, HOST_RSP, HOST_RBP, HOST_RSI, HOST_RDI,
+  HOST_R8,  HOST_R9,  HOST_R10, HOST_R11, HOST_R12, HOST_R13, HOST_R14, HOST_R15
+};
+
+#define JIT_CPU           HOST_RBX
+#define JIT_COUNTDOWN_PTR HOST_R12
+#define JIT_COUNTDOWN     HOST_R13
+
+// condition codes of the host Jcc
+#define JIT_CC_AE 0x3
+#define JIT_CC_Z  0x4
+#define JIT_CC_NZ 0x5
+
+// opcode extensions of the host immediate group instructions
+#define JIT_ALU_ADD 0
+#define JIT_ALU_OR  1
+#define JIT_ALU_AND 4
+#define JIT_ALU_SUB 5
+#define JIT_ALU_CMP 7
+#define JIT_SHIFT_SHL 4
+#define JIT_SHIFT_SHR 5
+
+#define JIT_ADDRESS_W (sizeof(bx_address) == 8)
+
+#define JIT_FUNC(f) ((Bit64u)(bx_ptr_equiv_t)(f))
+
+static BX_CPP_INLINE Bit32s cpuOffset(const volatile void *field)
+{
+  return (Bit32s) ((const volatile Bit8u *) field - (const Bit8u *) BX_CPU_THIS);
+}
+
+#define CPU_OFFSET(field) cpuOffset(&(BX_CPU_THIS_PTR field))
+#define REG_OFFSET(reg)   CPU_OFFSET(gen_reg[reg])
+#define RIP_OFFSET        REG_OFFSET(BX_64BIT_REG_RIP)
+
+// Register and immediate forms of the 32-bit arithmetic and logical
+// instructions which are translated inline
+enum { JIT_FORM_GdEd, JIT_FORM_EdId, JIT_FORM_EAXId };
+
+struct bxJitAluOp {
+  BxExecutePtr_tR execute;
+  unsigned form;
+  Bit8u op;           // host "op r/m32, r32" opcode computing the result
+  unsigned instr;     // lazy flags instruction
+  bx_bool writeback;  // result written to the destination register
+};
+
+static const bxJitAluOp jitAluOps[] = {
+  { &BX_CPU_C::ADD_GdEdR,  JIT_FORM_GdEd,  0x01, BX_LF_INSTR_ADD32,   1 },
+  { &BX_CPU_C::OR_GdEdR,   JIT_FORM_GdEd,  0x09, BX_LF_INSTR_LOGIC32, 1 },
+  { &BX_CPU_C::AND_GdEdR,  JIT_FORM_GdEd,  0x21, BX_LF_INSTR_LOGIC32, 1 },
+  { &BX_CPU_C::SUB_GdEdR,  JIT_FORM_GdEd,  0x29, BX_LF_INSTR_SUB32,   1 },
+  { &BX_CPU_C::XOR_GdEdR,  JIT_FORM_GdEd,  0x31, BX_LF_INSTR_LOGIC32, 1 },
+  { &BX_CPU_C::CMP_GdEdR,  JIT_FORM_GdEd,  0x29, BX_LF_INSTR_SUB32,   0 },
+  { &BX_CPU_C::TEST_EdGdR, JIT_FORM_GdEd,  0x21, BX_LF_INSTR_LOGIC32, 0 },
+  { &BX_CPU_C::ADD_EdIdR,  JIT_FORM_EdId,  0x01, BX_LF_INSTR_ADD32,   1 },
+  { &BX_CPU_C::OR_EdIdR,   JIT_FORM_EdId,  0x09, BX_LF_INSTR_LOGIC32, 1 },
+  { &BX_CPU_C::AND_EdIdR,  JIT_FORM_EdId,  0x21, BX_LF_INSTR_LOGIC32, 1 },
+  { &BX_CPU_C::SUB_EdIdR,  JIT_FORM_EdId,  0x29, BX_LF_INSTR_SUB32,   1 },
+  { &BX_CPU_C::XOR_EdIdR,  JIT_FORM_EdId,  0x31, BX_LF_INSTR_LOGIC32, 1 },
+  { &BX_CPU_C::CMP_EdIdR,  JIT_FORM_EdId,  0x29, BX_LF_INSTR_SUB32,   0 },
+  { &BX_CPU_C::TEST_EdIdR, JIT_FORM_EdId,  0x21, BX_LF_INSTR_LOGIC32, 0 },
+  { &BX_CPU_C::ADD_EAXId,  JIT_FORM_EAXId, 0x01, BX_LF_INSTR_ADD32,   1 },
+  { &BX_CPU_C::OR_EAXId,   JIT_FORM_EAXId, 0x09, BX_LF_INSTR_LOGIC32, 1 },
+  { &BX_CPU_C::AND_EAXId,  JIT_FORM_EAXId, 0x21, BX_LF_INSTR_LOGIC32, 1 },
+  { &BX_CPU_C::SUB_EAXId,  JIT_FORM_EAXId, 0x29, BX_LF_INSTR_SUB32,   1 },
+  { &BX_CPU_C::XOR_EAXId,  JIT_FORM_EAXId, 0x31, BX_LF_INSTR_LOGIC32, 1 },
+  { &BX_CPU_C::CMP_EAXId,  JIT_FORM_EAXId, 0x29, BX_LF_INSTR_SUB32,   0 },
+  { &BX_CPU_C::TEST_EAXId, JIT_FORM_EAXId, 0x21, BX_LF_INSTR_LOGIC32, 0 },
+#if BX_SUPPORT_FLAGS_LIVENESS
+  // translated with their lazy flags, which the inline code stores cheaply
+  { &BX_CPU_C::ADD_GdEdR_NF, JIT_FORM_GdEd, 0x01, BX_LF_INSTR_ADD32,   1 },
+  { &BX_CPU_C::OR_GdEdR_NF,  JIT_FORM_GdEd, 0x09, BX_LF_INSTR_LOGIC32, 1 },
+  { &BX_CPU_C::AND_GdEdR_NF, JIT_FORM_GdEd, 0x21, BX_LF_INSTR_LOGIC32, 1 },
+  { &BX_CPU_C::SUB_GdEdR_NF, JIT_FORM_GdEd, 0x29, BX_LF_INSTR_SUB32,   1 },
+  { &BX_CPU_C::XOR_GdEdR_NF, JIT_FORM_GdEd, 0x31, BX_LF_INSTR_LOGIC32, 1 },
+  { &BX_CPU_C::ADD_EdIdR_NF, JIT_FORM_EdId, 0x01, BX_LF_INSTR_ADD32,   1 },
+  { &BX_CPU_C::OR_EdIdR_NF,  JIT_FORM_EdId, 0x09, BX_LF_INSTR_LOGIC32, 1 },
+  { &BX_CPU_C::AND_EdIdR_NF, JIT_FORM_EdId, 0x21, BX_LF_INSTR_LOGIC32, 1 },
+  { &BX_CPU_C::SUB_EdIdR_NF, JIT_FORM_EdId, 0x29, BX_LF_INSTR_SUB32,   1 },
+  { &BX_CPU_C::XOR_EdIdR_NF, JIT_FORM_EdId, 0x31, BX_LF_INSTR_LOGIC32, 1 },
+#endif
+};
+
+static const bxJitAluOp *findAluOp(BxExecutePtr_tR execute)
+{
+  for (unsigned n=0; n < sizeof(jitAluOps) / sizeof(jitAluOps[0]); n++) {
+    if (jitAluOps[n].execute == execute) return &jitAluOps[n];
+  }
+  return NULL;
+}
+
+bxJitCompiler::bxJitCompiler(): traces(0), inlined(0), called(0), flushes(0)
+{
+  buffer = (Bit8u *) mmap(NULL, BX_JIT_CODE_BUFFER, PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buffer == (Bit8u *) MAP_FAILED) {
+    BX_ERROR(("JIT: could not allocate the code buffer, all traces are interpreted"));
+    buffer = NULL;
+  }
+  bufferPtr = buffer;
+}
+
+bxJitCompiler::~bxJitCompiler()
+{
+  if (buffer) munmap(buffer, BX_JIT_CODE_BUFFER);
+}
+
+void bxJitCompiler::flush(void)
+{
+  bxICacheEntry_c *e = BX_CPU_THIS_PTR iCache.entry;
+  for (unsigned n=0; n < BxICacheEntries; n++, e++) {
+    e->jitCode = NULL;
+    e->jitCount = 0;
+  }
+  bufferPtr = buffer;
+  flushes++;
+}
+
+void bxJitCompiler::countdownEvent(void)
+{
+  bx_pc_system.countdownEvent();
+}
+
+void bxJitCompiler::forceCF(void)
+{
+  BX_CPU_THIS_PTR force_CF();
+}
+
+bxJitCode_t bxJitCompiler::compile(bxICacheEntry_c *entry)
+{
+  if (! buffer) return NULL;
+
+#if BX_SUPPORT_X86_64
+  // only the decoding of 32-bit code is known to the translator
+  if (BX_CPU_THIS_PTR cpu_mode == BX_MODE_LONG_64) return NULL;
+#endif
+
+  if (bufferPtr + BX_JIT_MAX_TRACE_CODE > buffer + BX_JIT_CODE_BUFFER)
+    flush();
+
+  code = bufferPtr;
+  pendingRip = 0;
+  nstubs = nexits = 0;
+
+  emitPrologue();
+
+  bxInstruction_c *i = entry->i;
+  for (unsigned n=0; n < entry->tlen; n++, i++) {
+    if (inlineInstruction(i))
+      inlined++;
+    else
+      callInstruction(i);
+  }
+
+  // the trace ran to its end, commit the instruction pointer
+  if (pendingRip)
+    emitStoreRip(pendingRip, pendingRip);
+
+  Bit8u *exit = code;
+  emitEpilogue();
+
+  for (unsigned n=0; n < nstubs; n++)
+    emitStub(&stubs[n]);
+  for (unsigned n=0; n < nexits; n++)
+    patch(exits[n], exit);
+
+  BX_ASSERT(code <= bufferPtr + BX_JIT_MAX_TRACE_CODE);
+
+  bxJitCode_t jitCode = (bxJitCode_t) bufferPtr;
+  bufferPtr = (Bit8u *) (((bx_ptr_equiv_t) code + 15) & ~(bx_ptr_equiv_t) 15);
+  traces++;
+
+  return jitCode;
+}
+
+bx_bool bxJitCompiler::inlineInstruction(bxInstruction_c *i)
+{
+  BxExecutePtr_tR execute = i->execute;
+  unsigned ripBefore = pendingRip, ripAfter = pendingRip + i->ilen();
+  bx_bool memory = 0;
+
+  const bxJitAluOp *alu = findAluOp(execute);
+  if (alu) {
+    switch(alu->form) {
+      case JIT_FORM_GdEd:
+        emitLoadReg(HOST_RAX, i->nnn());
+        emitLoadReg(HOST_RCX, i->rm());
+        emitAlu(alu->op, alu->instr, alu->writeback ? (int) i->nnn() : -1);
+        break;
+      case JIT_FORM_EdId:
+        emitLoadReg(HOST_RAX, i->rm());
+        movImm32(HOST_RCX, i->Id());
+        emitAlu(alu->op, alu->instr, alu->writeback ? (int) i->rm() : -1);
+        break;
+      case JIT_FORM_EAXId:
+        emitLoadReg(HOST_RAX, 0);
+        movImm32(HOST_RCX, i->Id());
+        emitAlu(alu->op, alu->instr, alu->writeback ? 0 : -1);
+        break;
+    }
+  }
+  else if (execute == &BX_CPU_C::INC_ERX || execute == &BX_CPU_C::DEC_ERX) {
+    // force_CF() before the result is computed, it only uses the
+    // lazy flags state of the previous instruction
+    opMem(0xF7, 0, 0, JIT_CPU, CPU_OFFSET(lf_flags_status));
+    dword(EFlagsCFMask);
+    Bit8u *skip = jcc(JIT_CC_Z);
+    callAbs(JIT_FUNC(forceCF));
+    patch(skip, code);
+
+    bx_bool inc = (execute == &BX_CPU_C::INC_ERX);
+    emitLoadReg(HOST_RAX, i->opcodeReg());
+    opReg(0xFF, 0, inc ? 0 : 1, HOST_RAX);
+    emitStoreReg(i->opcodeReg(), HOST_RAX);
+#if BX_HOST_LAZY_FLAGS
+    emitStoreHostFlags(0);
+#else
+    emitStoreLazy(CPU_OFFSET(oszapc.result), HOST_RAX);
+    opMem(0xC7, 0, 0, JIT_CPU, CPU_OFFSET(oszapc.instr));
+    dword(inc ? BX_LF_INSTR_INC32 : BX_LF_INSTR_DEC32);
+#endif
+    opMem(0xC7, 0, 0, JIT_CPU, CPU_OFFSET(lf_flags_status));
+    dword(EFlagsOSZAPMask);
+  }
+  else if (execute == &BX_CPU_C::MOV_GdEdR) {
+    emitLoadReg(HOST_RAX, i->rm());
+    emitStoreReg(i->nnn(), HOST_RAX);
+  }
+  else if (execute == &BX_CPU_C::MOV_ERXId) {
+    movImm32(HOST_RAX, i->Id());
+    emitStoreReg(i->opcodeReg(), HOST_RAX);
+  }
+  else {
+    // memory forms, only 32-bit effective addresses are translated
+    if (i->ResolveModrm != &BX_CPU_C::BxResolve32Base &&
+        i->ResolveModrm != &BX_CPU_C::BxResolve32BaseIndex) return 0;
+
+    if (execute == &BX_CPU_C::LEA_GdM) {
+      emitResolve(i);
+      emitStoreReg(i->nnn(), HOST_RSI);
+    }
+    else if (execute == &BX_CPU_C::MOV32_GdEdM) {
+      emitResolve(i);
+      emitAccess(i, ripBefore, 0);
+      emitStoreReg(i->nnn(), HOST_RAX);
+      memory = 1;
+    }
+    else if (execute == &BX_CPU_C::MOV32_EdGdM) {
+      emitResolve(i);
+      emitLoadReg(HOST_R9, i->nnn());
+      emitAccess(i, ripBefore, 1);
+      memory = 1;
+    }
+    else if (execute == &BX_CPU_C::CMP_EdGdM || execute == &BX_CPU_C::CMP_EdIdM) {
+      emitResolve(i);
+      emitAccess(i, ripBefore, 0);
+      if (execute == &BX_CPU_C::CMP_EdGdM)
+        emitLoadReg(HOST_RCX, i->nnn());
+      else
+        movImm32(HOST_RCX, i->Id());
+      emitAlu(0x29, BX_LF_INSTR_SUB32, -1);
+      memory = 1;
+    }
+    else if (execute == &BX_CPU_C::LOAD_Ed) {
+      // the loaded dword is the source operand of the register form
+      alu = findAluOp(i->execute2);
+      if (! alu || alu->form != JIT_FORM_GdEd || i->rm() != BX_TMP_REGISTER)
+        return 0;
+      emitResolve(i);
+      emitAccess(i, ripBefore, 0);
+      opMem(0x89, 0, HOST_RAX, JIT_CPU, REG_OFFSET(BX_TMP_REGISTER));
+      opReg(0x89, 0, HOST_RAX, HOST_RCX);
+      emitLoadReg(HOST_RAX, i->nnn());
+      emitAlu(alu->op, alu->instr, alu->writeback ? (int) i->nnn() : -1);
+      memory = 1;
+    }
+    else return 0;
+  }
+
+  pendingRip = ripAfter;
+  emitTick();
+  // device accesses done by the slow path could raise an event
+  if (memory)
+    emitAsyncCheck();
+
+  return 1;
+}
+
+// Same sequence as the trace loop of cpu_loop() runs for every instruction
+void bxJitCompiler::callInstruction(bxInstruction_c *i)
+{
+  emitStoreRip(pendingRip, pendingRip + i->ilen());
+  pendingRip = 0;
+
+  opMem(0x89, 0, JIT_COUNTDOWN, JIT_COUNTDOWN_PTR, 0);
+  movImm64(HOST_RDI, (bx_ptr_equiv_t) i);
+  opMem(0xFF, 0, 2, HOST_RDI, (Bit32s) ((Bit8u *) &i->execute - (Bit8u *) i));
+
+  // prev_rip = RIP
+  opMem(0x8B, JIT_ADDRESS_W, HOST_RAX, JIT_CPU, RIP_OFFSET);
+  opMem(0x89, JIT_ADDRESS_W, HOST_RAX, JIT_CPU, CPU_OFFSET(prev_rip));
+
+  // tick1()
+  opMem(0xFF, 0, 1, JIT_COUNTDOWN_PTR, 0);
+  Bit8u *skip = jcc(JIT_CC_NZ);
+  callAbs(JIT_FUNC(countdownEvent));
+  patch(skip, code);
+  opMem(0x8B, 0, JIT_COUNTDOWN, JIT_COUNTDOWN_PTR, 0);
+
+  aluMemImm(JIT_ALU_CMP, 0, JIT_CPU, CPU_OFFSET(async_event), 0);
+  exits[nexits++] = jcc(JIT_CC_NZ);
+
+  called++;
+}
+
+void bxJitCompiler::emitPrologue(void)
+{
+  byte(0x53);                 // push rbx
+  byte(0x41); byte(0x54);     // push r12
+  byte(0x41); byte(0x55);     // push r13
+  movImm64(JIT_CPU, (bx_ptr_equiv_t) BX_CPU_THIS);
+  movImm64(JIT_COUNTDOWN_PTR, (bx_ptr_equiv_t) &bx_pc_system.currCountdown);
+  opMem(0x8B, 0, JIT_COUNTDOWN, JIT_COUNTDOWN_PTR, 0);
+}
+
+void bxJitCompiler::emitEpilogue(void)
+{
+  opMem(0x89, 0, JIT_COUNTDOWN, JIT_COUNTDOWN_PTR, 0);
+  byte(0x41); byte(0x5D);     // pop r13
+  byte(0x41); byte(0x5C);     // pop r12
+  byte(0x5B);                 // pop rbx
+  byte(0xC3);                 // ret
+}
+
+void bxJitCompiler::emitTick(void)
+{
+  opReg(0xFF, 0, 1, JIT_COUNTDOWN);   // dec r13d
+  addStub(STUB_TICK, jcc(JIT_CC_Z), pendingRip, pendingRip);
+}
+
+void bxJitCompiler::emitAsyncCheck(void)
+{
+  aluMemImm(JIT_ALU_CMP, 0, JIT_CPU, CPU_OFFSET(async_event), 0);
+  addStub(STUB_EXIT, jcc(JIT_CC_NZ), pendingRip, pendingRip);
+}
+
+// Commit RIP of the inline code: prev_rip = RIP + ripBefore and
+// RIP += ripAfter
+void bxJitCompiler::emitStoreRip(unsigned ripBefore, unsigned ripAfter)
+{
+  opMem(0x8B, JIT_ADDRESS_W, HOST_RAX, JIT_CPU, RIP_OFFSET);
+  if (ripBefore)
+    aluImm(JIT_ALU_ADD, JIT_ADDRESS_W, HOST_RAX, ripBefore);
+  opMem(0x89, JIT_ADDRESS_W, HOST_RAX, JIT_CPU, CPU_OFFSET(prev_rip));
+  if (ripAfter != ripBefore)
+    aluImm(JIT_ALU_ADD, JIT_ADDRESS_W, HOST_RAX, ripAfter - ripBefore);
+  if (ripAfter)
+    opMem(0x89, JIT_ADDRESS_W, HOST_RAX, JIT_CPU, RIP_OFFSET);
+}
+
+void bxJitCompiler::addStub(unsigned kind, Bit8u *jump, unsigned ripBefore, unsigned ripAfter, unsigned seg)
+{
+  stub_t *stub = &stubs[nstubs++];
+  stub->kind = kind;
+  stub->jump[0] = jump;
+  stub->njumps = 1;
+  stub->resume = code;
+  stub->ripBefore = ripBefore;
+  stub->ripAfter = ripAfter;
+  stub->seg = seg;
+}
+
+void bxJitCompiler::emitStub(const stub_t *stub)
+{
+  for (unsigned n=0; n < stub->njumps; n++)
+    patch(stub->jump[n], code);
+
+  switch(stub->kind) {
+    case STUB_TICK:
+      // countdown reached zero: fire the timers, the trace is left if
+      // they raised an event
+      opMem(0x89, 0, JIT_COUNTDOWN, JIT_COUNTDOWN_PTR, 0);
+      emitStoreRip(stub->ripAfter, stub->ripAfter);
+      callAbs(JIT_FUNC(countdownEvent));
+      opMem(0x8B, 0, JIT_COUNTDOWN, JIT_COUNTDOWN_PTR, 0);
+      aluMemImm(JIT_ALU_CMP, 0, JIT_CPU, CPU_OFFSET(async_event), 0);
+      exits[nexits++] = jcc(JIT_CC_NZ);
+      break;
+
+    case STUB_EXIT:
+      emitStoreRip(stub->ripAfter, stub->ripAfter);
+      exits[nexits++] = jmp();
+      return;
+
+    case STUB_READ:
+    case STUB_WRITE:
+      // the access functions see RIP the way the interpreter would
+      // and fault with the guest state of the instruction start
+      emitStoreRip(stub->ripBefore, stub->ripAfter);
+      opMem(0x89, 0, JIT_COUNTDOWN, JIT_COUNTDOWN_PTR, 0);
+      movImm32(HOST_RDI, stub->seg);
+      if (stub->kind == STUB_READ) {
+        callAbs(JIT_FUNC(&BX_CPU_C::read_virtual_dword_32));
+        opReg(0x89, 0, HOST_RAX, HOST_RAX);   // zero extend the result
+      }
+      else {
+        opReg(0x89, 0, HOST_R9, HOST_RDX);
+        callAbs(JIT_FUNC(&BX_CPU_C::write_virtual_dword_32));
+      }
+      opMem(0x8B, 0, JIT_COUNTDOWN, JIT_COUNTDOWN_PTR, 0);
+      break;
+  }
+
+  // back to the inline code which keeps RIP uncommitted
+  if (stub->ripAfter)
+    aluMemImm(JIT_ALU_SUB, JIT_ADDRESS_W, JIT_CPU, RIP_OFFSET, stub->ripAfter);
+  patch(jmp(), stub->resume);
+}
+
+// ESI = effective address, same computation as BxResolve32Base and
+// BxResolve32BaseIndex
+void bxJitCompiler::emitResolve(bxInstruction_c *i)
+{
+  Bit32u displ = (Bit32u) i->displ32s();
+
+  if (i->sibBase() == BX_NIL_REGISTER) {
+    movImm32(HOST_RSI, displ);
+    displ = 0;
+  }
+  else {
+    emitLoadReg(HOST_RSI, i->sibBase());
+  }
+
+  if (i->ResolveModrm == &BX_CPU_C::BxResolve32BaseIndex && i->sibIndex() != BX_NIL_REGISTER) {
+    emitLoadReg(HOST_RAX, i->sibIndex());
+    if (i->sibScale())
+      shiftImm(JIT_SHIFT_SHL, 0, HOST_RAX, i->sibScale());
+    opReg(0x01, 0, HOST_RAX, HOST_RSI);
+  }
+
+  if (displ)
+    aluImm(JIT_ALU_ADD, 0, HOST_RSI, displ);
+}
+
+// Dword access at ESI. The inline part is the TLB hit path of
+// read_virtual_dword_32() / write_virtual_dword_32(), anything else
+// (segment checks, TLB misses, alignment checks, writes to code pages)
+// calls the access function. A read returns the data in EAX, a write
+// stores R9D.
+void bxJitCompiler::emitAccess(bxInstruction_c *i, unsigned ripBefore, bx_bool write)
+{
+  unsigned s = i->seg();
+  Bit32s tlb = CPU_OFFSET(TLB.entry[0]);
+  stub_t *stub = &stubs[nstubs++];
+  stub->kind = write ? STUB_WRITE : STUB_READ;
+  stub->njumps = 0;
+  stub->ripBefore = ripBefore;
+  stub->ripAfter = ripBefore + i->ilen();
+  stub->seg = s;
+
+  opMem(0xF7, 0, 0, JIT_CPU, CPU_OFFSET(sregs[s].cache.valid));
+  dword(write ? SegAccessWOK : SegAccessROK);
+  stub->jump[stub->njumps++] = jcc(JIT_CC_Z);
+
+  // offset < limit_scaled-2
+  opMem(0x8B, 0, HOST_RAX, JIT_CPU, CPU_OFFSET(sregs[s].cache.u.segment.limit_scaled));
+  aluImm(JIT_ALU_SUB, 0, HOST_RAX, 2);
+  opReg(0x39, 0, HOST_RAX, HOST_RSI);
+  stub->jump[stub->njumps++] = jcc(JIT_CC_AE);
+
+  // EAX = laddr, RDX = TLB entry
+  opMem(0x8B, 0, HOST_RAX, JIT_CPU, CPU_OFFSET(sregs[s].cache.u.segment.base));
+  opReg(0x01, 0, HOST_RSI, HOST_RAX);
+  opMem(0x8D, 0, HOST_RDX, HOST_RAX, 3);
+  aluImm(JIT_ALU_AND, 0, HOST_RDX, BX_TLB_MASK);
+  shiftImm(JIT_SHIFT_SHR, 0, HOST_RDX, 12);
+  opReg(0x69, 0, HOST_RDX, HOST_RDX);
+  dword(sizeof(bx_TLB_entry));
+  opReg(0x01, 1, JIT_CPU, HOST_RDX);
+
+#if BX_SUPPORT_ALIGNMENT_CHECK && BX_CPU_LEVEL >= 4
+  opMem(0x8B, 0, HOST_RCX, JIT_CPU, CPU_OFFSET(alignment_check_mask));
+  aluImm(JIT_ALU_AND, 0, HOST_RCX, 3);
+  aluImm(JIT_ALU_OR, 0, HOST_RCX, 0xfffff000);
+#else
+  movImm32(HOST_RCX, 0xfffff000);
+#endif
+  opReg(0x21, 0, HOST_RAX, HOST_RCX);
+  opMem(0x39, JIT_ADDRESS_W, HOST_RCX, HOST_RDX, tlb + offsetof(bx_TLB_entry, lpf));
+  stub->jump[stub->njumps++] = jcc(JIT_CC_NZ);
+
+  opMem(0x8B, 0, HOST_RCX, JIT_CPU, CPU_OFFSET(user_pl));
+  if (write)
+    aluImm(JIT_ALU_OR, 0, HOST_RCX, 0x2);
+  opMem(0x85, 0, HOST_RCX, HOST_RDX, tlb + offsetof(bx_TLB_entry, accessBits));
+  stub->jump[stub->njumps++] = jcc(JIT_CC_NZ);
+
+  if (write) {
+    // writes to pages with traces or tracked page tables go through
+    // decWriteStamp()
+    opMem(0x8B, sizeof(bx_phy_address) == 8, HOST_RCX, HOST_RDX, tlb + offsetof(bx_TLB_entry, ppf));
+    shiftImm(JIT_SHIFT_SHR, 1, HOST_RCX, 12);
+    aluImm(JIT_ALU_AND, 0, HOST_RCX, PHY_MEM_PAGES-1);
+    movImm64(HOST_R8, (bx_ptr_equiv_t) pageWriteStampTable.getPageWriteStampPtr(0));
+    opMem(0xF7, 0, 0, HOST_R8, 0, HOST_RCX, 2);
+    dword(ICacheWriteStampTrackMask);
+    stub->jump[stub->njumps++] = jcc(JIT_CC_NZ);
+  }
+
+  aluImm(JIT_ALU_AND, 0, HOST_RAX, 0xfff);
+  opMem(0x03, 1, HOST_RAX, HOST_RDX, tlb + offsetof(bx_TLB_entry, hostPageAddr));
+  if (write)
+    opMem(0x89, 0, HOST_R9, HOST_RAX, 0);
+  else
+    opMem(0x8B, 0, HOST_RAX, HOST_RAX, 0);
+
+  stub->resume = code;
+}
+
+// op1 in EAX, op2 in ECX, the result is computed in EDX
+void bxJitCompiler::emitAlu(Bit8u op, unsigned instr, int dst)
+{
+  opReg(0x89, 0, HOST_RAX, HOST_RDX);
+  opReg(op, 0, HOST_RCX, HOST_RDX);
+  if (dst >= 0)
+    emitStoreReg(dst, HOST_RDX);
+
+#if BX_HOST_LAZY_FLAGS
+  emitStoreHostFlags(instr == BX_LF_INSTR_LOGIC32);
+#else
+  if (instr != BX_LF_INSTR_LOGIC32) {
+    emitStoreLazy(CPU_OFFSET(oszapc.op1), HOST_RAX);
+    emitStoreLazy(CPU_OFFSET(oszapc.op2), HOST_RCX);
+  }
+  emitStoreLazy(CPU_OFFSET(oszapc.result), HOST_RDX);
+  opMem(0xC7, 0, 0, JIT_CPU, CPU_OFFSET(oszapc.instr));
+  dword(instr);
+#endif
+  opMem(0xC7, 0, 0, JIT_CPU, CPU_OFFSET(lf_flags_status));
+  dword(EFlagsOSZAPCMask);
+}
+
+#if BX_HOST_LAZY_FLAGS
+// Lazy flags from the flags of the host instruction just emitted, the way
+// lazy_flags.h captures them. Clobbers RAX.
+void bxJitCompiler::emitStoreHostFlags(bx_bool logic)
+{
+  byte(0x9F);                          // lahf
+  byte(0x0F); byte(0x90); byte(0xC0);  // seto al
+  if (logic) {
+    byte(0x80); byte(0xE4);            // and ah, ~AF
+    byte((Bit8u) ~(1 << (BX_LF_HOST_AF_BIT - 8)));
+  }
+  opMem(0x89, 0, HOST_RAX, JIT_CPU, CPU_OFFSET(oszapc.flags));
+}
+#endif
+
+void bxJitCompiler::emitLoadReg(unsigned hostReg, unsigned reg)
+{
+  opMem(0x8B, 0, hostReg, JIT_CPU, REG_OFFSET(reg));
+}
+
+// BX_WRITE_32BIT_REGZ, the host register holds a zero extended value
+void bxJitCompiler::emitStoreReg(unsigned reg, unsigned hostReg)
+{
+  opMem(0x89, BX_SUPPORT_X86_64, hostReg, JIT_CPU, REG_OFFSET(reg));
+}
+
+// lazy flags operands are stored sign extended to bx_address
+void bxJitCompiler::emitStoreLazy(Bit32s offset, unsigned hostReg)
+{
+#if BX_SUPPORT_X86_64
+  opReg(0x63, 1, hostReg, hostReg);   // movsxd
+  opMem(0x89, 1, hostReg, JIT_CPU, offset);
+#else
+  opMem(0x89, 0, hostReg, JIT_CPU, offset);
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////
+// x86-64 instruction encoding
+/////////////////////////////////////////////////////////////////////////
+
+void bxJitCompiler::rex(bx_bool w, unsigned reg, unsigned index, unsigned base)
+{
+  Bit8u prefix = 0x40 | (w ? 0x8 : 0) | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((base & 8) >> 3);
+  if (prefix != 0x40) byte(prefix);
+}
+
+void bxJitCompiler::opMem(Bit8u opcode, bx_bool w, unsigned reg, unsigned base, Bit32s disp, int index, unsigned scale)
+{
+  rex(w, reg, (index < 0) ? 0 : index, base);
+  byte(opcode);
+
+  unsigned mod = (disp == 0 && (base & 7) != HOST_RBP) ? 0 : (disp >= -128 && disp <= 127) ? 1 : 2;
+  if (index < 0 && (base & 7) != HOST_RSP) {
+    byte((mod << 6) | ((reg & 7) << 3) | (base & 7));
+  }
+  else {
+    byte((mod << 6) | ((reg & 7) << 3) | 4);
+    byte((scale << 6) | (((index < 0) ? HOST_RSP : index) & 7) << 3 | (base & 7));
+  }
+  if (mod == 1) byte((Bit8u) disp);
+  else if (mod == 2) dword((Bit32u) disp);
+}
+
+void bxJitCompiler::opReg(Bit8u opcode, bx_bool w, unsigned reg, unsigned rm)
+{
+  rex(w, reg, 0, rm);
+  byte(opcode);
+  byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+void bxJitCompiler::movImm32(unsigned reg, Bit32u imm)
+{
+  rex(0, 0, 0, reg);
+  byte(0xB8 + (reg & 7));
+  dword(imm);
+}
+
+void bxJitCompiler::movImm64(unsigned reg, Bit64u imm)
+{
+  rex(1, 0, 0, reg);
+  byte(0xB8 + (reg & 7));
+  qword(imm);
+}
+
+void bxJitCompiler::aluImm(unsigned op, bx_bool w, unsigned reg, Bit32u imm)
+{
+  bx_bool imm8 = ((Bit32s) imm >= -128 && (Bit32s) imm <= 127);
+  opReg(imm8 ? 0x83 : 0x81, w, op, reg);
+  if (imm8) byte((Bit8u) imm);
+  else dword(imm);
+}
+
+void bxJitCompiler::aluMemImm(unsigned op, bx_bool w, unsigned base, Bit32s disp, Bit32u imm)
+{
+  bx_bool imm8 = ((Bit32s) imm >= -128 && (Bit32s) imm <= 127);
+  opMem(imm8 ? 0x83 : 0x81, w, op, base, disp);
+  if (imm8) byte((Bit8u) imm);
+  else dword(imm);
+}
+
+void bxJitCompiler::shiftImm(unsigned op, bx_bool w, unsigned reg, unsigned count)
+{
+  opReg(0xC1, w, op, reg);
+  byte(count);
+}
+
+void bxJitCompiler::callAbs(Bit64u func)
+{
+  movImm64(HOST_RAX, func);
+  opReg(0xFF, 0, 2, HOST_RAX);
+}
+
+Bit8u *bxJitCompiler::jcc(unsigned cond)
+{
+  byte(0x0F);
+  byte(0x80 | cond);
+  Bit8u *jump = code;
+  dword(0);
+  return jump;
+}
+
+Bit8u *bxJitCompiler::jmp(void)
+{
+  byte(0xE9);
+  Bit8u *jump = code;
+  dword(0);
+  return jump;
+}
+
+#endif
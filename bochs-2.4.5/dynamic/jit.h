@@ -0,0 +1,127 @@
+/////////////////////////////////////////////////////////////////////////
+// $Id$
+/////////////////////////////////////////////////////////////////////////
+//
+//  Copyright (C) 2010  The Bochs Project
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA B 02110-1301 USA
+//
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef BX_DYNAMIC_JIT_H
+#define BX_DYNAMIC_JIT_H
+
+#if BX_SUPPORT_JIT
+
+// Second execution tier for hot trace cache entries. A trace executed
+// jit_threshold times is translated into x86-64 host code. Simple 32-bit
+// integer instructions, their effective addresses and dword memory
+// accesses which hit the TLB are done inline, everything else calls the
+// instruction handler exactly like the trace loop in cpu_loop() does.
+// The translated code ticks the system timer after every guest
+// instruction and leaves the trace at the same instruction boundaries
+// the interpreter would, so the timing of the simulation does not change.
+
+#define BX_JIT_CODE_BUFFER    (16 * 1024 * 1024)
+#define BX_JIT_MAX_TRACE_CODE (BX_MAX_TRACE_LENGTH * 512)
+
+class bxJitCompiler {
+public:
+  bxJitCompiler();
+ ~bxJitCompiler();
+
+  // Returns host code for the trace or NULL if it can't be translated
+  bxJitCode_t compile(bxICacheEntry_c *entry);
+  // Drops the code of all translated traces
+  void flush(void);
+
+  // statistics, reported at exit
+  Bit64u traces;       // traces translated
+  Bit64u inlined;      // guest instructions translated inline
+  Bit64u called;       // guest instructions translated into handler calls
+  Bit64u flushes;      // code buffer flushes
+
+private:
+  Bit8u *buffer;
+  Bit8u *bufferPtr;
+
+  // state of the trace being translated
+  Bit8u *code;
+  unsigned pendingRip;   // guest bytes executed since RIP was last stored
+
+  // Out of line code of the trace: timer events and memory accesses
+  // which missed the inline TLB lookup
+  enum { STUB_TICK, STUB_EXIT, STUB_READ, STUB_WRITE };
+  struct stub_t {
+    unsigned kind;
+    Bit8u *jump[6];      // rel32 fields of the branches to the stub
+    unsigned njumps;
+    Bit8u *resume;       // where the stub continues
+    unsigned ripBefore;  // RIP of the guest instruction
+    unsigned ripAfter;   // RIP after the guest instruction
+    unsigned seg;
+  };
+  stub_t stubs[BX_MAX_TRACE_LENGTH * 4];
+  unsigned nstubs;
+  Bit8u *exits[BX_MAX_TRACE_LENGTH * 4];
+  unsigned nexits;
+
+  bx_bool inlineInstruction(bxInstruction_c *i);
+  void callInstruction(bxInstruction_c *i);
+
+  void emitPrologue(void);
+  void emitEpilogue(void);
+  void emitTick(void);
+  void emitAsyncCheck(void);
+  void emitStoreRip(unsigned ripBefore, unsigned ripAfter);
+  void emitStub(const stub_t *stub);
+  void addStub(unsigned kind, Bit8u *jump, unsigned ripBefore, unsigned ripAfter, unsigned seg = 0);
+
+  void emitResolve(bxInstruction_c *i);
+  void emitAccess(bxInstruction_c *i, unsigned ripBefore, bx_bool write);
+  void emitAlu(Bit8u op, unsigned instr, int dst);
+  void emitLoadReg(unsigned hostReg, unsigned reg);
+  void emitStoreReg(unsigned reg, unsigned hostReg);
+  void emitStoreLazy(Bit32s offset, unsigned hostReg);
+#if BX_HOST_LAZY_FLAGS
+  void emitStoreHostFlags(bx_bool logic);
+#endif
+
+  // x86-64 instruction encoding
+  void byte(Bit8u b) { *code++ = b; }
+  void dword(Bit32u d) { *(Bit32u *) code = d; code += 4; }
+  void qword(Bit64u q) { *(Bit64u *) code = q; code += 8; }
+  void rex(bx_bool w, unsigned reg, unsigned index, unsigned base);
+  void opMem(Bit8u opcode, bx_bool w, unsigned reg, unsigned base, Bit32s disp, int index = -1, unsigned scale = 0);
+  void opReg(Bit8u opcode, bx_bool w, unsigned reg, unsigned rm);
+  void movImm32(unsigned reg, Bit32u imm);
+  void movImm64(unsigned reg, Bit64u imm);
+  void aluImm(unsigned op, bx_bool w, unsigned reg, Bit32u imm);
+  void aluMemImm(unsigned op, bx_bool w, unsigned base, Bit32s disp, Bit32u imm);
+  void shiftImm(unsigned op, bx_bool w, unsigned reg, unsigned count);
+  void callAbs(Bit64u func);
+  Bit8u *jcc(unsigned cond);
+  Bit8u *jmp(void);
+  static void patch(Bit8u *jump, const Bit8u *target) {
+    *(Bit32s *) jump = (Bit32s) (target - (jump + 4));
+  }
+
+  static void countdownEvent(void);
+  static void forceCF(void);
+};
+
+#endif
+
+#endif
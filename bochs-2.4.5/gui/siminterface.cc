@@ -27,6 +27,10 @@
 #include "param_names.h"
 #include "iodev.h"
 
+#if BX_HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
 bx_simulator_interface_c *SIM = NULL;
 logfunctions *siminterface_log = NULL;
 bx_list_c *root_param = NULL;
@@ -480,8 +484,9 @@ const char *atadevice_mode_names[] = {
   "undoable",
   "growing",
   "volatile",
-//"z-undoable",
-//"z-volatile",
+  "dedup",
+  "z-undoable",
+  "z-volatile",
   NULL
 };
 
@@ -950,6 +955,26 @@ bx_bool bx_real_sim_c::save_state(const char *checkpoint_path)
   return 1;
 }
 
+#if BX_HAVE_SYS_MMAN_H
+// Map the saved contents of a page aligned data parameter (the guest RAM)
+// copy-on-write instead of reading them, so that the machines restored
+// from one snapshot share the pages none of them has modified.
+static bx_bool map_sr_data(bx_shadow_data_c *param, FILE *fp)
+{
+  Bit8u *ptr = param->getptr();
+  Bit32u size = param->get_size();
+  long page_size = getpagesize();
+  struct stat stat_buf;
+
+  if ((((bx_ptr_equiv_t) ptr) & (page_size-1)) || (size & (page_size-1)))
+    return 0;
+  if (fstat(fileno(fp), &stat_buf) || stat_buf.st_size < (off_t) size)
+    return 0;
+  return mmap(ptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+              fileno(fp), 0) != MAP_FAILED;
+}
+#endif
+
 bx_bool bx_real_sim_c::restore_config()
 {
   char config[BX_PATHNAME_LEN];
@@ -1115,6 +1140,9 @@ bx_bool bx_real_sim_c::restore_bochs_param(bx_list_c *root, const char *sr_path,
                   sprintf(devdata, "%s/%s", sr_path, ptr);
                   fp2 = fopen(devdata, "rb");
                   if (fp2 != NULL) {
+#if BX_HAVE_SYS_MMAN_H
+                    if (! map_sr_data((bx_shadow_data_c*)param, fp2))
+#endif
                     fread(((bx_shadow_data_c*)param)->getptr(), 1, ((bx_shadow_data_c*)param)->get_size(), fp2);
                     fclose(fp2);
                   }
@@ -1221,6 +1249,8 @@ bx_bool bx_real_sim_c::save_sr_param(FILE *fp, bx_param_c *node, const char *sr_
         sprintf(tmpstr, "%s/%s.%s", sr_path, node->get_parent()->get_name(), node->get_name());
       else
         sprintf(tmpstr, "%s.%s", node->get_parent()->get_name(), node->get_name());
+      // a new file, the old one might still be mapped by a restored machine
+      remove(tmpstr);
       fp2 = fopen(tmpstr, "wb");
       if (fp2 != NULL) {
         fwrite(((bx_shadow_data_c*)node)->getptr(), 1, ((bx_shadow_data_c*)node)->get_size(), fp2);
@@ -950,9 +950,10 @@ enum {
 #define BX_ATA_MODE_UNDOABLE     7
 #define BX_ATA_MODE_GROWING      8
 #define BX_ATA_MODE_VOLATILE     9
-#define BX_ATA_MODE_Z_UNDOABLE  10
-#define BX_ATA_MODE_Z_VOLATILE  11
-#define BX_ATA_MODE_LAST        11
+#define BX_ATA_MODE_DEDUP       10
+#define BX_ATA_MODE_Z_UNDOABLE  11
+#define BX_ATA_MODE_Z_VOLATILE  12
+#define BX_ATA_MODE_LAST        12
 
 #define BX_CLOCK_SYNC_NONE       0
 #define BX_CLOCK_SYNC_REALTIME   1
@@ -960,6 +961,11 @@ enum {
 #define BX_CLOCK_SYNC_BOTH       3
 #define BX_CLOCK_SYNC_LAST       3
 
+#define BX_SMP_MODE_ROUNDROBIN   0
+#define BX_SMP_MODE_THREADS      1
+#define BX_SMP_MODE_LOCKSTEP     2
+#define BX_SMP_MODE_LAST         2
+
 #define BX_CPUID_SUPPORT_NOSSE   0
 #define BX_CPUID_SUPPORT_SSE     1
 #define BX_CPUID_SUPPORT_SSE2    2
@@ -962,8 +962,13 @@ bx_devices_c::inp(Bit16u addr, unsigned io_len)
   struct io_handler_struct *io_read_handler;
   Bit32u ret;
 
+  BX_SMP_SERIALIZE();
+
   BX_INSTR_INP(addr, io_len);
 
+  // the devices are not thread safe, serialize the processor threads
+  BX_SMP_LOCK();
+
   io_read_handler = read_port_to_handler[addr];
   if (io_read_handler->mask & io_len) {
 	ret = ((bx_read_handler_t)io_read_handler->funct)(io_read_handler->this_ptr, (Bit32u)addr, io_len);
@@ -978,6 +983,8 @@ bx_devices_c::inp(Bit16u addr, unsigned io_len)
     }
   }
 
+  BX_SMP_UNLOCK();
+
   BX_INSTR_INP2(addr, io_len, ret);
   BX_DBG_IO_REPORT(addr, io_len, BX_READ, ret);
 
@@ -994,15 +1001,21 @@ bx_devices_c::outp(Bit16u addr, Bit32u value, unsigned io_len)
 {
   struct io_handler_struct *io_write_handler;
 
+  BX_SMP_SERIALIZE();
+
   BX_INSTR_OUTP(addr, io_len, value);
   BX_DBG_IO_REPORT(addr, io_len, BX_WRITE, value);
 
+  BX_SMP_LOCK();
+
   io_write_handler = write_port_to_handler[addr];
   if (io_write_handler->mask & io_len) {
 	((bx_write_handler_t)io_write_handler->funct)(io_write_handler->this_ptr, (Bit32u)addr, value, io_len);
   } else if (addr != 0x0cf8) { // don't flood the logfile when probing PCI
     BX_ERROR(("write to port 0x%04x with len %d ignored", addr, io_len));
   }
+
+  BX_SMP_UNLOCK();
 }
 
 bx_bool bx_devices_c::is_harddrv_enabled(void)
@@ -133,16 +133,35 @@ bx_hard_drive_c::bx_hard_drive_c()
       channels[channel].drives[device].hard_drive =  NULL;
 #ifdef LOWLEVEL_CDROM
       channels[channel].drives[device].cdrom.cd =  NULL;
+#endif
+#if BX_SUPPORT_ASYNC_DISK
+      channels[channel].drives[device].async.io = NULL;
+      channels[channel].drives[device].async.pending = 0;
 #endif
     }
   }
   iolight_timer_index = BX_NULL_TIMER_HANDLE;
+#if BX_SUPPORT_ASYNC_DISK
+  async_timer_index = BX_NULL_TIMER_HANDLE;
+#endif
+  bmdma_span = NULL;
+  bmdma_span_size = 0;
+  bmdma_iov = NULL;
+  bmdma_iov_size = 0;
+  bmdma_bounce = NULL;
+  bmdma_bounce_size = 0;
 }
 
 bx_hard_drive_c::~bx_hard_drive_c()
 {
   for (Bit8u channel=0; channel<BX_MAX_ATA_CHANNEL; channel++) {
     for (Bit8u device=0; device<2; device ++) {
+#if BX_SUPPORT_ASYNC_DISK
+      if (channels[channel].drives[device].async.io != NULL) {
+        delete channels[channel].drives[device].async.io;
+        channels[channel].drives[device].async.io = NULL;
+      }
+#endif
       if (channels[channel].drives[device].hard_drive != NULL) {
         channels[channel].drives[device].hard_drive->close();
         delete channels[channel].drives[device].hard_drive;
@@ -156,6 +175,9 @@ bx_hard_drive_c::~bx_hard_drive_c()
 #endif
     }
   }
+  if (bmdma_span != NULL) free(bmdma_span);
+  if (bmdma_iov != NULL) free(bmdma_iov);
+  if (bmdma_bounce != NULL) delete [] bmdma_bounce;
   BX_DEBUG(("Exit"));
 }
 
@@ -176,6 +198,14 @@ void bx_hard_drive_c::init(void)
       BX_HD_THIS channels[channel].ioaddr1 = SIM->get_param_num("ioaddr1", base)->get();
       BX_HD_THIS channels[channel].ioaddr2 = SIM->get_param_num("ioaddr2", base)->get();
       BX_HD_THIS channels[channel].irq = SIM->get_param_num("irq", base)->get();
+      BX_HD_THIS channels[channel].bmdma.ioaddr = SIM->get_param_num("bmdma", base)->get();
+#if BX_SUPPORT_PCI
+      if ((BX_HD_THIS channels[channel].bmdma.ioaddr != 0) && (channel < 2) &&
+          SIM->get_param_bool(BXPN_I440FX_SUPPORT)->get()) {
+        BX_ERROR(("ata%d: bmdma option ignored, the PCI IDE controller does bus master DMA", channel));
+        BX_HD_THIS channels[channel].bmdma.ioaddr = 0;
+      }
+#endif
 
       // Coherency check
       if ((BX_HD_THIS channels[channel].ioaddr1 == 0) ||
@@ -193,7 +223,11 @@ void bx_hard_drive_c::init(void)
       BX_HD_THIS channels[channel].ioaddr1 = 0;
       BX_HD_THIS channels[channel].ioaddr2 = 0;
       BX_HD_THIS channels[channel].irq = 0;
+      BX_HD_THIS channels[channel].bmdma.ioaddr = 0;
     }
+    BX_HD_THIS channels[channel].bmdma.command = 0;
+    BX_HD_THIS channels[channel].bmdma.status = 0;
+    BX_HD_THIS channels[channel].bmdma.prd = 0;
   }
 
   for (channel=0; channel<BX_MAX_ATA_CHANNEL; channel++) {
@@ -225,6 +259,19 @@ void bx_hard_drive_c::init(void)
       }
     }
 
+    if (BX_HD_THIS channels[channel].bmdma.ioaddr != 0) {
+      const Bit8u bmdma_iomask[BX_HD_BMDMA_PORTS] = {1, 0, 1, 0, 4, 0, 0, 0};
+      for (unsigned addr=0; addr<BX_HD_BMDMA_PORTS; addr++) {
+        if (bmdma_iomask[addr] == 0) continue;
+        DEV_register_ioread_handler(this, bmdma_read_handler,
+                              BX_HD_THIS channels[channel].bmdma.ioaddr+addr, string, bmdma_iomask[addr]);
+        DEV_register_iowrite_handler(this, bmdma_write_handler,
+                              BX_HD_THIS channels[channel].bmdma.ioaddr+addr, string, bmdma_iomask[addr]);
+      }
+      BX_INFO(("ata%d: bus master DMA registers at 0x%04x", channel,
+               BX_HD_THIS channels[channel].bmdma.ioaddr));
+    }
+
     BX_HD_THIS channels[channel].drive_select = 0;
   }
 
@@ -362,25 +409,25 @@ void bx_hard_drive_c::init(void)
                 SIM->get_param_string("journal", base)->getptr());
             break;
 
+          case BX_ATA_MODE_DEDUP:
+            BX_INFO(("HD on ata%d-%d: '%s' 'dedup' mode ", channel, device,
+                     SIM->get_param_string("path", base)->getptr()));
+            channels[channel].drives[device].hard_drive = new dedup_image_t();
+            break;
+
 #if BX_COMPRESSED_HD_SUPPORT
           case BX_ATA_MODE_Z_UNDOABLE:
-            BX_PANIC(("z-undoable disk support not implemented"));
-#if 0
             BX_INFO(("HD on ata%d-%d: '%s' 'z-undoable' mode ", channel, device,
                      SIM->get_param_string("path", base)->getptr()));
             channels[channel].drives[device].hard_drive = new z_undoable_image_t(disk_size,
                 SIM->get_param_string("journal", base)->getptr());
-#endif
             break;
 
           case BX_ATA_MODE_Z_VOLATILE:
-            BX_PANIC(("z-volatile disk support not implemented"));
-#if 0
             BX_INFO(("HD on ata%d-%d: '%s' 'z-volatile' mode ", channel, device,
                      SIM->get_param_string("path", base)->getptr()));
             channels[channel].drives[device].hard_drive = new z_volatile_image_t(disk_size,
                 SIM->get_param_string("journal", base)->getptr());
-#endif
             break;
 #endif //BX_COMPRESSED_HD_SUPPORT
 
@@ -394,12 +441,18 @@ void bx_hard_drive_c::init(void)
         BX_HD_THIS channels[channel].drives[device].hard_drive->cylinders = cyl;
         BX_HD_THIS channels[channel].drives[device].hard_drive->heads = heads;
         BX_HD_THIS channels[channel].drives[device].hard_drive->sectors = spt;
+        if ((image_mode == BX_ATA_MODE_FLAT) || (image_mode == BX_ATA_MODE_SPARSE)) {
+          BX_HD_THIS channels[channel].drives[device].hard_drive->use_mmap =
+            SIM->get_param_bool("mmap", base)->get();
+        }
         bx_bool geometry_detect = 0;
 
         if ((image_mode == BX_ATA_MODE_FLAT) || (image_mode == BX_ATA_MODE_CONCAT) ||
             (image_mode == BX_ATA_MODE_GROWING) || (image_mode == BX_ATA_MODE_UNDOABLE) ||
             (image_mode == BX_ATA_MODE_VOLATILE) || (image_mode == BX_ATA_MODE_VMWARE3) ||
-            (image_mode == BX_ATA_MODE_VMWARE4) || (image_mode == BX_ATA_MODE_SPARSE)) {
+            (image_mode == BX_ATA_MODE_VMWARE4) || (image_mode == BX_ATA_MODE_SPARSE) ||
+            (image_mode == BX_ATA_MODE_DEDUP) || (image_mode == BX_ATA_MODE_Z_UNDOABLE) ||
+            (image_mode == BX_ATA_MODE_Z_VOLATILE)) {
           geometry_detect = ((cyl == 0) || (image_mode == BX_ATA_MODE_VMWARE3) || (image_mode == BX_ATA_MODE_VMWARE4));
           if ((heads == 0) || (spt == 0)) {
             BX_PANIC(("ata%d-%d cannot have zero heads, or sectors/track", channel, device));
@@ -442,6 +495,14 @@ void bx_hard_drive_c::init(void)
         } else if (geometry_detect) {
           BX_PANIC(("ata%d-%d image doesn't support geometry detection", channel, device));
         }
+#if BX_SUPPORT_ASYNC_DISK
+        if (SIM->get_param_bool("async", base)->get()) {
+          BX_INFO(("ata%d-%d: using asynchronous transfers", channel, device));
+          BX_HD_THIS channels[channel].drives[device].async.io =
+            new async_io_t(BX_HD_THIS channels[channel].drives[device].hard_drive,
+                           async_notify_handler, this);
+        }
+#endif
       } else if (SIM->get_param_enum("type", base)->get() == BX_ATA_DEVICE_CDROM) {
         bx_list_c *cdrom_rt = (bx_list_c*)SIM->get_param(BXPN_MENU_RUNTIME_CDROM);
         cdrom_rt->add(base);
@@ -655,6 +716,14 @@ void bx_hard_drive_c::init(void)
     BX_HD_THIS iolight_timer_index =
       DEV_register_timer(this, iolight_timer_handler, 100000, 0,0, "HD/CD i/o light");
   }
+#if BX_SUPPORT_ASYNC_DISK
+  // register timer completing the asynchronous transfers, the I/O threads
+  // post it when a transfer has finished
+  if (BX_HD_THIS async_timer_index == BX_NULL_TIMER_HANDLE) {
+    BX_HD_THIS async_timer_index =
+      DEV_register_timer(this, async_timer_handler, BX_HD_ASYNC_COMPLETE_USEC, 0,0, "HD async i/o");
+  }
+#endif
 }
 
 void bx_hard_drive_c::reset(unsigned type)
@@ -662,6 +731,9 @@ void bx_hard_drive_c::reset(unsigned type)
   for (unsigned channel=0; channel<BX_MAX_ATA_CHANNEL; channel++) {
     if (BX_HD_THIS channels[channel].irq)
       DEV_pic_lower_irq(BX_HD_THIS channels[channel].irq);
+    BX_HD_THIS channels[channel].bmdma.command = 0;
+    BX_HD_THIS channels[channel].bmdma.status = 0;
+    BX_HD_THIS channels[channel].bmdma.prd = 0;
   }
 }
 
@@ -674,11 +746,11 @@ void bx_hard_drive_c::register_state(void)
   bx_list_c *list = new bx_list_c(SIM->get_bochs_root(), "hard_drive", "Hard Drive State", BX_MAX_ATA_CHANNEL);
   for (i=0; i<BX_MAX_ATA_CHANNEL; i++) {
     sprintf(cname, "%d", i);
-    chan = new bx_list_c(list, cname, 3);
+    chan = new bx_list_c(list, cname, 6);
     for (j=0; j<2; j++) {
       if (BX_DRIVE_IS_PRESENT(i, j)) {
         sprintf(dname, "drive%d", i);
-        drive = new bx_list_c(chan, dname, 27);
+        drive = new bx_list_c(chan, dname, 27 + 4 * BX_SUPPORT_ASYNC_DISK);
         new bx_shadow_data_c(drive, "buffer", BX_CONTROLLER(i, j).buffer, MAX_MULTIPLE_SECTORS * 512);
         status = new bx_list_c(drive, "status", 9);
         new bx_shadow_bool_c(status, "busy", &BX_CONTROLLER(i, j).status.busy);
@@ -715,10 +787,40 @@ void bx_hard_drive_c::register_state(void)
         new bx_shadow_num_c(drive, "hob_hcyl", &BX_CONTROLLER(i, j).hob.hcyl, BASE_HEX);
         new bx_shadow_num_c(drive, "num_sectors", &BX_CONTROLLER(i, j).num_sectors, BASE_HEX);
         new bx_shadow_bool_c(drive, "cdrom_locked", &BX_HD_THIS channels[i].drives[j].cdrom.locked);
+#if BX_SUPPORT_ASYNC_DISK
+        new bx_shadow_bool_c(drive, "async_pending", &BX_DRIVE(i, j).async.pending);
+        new bx_shadow_bool_c(drive, "async_write", &BX_DRIVE(i, j).async.write);
+        new bx_shadow_num_c(drive, "async_offset", &BX_DRIVE(i, j).async.offset, BASE_HEX);
+        new bx_shadow_num_c(drive, "async_size", &BX_DRIVE(i, j).async.size, BASE_HEX);
+#endif
       }
     }
     new bx_shadow_num_c(chan, "drive_select", &BX_HD_THIS channels[i].drive_select);
+    new bx_shadow_num_c(chan, "bmdma_command", &BX_HD_THIS channels[i].bmdma.command, BASE_HEX);
+    new bx_shadow_num_c(chan, "bmdma_status", &BX_HD_THIS channels[i].bmdma.status, BASE_HEX);
+    new bx_shadow_num_c(chan, "bmdma_prd", &BX_HD_THIS channels[i].bmdma.prd, BASE_HEX);
+  }
+}
+
+void bx_hard_drive_c::after_restore_state(void)
+{
+#if BX_SUPPORT_ASYNC_DISK
+  // A transfer in progress at save time is done again now, synchronously.
+  for (Bit8u channel=0; channel<BX_MAX_ATA_CHANNEL; channel++) {
+    if (BX_SELECTED_DRIVE(channel).async.pending) {
+      struct iovec iov;
+      ssize_t ret;
+
+      iov.iov_base = BX_SELECTED_CONTROLLER(channel).buffer;
+      iov.iov_len = BX_SELECTED_DRIVE(channel).async.size;
+      if (BX_SELECTED_DRIVE(channel).async.write)
+        ret = BX_SELECTED_DRIVE(channel).hard_drive->write_sectors(BX_SELECTED_DRIVE(channel).async.offset, &iov, 1);
+      else
+        ret = BX_SELECTED_DRIVE(channel).hard_drive->read_sectors(BX_SELECTED_DRIVE(channel).async.offset, &iov, 1);
+      ide_async_complete(channel, ret);
+    }
   }
+#endif
 }
 
 void bx_hard_drive_c::iolight_timer_handler(void *this_ptr)
@@ -741,6 +843,33 @@ void bx_hard_drive_c::iolight_timer()
   }
 }
 
+#if BX_SUPPORT_ASYNC_DISK
+// called on the I/O thread of a drive when its transfer has finished
+void bx_hard_drive_c::async_notify_handler(void *this_ptr)
+{
+  bx_hard_drive_c *class_ptr = (bx_hard_drive_c *) this_ptr;
+  bx_pc_system.post_timer(class_ptr->async_timer_index);
+}
+
+void bx_hard_drive_c::async_timer_handler(void *this_ptr)
+{
+  bx_hard_drive_c *class_ptr = (bx_hard_drive_c *) this_ptr;
+  class_ptr->async_timer();
+}
+
+void bx_hard_drive_c::async_timer()
+{
+  // the transfers still running post the timer again when they finish
+  for (Bit8u channel=0; channel<BX_MAX_ATA_CHANNEL; channel++) {
+    if (BX_SELECTED_DRIVE(channel).async.pending &&
+        BX_SELECTED_DRIVE(channel).async.io->poll())
+    {
+      ide_async_complete(channel, BX_SELECTED_DRIVE(channel).async.io->wait());
+    }
+  }
+}
+#endif
+
 #define GOTO_RETURN_VALUE  if(io_len==4) {            \
                              goto return_value32;     \
                            }                          \
@@ -795,6 +924,14 @@ Bit32u bx_hard_drive_c::read(Bit32u address, unsigned io_len)
     }
   }
 
+#if BX_SUPPORT_ASYNC_DISK
+  // The status shows BSY while a transfer is in progress. Other registers
+  // are not valid until it has completed, so wait for it.
+  if (BX_SELECTED_DRIVE(channel).async.pending && (port != 0x07) && (port != 0x16)) {
+    ide_async_complete(channel, BX_SELECTED_DRIVE(channel).async.io->wait());
+  }
+#endif
+
   switch (port) {
     case 0x00: // hard disk data (16bit) 0x1f0
       if (BX_SELECTED_CONTROLLER(channel).status.drq == 0) {
@@ -872,6 +1009,11 @@ Bit32u bx_hard_drive_c::read(Bit32u address, unsigned io_len)
               BX_SELECTED_CONTROLLER(channel).status.drq = 1;
               BX_SELECTED_CONTROLLER(channel).status.seek_complete = 1;
 
+#if BX_SUPPORT_ASYNC_DISK
+              if (ide_async_start(channel, 0)) {
+                GOTO_RETURN_VALUE;
+              }
+#endif
               if (ide_read_sector(channel, BX_SELECTED_CONTROLLER(channel).buffer,
                                   BX_SELECTED_CONTROLLER(channel).buffer_size)) {
                 BX_SELECTED_CONTROLLER(channel).buffer_index = 0;
@@ -1238,6 +1380,13 @@ void bx_hard_drive_c::write(Bit32u address, Bit32u value, unsigned io_len)
     }
   }
 
+#if BX_SUPPORT_ASYNC_DISK
+  // complete a transfer in progress before the guest changes the state
+  if (BX_SELECTED_DRIVE(channel).async.pending) {
+    ide_async_complete(channel, BX_SELECTED_DRIVE(channel).async.io->wait());
+  }
+#endif
+
   switch (io_len) {
     case 1:
       BX_DEBUG(("8-bit write to %04x = %02x {%s}",
@@ -1301,38 +1450,14 @@ void bx_hard_drive_c::write(Bit32u address, Bit32u value, unsigned io_len)
 
           /* if buffer completely writtten */
           if (BX_SELECTED_CONTROLLER(channel).buffer_index >= BX_SELECTED_CONTROLLER(channel).buffer_size) {
+#if BX_SUPPORT_ASYNC_DISK
+            if (ide_async_start(channel, 1)) {
+              break;
+            }
+#endif
             if (ide_write_sector(channel, BX_SELECTED_CONTROLLER(channel).buffer,
                                  BX_SELECTED_CONTROLLER(channel).buffer_size)) {
-              if ((BX_SELECTED_CONTROLLER(channel).current_command == 0xC5) ||
-                  (BX_SELECTED_CONTROLLER(channel).current_command == 0x39)) {
-                if (BX_SELECTED_CONTROLLER(channel).num_sectors > BX_SELECTED_CONTROLLER(channel).multiple_sectors) {
-                  BX_SELECTED_CONTROLLER(channel).buffer_size = BX_SELECTED_CONTROLLER(channel).multiple_sectors * 512;
-                } else {
-                  BX_SELECTED_CONTROLLER(channel).buffer_size = BX_SELECTED_CONTROLLER(channel).num_sectors * 512;
-                }
-              }
-              BX_SELECTED_CONTROLLER(channel).buffer_index = 0;
-
-              /* When the write is complete, controller clears the DRQ bit and
-               * sets the BSY bit.
-               * If at least one more sector is to be written, controller sets DRQ bit,
-               * clears BSY bit, and issues IRQ
-               */
-
-              if (BX_SELECTED_CONTROLLER(channel).num_sectors != 0) {
-                BX_SELECTED_CONTROLLER(channel).status.busy = 0;
-                BX_SELECTED_CONTROLLER(channel).status.drive_ready = 1;
-                BX_SELECTED_CONTROLLER(channel).status.drq = 1;
-                BX_SELECTED_CONTROLLER(channel).status.corrected_data = 0;
-                BX_SELECTED_CONTROLLER(channel).status.err = 0;
-              } else { /* no more sectors to write */
-                BX_SELECTED_CONTROLLER(channel).status.busy = 0;
-                BX_SELECTED_CONTROLLER(channel).status.drive_ready = 1;
-                BX_SELECTED_CONTROLLER(channel).status.drq = 0;
-                BX_SELECTED_CONTROLLER(channel).status.err = 0;
-                BX_SELECTED_CONTROLLER(channel).status.corrected_data = 0;
-              }
-              raise_interrupt(channel);
+              ide_write_sector_done(channel);
             }
           }
           break;
@@ -2119,6 +2244,11 @@ void bx_hard_drive_c::write(Bit32u address, Bit32u value, unsigned io_len)
           }
           BX_SELECTED_CONTROLLER(channel).current_command = value;
 
+#if BX_SUPPORT_ASYNC_DISK
+          if (ide_async_start(channel, 0)) {
+            break;
+          }
+#endif
           if (ide_read_sector(channel, BX_SELECTED_CONTROLLER(channel).buffer,
                                   BX_SELECTED_CONTROLLER(channel).buffer_size)) {
             BX_SELECTED_CONTROLLER(channel).error_register = 0;
@@ -2455,10 +2585,14 @@ void bx_hard_drive_c::write(Bit32u address, Bit32u value, unsigned io_len)
           break;
 
         // power management & flush cache stubs
-        case 0xE0: // STANDBY NOW
-        case 0xE1: // IDLE IMMEDIATE
         case 0xE7: // FLUSH CACHE
         case 0xEA: // FLUSH CACHE EXT
+          if (BX_SELECTED_IS_HD(channel)) {
+            BX_SELECTED_DRIVE(channel).hard_drive->flush();
+          }
+          // fall through
+        case 0xE0: // STANDBY NOW
+        case 0xE1: // IDLE IMMEDIATE
           BX_SELECTED_CONTROLLER(channel).status.busy = 0;
           BX_SELECTED_CONTROLLER(channel).status.drive_ready = 1;
           BX_SELECTED_CONTROLLER(channel).status.write_fault = 0;
@@ -2502,12 +2636,14 @@ void bx_hard_drive_c::write(Bit32u address, Bit32u value, unsigned io_len)
         case 0x25: // READ DMA EXT
           lba48 = 1;
         case 0xC8: // READ DMA
-          if (BX_SELECTED_IS_HD(channel) && BX_HD_THIS bmdma_present()) {
+          if (BX_SELECTED_IS_HD(channel) && BX_HD_THIS dma_present(channel)) {
             lba48_transform(channel, lba48);
             BX_SELECTED_CONTROLLER(channel).status.drive_ready = 1;
             BX_SELECTED_CONTROLLER(channel).status.seek_complete = 1;
             BX_SELECTED_CONTROLLER(channel).status.drq   = 1;
             BX_SELECTED_CONTROLLER(channel).current_command = value;
+            // the transfer starts now if the bus master is already active
+            BX_HD_THIS bmdma_start(channel);
           } else {
             BX_ERROR(("write cmd 0x%02x (READ DMA) not supported", value));
             command_aborted(channel, value);
@@ -2517,12 +2653,14 @@ void bx_hard_drive_c::write(Bit32u address, Bit32u value, unsigned io_len)
         case 0x35: // WRITE DMA EXT
           lba48 = 1;
         case 0xCA: // WRITE DMA
-          if (BX_SELECTED_IS_HD(channel) && BX_HD_THIS bmdma_present()) {
+          if (BX_SELECTED_IS_HD(channel) && BX_HD_THIS dma_present(channel)) {
             lba48_transform(channel, lba48);
             BX_SELECTED_CONTROLLER(channel).status.drive_ready = 1;
             BX_SELECTED_CONTROLLER(channel).status.seek_complete = 1;
             BX_SELECTED_CONTROLLER(channel).status.drq   = 1;
             BX_SELECTED_CONTROLLER(channel).current_command = value;
+            // the transfer starts now if the bus master is already active
+            BX_HD_THIS bmdma_start(channel);
           } else {
             BX_ERROR(("write cmd 0x%02x (WRITE DMA) not supported", value));
             command_aborted(channel, value);
@@ -2931,7 +3069,7 @@ void bx_hard_drive_c::identify_drive(Bit8u channel)
   //       9: 1 = LBA supported
   //       8: 1 = DMA supported
   //     7-0: Vendor unique
-  if (BX_HD_THIS bmdma_present()) {
+  if (BX_HD_THIS dma_present(channel)) {
     BX_SELECTED_DRIVE(channel).id_drive[49] = (1<<9) | (1<<8);
   } else {
     BX_SELECTED_DRIVE(channel).id_drive[49] = 1<<9;
@@ -3008,7 +3146,7 @@ void bx_hard_drive_c::identify_drive(Bit8u channel)
   // supported e.g., if Mode 0 is supported bit 0 is set.
   // The high order byte contains a single bit set to indiciate
   // which mode is active.
-  if (BX_HD_THIS bmdma_present()) {
+  if (BX_HD_THIS dma_present(channel)) {
     BX_SELECTED_DRIVE(channel).id_drive[63] = 0x07 | (BX_SELECTED_CONTROLLER(channel).mdma_mode << 8);
   } else {
     BX_SELECTED_DRIVE(channel).id_drive[63] = 0x0;
@@ -3093,7 +3231,7 @@ void bx_hard_drive_c::identify_drive(Bit8u channel)
   BX_SELECTED_DRIVE(channel).id_drive[86] = (1 << 14) | (1 << 13) | (1 << 12) | (1 << 10);
   BX_SELECTED_DRIVE(channel).id_drive[87] = 1 << 14;
 
-  if (BX_HD_THIS bmdma_present()) {
+  if (BX_HD_THIS dma_present(channel)) {
     BX_SELECTED_DRIVE(channel).id_drive[88] = 0x3f | (BX_SELECTED_CONTROLLER(channel).udma_mode << 8);
   } else {
     BX_SELECTED_DRIVE(channel).id_drive[88] = 0x0;
@@ -3233,6 +3371,9 @@ bx_hard_drive_c::raise_interrupt(Bit8u channel)
 #if BX_SUPPORT_PCI
     DEV_ide_bmdma_set_irq(channel);
 #endif
+    if (BX_HD_THIS channels[channel].bmdma.ioaddr != 0) {
+      BX_HD_THIS channels[channel].bmdma.status |= 0x04;
+    }
     DEV_pic_raise_irq(irq);
   } else {
     BX_DEBUG(("not raising interrupt {%s}", BX_SELECTED_TYPE_STRING(channel)));
@@ -3346,13 +3487,23 @@ bx_bool bx_hard_drive_c::bmdma_present(void)
   return 0;
 }
 
+bx_bool bx_hard_drive_c::dma_present(Bit8u channel)
+{
+  return (BX_HD_THIS bmdma_present() || (BX_HD_THIS channels[channel].bmdma.ioaddr != 0));
+}
+
 #if BX_SUPPORT_PCI
 bx_bool bx_hard_drive_c::bmdma_read_sector(Bit8u channel, Bit8u *buffer, Bit32u *sector_size)
 {
   if ((BX_SELECTED_CONTROLLER(channel).current_command == 0xC8) ||
       (BX_SELECTED_CONTROLLER(channel).current_command == 0x25)) {
-    *sector_size = 512;
-    if (!ide_read_sector(channel, buffer, 512)) {
+    // read as many of the remaining sectors as the request takes
+    Bit32u sectors = *sector_size / 512;
+    if (sectors > BX_SELECTED_CONTROLLER(channel).num_sectors)
+      sectors = BX_SELECTED_CONTROLLER(channel).num_sectors;
+    if (sectors == 0) sectors = 1;
+    *sector_size = sectors * 512;
+    if (!ide_read_sector(channel, buffer, *sector_size)) {
       return 0;
     }
   } else if (BX_SELECTED_CONTROLLER(channel).current_command == 0xA0) {
@@ -3410,6 +3561,7 @@ bx_bool bx_hard_drive_c::bmdma_write_sector(Bit8u channel, Bit8u *buffer)
   }
   return 1;
 }
+#endif
 
 void bx_hard_drive_c::bmdma_complete(Bit8u channel)
 {
@@ -3428,7 +3580,264 @@ void bx_hard_drive_c::bmdma_complete(Bit8u channel)
   }
   raise_interrupt(channel);
 }
-#endif
+
+// Bus master DMA for the hard disks of a channel without the PCI IDE
+// controller. The registers are the ones of one PIIX3 channel: command at
+// offset 0, status at offset 2 and the descriptor table pointer at offset 4.
+// A READ/WRITE DMA command runs as soon as both the command is issued and
+// the bus master is started, in one transfer between the image and the
+// memory described by the descriptor table.
+
+// static IO port read callback handler
+// redirects to non-static class handler to avoid virtual functions
+Bit32u bx_hard_drive_c::bmdma_read_handler(void *this_ptr, Bit32u address, unsigned io_len)
+{
+#if !BX_USE_HD_SMF
+  bx_hard_drive_c *class_ptr = (bx_hard_drive_c *) this_ptr;
+  return class_ptr->bmdma_read(address, io_len);
+}
+
+Bit32u bx_hard_drive_c::bmdma_read(Bit32u address, unsigned io_len)
+{
+#else
+  UNUSED(this_ptr);
+#endif  // !BX_USE_HD_SMF
+  Bit8u channel;
+  Bit32u value = 0xffffffff;
+
+  for (channel=0; channel<BX_MAX_ATA_CHANNEL; channel++) {
+    if ((address & ~(BX_HD_BMDMA_PORTS-1)) == BX_HD_THIS channels[channel].bmdma.ioaddr)
+      break;
+  }
+  if (channel == BX_MAX_ATA_CHANNEL) {
+    BX_PANIC(("bmdma_read: unable to find ATA channel, ioport=0x%04x", address));
+    return value;
+  }
+
+  switch (address & (BX_HD_BMDMA_PORTS-1)) {
+    case 0x00:
+      value = BX_HD_THIS channels[channel].bmdma.command;
+      break;
+    case 0x02:
+      value = BX_HD_THIS channels[channel].bmdma.status;
+      break;
+    case 0x04:
+      value = BX_HD_THIS channels[channel].bmdma.prd;
+      break;
+  }
+  BX_DEBUG(("ata%d: BM-DMA read register 0x%04x, value = 0x%08x", channel, address, value));
+  return value;
+}
+
+// static IO port write callback handler
+// redirects to non-static class handler to avoid virtual functions
+void bx_hard_drive_c::bmdma_write_handler(void *this_ptr, Bit32u address, Bit32u value, unsigned io_len)
+{
+#if !BX_USE_HD_SMF
+  bx_hard_drive_c *class_ptr = (bx_hard_drive_c *) this_ptr;
+  class_ptr->bmdma_write(address, value, io_len);
+}
+
+void bx_hard_drive_c::bmdma_write(Bit32u address, Bit32u value, unsigned io_len)
+{
+#else
+  UNUSED(this_ptr);
+#endif  // !BX_USE_HD_SMF
+  Bit8u channel;
+
+  for (channel=0; channel<BX_MAX_ATA_CHANNEL; channel++) {
+    if ((address & ~(BX_HD_BMDMA_PORTS-1)) == BX_HD_THIS channels[channel].bmdma.ioaddr)
+      break;
+  }
+  if (channel == BX_MAX_ATA_CHANNEL) {
+    BX_PANIC(("bmdma_write: unable to find ATA channel, ioport=0x%04x", address));
+    return;
+  }
+  BX_DEBUG(("ata%d: BM-DMA write register 0x%04x, value = 0x%08x", channel, address, value));
+
+  switch (address & (BX_HD_BMDMA_PORTS-1)) {
+    case 0x00:
+      if ((value & 0x01) && !(BX_HD_THIS channels[channel].bmdma.command & 0x01)) {
+        BX_HD_THIS channels[channel].bmdma.command = value & 0x09;
+        BX_HD_THIS channels[channel].bmdma.status |= 0x01;
+        bmdma_start(channel);
+      } else {
+        if (!(value & 0x01)) {
+          BX_HD_THIS channels[channel].bmdma.status &= ~0x01;
+        }
+        BX_HD_THIS channels[channel].bmdma.command = value & 0x09;
+      }
+      break;
+    case 0x02:
+      BX_HD_THIS channels[channel].bmdma.status = (value & 0x60)
+        | (BX_HD_THIS channels[channel].bmdma.status & 0x01)
+        | (BX_HD_THIS channels[channel].bmdma.status & (~value & 0x06));
+      break;
+    case 0x04:
+      BX_HD_THIS channels[channel].bmdma.prd = value & 0xfffffffc;
+      break;
+  }
+}
+
+// Collect the memory of the descriptor table for a transfer of size bytes
+// in bmdma_span and return the number of bytes it covers. If all of it is
+// host memory in whole sectors, bmdma_iov describes it and *iovcnt is the
+// number of entries, otherwise *iovcnt is 0. *prd_end tells whether the
+// transfer ends with the last descriptor.
+Bit32u bx_hard_drive_c::bmdma_map(Bit8u channel, Bit32u size, bx_bool write,
+                                  int *spans, int *iovcnt, bx_bool *prd_end)
+{
+  bx_phy_address prd = BX_HD_THIS channels[channel].bmdma.prd;
+  Bit32u total = 0, len;
+  bx_bool direct = 1, eot = 0;
+  int i, n = 0, iov = 0;
+  struct {
+    Bit32u addr;
+    Bit32u size;
+  } desc;
+
+  *prd_end = 0;
+  while ((total < size) && !eot) {
+    DEV_MEM_READ_PHYSICAL(prd, 4, (Bit8u *)&desc.addr);
+    DEV_MEM_READ_PHYSICAL(prd+4, 4, (Bit8u *)&desc.size);
+    prd += 8;
+    eot = (desc.size & 0x80000000) != 0;
+    len = desc.size & 0xfffe;
+    if (len == 0) {
+      len = 0x10000;
+    }
+    *prd_end = eot;
+    if (len > size - total) {
+      len = size - total;
+      *prd_end = 0;
+    }
+
+    if (n == BX_HD_THIS bmdma_span_size) {
+      BX_HD_THIS bmdma_span_size = n ? n * 2 : 16;
+      BX_HD_THIS bmdma_span = (bmdma_span_t *)realloc(BX_HD_THIS bmdma_span,
+        BX_HD_THIS bmdma_span_size * sizeof(bmdma_span_t));
+    }
+    BX_HD_THIS bmdma_span[n].addr = desc.addr & ~1;
+    BX_HD_THIS bmdma_span[n].len = len;
+    n++;
+
+    // pages which follow each other in the host memory share one entry
+    for (Bit32u offset = 0; direct && (offset < len); ) {
+      bx_phy_address addr = (desc.addr & ~1) + offset;
+      Bit32u chunk = 0x1000 - (Bit32u)(addr & 0xfff);
+      if (chunk > len - offset) chunk = len - offset;
+      // the device reads the memory for a disk write
+      Bit8u *host = DEV_MEM_GET_HOST_ADDR(addr, write ? BX_READ : BX_WRITE);
+      if (host == NULL) {
+        direct = 0;
+      } else if ((iov > 0) &&
+                 ((Bit8u *)BX_HD_THIS bmdma_iov[iov-1].iov_base + BX_HD_THIS bmdma_iov[iov-1].iov_len == host)) {
+        BX_HD_THIS bmdma_iov[iov-1].iov_len += chunk;
+      } else {
+        if (iov == BX_HD_THIS bmdma_iov_size) {
+          BX_HD_THIS bmdma_iov_size = iov ? iov * 2 : 16;
+          BX_HD_THIS bmdma_iov = (struct iovec *)realloc(BX_HD_THIS bmdma_iov,
+            BX_HD_THIS bmdma_iov_size * sizeof(struct iovec));
+        }
+        BX_HD_THIS bmdma_iov[iov].iov_base = host;
+        BX_HD_THIS bmdma_iov[iov].iov_len = chunk;
+        iov++;
+      }
+      offset += chunk;
+    }
+    total += len;
+  }
+
+  for (i = 0; direct && (i < iov); i++) {
+    if (BX_HD_THIS bmdma_iov[i].iov_len & 511)
+      direct = 0;
+  }
+  *spans = n;
+  *iovcnt = direct ? iov : 0;
+  return total;
+}
+
+void bx_hard_drive_c::bmdma_start(Bit8u channel)
+{
+  bx_bool write, prd_end, ret;
+  int i, spans, iovcnt;
+  Bit32u offset;
+
+  if (!(BX_HD_THIS channels[channel].bmdma.status & 0x01) ||
+      !BX_SELECTED_IS_HD(channel) || !BX_SELECTED_CONTROLLER(channel).status.drq)
+    return;
+
+  switch (BX_SELECTED_CONTROLLER(channel).current_command) {
+    case 0x25: // READ DMA EXT
+    case 0xC8: // READ DMA
+      write = 0;
+      break;
+    case 0x35: // WRITE DMA EXT
+    case 0xCA: // WRITE DMA
+      write = 1;
+      break;
+    default:
+      return;
+  }
+
+  Bit32u size = BX_SELECTED_CONTROLLER(channel).num_sectors * 512;
+  if (bmdma_map(channel, size, write, &spans, &iovcnt, &prd_end) < size) {
+    BX_ERROR(("ata%d: BM-DMA descriptor table too short for %u sectors", channel,
+              BX_SELECTED_CONTROLLER(channel).num_sectors));
+    BX_HD_THIS channels[channel].bmdma.status &= ~0x01;
+    BX_HD_THIS channels[channel].bmdma.status |= 0x06;
+    return;
+  }
+  BX_DEBUG(("ata%d: BM-DMA %s of %u bytes in %d spans (%s)", channel, write ? "write" : "read",
+            size, spans, iovcnt ? "direct" : "buffered"));
+
+  if (iovcnt > 0) {
+    if (write)
+      ret = ide_write_sectors(channel, BX_HD_THIS bmdma_iov, iovcnt, size);
+    else
+      ret = ide_read_sectors(channel, BX_HD_THIS bmdma_iov, iovcnt, size);
+  } else {
+    // memory without a host address, or spans which split a sector
+    struct iovec iov;
+
+    if (size > BX_HD_THIS bmdma_bounce_size) {
+      if (BX_HD_THIS bmdma_bounce != NULL) delete [] BX_HD_THIS bmdma_bounce;
+      BX_HD_THIS bmdma_bounce = new Bit8u[size];
+      BX_HD_THIS bmdma_bounce_size = size;
+    }
+    iov.iov_base = BX_HD_THIS bmdma_bounce;
+    iov.iov_len = size;
+    if (write) {
+      for (i = 0, offset = 0; i < spans; i++) {
+        DEV_MEM_READ_PHYSICAL_BLOCK(BX_HD_THIS bmdma_span[i].addr, BX_HD_THIS bmdma_span[i].len,
+                                    BX_HD_THIS bmdma_bounce + offset);
+        offset += BX_HD_THIS bmdma_span[i].len;
+      }
+      ret = ide_write_sectors(channel, &iov, 1, size);
+    } else {
+      ret = ide_read_sectors(channel, &iov, 1, size);
+      if (ret) {
+        for (i = 0, offset = 0; i < spans; i++) {
+          DEV_MEM_WRITE_PHYSICAL_BLOCK(BX_HD_THIS bmdma_span[i].addr, BX_HD_THIS bmdma_span[i].len,
+                                       BX_HD_THIS bmdma_bounce + offset);
+          offset += BX_HD_THIS bmdma_span[i].len;
+        }
+      }
+    }
+  }
+
+  if (!ret) {
+    // the command has been aborted
+    BX_HD_THIS channels[channel].bmdma.status &= ~0x01;
+    BX_HD_THIS channels[channel].bmdma.status |= 0x02;
+    return;
+  }
+  // the bus master stays active if the descriptor table is longer
+  if (prd_end) {
+    BX_HD_THIS channels[channel].bmdma.status &= ~0x01;
+  }
+  BX_HD_THIS bmdma_complete(channel);
+}
 
 void bx_hard_drive_c::set_signature(Bit8u channel, Bit8u id)
 {
@@ -3446,80 +3855,199 @@ void bx_hard_drive_c::set_signature(Bit8u channel, Bit8u id)
   }
 }
 
-bx_bool bx_hard_drive_c::ide_read_sector(Bit8u channel, Bit8u *buffer, Bit32u buffer_size)
+// The sectors of a transfer follow each other on the disk, so all of them
+// are read or written with a single call of the image.
+// Find the first sector of a transfer of buffer_size bytes and advance the
+// address over it. Returns 0 and the invalid sector if it runs off the disk.
+bx_bool bx_hard_drive_c::ide_sector_range(Bit8u channel, Bit32u buffer_size, Bit64s *sector)
 {
-  Bit64s logical_sector = 0;
-  Bit64s ret;
+  Bit64s logical_sector = 0, first_sector = 0;
 
   int sector_count = (buffer_size / 512);
-  Bit8u *bufptr = buffer;
+  int count = 0;
   do {
     if (!calculate_logical_address(channel, &logical_sector)) {
-      BX_ERROR(("ide_read_sector() reached invalid sector %lu, aborting", (unsigned long)logical_sector));
-      command_aborted(channel, BX_SELECTED_CONTROLLER(channel).current_command);
-      return 0;
-    }
-    ret = BX_SELECTED_DRIVE(channel).hard_drive->lseek(logical_sector * 512, SEEK_SET);
-    if (ret < 0) {
-      BX_ERROR(("could not lseek() hard drive image file"));
-      command_aborted(channel, BX_SELECTED_CONTROLLER(channel).current_command);
-      return 0;
-    }
-    /* set status bar conditions for device */
-    if (!BX_SELECTED_DRIVE(channel).iolight_counter)
-      bx_gui->statusbar_setitem(BX_SELECTED_DRIVE(channel).statusbar_id, 1);
-    BX_SELECTED_DRIVE(channel).iolight_counter = 5;
-    bx_pc_system.activate_timer(BX_HD_THIS iolight_timer_index, 100000, 0);
-    ret = BX_SELECTED_DRIVE(channel).hard_drive->read((bx_ptr_t)bufptr, 512);
-    if (ret < 512) {
-      BX_ERROR(("could not read() hard drive image file at byte %lu", (unsigned long)logical_sector*512));
-      command_aborted(channel, BX_SELECTED_CONTROLLER(channel).current_command);
+      *sector = logical_sector;
       return 0;
     }
+    if (count == 0) first_sector = logical_sector;
     increment_address(channel);
-    bufptr += 512;
-  } while (--sector_count > 0);
+  } while (++count < sector_count);
 
+  *sector = first_sector;
   return 1;
 }
 
+bx_bool bx_hard_drive_c::ide_read_sector(Bit8u channel, Bit8u *buffer, Bit32u buffer_size)
+{
+  struct iovec iov;
+
+  iov.iov_base = buffer;
+  iov.iov_len = (buffer_size / 512) * 512;
+  return ide_read_sectors(channel, &iov, 1, iov.iov_len);
+}
+
 bx_bool bx_hard_drive_c::ide_write_sector(Bit8u channel, Bit8u *buffer, Bit32u buffer_size)
 {
-  Bit64s logical_sector = 0;
-  Bit64s ret;
+  struct iovec iov;
 
-  int sector_count = (buffer_size / 512);
-  Bit8u *bufptr = buffer;
-  do {
-    if (!calculate_logical_address(channel, &logical_sector)) {
-      BX_ERROR(("ide_write_sector() reached invalid sector %lu, aborting", (unsigned long)logical_sector));
-      command_aborted(channel, BX_SELECTED_CONTROLLER(channel).current_command);
-      return 0;
-    }
-    ret = BX_SELECTED_DRIVE(channel).hard_drive->lseek(logical_sector * 512, SEEK_SET);
-    if (ret < 0) {
-      BX_ERROR(("could not lseek() hard drive image file at byte %lu", (unsigned long)logical_sector * 512));
-      command_aborted(channel, BX_SELECTED_CONTROLLER(channel).current_command);
-      return 0;
-    }
-    /* set status bar conditions for device */
-    if (!BX_SELECTED_DRIVE(channel).iolight_counter)
-      bx_gui->statusbar_setitem(BX_SELECTED_DRIVE(channel).statusbar_id, 1, 1 /* write */);
-    BX_SELECTED_DRIVE(channel).iolight_counter = 5;
-    bx_pc_system.activate_timer(BX_HD_THIS iolight_timer_index, 100000, 0);
-    ret = BX_SELECTED_DRIVE(channel).hard_drive->write((bx_ptr_t)bufptr, 512);
-    if (ret < 512) {
-      BX_ERROR(("could not write() hard drive image file at byte %lu", (unsigned long)logical_sector*512));
-      command_aborted(channel, BX_SELECTED_CONTROLLER(channel).current_command);
-      return 0;
+  iov.iov_base = buffer;
+  iov.iov_len = (buffer_size / 512) * 512;
+  return ide_write_sectors(channel, &iov, 1, iov.iov_len);
+}
+
+// Read the next size / 512 sectors of the command to the buffers of iov
+bx_bool bx_hard_drive_c::ide_read_sectors(Bit8u channel, const struct iovec *iov, int iovcnt, Bit32u size)
+{
+  Bit64s first_sector = 0;
+  ssize_t ret;
+
+  if (!ide_sector_range(channel, size, &first_sector)) {
+    BX_ERROR(("ide_read_sector() reached invalid sector %lu, aborting", (unsigned long)first_sector));
+    command_aborted(channel, BX_SELECTED_CONTROLLER(channel).current_command);
+    return 0;
+  }
+
+  /* set status bar conditions for device */
+  if (!BX_SELECTED_DRIVE(channel).iolight_counter)
+    bx_gui->statusbar_setitem(BX_SELECTED_DRIVE(channel).statusbar_id, 1);
+  BX_SELECTED_DRIVE(channel).iolight_counter = 5;
+  bx_pc_system.activate_timer(BX_HD_THIS iolight_timer_index, 100000, 0);
+  ret = BX_SELECTED_DRIVE(channel).hard_drive->read_sectors(first_sector * 512, iov, iovcnt);
+  if (ret < (ssize_t)size) {
+    BX_ERROR(("could not read() hard drive image file at byte %lu", (unsigned long)first_sector*512));
+    command_aborted(channel, BX_SELECTED_CONTROLLER(channel).current_command);
+    return 0;
+  }
+
+  return 1;
+}
+
+// Write the next size / 512 sectors of the command from the buffers of iov
+bx_bool bx_hard_drive_c::ide_write_sectors(Bit8u channel, const struct iovec *iov, int iovcnt, Bit32u size)
+{
+  Bit64s first_sector = 0;
+  ssize_t ret;
+
+  if (!ide_sector_range(channel, size, &first_sector)) {
+    BX_ERROR(("ide_write_sector() reached invalid sector %lu, aborting", (unsigned long)first_sector));
+    command_aborted(channel, BX_SELECTED_CONTROLLER(channel).current_command);
+    return 0;
+  }
+
+  /* set status bar conditions for device */
+  if (!BX_SELECTED_DRIVE(channel).iolight_counter)
+    bx_gui->statusbar_setitem(BX_SELECTED_DRIVE(channel).statusbar_id, 1, 1 /* write */);
+  BX_SELECTED_DRIVE(channel).iolight_counter = 5;
+  bx_pc_system.activate_timer(BX_HD_THIS iolight_timer_index, 100000, 0);
+  ret = BX_SELECTED_DRIVE(channel).hard_drive->write_sectors(first_sector * 512, iov, iovcnt);
+  if (ret < (ssize_t)size) {
+    BX_ERROR(("could not write() hard drive image file at byte %lu", (unsigned long)first_sector*512));
+    command_aborted(channel, BX_SELECTED_CONTROLLER(channel).current_command);
+    return 0;
+  }
+
+  return 1;
+}
+
+void bx_hard_drive_c::ide_write_sector_done(Bit8u channel)
+{
+  if ((BX_SELECTED_CONTROLLER(channel).current_command == 0xC5) ||
+      (BX_SELECTED_CONTROLLER(channel).current_command == 0x39)) {
+    if (BX_SELECTED_CONTROLLER(channel).num_sectors > BX_SELECTED_CONTROLLER(channel).multiple_sectors) {
+      BX_SELECTED_CONTROLLER(channel).buffer_size = BX_SELECTED_CONTROLLER(channel).multiple_sectors * 512;
+    } else {
+      BX_SELECTED_CONTROLLER(channel).buffer_size = BX_SELECTED_CONTROLLER(channel).num_sectors * 512;
     }
-    increment_address(channel);
-    bufptr += 512;
-  } while (--sector_count > 0);
+  }
+  BX_SELECTED_CONTROLLER(channel).buffer_index = 0;
+
+  /* When the write is complete, controller clears the DRQ bit and
+   * sets the BSY bit.
+   * If at least one more sector is to be written, controller sets DRQ bit,
+   * clears BSY bit, and issues IRQ
+   */
+
+  if (BX_SELECTED_CONTROLLER(channel).num_sectors != 0) {
+    BX_SELECTED_CONTROLLER(channel).status.busy = 0;
+    BX_SELECTED_CONTROLLER(channel).status.drive_ready = 1;
+    BX_SELECTED_CONTROLLER(channel).status.drq = 1;
+    BX_SELECTED_CONTROLLER(channel).status.corrected_data = 0;
+    BX_SELECTED_CONTROLLER(channel).status.err = 0;
+  } else { /* no more sectors to write */
+    BX_SELECTED_CONTROLLER(channel).status.busy = 0;
+    BX_SELECTED_CONTROLLER(channel).status.drive_ready = 1;
+    BX_SELECTED_CONTROLLER(channel).status.drq = 0;
+    BX_SELECTED_CONTROLLER(channel).status.err = 0;
+    BX_SELECTED_CONTROLLER(channel).status.corrected_data = 0;
+  }
+  raise_interrupt(channel);
+}
+
+#if BX_SUPPORT_ASYNC_DISK
+// Start the transfer of the controller buffer on the I/O thread of the
+// drive. BSY stays set until ide_async_complete() is called for it by the
+// timer the I/O thread posts or by the next register access. Returns 0 if
+// the drive does its transfers synchronously.
+bx_bool bx_hard_drive_c::ide_async_start(Bit8u channel, bx_bool write)
+{
+  Bit64s first_sector = 0;
+  Bit32u buffer_size = BX_SELECTED_CONTROLLER(channel).buffer_size;
+
+  if (BX_SELECTED_DRIVE(channel).async.io == NULL)
+    return 0;
 
+  if (!ide_sector_range(channel, buffer_size, &first_sector)) {
+    BX_ERROR(("ide_async_start() reached invalid sector %lu, aborting", (unsigned long)first_sector));
+    command_aborted(channel, BX_SELECTED_CONTROLLER(channel).current_command);
+    return 1;
+  }
+
+  /* set status bar conditions for device */
+  if (!BX_SELECTED_DRIVE(channel).iolight_counter)
+    bx_gui->statusbar_setitem(BX_SELECTED_DRIVE(channel).statusbar_id, 1, write);
+  BX_SELECTED_DRIVE(channel).iolight_counter = 5;
+  bx_pc_system.activate_timer(BX_HD_THIS iolight_timer_index, 100000, 0);
+
+  BX_SELECTED_CONTROLLER(channel).status.busy = 1;
+  BX_SELECTED_CONTROLLER(channel).status.drq = 0;
+  BX_SELECTED_DRIVE(channel).async.pending = 1;
+  BX_SELECTED_DRIVE(channel).async.write = write;
+  BX_SELECTED_DRIVE(channel).async.offset = first_sector * 512;
+  BX_SELECTED_DRIVE(channel).async.size = buffer_size;
+  BX_SELECTED_DRIVE(channel).async.io->submit(write, first_sector * 512,
+    BX_SELECTED_CONTROLLER(channel).buffer, buffer_size);
   return 1;
 }
 
+void bx_hard_drive_c::ide_async_complete(Bit8u channel, ssize_t ret)
+{
+  BX_SELECTED_DRIVE(channel).async.pending = 0;
+
+  if (ret < (ssize_t)BX_SELECTED_DRIVE(channel).async.size) {
+    BX_ERROR(("could not %s hard drive image file at byte %lu",
+              BX_SELECTED_DRIVE(channel).async.write ? "write()" : "read()",
+              (unsigned long)BX_SELECTED_DRIVE(channel).async.offset));
+    command_aborted(channel, BX_SELECTED_CONTROLLER(channel).current_command);
+    return;
+  }
+
+  if (BX_SELECTED_DRIVE(channel).async.write) {
+    ide_write_sector_done(channel);
+  } else {
+    BX_SELECTED_CONTROLLER(channel).error_register = 0;
+    BX_SELECTED_CONTROLLER(channel).status.busy = 0;
+    BX_SELECTED_CONTROLLER(channel).status.drive_ready = 1;
+    BX_SELECTED_CONTROLLER(channel).status.seek_complete = 1;
+    BX_SELECTED_CONTROLLER(channel).status.drq = 1;
+    BX_SELECTED_CONTROLLER(channel).status.corrected_data = 0;
+    BX_SELECTED_CONTROLLER(channel).status.err = 0;
+    BX_SELECTED_CONTROLLER(channel).buffer_index = 0;
+    raise_interrupt(channel);
+  }
+}
+#endif
+
 void bx_hard_drive_c::lba48_transform(Bit8u channel, bx_bool lba48)
 {
   BX_SELECTED_CONTROLLER(channel).lba48 = lba48;
@@ -23,6 +23,13 @@
 
 #define MAX_MULTIPLE_SECTORS 16
 
+// delay of the completion of an asynchronous transfer, after the I/O
+// thread has posted it
+#define BX_HD_ASYNC_COMPLETE_USEC 10
+
+// number of I/O ports of the bus master registers of an ATA channel
+#define BX_HD_BMDMA_PORTS 8
+
 typedef enum _sense {
       SENSE_NONE = 0, SENSE_NOT_READY = 2, SENSE_ILLEGAL_REQUEST = 5,
       SENSE_UNIT_ATTENTION = 6
@@ -38,6 +45,8 @@ typedef enum _asc {
 } asc_t;
 
 class device_image_t;
+class async_io_t;
+struct iovec;
 class LOWLEVEL_CDROM;
 
 typedef struct {
@@ -175,9 +184,10 @@ public:
 #if BX_SUPPORT_PCI
   virtual bx_bool  bmdma_read_sector(Bit8u channel, Bit8u *buffer, Bit32u *sector_size);
   virtual bx_bool  bmdma_write_sector(Bit8u channel, Bit8u *buffer);
-  virtual void     bmdma_complete(Bit8u channel);
 #endif
+  virtual void     bmdma_complete(Bit8u channel);
   virtual void     register_state(void);
+  virtual void     after_restore_state(void);
 
   virtual Bit32u virt_read_handler(Bit32u address, unsigned io_len)
   {
@@ -196,8 +206,21 @@ public:
   static Bit32u read_handler(void *this_ptr, Bit32u address, unsigned io_len);
   static void   write_handler(void *this_ptr, Bit32u address, Bit32u value, unsigned io_len);
 
+#if !BX_USE_HD_SMF
+  Bit32u bmdma_read(Bit32u address, unsigned io_len);
+  void   bmdma_write(Bit32u address, Bit32u value, unsigned io_len);
+#endif
+
+  static Bit32u bmdma_read_handler(void *this_ptr, Bit32u address, unsigned io_len);
+  static void   bmdma_write_handler(void *this_ptr, Bit32u address, Bit32u value, unsigned io_len);
+
   static void iolight_timer_handler(void *);
   BX_HD_SMF void iolight_timer(void);
+#if BX_SUPPORT_ASYNC_DISK
+  static void async_notify_handler(void *);
+  static void async_timer_handler(void *);
+  BX_HD_SMF void async_timer(void);
+#endif
 
 private:
 
@@ -214,9 +237,21 @@ private:
   BX_HD_SMF void init_mode_sense_single(Bit8u channel, const void* src, int size);
   BX_HD_SMF void atapi_cmd_nop(Bit8u channel) BX_CPP_AttrRegparmN(1);
   BX_HD_SMF bx_bool bmdma_present(void);
+  BX_HD_SMF bx_bool dma_present(Bit8u channel);
+  BX_HD_SMF void bmdma_start(Bit8u channel);
+  BX_HD_SMF Bit32u bmdma_map(Bit8u channel, Bit32u size, bx_bool write,
+                             int *spans, int *iovcnt, bx_bool *prd_end);
   BX_HD_SMF void set_signature(Bit8u channel, Bit8u id);
+  BX_HD_SMF bx_bool ide_sector_range(Bit8u channel, Bit32u buffer_size, Bit64s *sector);
   BX_HD_SMF bx_bool ide_read_sector(Bit8u channel, Bit8u *buffer, Bit32u buffer_size);
   BX_HD_SMF bx_bool ide_write_sector(Bit8u channel, Bit8u *buffer, Bit32u buffer_size);
+  BX_HD_SMF bx_bool ide_read_sectors(Bit8u channel, const struct iovec *iov, int iovcnt, Bit32u size);
+  BX_HD_SMF bx_bool ide_write_sectors(Bit8u channel, const struct iovec *iov, int iovcnt, Bit32u size);
+  BX_HD_SMF void ide_write_sector_done(Bit8u channel);
+#if BX_SUPPORT_ASYNC_DISK
+  BX_HD_SMF bx_bool ide_async_start(Bit8u channel, bx_bool write);
+  BX_HD_SMF void ide_async_complete(Bit8u channel, ssize_t ret);
+#endif
   BX_HD_SMF void lba48_transform(Bit8u channel, bx_bool lba48);
 
   // FIXME:
@@ -242,6 +277,15 @@ private:
       int statusbar_id;
       int iolight_counter;
       Bit8u device_num; // for ATAPI identify & inquiry
+#if BX_SUPPORT_ASYNC_DISK
+      struct {
+        async_io_t *io;   // NULL if the transfers are synchronous
+        bx_bool pending;  // a transfer is in progress, BSY is set
+        bx_bool write;
+        Bit64s  offset;
+        Bit32u  size;
+      } async;
+#endif
     } drives[2];
     unsigned drive_select;
 
@@ -249,9 +293,31 @@ private:
     Bit16u ioaddr2;
     Bit8u  irq;
 
+    // bus master DMA registers without the PCI IDE controller
+    struct {
+      Bit16u ioaddr;   // 0 if not present
+      Bit8u  command;
+      Bit8u  status;
+      Bit32u prd;      // physical address of the descriptor table
+    } bmdma;
+
   } channels[BX_MAX_ATA_CHANNEL];
 
+  // memory spans of the current bus master transfer
+  struct bmdma_span_t {
+    bx_phy_address addr;
+    Bit32u len;
+  } *bmdma_span;
+  int bmdma_span_size;
+  struct iovec *bmdma_iov;
+  int bmdma_iov_size;
+  Bit8u *bmdma_bounce;
+  Bit32u bmdma_bounce_size;
+
   int iolight_timer_index;
+#if BX_SUPPORT_ASYNC_DISK
+  int async_timer_index;
+#endif
   Bit8u cdrom_count;
 };
 
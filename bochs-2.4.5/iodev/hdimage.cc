@@ -39,10 +39,56 @@
 device_image_t::device_image_t()
 {
   hd_size = 0;
+  use_mmap = 0;
+}
+
+// The image types handle one sector per read() or write() call, which
+// is why the sectors are positioned and transferred one by one here.
+ssize_t device_image_t::read_sectors(Bit64s offset, const struct iovec *iov, int iovcnt)
+{
+  ssize_t total = 0;
+
+  for (int i = 0; i < iovcnt; i++) {
+    char *buf = (char*) iov[i].iov_base;
+    for (size_t n = 0; n < iov[i].iov_len; n += 512) {
+      if (lseek(offset + total, SEEK_SET) < 0)
+        return -1;
+      if (read(buf + n, 512) < 512)
+        return -1;
+      total += 512;
+    }
+  }
+  return total;
+}
+
+ssize_t device_image_t::write_sectors(Bit64s offset, const struct iovec *iov, int iovcnt)
+{
+  ssize_t total = 0;
+
+  for (int i = 0; i < iovcnt; i++) {
+    const char *buf = (const char*) iov[i].iov_base;
+    for (size_t n = 0; n < iov[i].iov_len; n += 512) {
+      if (lseek(offset + total, SEEK_SET) < 0)
+        return -1;
+      if (write(buf + n, 512) < 512)
+        return -1;
+      total += 512;
+    }
+  }
+  return total;
 }
 
 /*** default_image_t function definitions ***/
 
+default_image_t::default_image_t()
+{
+  fd = -1;
+#ifdef _POSIX_MAPPED_FILES
+  mmap_data = NULL;
+  mmap_position = 0;
+#endif
+}
+
 int default_image_t::open(const char* pathname)
 {
   return open(pathname, O_RDWR);
@@ -89,31 +135,147 @@ int default_image_t::open(const char* pathname, int flags)
     BX_PANIC(("size of disk image must be multiple of 512 bytes"));
   }
 
+#ifdef _POSIX_MAPPED_FILES
+  if (use_mmap && (hd_size > 0)) {
+    if ((Bit64u)(size_t)hd_size != hd_size) {
+      BX_INFO(("image too large to be mapped, using read/write"));
+    } else {
+      int prot = ((flags & O_ACCMODE) == O_RDONLY) ? PROT_READ : (PROT_READ | PROT_WRITE);
+      void *data = ::mmap(NULL, (size_t)hd_size, prot, MAP_SHARED, fd, 0);
+      if (data == MAP_FAILED) {
+        BX_INFO(("failed to mmap hard drive image file: %d (%s), using read/write", errno, strerror(errno)));
+      } else {
+        mmap_data = (Bit8u*)data;
+        mmap_position = 0;
+        BX_INFO(("hard drive image mapped at %p", data));
+      }
+    }
+  }
+#endif
+
   return fd;
 }
 
 void default_image_t::close()
 {
+#ifdef _POSIX_MAPPED_FILES
+  if (mmap_data != NULL) {
+    ::munmap(mmap_data, (size_t)hd_size);
+    mmap_data = NULL;
+  }
+#endif
   if (fd > -1) {
     ::close(fd);
+    fd = -1;
   }
 }
 
 Bit64s default_image_t::lseek(Bit64s offset, int whence)
 {
+#ifdef _POSIX_MAPPED_FILES
+  if (mmap_data != NULL) {
+    if (whence == SEEK_CUR)
+      offset += mmap_position;
+    else if (whence == SEEK_END)
+      offset += (Bit64s)hd_size;
+    if (offset < 0) {
+      errno = EINVAL;
+      return -1;
+    }
+    mmap_position = offset;
+    return offset;
+  }
+#endif
   return (Bit64s)::lseek(fd, (off_t)offset, whence);
 }
 
 ssize_t default_image_t::read(void* buf, size_t count)
 {
+#ifdef _POSIX_MAPPED_FILES
+  if (mmap_data != NULL) {
+    if (mmap_position >= (Bit64s)hd_size)
+      return 0;
+    if ((Bit64u)(mmap_position + count) > hd_size)
+      count = (size_t)(hd_size - mmap_position);
+    memcpy(buf, mmap_data + mmap_position, count);
+    mmap_position += count;
+    return count;
+  }
+#endif
   return ::read(fd, (char*) buf, count);
 }
 
 ssize_t default_image_t::write(const void* buf, size_t count)
 {
+#ifdef _POSIX_MAPPED_FILES
+  // the mapping has the size of the image, writes beyond are refused
+  if (mmap_data != NULL) {
+    if ((Bit64u)(mmap_position + count) > hd_size) {
+      errno = ENOSPC;
+      return -1;
+    }
+    memcpy(mmap_data + mmap_position, buf, count);
+    mmap_position += count;
+    return count;
+  }
+#endif
   return ::write(fd, (char*) buf, count);
 }
 
+#if BX_HAVE_PREADV || defined(_POSIX_MAPPED_FILES)
+ssize_t default_image_t::read_sectors(Bit64s offset, const struct iovec *iov, int iovcnt)
+{
+#ifdef _POSIX_MAPPED_FILES
+  if (mmap_data != NULL) {
+    ssize_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+      if ((Bit64u)(offset + total + iov[i].iov_len) > hd_size)
+        return -1;
+      memcpy(iov[i].iov_base, mmap_data + offset + total, iov[i].iov_len);
+      total += iov[i].iov_len;
+    }
+    return total;
+  }
+#endif
+#if BX_HAVE_PREADV
+  return ::preadv(fd, iov, iovcnt, (off_t)offset);
+#else
+  return device_image_t::read_sectors(offset, iov, iovcnt);
+#endif
+}
+
+ssize_t default_image_t::write_sectors(Bit64s offset, const struct iovec *iov, int iovcnt)
+{
+#ifdef _POSIX_MAPPED_FILES
+  if (mmap_data != NULL) {
+    ssize_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+      if ((Bit64u)(offset + total + iov[i].iov_len) > hd_size)
+        return -1;
+      memcpy(mmap_data + offset + total, iov[i].iov_base, iov[i].iov_len);
+      total += iov[i].iov_len;
+    }
+    return total;
+  }
+#endif
+#if BX_HAVE_PREADV
+  return ::pwritev(fd, iov, iovcnt, (off_t)offset);
+#else
+  return device_image_t::write_sectors(offset, iov, iovcnt);
+#endif
+}
+#endif
+
+#ifdef _POSIX_MAPPED_FILES
+void default_image_t::flush()
+{
+  if (mmap_data != NULL) {
+    if (::msync(mmap_data, (size_t)hd_size, MS_SYNC) != 0)
+      BX_ERROR(("msync() of hard drive image failed: %s", strerror(errno)));
+  }
+}
+#endif
+
 char increment_string(char *str, int diff)
 {
   // find the last character of the string, and increment it.
@@ -268,8 +430,11 @@ sparse_image_t::sparse_image_t ()
   pathname = NULL;
 #ifdef _POSIX_MAPPED_FILES
   mmap_header = NULL;
+  mmap_data = NULL;
+  mmap_data_length = 0;
 #endif
   pagetable = NULL;
+  parent_image = NULL;
 }
 
 /*
@@ -338,7 +503,7 @@ void sparse_image_t::read_header()
 
 #ifdef _POSIX_MAPPED_FILES
 // Try to memory map from the beginning of the file (0 is trivially a page multiple)
- void * mmap_header = mmap(NULL, preamble_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+ mmap_header = mmap(NULL, preamble_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
  if (mmap_header == MAP_FAILED)
  {
    BX_INFO(("failed to mmap sparse disk file - using conventional file access"));
@@ -407,6 +572,32 @@ int sparse_image_t::open (const char* pathname0)
   if (-1 == ::lseek(fd, 0, SEEK_SET))
     panic("error while seeking to start of file");
 
+#ifdef _POSIX_MAPPED_FILES
+  if (use_mmap)
+  {
+    // Map the file as large as it can grow, so pages appended by write()
+    // are reachable without remapping. Only allocated pages are touched.
+    Bit64u max_filesize = (Bit64u)data_start + (Bit64u)total_size;
+    if ((Bit64u)(size_t)max_filesize != max_filesize)
+    {
+      BX_INFO(("sparse disk image too large to be mapped, using read/write"));
+    }
+    else
+    {
+      void * data = mmap(NULL, (size_t)max_filesize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (data == MAP_FAILED)
+      {
+        BX_INFO(("failed to mmap sparse disk file data - using conventional file access"));
+      }
+      else
+      {
+        mmap_data = (Bit8u *) data;
+        mmap_data_length = (size_t)max_filesize;
+      }
+    }
+  }
+#endif
+
   lseek(0, SEEK_SET);
 
   //showpagetable(pagetable, header.numpages);
@@ -420,6 +611,7 @@ int sparse_image_t::open (const char* pathname0)
     if (0 == stat(parentpathname, &stat_buf))
     {
       parent_image = new sparse_image_t();
+      parent_image->use_mmap = use_mmap;
       int ret = parent_image->open(parentpathname);
       if (ret != 0) return ret;
       if (    (parent_image->pagesize != pagesize)
@@ -445,6 +637,7 @@ void sparse_image_t::close()
   if (pathname != NULL)
   {
     free(pathname);
+    pathname = NULL;
   }
 #ifdef _POSIX_MAPPED_FILES
   if (mmap_header != NULL)
@@ -452,19 +645,29 @@ void sparse_image_t::close()
     int ret = munmap(mmap_header, mmap_length);
     if (ret != 0)
       BX_INFO(("failed to un-memory map sparse disk file"));
+    mmap_header = NULL;
+    pagetable = NULL; // We didn't malloc it
+  }
+  if (mmap_data != NULL)
+  {
+    munmap(mmap_data, mmap_data_length);
+    mmap_data = NULL;
   }
-  pagetable = NULL; // We didn't malloc it
 #endif
   if (fd > -1) {
     ::close(fd);
+    fd = -1;
   }
   if (pagetable != NULL)
   {
+    // allocated by read_header() when the header could not be mapped
     delete [] pagetable;
+    pagetable = NULL;
   }
   if (parent_image != NULL)
   {
     delete parent_image;
+    parent_image = NULL;
   }
 }
 
@@ -531,6 +734,14 @@ ssize_t sparse_image_t::read_page_fragment(Bit32u read_virtual_page, Bit32u read
   {
     Bit64s physical_offset = get_physical_offset();
 
+#ifdef _POSIX_MAPPED_FILES
+    if (mmap_data != NULL)
+    {
+      memcpy(buf, mmap_data + physical_offset, read_size);
+      return read_size;
+    }
+#endif
+
     if (physical_offset != underlying_current_filepos)
     {
       off_t ret = ::lseek(fd, (off_t)physical_offset, SEEK_SET);
@@ -703,28 +914,37 @@ ssize_t sparse_image_t::write (const void* buf, size_t count)
 
     Bit64s physical_offset = get_physical_offset();
 
-    if (physical_offset != underlying_current_filepos)
+#ifdef _POSIX_MAPPED_FILES
+    if (mmap_data != NULL)
     {
-      off_t ret = ::lseek(fd, (off_t)physical_offset, SEEK_SET);
-      // underlying_current_filepos update deferred
-      if (ret == -1)
-        panic(strerror(errno));
+      memcpy(mmap_data + physical_offset, buf, can_write);
     }
+    else
+#endif
+    {
+      if (physical_offset != underlying_current_filepos)
+      {
+        off_t ret = ::lseek(fd, (off_t)physical_offset, SEEK_SET);
+        // underlying_current_filepos update deferred
+        if (ret == -1)
+          panic(strerror(errno));
+      }
 
-    //printf("Writing at position %ld size %d\n", (long) physical_offset, can_write);
-    ssize_t writeret = ::write(fd, buf, can_write);
+      //printf("Writing at position %ld size %d\n", (long) physical_offset, can_write);
+      ssize_t writeret = ::write(fd, buf, can_write);
 
-    if (writeret == -1)
-    {
-      panic(strerror(errno));
-    }
+      if (writeret == -1)
+      {
+        panic(strerror(errno));
+      }
 
-    if ((size_t)writeret != can_write)
-    {
-      panic("could not write block contents to file");
-    }
+      if ((size_t)writeret != can_write)
+      {
+        panic("could not write block contents to file");
+      }
 
-    underlying_current_filepos = physical_offset + can_write;
+      underlying_current_filepos = physical_offset + can_write;
+    }
 
     total_written += can_write;
 
@@ -781,6 +1001,18 @@ ssize_t sparse_image_t::write (const void* buf, size_t count)
   return total_written;
 }
 
+#ifdef _POSIX_MAPPED_FILES
+void sparse_image_t::flush()
+{
+  // the block table and the data pages share the page cache of the file
+  if (mmap_data != NULL)
+  {
+    if (msync(mmap_data, (size_t)underlying_filesize, MS_SYNC) != 0)
+      panic(strerror(errno));
+  }
+}
+#endif
+
 #if DLL_HD_SUPPORT
 
 /*** dll_image_t function definitions ***/
@@ -858,7 +1090,10 @@ redolog_t::redolog_t()
 {
   fd = -1;
   catalog = NULL;
-  bitmap = NULL;
+  bitmaps = NULL;
+  bitmap_dirty = NULL;
+  catalog_dirty = 0;
+  file_size = 0;
   extent_index = (Bit32u)0;
   extent_offset = (Bit32u)0;
   extent_next = (Bit32u)0;
@@ -924,14 +1159,15 @@ int redolog_t::make_header(const char* type, Bit64u size)
   print_header();
 
   catalog = (Bit32u*)malloc(dtoh32(header.specific.catalog) * sizeof(Bit32u));
-  bitmap = (Bit8u*)malloc(dtoh32(header.specific.bitmap));
 
-  if ((catalog == NULL) || (bitmap==NULL))
-    BX_PANIC(("redolog : could not malloc catalog or bitmap"));
+  if (catalog == NULL)
+    BX_PANIC(("redolog : could not malloc catalog"));
 
   for (Bit32u i=0; i<dtoh32(header.specific.catalog); i++)
     catalog[i] = htod32(REDOLOG_PAGE_NOT_ALLOCATED);
 
+  init_bitmaps();
+
   bitmap_blocs = 1 + (dtoh32(header.specific.bitmap) - 1) / 512;
   extent_blocs = 1 + (dtoh32(header.specific.extent) - 1) / 512;
 
@@ -975,6 +1211,8 @@ int redolog_t::create(int filedes, const char* type, Bit64u size)
   // FIXME could mmap
   ::write(fd, catalog, dtoh32(header.specific.catalog) * sizeof (Bit32u));
 
+  file_size = (Bit64s)dtoh32(header.standard.header) + dtoh32(header.specific.catalog) * sizeof(Bit32u);
+
   return 0;
 }
 
@@ -1057,8 +1295,15 @@ int redolog_t::open(const char* filename, const char *type)
   }
   BX_INFO(("redolog : next extent will be at index %d",extent_next));
 
-  // memory used for storing bitmaps
-  bitmap = (Bit8u *)malloc(dtoh32(header.specific.bitmap));
+  struct stat stat_buf;
+  if (fstat(fd, &stat_buf) != 0)
+  {
+    BX_PANIC(("redolog : fstat() returns error!"));
+    return -1;
+  }
+  file_size = (Bit64s)stat_buf.st_size;
+
+  init_bitmaps();
 
   bitmap_blocs = 1 + (dtoh32(header.specific.bitmap) - 1) / 512;
   extent_blocs = 1 + (dtoh32(header.specific.extent) - 1) / 512;
@@ -1071,14 +1316,105 @@ int redolog_t::open(const char* filename, const char *type)
 
 void redolog_t::close()
 {
-  if (fd >= 0)
+  if (fd >= 0) {
+    flush();
     ::close(fd);
+    fd = -1;
+  }
 
-  if (catalog != NULL)
+  if (bitmaps != NULL) {
+    for (Bit32u i=0; i<dtoh32(header.specific.catalog); i++) {
+      if (bitmaps[i] != NULL)
+        free(bitmaps[i]);
+    }
+    free(bitmaps);
+    bitmaps = NULL;
+  }
+
+  if (bitmap_dirty != NULL) {
+    free(bitmap_dirty);
+    bitmap_dirty = NULL;
+  }
+
+  if (catalog != NULL) {
     free(catalog);
+    catalog = NULL;
+  }
+}
+
+// The extent bitmaps are loaded on first use and kept in memory. Modified
+// bitmaps and the catalog are written back by flush(), which is called when
+// the guest flushes the drive cache and when the redolog is closed.
+void redolog_t::init_bitmaps()
+{
+  bitmaps = (Bit8u**)calloc(dtoh32(header.specific.catalog), sizeof(Bit8u*));
+  bitmap_dirty = (Bit8u*)calloc(dtoh32(header.specific.catalog), 1);
+
+  if ((bitmaps == NULL) || (bitmap_dirty == NULL))
+    BX_PANIC(("redolog : could not malloc bitmap cache"));
+
+  catalog_dirty = 0;
+}
+
+Bit64s redolog_t::get_bitmap_offset(Bit32u index)
+{
+  Bit64s bitmap_offset;
+
+  bitmap_offset  = (Bit64s)STANDARD_HEADER_SIZE + (dtoh32(header.specific.catalog) * sizeof(Bit32u));
+  bitmap_offset += (Bit64s)512 * dtoh32(catalog[index]) * (extent_blocs + bitmap_blocs);
+
+  return bitmap_offset;
+}
+
+Bit8u *redolog_t::get_bitmap(Bit32u index)
+{
+  if (bitmaps[index] == NULL)
+  {
+    bitmaps[index] = (Bit8u*)malloc(dtoh32(header.specific.bitmap));
+    if (bitmaps[index] == NULL)
+      BX_PANIC(("redolog : could not malloc bitmap for extent %d", index));
+
+    Bit64s bitmap_offset = get_bitmap_offset(index);
+
+    BX_DEBUG(("redolog : loading bitmap of extent %d at offset %x", index, (Bit32u)bitmap_offset));
+
+    ::lseek(fd, (off_t)bitmap_offset, SEEK_SET);
+    if (::read(fd, bitmaps[index], dtoh32(header.specific.bitmap)) != (ssize_t)dtoh32(header.specific.bitmap))
+    {
+      BX_PANIC(("redolog : failed to read bitmap for extent %d", index));
+      memset(bitmaps[index], 0, dtoh32(header.specific.bitmap));
+    }
+  }
+
+  return bitmaps[index];
+}
+
+void redolog_t::flush()
+{
+  if ((fd < 0) || (bitmaps == NULL))
+    return;
 
-  if (bitmap != NULL)
-    free(bitmap);
+  for (Bit32u i=0; i<dtoh32(header.specific.catalog); i++)
+  {
+    if (bitmap_dirty[i])
+    {
+      ::lseek(fd, (off_t)get_bitmap_offset(i), SEEK_SET);
+      if (::write(fd, bitmaps[i], dtoh32(header.specific.bitmap)) != (ssize_t)dtoh32(header.specific.bitmap))
+        BX_PANIC(("redolog : failed to write bitmap for extent %d", i));
+      bitmap_dirty[i] = 0;
+    }
+  }
+
+  if (catalog_dirty)
+  {
+    BX_DEBUG(("redolog : writing catalog"));
+
+    ::lseek(fd, (off_t)STANDARD_HEADER_SIZE, SEEK_SET);
+    if (::write(fd, catalog, dtoh32(header.specific.catalog) * sizeof(Bit32u)) !=
+        (ssize_t)(dtoh32(header.specific.catalog) * sizeof(Bit32u)))
+      BX_PANIC(("redolog : failed to write catalog"));
+    catalog_dirty = 0;
+  }
 }
 
 Bit64u redolog_t::get_size()
@@ -1113,6 +1449,7 @@ Bit64s redolog_t::lseek(Bit64s offset, int whence)
 ssize_t redolog_t::read(void* buf, size_t count)
 {
   Bit64s bloc_offset, bitmap_offset;
+  Bit8u *bitmap;
 
   if (count != 512)
     BX_PANIC(("redolog : read HD with count not 512"));
@@ -1125,22 +1462,13 @@ ssize_t redolog_t::read(void* buf, size_t count)
     return 0;
   }
 
-  bitmap_offset  = (Bit64s)STANDARD_HEADER_SIZE + (dtoh32(header.specific.catalog) * sizeof(Bit32u));
-  bitmap_offset += (Bit64s)512 * dtoh32(catalog[extent_index]) * (extent_blocs + bitmap_blocs);
+  bitmap_offset  = get_bitmap_offset(extent_index);
   bloc_offset    = bitmap_offset + ((Bit64s)512 * (bitmap_blocs + extent_offset));
 
   BX_DEBUG(("redolog : bitmap offset is %x", (Bit32u)bitmap_offset));
   BX_DEBUG(("redolog : bloc offset is %x", (Bit32u)bloc_offset));
 
-  // FIXME if same extent_index as before we can skip bitmap read
-
-  ::lseek(fd, (off_t)bitmap_offset, SEEK_SET);
-
-  if (::read(fd, bitmap,  dtoh32(header.specific.bitmap)) != (ssize_t)dtoh32(header.specific.bitmap))
-  {
-    BX_PANIC(("redolog : failed to read bitmap for extent %d", extent_index));
-    return 0;
-  }
+  bitmap = get_bitmap(extent_index);
 
   if (((bitmap[extent_offset/8] >> (extent_offset%8)) & 0x01) == 0x00)
   {
@@ -1157,10 +1485,9 @@ ssize_t redolog_t::read(void* buf, size_t count)
 
 ssize_t redolog_t::write(const void* buf, size_t count)
 {
-  Bit32u i;
-  Bit64s bloc_offset, bitmap_offset, catalog_offset;
+  Bit64s bloc_offset, bitmap_offset;
   ssize_t written;
-  bx_bool update_catalog = 0;
+  Bit8u *bitmap;
 
   if (count != 512)
     BX_PANIC(("redolog : write HD with count not 512"));
@@ -1181,30 +1508,30 @@ ssize_t redolog_t::write(const void* buf, size_t count)
 
     extent_next += 1;
 
-    char *zerobuffer = (char*)malloc(512);
-    memset(zerobuffer, 0, 512);
-
-    // Write bitmap
-    bitmap_offset  = (Bit64s)STANDARD_HEADER_SIZE + (dtoh32(header.specific.catalog) * sizeof(Bit32u));
-    bitmap_offset += (Bit64s)512 * dtoh32(catalog[extent_index]) * (extent_blocs + bitmap_blocs);
-    ::lseek(fd, (off_t)bitmap_offset, SEEK_SET);
-    for (i=0; i<bitmap_blocs; i++)
-    {
-      ::write(fd, zerobuffer, 512);
-    }
-    // Write extent
-    for (i=0; i<extent_blocs; i++)
+    // Extend the file by the zeroed bitmap and extent in one step
+    Bit64s extent_end = get_bitmap_offset(extent_index) + (Bit64s)512 * (bitmap_blocs + extent_blocs);
+    if (extent_end > file_size)
     {
-      ::write(fd, zerobuffer, 512);
+#ifndef WIN32
+      if (::ftruncate(fd, (off_t)extent_end) < 0)
+        BX_PANIC(("redolog : failed to extend file for extent %d", extent_index));
+#else
+      char zero = 0;
+      ::lseek(fd, (off_t)(extent_end - 1), SEEK_SET);
+      ::write(fd, &zero, 1);
+#endif
+      file_size = extent_end;
     }
 
-    free(zerobuffer);
+    // The new bitmap is all zero, like the file contents
+    bitmaps[extent_index] = (Bit8u*)calloc(dtoh32(header.specific.bitmap), 1);
+    if (bitmaps[extent_index] == NULL)
+      BX_PANIC(("redolog : could not malloc bitmap for extent %d", extent_index));
 
-    update_catalog = 1;
+    catalog_dirty = 1;
   }
 
-  bitmap_offset  = (Bit64s)STANDARD_HEADER_SIZE + (dtoh32(header.specific.catalog) * sizeof(Bit32u));
-  bitmap_offset += (Bit64s)512 * dtoh32(catalog[extent_index]) * (extent_blocs + bitmap_blocs);
+  bitmap_offset  = get_bitmap_offset(extent_index);
   bloc_offset    = bitmap_offset + ((Bit64s)512 * (bitmap_blocs + extent_offset));
 
   BX_DEBUG(("redolog : bitmap offset is %x", (Bit32u)bitmap_offset));
@@ -1214,33 +1541,12 @@ ssize_t redolog_t::write(const void* buf, size_t count)
   ::lseek(fd, (off_t)bloc_offset, SEEK_SET);
   written = ::write(fd, buf, count);
 
-  // Write bitmap
-  // FIXME if same extent_index as before we can skip bitmap read
-  ::lseek(fd, (off_t)bitmap_offset, SEEK_SET);
-  if (::read(fd, bitmap,  dtoh32(header.specific.bitmap)) != (ssize_t)dtoh32(header.specific.bitmap))
-  {
-    BX_PANIC(("redolog : failed to read bitmap for extent %d", extent_index));
-    return 0;
-  }
-
-  // If bloc does not belong to extent yet
+  // If bloc does not belong to extent yet, update the cached bitmap
+  bitmap = get_bitmap(extent_index);
   if (((bitmap[extent_offset/8] >> (extent_offset%8)) & 0x01) == 0x00)
   {
     bitmap[extent_offset/8] |= 1 << (extent_offset%8);
-    ::lseek(fd, (off_t)bitmap_offset, SEEK_SET);
-    ::write(fd, bitmap,  dtoh32(header.specific.bitmap));
-  }
-
-  // Write catalog
-  if (update_catalog)
-  {
-    // FIXME if mmap
-    catalog_offset  = (Bit64s)STANDARD_HEADER_SIZE + (extent_index * sizeof(Bit32u));
-
-    BX_DEBUG(("redolog : writing catalog at offset %x", (Bit32u)catalog_offset));
-
-    ::lseek(fd, (off_t)catalog_offset, SEEK_SET);
-    ::write(fd, &catalog[extent_index], sizeof(Bit32u));
+    bitmap_dirty[extent_index] = 1;
   }
 
   return written;
@@ -1288,6 +1594,11 @@ ssize_t growing_image_t::write(const void* buf, size_t count)
   return redolog->write((char*) buf, count);
 }
 
+void growing_image_t::flush()
+{
+  redolog->flush();
+}
+
 /*** undoable_image_t function definitions ***/
 
 undoable_image_t::undoable_image_t(const char* _redolog_name)
@@ -1380,6 +1691,11 @@ ssize_t undoable_image_t::write(const void* buf, size_t count)
   return redolog->write((char*) buf, count);
 }
 
+void undoable_image_t::flush()
+{
+  redolog->flush();
+}
+
 /*** volatile_image_t function definitions ***/
 
 volatile_image_t::volatile_image_t(const char* _redolog_name)
@@ -1484,82 +1800,878 @@ ssize_t volatile_image_t::write(const void* buf, size_t count)
   return redolog->write((char*) buf, count);
 }
 
-#if BX_COMPRESSED_HD_SUPPORT
-
-/*** z_ro_image_t function definitions ***/
-
-z_ro_image_t::z_ro_image_t()
+void volatile_image_t::flush()
 {
-  offset = (Bit64s)0;
+  redolog->flush();
 }
 
-int z_ro_image_t::open(const char* pathname)
-{
-  fd = ::open(pathname, O_RDONLY
-#ifdef O_BINARY
-              | O_BINARY
-#endif
-             );
-
-  if (fd < 0)
-  {
-    BX_PANIC(("Could not open '%s' file", pathname));
-    return fd;
-  }
+/*** dedup_image_t function definitions ***/
 
-  gzfile = gzdopen(fd, "rb");
-  return 0;
+static int bx_read_image(int fd, Bit64s offset, void *buf, int count)
+{
+  if (::lseek(fd, (off_t)offset, SEEK_SET) == -1)
+    return -1;
+  return ::read(fd, buf, count);
 }
 
-void z_ro_image_t::close()
+static int bx_write_image(int fd, Bit64s offset, void *buf, int count)
 {
-  if (fd > -1) {
-    gzclose(gzfile);
-    // ::close(fd);
-  }
+  if (::lseek(fd, (off_t)offset, SEEK_SET) == -1)
+    return -1;
+  return ::write(fd, buf, count);
 }
 
-Bit64s z_ro_image_t::lseek(Bit64s _offset, int whence)
+dedup_image_t::dedup_image_t()
 {
-  // Only SEEK_SET supported
-  if (whence != SEEK_SET)
-  {
-    BX_PANIC(("lseek on compressed images : only SEEK_SET supported"));
-  }
-
-  // Seeking is expensive on compressed files, so we do it
-  // only when necessary, at the latest moment
-  offset = _offset;
-
-  return offset;
+  fd = -1;
+  pathname = NULL;
+  map = NULL;
+  map_dirty = 0;
+  cluster_size = 0;
+  cluster_count = 0;
+  file_size = 0;
+  position = 0;
+  base = NULL;
+  cache = NULL;
+  cache_next = 0;
+  cache_slot = NULL;
+  index_heads = NULL;
+  index_mask = 0;
+  index_entries = NULL;
+  index_count = 0;
+  index_size = 0;
+  record_buffer = NULL;
+  compare_buffer = NULL;
 }
 
-ssize_t z_ro_image_t::read(void* buf, size_t count)
+dedup_image_t::~dedup_image_t()
 {
-  gzseek(gzfile, offset, SEEK_SET);
-  return gzread(gzfile, buf, count);
+  close();
 }
 
-ssize_t z_ro_image_t::write(const void* buf, size_t count)
+int dedup_image_t::open(const char* _pathname)
 {
-  BX_PANIC(("z_ro_image: write not supported"));
-  return 0;
+  return open(_pathname, O_RDWR);
 }
 
-
-/*** z_undoable_image_t function definitions ***/
-
-z_undoable_image_t::z_undoable_image_t(Bit64u _size, const char* _redolog_name)
+int dedup_image_t::open(const char* _pathname, int flags)
 {
-  redolog = new redolog_t();
-  ro_disk = new z_ro_image_t();
-  size = _size;
+  Bit32u i;
 
-  redolog_name = NULL;
-  if (_redolog_name != NULL) {
-    if (strcmp(_redolog_name,"") != 0) {
-      redolog_name = strdup(_redolog_name);
-    }
+  pathname = strdup(_pathname);
+  fd = ::open(pathname, flags
+#ifdef O_BINARY
+              | O_BINARY
+#endif
+              );
+  if (fd < 0)
+  {
+    BX_PANIC(("dedup: could not open image '%s'", pathname));
+    return -1;
+  }
+
+  if (::read(fd, &header, sizeof(header)) != STANDARD_HEADER_SIZE)
+  {
+    BX_PANIC(("dedup: could not read header of '%s'", pathname));
+    return -1;
+  }
+
+  if ((strcmp((char*)header.standard.magic, STANDARD_HEADER_MAGIC) != 0) ||
+      (strcmp((char*)header.standard.type, DEDUP_TYPE) != 0) ||
+      (strcmp((char*)header.standard.subtype, DEDUP_SUBTYPE) != 0))
+  {
+    BX_PANIC(("dedup: '%s' is not a dedup image", pathname));
+    return -1;
+  }
+
+  if (dtoh32(header.standard.version) != STANDARD_HEADER_VERSION)
+  {
+    BX_PANIC(("dedup: bad header version in '%s'", pathname));
+    return -1;
+  }
+
+  cluster_size = dtoh32(header.specific.cluster);
+  cluster_count = dtoh32(header.specific.clusters);
+  hd_size = dtoh64(header.specific.disk);
+  header.specific.base[DEDUP_BASE_NAME_LEN - 1] = 0;
+
+  if ((cluster_size < 512) || ((cluster_size & (cluster_size - 1)) != 0) ||
+      ((Bit64u)cluster_count * cluster_size < hd_size))
+  {
+    BX_PANIC(("dedup: bad cluster size or count in '%s'", pathname));
+    return -1;
+  }
+
+  map = (Bit64u*)malloc(cluster_count * sizeof(Bit64u));
+  cache = (Bit8u*)malloc(BX_DEDUP_CACHE_CLUSTERS * cluster_size);
+  cache_slot = (Bit16s*)malloc(cluster_count * sizeof(Bit16s));
+  record_buffer = (Bit8u*)malloc(cluster_size);
+  compare_buffer = (Bit8u*)malloc(cluster_size);
+  if ((map == NULL) || (cache == NULL) || (cache_slot == NULL) ||
+      (record_buffer == NULL) || (compare_buffer == NULL))
+  {
+    BX_PANIC(("dedup: could not malloc cluster map and cache"));
+    return -1;
+  }
+
+  ::lseek(fd, (off_t)STANDARD_HEADER_SIZE, SEEK_SET);
+  if (::read(fd, map, cluster_count * sizeof(Bit64u)) != (ssize_t)(cluster_count * sizeof(Bit64u)))
+  {
+    BX_PANIC(("dedup: could not read cluster map of '%s'", pathname));
+    return -1;
+  }
+
+  for (i = 0; i < cluster_count; i++)
+    cache_slot[i] = -1;
+  for (i = 0; i < BX_DEDUP_CACHE_CLUSTERS; i++) {
+    cache_cluster[i] = BX_DEDUP_NO_CLUSTER;
+    cache_dirty[i] = 0;
+  }
+
+  struct stat stat_buf;
+  if (fstat(fd, &stat_buf) != 0)
+  {
+    BX_PANIC(("dedup: fstat() returns error!"));
+    return -1;
+  }
+  file_size = (Bit64s)stat_buf.st_size;
+  if (file_size < (Bit64s)dtoh64(header.specific.data))
+    file_size = (Bit64s)dtoh64(header.specific.data);
+
+  // index the records the map refers to
+  for (index_mask = 255; index_mask < cluster_count; index_mask = (index_mask << 1) | 1);
+  index_heads = (Bit32u*)malloc((index_mask + 1) * sizeof(Bit32u));
+  if (index_heads == NULL)
+  {
+    BX_PANIC(("dedup: could not malloc record index"));
+    return -1;
+  }
+  for (i = 0; i <= index_mask; i++)
+    index_heads[i] = BX_DEDUP_NO_CLUSTER;
+
+  for (i = 0; i < cluster_count; i++) {
+    Bit64u offset = dtoh64(map[i]);
+    if ((offset == DEDUP_CLUSTER_BASE) || (offset == DEDUP_CLUSTER_ZERO))
+      continue;
+    dedup_record_t record;
+    if (bx_read_image(fd, (Bit64s)offset, &record, sizeof(record)) != sizeof(record))
+    {
+      BX_PANIC(("dedup: could not read record of cluster %d in '%s'", i, pathname));
+      return -1;
+    }
+    add_record(dtoh64(record.hash), offset);
+  }
+
+  // open the base image read-only, its name is relative to this image
+  if (header.specific.base[0] != 0) {
+    char *basename = (char*)header.specific.base;
+    char *basepath = (char*)malloc(strlen(pathname) + strlen(basename) + 1);
+    const char *dirend = strrchr(pathname, '/');
+#ifdef WIN32
+    if (strrchr(pathname, '\\') > dirend) dirend = strrchr(pathname, '\\');
+#endif
+    if ((basename[0] == '/') || (basename[0] == '\\') ||
+        (basename[0] != 0 && basename[1] == ':') || (dirend == NULL)) {
+      strcpy(basepath, basename);
+    } else {
+      size_t dirlen = dirend - pathname + 1;
+      memcpy(basepath, pathname, dirlen);
+      strcpy(basepath + dirlen, basename);
+    }
+    base = new dedup_image_t();
+    if (base->open(basepath, O_RDONLY) < 0) {
+      free(basepath);
+      return -1;
+    }
+    if ((base->cluster_size != cluster_size) || (base->hd_size != hd_size))
+    {
+      BX_PANIC(("dedup: base image '%s' doesn't match '%s'", basepath, pathname));
+      free(basepath);
+      return -1;
+    }
+    BX_INFO(("dedup: '%s' is based on '%s'", pathname, basepath));
+    free(basepath);
+  }
+
+  BX_INFO(("dedup: opened '%s', %d clusters of %d bytes, %d records",
+           pathname, cluster_count, cluster_size, index_count));
+  return 0;
+}
+
+void dedup_image_t::close()
+{
+  if (fd >= 0) {
+    flush();
+    ::close(fd);
+    fd = -1;
+  }
+  if (base != NULL) {
+    delete base;
+    base = NULL;
+  }
+  if (pathname != NULL) {
+    free(pathname);
+    pathname = NULL;
+  }
+  if (map != NULL) {
+    free(map);
+    map = NULL;
+  }
+  if (cache != NULL) {
+    free(cache);
+    cache = NULL;
+  }
+  if (cache_slot != NULL) {
+    free(cache_slot);
+    cache_slot = NULL;
+  }
+  if (index_heads != NULL) {
+    free(index_heads);
+    index_heads = NULL;
+  }
+  if (index_entries != NULL) {
+    free(index_entries);
+    index_entries = NULL;
+  }
+  index_count = index_size = 0;
+  if (record_buffer != NULL) {
+    free(record_buffer);
+    record_buffer = NULL;
+  }
+  if (compare_buffer != NULL) {
+    free(compare_buffer);
+    compare_buffer = NULL;
+  }
+}
+
+Bit64s dedup_image_t::lseek(Bit64s offset, int whence)
+{
+  if (whence == SEEK_SET)
+    position = offset;
+  else if (whence == SEEK_CUR)
+    position += offset;
+  else if (whence == SEEK_END)
+    position = (Bit64s)hd_size + offset;
+  else
+    return -1;
+
+  if ((position < 0) || ((Bit64u)position > hd_size))
+  {
+    BX_ERROR(("dedup: seek out of range (" FMT_LL "d)", position));
+    return -1;
+  }
+  return position;
+}
+
+ssize_t dedup_image_t::read(void* buf, size_t count)
+{
+  Bit8u *dest = (Bit8u*)buf;
+  size_t left = count;
+
+  while (left > 0) {
+    Bit32u index = (Bit32u)(position / cluster_size);
+    Bit32u offset = (Bit32u)(position & (cluster_size - 1));
+    size_t len = cluster_size - offset;
+    if (len > left) len = left;
+    if ((Bit64u)position + len > hd_size)
+      return -1;
+
+    Bit8u *data = get_cluster(index, 0);
+    if (data == NULL)
+      return -1;
+    memcpy(dest, data + offset, len);
+
+    dest += len;
+    position += len;
+    left -= len;
+  }
+  return count;
+}
+
+ssize_t dedup_image_t::write(const void* buf, size_t count)
+{
+  const Bit8u *src = (const Bit8u*)buf;
+  size_t left = count;
+
+  while (left > 0) {
+    Bit32u index = (Bit32u)(position / cluster_size);
+    Bit32u offset = (Bit32u)(position & (cluster_size - 1));
+    size_t len = cluster_size - offset;
+    if (len > left) len = left;
+    if ((Bit64u)position + len > hd_size)
+      return -1;
+
+    // a cluster that is overwritten completely need not be read first
+    Bit8u *data = get_cluster(index, len == cluster_size);
+    if (data == NULL)
+      return -1;
+    memcpy(data + offset, src, len);
+    cache_dirty[cache_slot[index]] = 1;
+
+    src += len;
+    position += len;
+    left -= len;
+  }
+  return count;
+}
+
+void dedup_image_t::flush()
+{
+  if (fd < 0)
+    return;
+
+  for (int slot = 0; slot < BX_DEDUP_CACHE_CLUSTERS; slot++) {
+    if (cache_dirty[slot])
+      store_cluster(slot);
+  }
+
+  if (map_dirty)
+  {
+    BX_DEBUG(("dedup: writing cluster map"));
+
+    ::lseek(fd, (off_t)STANDARD_HEADER_SIZE, SEEK_SET);
+    if (::write(fd, map, cluster_count * sizeof(Bit64u)) != (ssize_t)(cluster_count * sizeof(Bit64u)))
+      BX_PANIC(("dedup: failed to write cluster map of '%s'", pathname));
+    map_dirty = 0;
+  }
+}
+
+// Return the cached data of a cluster, loading it if necessary. The least
+// recently loaded cluster is evicted.
+Bit8u *dedup_image_t::get_cluster(Bit32u index, bx_bool overwrite)
+{
+  if (index >= cluster_count)
+    return NULL;
+
+  int slot = cache_slot[index];
+  if (slot < 0) {
+    slot = cache_next;
+    cache_next = (cache_next + 1) % BX_DEDUP_CACHE_CLUSTERS;
+    if (cache_cluster[slot] != BX_DEDUP_NO_CLUSTER) {
+      if (cache_dirty[slot])
+        store_cluster(slot);
+      cache_slot[cache_cluster[slot]] = -1;
+      cache_cluster[slot] = BX_DEDUP_NO_CLUSTER;
+    }
+    if (!overwrite) {
+      if (read_cluster(index, cache + slot * cluster_size) < 0)
+        return NULL;
+    }
+    cache_cluster[slot] = index;
+    cache_slot[index] = slot;
+  }
+  return cache + slot * cluster_size;
+}
+
+int dedup_image_t::read_cluster(Bit32u index, Bit8u *buf)
+{
+  Bit64u offset = dtoh64(map[index]);
+
+  if (offset == DEDUP_CLUSTER_BASE) {
+    if (base != NULL)
+      return base->read_cluster(index, buf);
+    memset(buf, 0, cluster_size);
+    return 0;
+  }
+  if (offset == DEDUP_CLUSTER_ZERO) {
+    memset(buf, 0, cluster_size);
+    return 0;
+  }
+  return read_record(offset, buf, NULL);
+}
+
+int dedup_image_t::read_record(Bit64u offset, Bit8u *buf, Bit64u *hash)
+{
+  dedup_record_t record;
+
+  if (bx_read_image(fd, (Bit64s)offset, &record, sizeof(record)) != sizeof(record))
+  {
+    BX_PANIC(("dedup: could not read record at offset " FMT_LL "d in '%s'", offset, pathname));
+    return -1;
+  }
+  Bit32u length = dtoh32(record.length);
+  if (hash != NULL)
+    *hash = dtoh64(record.hash);
+
+  if (dtoh32(record.flags) & DEDUP_RECORD_DEFLATED) {
+#if BX_COMPRESSED_HD_SUPPORT
+    uLongf size = cluster_size;
+    if ((length > cluster_size) ||
+        (bx_read_image(fd, (Bit64s)offset + sizeof(record), record_buffer, length) != (int)length) ||
+        (uncompress(buf, &size, record_buffer, length) != Z_OK) || (size != cluster_size))
+    {
+      BX_PANIC(("dedup: bad compressed record at offset " FMT_LL "d in '%s'", offset, pathname));
+      return -1;
+    }
+#else
+    BX_PANIC(("dedup: '%s' has compressed clusters, zlib support is not compiled in", pathname));
+    return -1;
+#endif
+  } else {
+    if ((length != cluster_size) ||
+        (bx_read_image(fd, (Bit64s)offset + sizeof(record), buf, length) != (int)length))
+    {
+      BX_PANIC(("dedup: bad record at offset " FMT_LL "d in '%s'", offset, pathname));
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Point the map entry of a modified cluster to a record with its data,
+// appending a new record only if no equal one exists.
+void dedup_image_t::store_cluster(int slot)
+{
+  Bit32u index = cache_cluster[slot];
+  Bit8u *data = cache + slot * cluster_size;
+  Bit64u offset = DEDUP_CLUSTER_ZERO;
+
+  cache_dirty[slot] = 0;
+
+  for (Bit32u i = 0; i < cluster_size; i++) {
+    if (data[i] != 0) {
+      Bit64u hash = hash_cluster(data);
+      offset = find_record(hash, data);
+      if (offset == 0)
+        offset = append_record(hash, data);
+      break;
+    }
+  }
+
+  if (dtoh64(map[index]) != offset) {
+    map[index] = htod64(offset);
+    map_dirty = 1;
+  }
+}
+
+Bit64u dedup_image_t::find_record(Bit64u hash, const Bit8u *data)
+{
+  for (Bit32u i = index_heads[hash & index_mask]; i != BX_DEDUP_NO_CLUSTER; i = index_entries[i].next) {
+    if (index_entries[i].hash != hash)
+      continue;
+    // compare the data, equal hashes don't guarantee equal clusters
+    if ((read_record(index_entries[i].offset, compare_buffer, NULL) == 0) &&
+        (memcmp(compare_buffer, data, cluster_size) == 0))
+      return index_entries[i].offset;
+  }
+  return 0;
+}
+
+Bit64u dedup_image_t::append_record(Bit64u hash, const Bit8u *data)
+{
+  dedup_record_t record;
+  const Bit8u *stored = data;
+  Bit32u length = cluster_size;
+
+  record.hash = htod64(hash);
+  record.flags = 0;
+#if BX_COMPRESSED_HD_SUPPORT
+  uLongf size = cluster_size;
+  if ((compress2(record_buffer, &size, data, cluster_size, Z_BEST_SPEED) == Z_OK) &&
+      (size < cluster_size))
+  {
+    stored = record_buffer;
+    length = size;
+    record.flags = htod32(DEDUP_RECORD_DEFLATED);
+  }
+#endif
+  record.length = htod32(length);
+
+  Bit64u offset = (Bit64u)file_size;
+  if ((bx_write_image(fd, file_size, &record, sizeof(record)) != sizeof(record)) ||
+      (bx_write_image(fd, file_size + sizeof(record), (void*)stored, length) != (int)length))
+  {
+    BX_PANIC(("dedup: failed to write record to '%s'", pathname));
+  }
+  file_size += sizeof(record) + length;
+
+  add_record(hash, offset);
+  return offset;
+}
+
+void dedup_image_t::add_record(Bit64u hash, Bit64u offset)
+{
+  Bit32u i;
+
+  for (i = index_heads[hash & index_mask]; i != BX_DEDUP_NO_CLUSTER; i = index_entries[i].next) {
+    if (index_entries[i].offset == offset)
+      return;
+  }
+
+  if (index_count == index_size) {
+    index_size = (index_size == 0) ? 256 : index_size * 2;
+    index_entries = (index_entry_t*)realloc(index_entries, index_size * sizeof(index_entry_t));
+    if (index_entries == NULL)
+      BX_PANIC(("dedup: could not malloc record index"));
+  }
+
+  i = index_count++;
+  index_entries[i].hash = hash;
+  index_entries[i].offset = offset;
+  index_entries[i].next = index_heads[hash & index_mask];
+  index_heads[hash & index_mask] = i;
+}
+
+Bit64u dedup_image_t::hash_cluster(const Bit8u *data)
+{
+  Bit64u hash = DEDUP_HASH_INIT;
+
+  for (Bit32u i = 0; i < cluster_size; i++) {
+    hash ^= data[i];
+    hash *= DEDUP_HASH_PRIME;
+  }
+  return hash;
+}
+
+#if BX_COMPRESSED_HD_SUPPORT
+
+/*** z_ro_image_t function definitions ***/
+
+z_ro_image_t::z_ro_image_t()
+{
+  offset = (Bit64s)0;
+  fd = -1;
+  points = NULL;
+  point_count = 0;
+  point_size = 0;
+  stream_init = 0;
+  stream_end = 0;
+  stream_out = 0;
+  input = NULL;
+  cache = NULL;
+  cache_clock = 0;
+}
+
+z_ro_image_t::~z_ro_image_t()
+{
+  close();
+}
+
+int z_ro_image_t::open(const char* pathname)
+{
+  fd = ::open(pathname, O_RDONLY
+#ifdef O_BINARY
+              | O_BINARY
+#endif
+             );
+
+  if (fd < 0)
+  {
+    BX_PANIC(("Could not open '%s' file", pathname));
+    return fd;
+  }
+
+  input = (Bit8u*)malloc(BX_Z_RO_INPUT_SIZE);
+  cache = (Bit8u*)malloc(BX_Z_RO_CACHE_CHUNKS * BX_Z_RO_CHUNK_SIZE);
+  if ((input == NULL) || (cache == NULL))
+  {
+    BX_PANIC(("z_ro_image: could not malloc buffers"));
+    return -1;
+  }
+  for (int i = 0; i < BX_Z_RO_CACHE_CHUNKS; i++) {
+    cache_start[i] = -1;
+    cache_used[i] = 0;
+  }
+
+  if (build_index(pathname) < 0)
+    return -1;
+
+  BX_INFO(("z_ro_image: '%s' holds " FMT_LL "d bytes, %d restart points", pathname, hd_size, point_count));
+  return 0;
+}
+
+void z_ro_image_t::close()
+{
+  if (stream_init) {
+    inflateEnd(&stream);
+    stream_init = 0;
+  }
+  if (fd > -1) {
+    ::close(fd);
+    fd = -1;
+  }
+  if (points != NULL) {
+    for (int i = 0; i < point_count; i++)
+      free(points[i].window);
+    free(points);
+    points = NULL;
+  }
+  point_count = point_size = 0;
+  if (input != NULL) {
+    free(input);
+    input = NULL;
+  }
+  if (cache != NULL) {
+    free(cache);
+    cache = NULL;
+  }
+}
+
+// Inflate the whole file once and remember a restart point at the first
+// block boundary after every BX_Z_RO_SPAN bytes of disk data, with the
+// window of data preceding it (see examples/zran.c in zlib).
+int z_ro_image_t::build_index(const char* pathname)
+{
+  z_stream strm;
+  Bit8u *window;
+  Bit64s totin = 0, totout = 0, last = 0;
+  int ret;
+
+  window = (Bit8u*)malloc(BX_Z_RO_WINDOW_SIZE);
+  if (window == NULL)
+  {
+    BX_PANIC(("z_ro_image: could not malloc window"));
+    return -1;
+  }
+
+  memset(&strm, 0, sizeof(strm));
+  // 47: gzip or zlib header and the largest window
+  if (inflateInit2(&strm, 47) != Z_OK)
+  {
+    BX_PANIC(("z_ro_image: inflateInit2() failed"));
+    free(window);
+    return -1;
+  }
+
+  ::lseek(fd, 0, SEEK_SET);
+  strm.avail_out = 0;
+  do {
+    ssize_t len = ::read(fd, input, BX_Z_RO_INPUT_SIZE);
+    if (len <= 0) {
+      ret = Z_DATA_ERROR;
+      break;
+    }
+    strm.avail_in = (uInt)len;
+    strm.next_in = input;
+
+    do {
+      if (strm.avail_out == 0) {
+        strm.avail_out = BX_Z_RO_WINDOW_SIZE;
+        strm.next_out = window;
+      }
+      totin += strm.avail_in;
+      totout += strm.avail_out;
+      ret = inflate(&strm, Z_BLOCK);
+      totin -= strm.avail_in;
+      totout -= strm.avail_out;
+      if ((ret != Z_OK) && (ret != Z_STREAM_END))
+        break;
+      if (ret == Z_STREAM_END)
+        break;
+      // at the end of a block header, but not after the last block
+      if ((strm.data_type & 128) && !(strm.data_type & 64) &&
+          ((totout == 0) || (totout - last > BX_Z_RO_SPAN))) {
+        add_point(strm.data_type & 7, totin, totout, strm.avail_out, window);
+        last = totout;
+      }
+    } while (strm.avail_in != 0);
+  } while ((ret == Z_OK) || (ret == Z_BUF_ERROR));
+
+  inflateEnd(&strm);
+  free(window);
+
+  if ((ret != Z_STREAM_END) || (point_count == 0))
+  {
+    BX_PANIC(("z_ro_image: '%s' is not a valid gzip file", pathname));
+    return -1;
+  }
+
+  hd_size = (Bit64u)totout;
+  return 0;
+}
+
+void z_ro_image_t::add_point(int bits, Bit64s in, Bit64s out, unsigned left, const Bit8u *window)
+{
+  if (point_count == point_size) {
+    point_size = (point_size == 0) ? 64 : point_size * 2;
+    points = (access_point_t*)realloc(points, point_size * sizeof(access_point_t));
+    if (points == NULL)
+      BX_PANIC(("z_ro_image: could not malloc index"));
+  }
+
+  access_point_t *point = &points[point_count++];
+  point->bits = bits;
+  point->in = in;
+  point->out = out;
+  point->window = (Bit8u*)malloc(BX_Z_RO_WINDOW_SIZE);
+  if (point->window == NULL)
+    BX_PANIC(("z_ro_image: could not malloc index"));
+
+  // the window is circular, the oldest data follows the last output
+  if (left)
+    memcpy(point->window, window + BX_Z_RO_WINDOW_SIZE - left, left);
+  if (left < BX_Z_RO_WINDOW_SIZE)
+    memcpy(point->window + left, window, BX_Z_RO_WINDOW_SIZE - left);
+}
+
+int z_ro_image_t::start_stream(int index)
+{
+  access_point_t *point = &points[index];
+
+  if (stream_init)
+    inflateEnd(&stream);
+  memset(&stream, 0, sizeof(stream));
+  stream_init = (inflateInit2(&stream, -15) == Z_OK);
+  if (!stream_init)
+    return -1;
+
+  ::lseek(fd, (off_t)(point->in - (point->bits ? 1 : 0)), SEEK_SET);
+  if (point->bits) {
+    Bit8u byte;
+    if (::read(fd, &byte, 1) != 1)
+      return -1;
+    inflatePrime(&stream, point->bits, byte >> (8 - point->bits));
+  }
+  inflateSetDictionary(&stream, point->window, BX_Z_RO_WINDOW_SIZE);
+
+  stream.avail_in = 0;
+  stream_out = point->out;
+  stream_end = 0;
+  return 0;
+}
+
+// Inflate up to count bytes of disk data at stream_out to buf. Returns the
+// number of bytes, which is smaller at the end of the data.
+size_t z_ro_image_t::inflate_stream(Bit8u *buf, size_t count)
+{
+  stream.next_out = buf;
+  stream.avail_out = (uInt)count;
+
+  while ((stream.avail_out > 0) && !stream_end) {
+    if (stream.avail_in == 0) {
+      ssize_t len = ::read(fd, input, BX_Z_RO_INPUT_SIZE);
+      if (len <= 0)
+        break;
+      stream.avail_in = (uInt)len;
+      stream.next_in = input;
+    }
+    int ret = inflate(&stream, Z_NO_FLUSH);
+    if (ret == Z_STREAM_END) {
+      stream_end = 1;
+    } else if (ret != Z_OK) {
+      BX_ERROR(("z_ro_image: inflate() failed at offset " FMT_LL "d", stream_out));
+      break;
+    }
+  }
+
+  count -= stream.avail_out;
+  stream_out += count;
+  return count;
+}
+
+// Return the cached chunk of disk data starting at start. The least
+// recently used chunk is replaced.
+Bit8u *z_ro_image_t::get_chunk(Bit64s start)
+{
+  int i, slot = 0;
+
+  for (i = 0; i < BX_Z_RO_CACHE_CHUNKS; i++) {
+    if (cache_start[i] == start) {
+      cache_used[i] = ++cache_clock;
+      return cache + i * BX_Z_RO_CHUNK_SIZE;
+    }
+    if (cache_used[i] < cache_used[slot])
+      slot = i;
+  }
+
+  Bit8u *data = cache + slot * BX_Z_RO_CHUNK_SIZE;
+  cache_start[slot] = -1;
+
+  // last restart point at or before the chunk
+  int lo = 0, hi = point_count - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (points[mid].out <= start)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+
+  // go on with the current stream unless the restart point is closer
+  if (!stream_init || (stream_out > start) || (points[lo].out > stream_out)) {
+    if (start_stream(lo) < 0) {
+      BX_ERROR(("z_ro_image: could not restart inflating at offset " FMT_LL "d", points[lo].out));
+      return NULL;
+    }
+  }
+
+  while (stream_out < start) {
+    size_t skip = BX_Z_RO_CHUNK_SIZE;
+    if ((Bit64s)skip > start - stream_out)
+      skip = (size_t)(start - stream_out);
+    if (inflate_stream(data, skip) < skip)
+      return NULL;
+  }
+
+  size_t len = inflate_stream(data, BX_Z_RO_CHUNK_SIZE);
+  if (len < BX_Z_RO_CHUNK_SIZE)
+    memset(data + len, 0, BX_Z_RO_CHUNK_SIZE - len);
+
+  cache_start[slot] = start;
+  cache_used[slot] = ++cache_clock;
+  return data;
+}
+
+Bit64s z_ro_image_t::lseek(Bit64s _offset, int whence)
+{
+  // Only SEEK_SET supported
+  if (whence != SEEK_SET)
+  {
+    BX_PANIC(("lseek on compressed images : only SEEK_SET supported"));
+  }
+
+  // Seeking is done by the next read, which inflates the data from the
+  // nearest restart point
+  offset = _offset;
+
+  return offset;
+}
+
+ssize_t z_ro_image_t::read(void* buf, size_t count)
+{
+  Bit8u *dest = (Bit8u*)buf;
+  size_t total = 0;
+
+  while ((total < count) && ((Bit64u)offset < hd_size)) {
+    Bit64s start = offset & ~(Bit64s)(BX_Z_RO_CHUNK_SIZE - 1);
+    size_t pos = (size_t)(offset - start);
+    size_t len = BX_Z_RO_CHUNK_SIZE - pos;
+    if (len > count - total)
+      len = count - total;
+    if ((Bit64u)(offset + len) > hd_size)
+      len = (size_t)(hd_size - offset);
+
+    Bit8u *data = get_chunk(start);
+    if (data == NULL)
+      return (total > 0) ? (ssize_t)total : -1;
+    memcpy(dest + total, data + pos, len);
+
+    offset += len;
+    total += len;
+  }
+  return total;
+}
+
+ssize_t z_ro_image_t::write(const void* buf, size_t count)
+{
+  BX_PANIC(("z_ro_image: write not supported"));
+  return 0;
+}
+
+
+/*** z_undoable_image_t function definitions ***/
+
+z_undoable_image_t::z_undoable_image_t(Bit64u _size, const char* _redolog_name)
+{
+  redolog = new redolog_t();
+  ro_disk = new z_ro_image_t();
+  size = _size;
+
+  redolog_name = NULL;
+  if (_redolog_name != NULL) {
+    if (strcmp(_redolog_name,"") != 0) {
+      redolog_name = strdup(_redolog_name);
+    }
   }
 }
 
@@ -1576,6 +2688,7 @@ int z_undoable_image_t::open(const char* pathname)
   if (ro_disk->open(pathname)<0)
     return -1;
 
+  hd_size = ro_disk->hd_size;
   // If redolog name was set
   if (redolog_name != NULL) {
     if (strcmp(redolog_name, "") != 0) {
@@ -1592,11 +2705,17 @@ int z_undoable_image_t::open(const char* pathname)
 
   if (redolog->open(logname, REDOLOG_SUBTYPE_UNDOABLE) < 0)
   {
-    if (redolog->create(logname, REDOLOG_SUBTYPE_UNDOABLE, size) < 0)
+    if (redolog->create(logname, REDOLOG_SUBTYPE_UNDOABLE, hd_size) < 0)
     {
       BX_PANIC(("Can't open or create redolog '%s'",logname));
       return -1;
     }
+    if (hd_size != redolog->get_size())
+    {
+      BX_PANIC(("size reported by redolog doesn't match z-ro disk size"));
+      free(logname);
+      return -1;
+    }
   }
 
   BX_INFO(("'z-undoable' disk opened, z-ro-file is '%s', redolog is '%s'", pathname, logname));
@@ -1623,7 +2742,7 @@ Bit64s z_undoable_image_t::lseek(Bit64s offset, int whence)
 ssize_t z_undoable_image_t::read(void* buf, size_t count)
 {
   // This should be fixed if count != 512
-  if (redolog->read((char*) buf, count) != count)
+  if ((size_t)redolog->read((char*) buf, count) != count)
     return ro_disk->read((char*) buf, count);
   else
     return count;
@@ -1634,6 +2753,11 @@ ssize_t z_undoable_image_t::write(const void* buf, size_t count)
   return redolog->write((char*) buf, count);
 }
 
+void z_undoable_image_t::flush()
+{
+  redolog->flush();
+}
+
 
 /*** z_volatile_image_t function definitions ***/
 
@@ -1666,6 +2790,7 @@ int z_volatile_image_t::open(const char* pathname)
   if (ro_disk->open(pathname)<0)
     return -1;
 
+  hd_size = ro_disk->hd_size;
   // if redolog name was set
   if (redolog_name != NULL) {
     if (strcmp(redolog_name, "") != 0) {
@@ -1688,7 +2813,7 @@ int z_volatile_image_t::open(const char* pathname)
     BX_PANIC(("Can't create volatile redolog '%s'", redolog_temp));
     return -1;
   }
-  if (redolog->create(filedes, REDOLOG_SUBTYPE_VOLATILE, size) < 0)
+  if (redolog->create(filedes, REDOLOG_SUBTYPE_VOLATILE, hd_size) < 0)
   {
     BX_PANIC(("Can't create volatile redolog '%s'", redolog_temp));
     return -1;
@@ -1730,7 +2855,7 @@ Bit64s z_volatile_image_t::lseek(Bit64s offset, int whence)
 ssize_t z_volatile_image_t::read (void* buf, size_t count)
 {
   // This should be fixed if count != 512
-  if (redolog->read((char*) buf, count) != count)
+  if ((size_t)redolog->read((char*) buf, count) != count)
     return ro_disk->read((char*) buf, count);
   else
     return count;
@@ -1741,4 +2866,110 @@ ssize_t z_volatile_image_t::write (const void* buf, size_t count)
   return redolog->write((char*) buf, count);
 }
 
+void z_volatile_image_t::flush()
+{
+  redolog->flush();
+}
+
+#endif
+
+#if BX_SUPPORT_ASYNC_DISK
+
+/*** async_io_t function definitions ***/
+
+async_io_t::async_io_t(device_image_t *_image, void (*_notify)(void *), void *_param)
+{
+  image = _image;
+  notify = _notify;
+  notify_param = _param;
+  running = 1;
+  requested = 0;
+  done = 1;
+  result = 0;
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&request_cond, NULL);
+  pthread_cond_init(&done_cond, NULL);
+  if (pthread_create(&thread, NULL, thread_main, this) != 0)
+    BX_PANIC(("async_io: could not create the I/O thread"));
+}
+
+async_io_t::~async_io_t()
+{
+  pthread_mutex_lock(&mutex);
+  while (!done)
+    pthread_cond_wait(&done_cond, &mutex);
+  running = 0;
+  pthread_cond_signal(&request_cond);
+  pthread_mutex_unlock(&mutex);
+  pthread_join(thread, NULL);
+  pthread_cond_destroy(&done_cond);
+  pthread_cond_destroy(&request_cond);
+  pthread_mutex_destroy(&mutex);
+}
+
+void *async_io_t::thread_main(void *arg)
+{
+  async_io_t *io = (async_io_t *) arg;
+  struct iovec iov;
+
+  pthread_mutex_lock(&io->mutex);
+  while (1) {
+    while (io->running && !io->requested)
+      pthread_cond_wait(&io->request_cond, &io->mutex);
+    if (!io->running)
+      break;
+    io->requested = 0;
+    iov.iov_base = io->buffer;
+    iov.iov_len = io->count;
+    pthread_mutex_unlock(&io->mutex);
+
+    ssize_t ret;
+    if (io->write)
+      ret = io->image->write_sectors(io->offset, &iov, 1);
+    else
+      ret = io->image->read_sectors(io->offset, &iov, 1);
+
+    pthread_mutex_lock(&io->mutex);
+    io->result = ret;
+    io->done = 1;
+    pthread_cond_signal(&io->done_cond);
+    io->notify(io->notify_param);
+  }
+  pthread_mutex_unlock(&io->mutex);
+  return NULL;
+}
+
+void async_io_t::submit(bx_bool _write, Bit64s _offset, Bit8u *_buffer, Bit32u _count)
+{
+  pthread_mutex_lock(&mutex);
+  while (!done)
+    pthread_cond_wait(&done_cond, &mutex);
+  write = _write;
+  offset = _offset;
+  buffer = _buffer;
+  count = _count;
+  done = 0;
+  requested = 1;
+  pthread_cond_signal(&request_cond);
+  pthread_mutex_unlock(&mutex);
+}
+
+bx_bool async_io_t::poll()
+{
+  pthread_mutex_lock(&mutex);
+  bx_bool ret = done;
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
+
+ssize_t async_io_t::wait()
+{
+  pthread_mutex_lock(&mutex);
+  while (!done)
+    pthread_cond_wait(&done_cond, &mutex);
+  ssize_t ret = result;
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
+
 #endif
@@ -21,6 +21,15 @@
 #ifndef BX_HDIMAGE_H
 #define BX_HDIMAGE_H
 
+#ifndef WIN32
+#include <sys/uio.h>
+#else
+struct iovec {
+  void  *iov_base;
+  size_t iov_len;
+};
+#endif
+
 // SPARSE IMAGES HEADER
 #define SPARSE_HEADER_MAGIC  (0x02468ace)
 #define SPARSE_HEADER_VERSION  2
@@ -104,6 +113,49 @@
    Bit8u padding[STANDARD_HEADER_SIZE - (sizeof (standard_header_t) + sizeof (redolog_specific_header_v1_t))];
  } redolog_header_v1_t;
 
+// DEDUP IMAGES HEADER
+#define DEDUP_TYPE    "Dedup"
+#define DEDUP_SUBTYPE "Clusters"
+
+#define DEDUP_DEFAULT_CLUSTER_SIZE (4096)
+#define DEDUP_BASE_NAME_LEN        (256)
+
+// cluster map entries that do not point to a record
+#define DEDUP_CLUSTER_BASE (0) // data of the base image, zero without base
+#define DEDUP_CLUSTER_ZERO (1) // cluster is all zero
+
+#define DEDUP_RECORD_DEFLATED (0x01)
+
+// 64-bit FNV-1a hash of the uncompressed cluster data
+#define DEDUP_HASH_INIT  BX_CONST64(0xcbf29ce484222325)
+#define DEDUP_HASH_PRIME BX_CONST64(0x00000100000001b3)
+
+ typedef struct
+ {
+   // the fields in the header are kept in little endian
+   Bit32u  cluster;    // cluster size in bytes
+   Bit32u  clusters;   // #entries in the cluster map
+   Bit64u  disk;       // disk size in bytes
+   Bit64u  data;       // file offset of the first cluster record
+   Bit8u   base[DEDUP_BASE_NAME_LEN]; // base image name, relative to this image
+ } dedup_specific_header_t;
+
+ typedef struct
+ {
+   standard_header_t standard;
+   dedup_specific_header_t specific;
+
+   Bit8u padding[STANDARD_HEADER_SIZE - (sizeof (standard_header_t) + sizeof (dedup_specific_header_t))];
+ } dedup_header_t;
+
+ typedef struct
+ {
+   // the fields of a record are kept in little endian
+   Bit64u  hash;       // hash of the uncompressed cluster
+   Bit32u  length;     // length of the stored data in bytes
+   Bit32u  flags;      // DEDUP_RECORD_DEFLATED if the data is compressed
+ } dedup_record_t;
+
 // htod : convert host to disk (little) endianness
 // dtoh : convert disk (little) to host endianness
 #if defined (BX_LITTLE_ENDIAN)
@@ -145,16 +197,36 @@ class device_image_t
       // written (count).
       virtual ssize_t write(const void* buf, size_t count) = 0;
 
+      // Read consecutive sectors starting at the byte offset to the
+      // iovcnt buffers of iov, which hold whole sectors. Return the
+      // number of bytes read.
+      virtual ssize_t read_sectors(Bit64s offset, const struct iovec *iov, int iovcnt);
+
+      // Write consecutive sectors starting at the byte offset from the
+      // iovcnt buffers of iov, which hold whole sectors. Return the
+      // number of bytes written.
+      virtual ssize_t write_sectors(Bit64s offset, const struct iovec *iov, int iovcnt);
+
+      // Write the modified data back to the image file, the guest has
+      // flushed the drive cache.
+      virtual void flush() {}
+
       unsigned cylinders;
       unsigned heads;
       unsigned sectors;
       Bit64u   hd_size;
+      // access the image file through a memory mapping (flat and sparse
+      // images), set before the image is opened
+      bx_bool  use_mmap;
 };
 
 // FLAT MODE
 class default_image_t : public device_image_t
 {
   public:
+      // Default constructor
+      default_image_t();
+
       // Open a image. Returns non-negative if successful.
       int open(const char* pathname);
 
@@ -176,9 +248,24 @@ class default_image_t : public device_image_t
       // written (count).
       ssize_t write(const void* buf, size_t count);
 
+#if BX_HAVE_PREADV || defined(_POSIX_MAPPED_FILES)
+      // Read and write consecutive sectors with one system call or a
+      // copy from or to the mapped image.
+      ssize_t read_sectors(Bit64s offset, const struct iovec *iov, int iovcnt);
+      ssize_t write_sectors(Bit64s offset, const struct iovec *iov, int iovcnt);
+#endif
+
+#ifdef _POSIX_MAPPED_FILES
+      void flush();
+#endif
+
   private:
       int fd;
 
+#ifdef _POSIX_MAPPED_FILES
+      Bit8u * mmap_data;
+      Bit64s  mmap_position;
+#endif
 };
 
 // CONCAT MODE
@@ -258,6 +345,10 @@ class sparse_image_t : public device_image_t
       // written (count).
       ssize_t write(const void* buf, size_t count);
 
+#ifdef _POSIX_MAPPED_FILES
+      void flush();
+#endif
+
   private:
  int fd;
 
@@ -265,6 +356,9 @@ class sparse_image_t : public device_image_t
  void *  mmap_header;
  size_t  mmap_length;
  size_t  system_pagesize_mask;
+ // the whole image file, if use_mmap is set
+ Bit8u * mmap_data;
+ size_t  mmap_data_length;
 #endif
  Bit32u *  pagetable;
 
@@ -350,12 +444,21 @@ class redolog_t
       ssize_t read(void* buf, size_t count);
       ssize_t write(const void* buf, size_t count);
 
+      // Write the modified bitmaps and the catalog back to the file.
+      void flush();
+
   private:
       void             print_header();
+      void             init_bitmaps();
+      Bit64s           get_bitmap_offset(Bit32u index);
+      Bit8u           *get_bitmap(Bit32u index);
       int              fd;
       redolog_header_t header;     // Header is kept in x86 (little) endianness
       Bit32u          *catalog;
-      Bit8u           *bitmap;
+      Bit8u          **bitmaps;      // cached extent bitmaps, indexed like the catalog
+      Bit8u           *bitmap_dirty; // bitmap has to be written back
+      bx_bool          catalog_dirty;
+      Bit64s           file_size;
       Bit32u           extent_index;
       Bit32u           extent_offset;
       Bit32u           extent_next;
@@ -390,6 +493,9 @@ class growing_image_t : public device_image_t
       // written (count).
       ssize_t write(const void* buf, size_t count);
 
+      // Write the redolog metadata back to the file.
+      void flush();
+
   private:
       redolog_t *redolog;
 };
@@ -420,6 +526,9 @@ class undoable_image_t : public device_image_t
       // written (count).
       ssize_t write(const void* buf, size_t count);
 
+      // Write the redolog metadata back to the file.
+      void flush();
+
   private:
       redolog_t       *redolog;       // Redolog instance
       default_image_t *ro_disk;       // Read-only flat disk instance
@@ -453,6 +562,9 @@ class volatile_image_t : public device_image_t
       // written (count).
       ssize_t write(const void* buf, size_t count);
 
+      // Write the redolog metadata back to the file.
+      void flush();
+
   private:
       redolog_t       *redolog;       // Redolog instance
       default_image_t *ro_disk;       // Read-only flat disk instance
@@ -460,6 +572,96 @@ class volatile_image_t : public device_image_t
       char            *redolog_temp;  // Redolog temporary file name
 };
 
+// DEDUP MODE
+class dedup_image_t : public device_image_t
+{
+
+// Format of a dedup file:
+// 512 byte header, containing the cluster size and the base image name
+// Cluster map, the file offset of the record of each virtual cluster
+// Cluster records (record header and raw or deflated data) till end of file
+//
+// Equal clusters share one record, which is found by the hash of its data.
+// Clusters never written to come from the base image, so a clone is an
+// empty map on top of its base.
+
+  public:
+      // Contructor
+      dedup_image_t();
+      virtual ~dedup_image_t();
+
+      // Open a image. Returns non-negative if successful.
+      int open(const char* pathname);
+
+      // Open an image with specific flags. Returns non-negative if successful.
+      int open(const char* pathname, int flags);
+
+      // Close the image.
+      void close();
+
+      // Position ourselves. Return the resulting offset from the
+      // beginning of the file.
+      Bit64s lseek(Bit64s offset, int whence);
+
+      // Read count bytes to the buffer buf. Return the number of
+      // bytes read (count).
+      ssize_t read(void* buf, size_t count);
+
+      // Write count bytes from buf. Return the number of bytes
+      // written (count).
+      ssize_t write(const void* buf, size_t count);
+
+      // Store the modified clusters and write the cluster map back.
+      void flush();
+
+  private:
+#define BX_DEDUP_CACHE_CLUSTERS 64
+#define BX_DEDUP_NO_CLUSTER     0xffffffff
+      int     read_cluster(Bit32u index, Bit8u *buf);
+      int     read_record(Bit64u offset, Bit8u *buf, Bit64u *hash);
+      Bit8u  *get_cluster(Bit32u index, bx_bool overwrite);
+      void    store_cluster(int slot);
+      Bit64u  find_record(Bit64u hash, const Bit8u *data);
+      Bit64u  append_record(Bit64u hash, const Bit8u *data);
+      void    add_record(Bit64u hash, Bit64u offset);
+      Bit64u  hash_cluster(const Bit8u *data);
+
+      int            fd;
+      char          *pathname;
+      dedup_header_t header;     // Header is kept in x86 (little) endianness
+      Bit64u        *map;        // cluster map, kept little endian
+      bx_bool        map_dirty;
+      Bit32u         cluster_size;
+      Bit32u         cluster_count;
+      Bit64s         file_size;
+      Bit64s         position;
+      dedup_image_t *base;
+
+      // cluster cache, modified clusters are stored when they are evicted
+      // or flushed
+      Bit8u         *cache;
+      Bit32u         cache_cluster[BX_DEDUP_CACHE_CLUSTERS];
+      bx_bool        cache_dirty[BX_DEDUP_CACHE_CLUSTERS];
+      unsigned       cache_next;
+      Bit16s        *cache_slot; // cache slot of each cluster, -1 if none
+
+      // record index, hash table of the records referenced by the map
+      // and of the records written since the image was opened
+      struct index_entry_t {
+        Bit64u hash;
+        Bit64u offset;
+        Bit32u next;
+      };
+      Bit32u        *index_heads;
+      Bit32u         index_mask;
+      index_entry_t *index_entries;
+      Bit32u         index_count;
+      Bit32u         index_size;
+
+      Bit8u         *record_buffer;
+      Bit8u         *compare_buffer;
+};
+
 
 #if BX_COMPRESSED_HD_SUPPORT
 
@@ -469,9 +671,16 @@ class volatile_image_t : public device_image_t
 // Default compressed READ-ONLY image class
 class z_ro_image_t : public device_image_t
 {
+
+// The gzip file is inflated once when it is opened, to build an index of
+// restart points, one every BX_Z_RO_SPAN bytes of disk data. A read inflates
+// from the nearest restart point before it, or goes on with the current
+// stream if that is closer. The inflated chunks are kept in a LRU cache.
+
   public:
       // Contructor
       z_ro_image_t();
+      virtual ~z_ro_image_t();
 
       // Open a image. Returns non-negative if successful.
       int open(const char* pathname);
@@ -492,10 +701,41 @@ class z_ro_image_t : public device_image_t
       ssize_t write(const void* buf, size_t count);
 
   private:
+#define BX_Z_RO_SPAN         (1024 * 1024)
+#define BX_Z_RO_WINDOW_SIZE  32768
+#define BX_Z_RO_INPUT_SIZE   16384
+#define BX_Z_RO_CHUNK_SIZE   65536
+#define BX_Z_RO_CACHE_CHUNKS 16
+      struct access_point_t {
+        Bit64s out;     // offset in the disk data
+        Bit64s in;      // offset in the compressed file
+        int    bits;    // bits of the byte before 'in' that belong to the stream
+        Bit8u *window;  // the disk data preceding the point
+      };
+      int     build_index(const char* pathname);
+      void    add_point(int bits, Bit64s in, Bit64s out, unsigned left, const Bit8u *window);
+      int     start_stream(int point);
+      size_t  inflate_stream(Bit8u *buf, size_t count);
+      Bit8u  *get_chunk(Bit64s start);
+
       Bit64s offset;
       int fd;
-      gzFile gzfile;
 
+      access_point_t *points;
+      int     point_count;
+      int     point_size;
+
+      // the stream used for reading, at stream_out in the disk data
+      z_stream stream;
+      bx_bool  stream_init;
+      bx_bool  stream_end;
+      Bit64s   stream_out;
+      Bit8u   *input;
+
+      Bit8u  *cache;
+      Bit64s  cache_start[BX_Z_RO_CACHE_CHUNKS];
+      Bit32u  cache_used[BX_Z_RO_CACHE_CHUNKS];
+      Bit32u  cache_clock;
 };
 
 // Z-UNDOABLE MODE
@@ -524,6 +764,9 @@ class z_undoable_image_t : public device_image_t
       // written (count).
       ssize_t write(const void* buf, size_t count);
 
+      // Write the redolog metadata back to the file.
+      void flush();
+
   private:
       redolog_t       *redolog;       // Redolog instance
       z_ro_image_t    *ro_disk;       // Read-only compressed flat disk instance
@@ -557,6 +800,9 @@ class z_volatile_image_t : public device_image_t
       // written (count).
       ssize_t write(const void* buf, size_t count);
 
+      // Write the redolog metadata back to the file.
+      void flush();
+
   private:
       redolog_t       *redolog;       // Redolog instance
       z_ro_image_t    *ro_disk;       // Read-only compressed flat disk instance
@@ -567,6 +813,56 @@ class z_volatile_image_t : public device_image_t
 
 #endif
 
+#if BX_SUPPORT_ASYNC_DISK
+
+#include <pthread.h>
+
+// Performs the read_sectors() and write_sectors() calls of an image on a
+// host thread, so the simulation goes on while the host waits for the
+// disk. There is one thread per image and one request at a time.
+class async_io_t
+{
+  public:
+      // Constructor, starts the thread. The thread calls notify(param)
+      // after every completed request.
+      async_io_t(device_image_t *image, void (*notify)(void *), void *param);
+      // Destructor, waits for the request and stops the thread
+      ~async_io_t();
+
+      // Start reading (write=0) or writing count bytes between buffer and
+      // the image at offset. The buffer must not be used until the request
+      // has completed.
+      void submit(bx_bool write, Bit64s offset, Bit8u *buffer, Bit32u count);
+
+      // Returns 1 if the request has completed, without blocking.
+      bx_bool poll();
+
+      // Wait for the request to complete and return the result of the
+      // read_sectors() or write_sectors() call.
+      ssize_t wait();
+
+  private:
+      static void *thread_main(void *arg);
+
+      device_image_t *image;
+      void          (*notify)(void *);
+      void           *notify_param;
+      pthread_t       thread;
+      pthread_mutex_t mutex;
+      pthread_cond_t  request_cond;
+      pthread_cond_t  done_cond;
+      bx_bool         running;
+      bx_bool         requested;
+      bx_bool         done;
+      bx_bool         write;
+      Bit64s          offset;
+      Bit8u          *buffer;
+      Bit32u          count;
+      ssize_t         result;
+};
+
+#endif
+
 #endif // HDIMAGE_HEADERS_ONLY
 
 #endif
@@ -510,72 +510,57 @@ private:
   bx_bool is_usb_uhci_enabled();
 };
 
-// memory stub has an assumption that there are no memory accesses splitting 4K page
-BX_CPP_INLINE void DEV_MEM_READ_PHYSICAL(bx_phy_address phy_addr, unsigned len, Bit8u *ptr)
+// Device transfers from and to the physical memory.  Block transfers are
+// split into page spans, which are copied directly from or to the host
+// memory unless a memory handler claims the page.
+BX_CPP_INLINE void DEV_MEM_READ_PHYSICAL_BLOCK(bx_phy_address phy_addr, unsigned len, Bit8u *ptr)
 {
-  unsigned remainingInPage = 0x1000 - (phy_addr & 0xfff);
-  if (len <= remainingInPage) {
-    BX_MEM(0)->readPhysicalPage(NULL, phy_addr, len, ptr);
-  }
-  else {
-    BX_MEM(0)->readPhysicalPage(NULL, phy_addr, remainingInPage, ptr);
+  while(len > 0) {
+    unsigned remainingInPage = 0x1000 - (phy_addr & 0xfff);
+    if (len < remainingInPage) remainingInPage = len;
+    BX_MEM(0)->dmaReadPhysicalPage(phy_addr, remainingInPage, ptr);
     ptr += remainingInPage;
     phy_addr += remainingInPage;
     len -= remainingInPage;
-    BX_MEM(0)->readPhysicalPage(NULL, phy_addr, len, ptr);
   }
 }
 
-BX_CPP_INLINE void DEV_MEM_READ_PHYSICAL_BLOCK(bx_phy_address phy_addr, unsigned len, Bit8u *ptr)
+BX_CPP_INLINE void DEV_MEM_WRITE_PHYSICAL_BLOCK(bx_phy_address phy_addr, unsigned len, Bit8u *ptr)
 {
-  Bit8u *memptr;
-
-  while(len > 0) { 
+  while(len > 0) {
     unsigned remainingInPage = 0x1000 - (phy_addr & 0xfff);
     if (len < remainingInPage) remainingInPage = len;
-    memptr = BX_MEM(0)->getHostMemAddr(NULL, phy_addr, BX_READ);
-    if (memptr != NULL) {
-      memcpy(ptr, memptr, remainingInPage);
-    }
+    BX_MEM(0)->dmaWritePhysicalPage(phy_addr, remainingInPage, ptr);
     ptr += remainingInPage;
     phy_addr += remainingInPage;
     len -= remainingInPage;
   }
 }
 
-// memory stub has an assumption that there are no memory accesses splitting 4K page
-BX_CPP_INLINE void DEV_MEM_WRITE_PHYSICAL(bx_phy_address phy_addr, unsigned len, Bit8u *ptr)
+// Accesses of up to 8 bytes within a page are host scalars (descriptors,
+// DMA data words), which are converted from or to the guest byte order.
+BX_CPP_INLINE void DEV_MEM_READ_PHYSICAL(bx_phy_address phy_addr, unsigned len, Bit8u *ptr)
 {
-  unsigned remainingInPage = 0x1000 - (phy_addr & 0xfff);
-  if (len <= remainingInPage) {
-    BX_MEM(0)->writePhysicalPage(NULL, phy_addr, len, ptr);
-  }
-  else {
-    BX_MEM(0)->writePhysicalPage(NULL, phy_addr, remainingInPage, ptr);
-    ptr += remainingInPage;
-    phy_addr += remainingInPage;
-    len -= remainingInPage;
-    BX_MEM(0)->writePhysicalPage(NULL, phy_addr, len, ptr);
-  }
+  if (len <= 8 && (phy_addr & 0xfff) + len <= 0x1000)
+    BX_MEM(0)->readPhysicalPage(NULL, phy_addr, len, ptr);
+  else
+    DEV_MEM_READ_PHYSICAL_BLOCK(phy_addr, len, ptr);
 }
 
-BX_CPP_INLINE void DEV_MEM_WRITE_PHYSICAL_BLOCK(bx_phy_address phy_addr, unsigned len, Bit8u *ptr)
+BX_CPP_INLINE void DEV_MEM_WRITE_PHYSICAL(bx_phy_address phy_addr, unsigned len, Bit8u *ptr)
 {
-  Bit8u *memptr;
-
-  while(len > 0) { 
-    unsigned remainingInPage = 0x1000 - (phy_addr & 0xfff);
-    if (len < remainingInPage) remainingInPage = len;
-    memptr = BX_MEM(0)->getHostMemAddr(NULL, phy_addr, BX_WRITE);
-    if (memptr != NULL) {
-      memcpy(memptr, ptr, remainingInPage);
-    }
-    ptr += remainingInPage;
-    phy_addr += remainingInPage;
-    len -= remainingInPage;
-  }
+  if (len <= 8 && (phy_addr & 0xfff) + len <= 0x1000)
+    BX_MEM(0)->writePhysicalPage(NULL, phy_addr, len, ptr);
+  else
+    DEV_MEM_WRITE_PHYSICAL_BLOCK(phy_addr, len, ptr);
 }
 
+// Zero copy access of a device to the page of phy_addr, returns NULL if
+// the page has to be accessed with DEV_MEM_READ/WRITE_PHYSICAL instead.
+// The write stamps of the page are invalidated for BX_WRITE access.
+#define DEV_MEM_GET_HOST_ADDR(phy_addr, rw) \
+  BX_MEM(0)->dmaGetHostMemAddr(phy_addr, rw)
+
 #ifndef NO_DEVICE_INCLUDES
 
 #include "iodev/vga.h"
@@ -166,6 +166,9 @@ void iofunctions::out(int level, const char *prefix, const char *fmt, va_list ap
   assert(this != NULL);
   assert(logfd != NULL);
 
+  // keep the lines of the processor threads apart
+  BX_SMP_LOCK();
+
   switch (level) {
     case LOGLEV_INFO: c='i'; break;
     case LOGLEV_PANIC: c='p'; break;
@@ -219,6 +222,8 @@ void iofunctions::out(int level, const char *prefix, const char *fmt, va_list ap
   vfprintf(logfd, fmt, ap);
   fprintf(logfd, "\n");
   fflush(logfd);
+
+  BX_SMP_UNLOCK();
 }
 
 iofunctions::iofunctions(FILE *fs)
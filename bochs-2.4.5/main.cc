@@ -105,6 +105,13 @@ BOCHSAPI BX_MEM_C bx_mem;
 char *bochsrc_filename = NULL;
 int jitter = 0;
 
+// configuration file and first bochsrc option on the command line which
+// are applied over a restored configuration
+static const char *restore_rcfile = NULL;
+static int restore_options = -1;
+
+static bx_bool bx_snapshot_due = 0;
+
 void bx_print_header()
 {
   printf("%s\n", divider);
@@ -493,6 +500,7 @@ void print_usage(void)
     "  -j n             jitter n\n"
     "  -benchmark n     run bochs in benchmark mode for millions of emulated ticks\n"
     "  -r path          restore the Bochs state from path\n"
+    "  -snapshot n path save the Bochs state to path after n emulated ticks\n"
     "  -log filename    specify Bochs log file name\n"
 #if BX_DEBUGGER
     "  -rc filename     execute debugger commands stored in file\n"
@@ -586,6 +594,14 @@ int bx_init_main(int argc, char *argv[])
         SIM->get_param_string(BXPN_RESTORE_PATH)->set(argv[arg]);
       }
     }
+    else if (!strcmp("-snapshot", argv[arg])) {
+      if (arg+2 >= argc) BX_PANIC(("-snapshot must be followed by a number and a path"));
+      else {
+        SIM->get_param_enum(BXPN_BOCHS_START)->set(BX_QUICK_START);
+        SIM->get_param_num(BXPN_SNAPSHOT_TICKS)->set(strtoull(argv[++arg], NULL, 10));
+        SIM->get_param_string(BXPN_SNAPSHOT_PATH)->set(argv[++arg]);
+      }
+    }
 #if BX_WITH_CARBON
     else if (!strncmp("-psn", argv[arg], 4)) {
       // "-psn" is passed if we are launched by double-clicking
@@ -751,9 +767,10 @@ int bx_init_main(int argc, char *argv[])
   }
 
   if (SIM->get_param_bool(BXPN_RESTORE_FLAG)->get()) {
-    if (arg < argc) {
-      BX_ERROR(("WARNING: bochsrc options are ignored in restore mode!"));
-    }
+    // a configuration file given with -f and the bochsrc options are
+    // applied over the restored configuration in bx_begin_simulation()
+    restore_rcfile = bochsrc_filename;
+    restore_options = arg;
   }
   else {
     // parse the rest of the command line.  This is done after reading the
@@ -863,6 +880,19 @@ int bx_begin_simulation (int argc, char *argv[])
       BX_PANIC(("cannot restore configuration"));
       SIM->get_param_bool(BXPN_RESTORE_FLAG)->set(0);
     }
+    else {
+      // Attach the restored machine to its own disk images, log and
+      // output files.  Options which change the hardware itself make the
+      // restore of its state fail.
+      if (restore_rcfile != NULL) {
+        if (bx_read_configuration(restore_rcfile) < 0)
+          return 0;
+      }
+      if (restore_options >= 0 && bx_parse_cmdline(restore_options, argc, argv)) {
+        BX_PANIC(("There were errors while parsing the command line"));
+        return 0;
+      }
+    }
   }
 
   // deal with gui selection
@@ -941,6 +971,15 @@ int bx_begin_simulation (int argc, char *argv[])
       // for one processor, the only reason for cpu_loop to return is
       // that kill_bochs_request was set by the GUI interface.
     }
+#if BX_SUPPORT_SMP_THREADS
+    else if (SIM->get_param_enum(BXPN_SMP_MODE)->get() != BX_SMP_MODE_ROUNDROBIN) {
+      // SMP simulation: each processor runs on its own host thread and
+      // returns to the thread loop after each quantum of instructions.
+      // In lock-step mode the quantum is the length of an epoch.
+      bx_smp_run(SIM->get_param_num(BXPN_SMP_QUANTUM)->get(),
+        SIM->get_param_enum(BXPN_SMP_MODE)->get() == BX_SMP_MODE_LOCKSTEP);
+    }
+#endif
     else {
       // SMP simulation: do a few instructions on each processor, then switch
       // to another.  Increasing quantum speeds up overall performance, but
@@ -953,17 +992,35 @@ int bx_begin_simulation (int argc, char *argv[])
         processor = (processor+1) % BX_SMP_PROCESSORS;
         if (bx_pc_system.kill_bochs_request)
           break;
-        if (processor == 0)
+        if (processor == 0) {
           BX_TICKN(quantum);
+          if (bx_pc_system.cpus_halted_idle())
+            bx_pc_system.skip_idle_quanta(quantum);
+        }
       }
     }
   }
 #endif /* BX_DEBUGGER == 0 */
+  if (bx_snapshot_due) {
+    const char *path = SIM->get_param_string(BXPN_SNAPSHOT_PATH)->getptr();
+    if (SIM->save_state(path)) {
+      BX_INFO(("Bochs state saved to '%s'", path));
+    } else {
+      BX_PANIC(("cannot save the Bochs state to '%s'", path));
+    }
+  }
   BX_INFO(("cpu loop quit, shutting down simulator"));
   bx_atexit();
   return(0);
 }
 
+static void bx_snapshot_timer(void *this_ptr)
+{
+  UNUSED(this_ptr);
+  bx_snapshot_due = 1;
+  bx_stop_simulation();
+}
+
 void bx_stop_simulation(void)
 {
   // in wxWidgets, the whole simulator is running in a separate thread.
@@ -983,6 +1040,7 @@ void bx_sr_after_restore_state(void)
     BX_CPU(i)->after_restore_state();
   }
 #endif
+  bx_pc_system.after_restore_state();
   DEV_after_restore_state();
 }
 
@@ -1035,7 +1093,12 @@ void bx_init_hardware()
   BX_INFO(("CPU configuration"));
   BX_INFO(("  level: %d",BX_CPU_LEVEL));
 #if BX_SUPPORT_SMP
+#if BX_SUPPORT_SMP_THREADS
+  BX_INFO(("  SMP support: yes, quantum=%d, mode=%s", SIM->get_param_num(BXPN_SMP_QUANTUM)->get(),
+    SIM->get_param_enum(BXPN_SMP_MODE)->get_selected()));
+#else
   BX_INFO(("  SMP support: yes, quantum=%d", SIM->get_param_num(BXPN_SMP_QUANTUM)->get()));
+#endif
 #else
   BX_INFO(("  SMP support: no"));
 #endif
@@ -1065,6 +1128,13 @@ void bx_init_hardware()
   BX_INFO(("Optimization configuration"));
   BX_INFO(("  RepeatSpeedups support: %s",BX_SupportRepeatSpeedups?"yes":"no"));
   BX_INFO(("  Trace cache support: %s",BX_SUPPORT_TRACE_CACHE?"yes":"no"));
+  BX_INFO(("  Trace linking support: %s",BX_SUPPORT_TRACE_LINKING?"yes":"no"));
+  BX_INFO(("  Instruction fusion support: %s",BX_SUPPORT_INSTR_FUSION?"yes":"no"));
+  BX_INFO(("  Flags liveness analysis: %s",BX_SUPPORT_FLAGS_LIVENESS?"yes":"no"));
+  BX_INFO(("  Host lazy flags: %s",BX_HOST_LAZY_FLAGS?"yes":"no"));
+  BX_INFO(("  TLB address space tagging: %s",BX_SUPPORT_TLB_ASID?"yes":"no"));
+  BX_INFO(("  JIT translation support: %s",BX_SUPPORT_JIT?"yes":"no"));
+  BX_INFO(("  Handlers chaining support: %s",BX_SUPPORT_HANDLERS_CHAINING?"yes":"no"));
   BX_INFO(("  Fast function calls: %s",BX_FAST_FUNC_CALL?"yes":"no"));
   BX_INFO(("Devices configuration"));
   BX_INFO(("  ACPI support: %s",BX_SUPPORT_ACPI?"yes":"no"));
@@ -1167,6 +1237,18 @@ void bx_init_hardware()
     }
   }
 
+  // set one shot timer for snapshot mode if needed, the simulation stops
+  // when it fires and the state is saved.  It is registered after the
+  // state was restored, so the timers of a snapshot and of the machines
+  // restored from it are the same.
+  Bit64u snapshot_ticks = SIM->get_param_num(BXPN_SNAPSHOT_TICKS)->get64();
+  if (snapshot_ticks) {
+    BX_INFO(("Bochs snapshot mode is ON (state saved to '%s' after " FMT_LL "u ticks)",
+      SIM->get_param_string(BXPN_SNAPSHOT_PATH)->getptr(), snapshot_ticks));
+    bx_pc_system.register_timer_ticks(&bx_pc_system, bx_snapshot_timer,
+        snapshot_ticks, 0, 1, "snapshot.timer");
+  }
+
   bx_gui->init_signal_handlers();
   bx_pc_system.start_timers();
 
@@ -1196,6 +1278,11 @@ int bx_atexit(void)
 {
   if (!SIM->get_init_done()) return 1; // protect from reentry
 
+#if BX_SUPPORT_SMP_THREADS
+  // stop the other processor threads before tearing everything down
+  bx_smp_stop();
+#endif
+
   // in case we ended up in simulation mode, change back to config mode
   // so that the user can see any messages left behind on the console.
   SIM->set_display_mode(DISP_MODE_CONFIG);
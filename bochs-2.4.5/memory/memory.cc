@@ -71,21 +71,27 @@ void BX_MEM_C::writePhysicalPage(BX_CPU_C *cpu, bx_phy_address addr, unsigned le
     }
   }
 
-  memory_handler = BX_MEM_THIS memory_handlers[a20addr >> 20];
+  memory_handler = BX_MEM_THIS get_memory_handlers(a20addr);
   while (memory_handler) {
     if (memory_handler->begin <= a20addr &&
-          memory_handler->end >= a20addr &&
-          memory_handler->write_handler(a20addr, len, data, memory_handler->param))
+          memory_handler->end >= a20addr)
     {
-      return;
+      // the device behind the handler is serialized with the other processors
+      BX_SMP_SERIALIZE();
+      BX_SMP_LOCK();
+      bx_bool handled = memory_handler->write_handler(a20addr, len, data, memory_handler->param);
+      BX_SMP_UNLOCK();
+      if (handled) return;
     }
-    memory_handler = memory_handler->next;
+    memory_handler = BX_MEM_THIS next_memory_handler(memory_handler, a20addr);
   }
 
 mem_write:
 
   // all memory access fits in single 4K page
   if (a20addr < BX_MEM_THIS len && ! is_bios) {
+    if (cpu != NULL)
+      BX_SMP_ACCESS(cpu->which_cpu(), a20addr, BX_WRITE);
     pageWriteStampTable.decWriteStamp(a20addr);
     // all of data is within limits of physical memory
     if (a20addr < 0x000a0000 || a20addr >= 0x00100000)
@@ -215,20 +221,26 @@ void BX_MEM_C::readPhysicalPage(BX_CPU_C *cpu, bx_phy_address addr, unsigned len
     }
   }
 
-  memory_handler = BX_MEM_THIS memory_handlers[a20addr >> 20];
+  memory_handler = BX_MEM_THIS get_memory_handlers(a20addr);
   while (memory_handler) {
     if (memory_handler->begin <= a20addr &&
-          memory_handler->end >= a20addr &&
-          memory_handler->read_handler(a20addr, len, data, memory_handler->param))
+          memory_handler->end >= a20addr)
     {
-      return;
+      // the device behind the handler is serialized with the other processors
+      BX_SMP_SERIALIZE();
+      BX_SMP_LOCK();
+      bx_bool handled = memory_handler->read_handler(a20addr, len, data, memory_handler->param);
+      BX_SMP_UNLOCK();
+      if (handled) return;
     }
-    memory_handler = memory_handler->next;
+    memory_handler = BX_MEM_THIS next_memory_handler(memory_handler, a20addr);
   }
 
 mem_read:
 
   if (a20addr < BX_MEM_THIS len && ! is_bios) {
+    if (cpu != NULL)
+      BX_SMP_ACCESS(cpu->which_cpu(), a20addr, BX_READ);
     // all of data is within limits of physical memory
     if (a20addr < 0x000a0000 || a20addr >= 0x00100000)
     {
@@ -358,3 +370,57 @@ inc_one:
     }
   }
 }
+
+//
+// Bulk transfers for devices (bus master DMA).  A span within one page is
+// copied directly from or to the host memory and the write stamps of the
+// page are invalidated once.  Only pages which belong to a memory handler
+// or are otherwise special go through readPhysicalPage/writePhysicalPage.
+//
+
+Bit8u* BX_MEM_C::dmaGetHostMemAddr(bx_phy_address addr, unsigned rw)
+{
+  Bit8u *memptr = BX_MEM_THIS getHostMemAddr(NULL, addr, rw);
+  if (memptr != NULL && (rw & 1)) {
+    // the page is about to be modified by the device, anywhere from addr
+    // up to its end
+#if BX_SUPPORT_MONITOR_MWAIT
+    BX_MEM_THIS check_monitor(A20ADDR(addr), 0x1000 - (unsigned)(addr & 0xfff));
+#endif
+    pageWriteStampTable.decWriteStamp(A20ADDR(addr));
+  }
+  return memptr;
+}
+
+void BX_MEM_C::dmaReadPhysicalPage(bx_phy_address addr, unsigned len, Bit8u *data)
+{
+  // Note: accesses should always be contained within a single page
+  if ((addr>>12) != ((addr+len-1)>>12)) {
+    BX_PANIC(("dmaReadPhysicalPage: cross page access at address 0x" FMT_PHY_ADDRX ", len=%d", addr, len));
+  }
+
+  Bit8u *memptr = BX_MEM_THIS dmaGetHostMemAddr(addr, BX_READ);
+  if (memptr != NULL)
+    memcpy(data, memptr, len);
+  else
+    BX_MEM_THIS readPhysicalPage(NULL, addr, len, data);
+}
+
+void BX_MEM_C::dmaWritePhysicalPage(bx_phy_address addr, unsigned len, Bit8u *data)
+{
+  // Note: accesses should always be contained within a single page
+  if ((addr>>12) != ((addr+len-1)>>12)) {
+    BX_PANIC(("dmaWritePhysicalPage: cross page access at address 0x" FMT_PHY_ADDRX ", len=%d", addr, len));
+  }
+
+  Bit8u *memptr = BX_MEM_THIS getHostMemAddr(NULL, addr, BX_WRITE);
+  if (memptr != NULL) {
+#if BX_SUPPORT_MONITOR_MWAIT
+    BX_MEM_THIS check_monitor(A20ADDR(addr), len);
+#endif
+    pageWriteStampTable.decWriteStamp(A20ADDR(addr));
+    memcpy(memptr, data, len);
+  }
+  else
+    BX_MEM_THIS writePhysicalPage(NULL, addr, len, data);
+}
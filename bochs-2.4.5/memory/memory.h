@@ -43,6 +43,7 @@ class BX_CPU_C;
 
 typedef bx_bool (*memory_handler_t)(bx_phy_address addr, unsigned len, void *data, void *param);
 
+// one record for every registration, kept on a list newest first
 struct memory_handler_struct {
   struct memory_handler_struct *next;
   void *param;
@@ -52,12 +53,24 @@ struct memory_handler_struct {
   memory_handler_t write_handler;
 };
 
+// memory handlers are looked up per page, with one table of page entries
+// for every megabyte which has handlers. A page entry refers to the newest
+// record covering the page; when more records cover it, the older ones are
+// found further down the list of all records.
+struct memory_handler_page {
+  struct memory_handler_struct *handler;
+  unsigned count;
+};
+
+#define BX_MEM_HANDLER_PAGES (BX_MEM_BLOCK_LEN >> 12)
+
 #define SMRAM_CODE  1
 #define SMRAM_DATA  2
 
 class BOCHSAPI BX_MEM_C : public logfunctions {
 private:
-  struct memory_handler_struct **memory_handlers;
+  struct memory_handler_page **memory_handlers;
+  struct memory_handler_struct *memory_handler_list;
   bx_bool rom_present[65];
   bx_bool pci_enabled;
   bx_bool smram_available;
@@ -66,6 +79,7 @@ private:
 
   Bit64u  len, allocated;  // could be > 4G
   Bit8u   *actual_vector;
+  Bit32u   actual_len; // size of a mapped vector, 0 if allocated with new
   Bit8u   *vector;   // aligned correctly
   Bit8u  **blocks;
   Bit8u   *rom;      // 512k BIOS rom space + 128k expansion rom space
@@ -86,6 +100,9 @@ public:
                                       unsigned len, void *data);
   BX_MEM_SMF void    writePhysicalPage(BX_CPU_C *cpu, bx_phy_address addr,
                                        unsigned len, void *data);
+  BX_MEM_SMF void    dmaReadPhysicalPage(bx_phy_address addr, unsigned len, Bit8u *data);
+  BX_MEM_SMF void    dmaWritePhysicalPage(bx_phy_address addr, unsigned len, Bit8u *data);
+  BX_MEM_SMF Bit8u*  dmaGetHostMemAddr(bx_phy_address addr, unsigned rw);
   BX_MEM_SMF void    load_ROM(const char *path, bx_phy_address romaddress, Bit8u type);
   BX_MEM_SMF void    load_RAM(const char *path, bx_phy_address romaddress, Bit8u type);
 #if (BX_DEBUGGER || BX_DISASM || BX_GDBSTUB)
@@ -101,8 +118,14 @@ public:
   BX_MEM_SMF bx_bool unregisterMemoryHandlers(memory_handler_t read_handler, memory_handler_t write_handler,
 		  bx_phy_address begin_addr, bx_phy_address end_addr);
   BX_MEM_SMF Bit64u  get_memory_len(void);
+  BX_MEM_SMF struct memory_handler_struct *get_memory_handlers(bx_phy_address a20addr);
+  BX_MEM_SMF struct memory_handler_struct *next_memory_handler(struct memory_handler_struct *memory_handler, bx_phy_address a20addr);
   BX_MEM_SMF void allocate_block(Bit32u index);
   BX_MEM_SMF Bit8u* alloc_vector_aligned(Bit32u bytes, Bit32u alignment);
+  BX_MEM_SMF void free_vector(void);
+#if BX_HAVE_SYS_MMAN_H
+  BX_MEM_SMF void map_ram_file(const char *path);
+#endif
 
 #if BX_SUPPORT_MONITOR_MWAIT
   BX_MEM_SMF bx_bool is_monitor(bx_phy_address begin_addr, unsigned len);
@@ -134,6 +157,23 @@ BX_CPP_INLINE Bit8u* BX_MEM_C::get_vector(bx_phy_address addr)
   return BX_MEM_THIS blocks[block] + (Bit32u)(addr & (BX_MEM_BLOCK_LEN-1));
 }
 
+// returns the newest memory handler which covers the page of a20addr
+BX_CPP_INLINE struct memory_handler_struct* BX_MEM_C::get_memory_handlers(bx_phy_address a20addr)
+{
+  struct memory_handler_page *pages = BX_MEM_THIS memory_handlers[a20addr >> 20];
+  if (! pages) return NULL;
+  return pages[(a20addr >> 12) & (BX_MEM_HANDLER_PAGES-1)].handler;
+}
+
+// returns the next candidate after memory_handler for the page of a20addr,
+// the caller still has to check the range of the returned record
+BX_CPP_INLINE struct memory_handler_struct* BX_MEM_C::next_memory_handler(struct memory_handler_struct *memory_handler, bx_phy_address a20addr)
+{
+  struct memory_handler_page *pages = BX_MEM_THIS memory_handlers[a20addr >> 20];
+  if (pages[(a20addr >> 12) & (BX_MEM_HANDLER_PAGES-1)].count < 2) return NULL;
+  return memory_handler->next;
+}
+
 BX_CPP_INLINE Bit64u BX_MEM_C::get_memory_len(void)
 {
   return (BX_MEM_THIS len);
@@ -28,8 +28,21 @@
 #include "iodev/iodev.h"
 #define LOG_THIS BX_MEM(0)->
 
+#if BX_HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#include <fcntl.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+#endif
+
 // alignment of memory vector, must be a power of 2
 #define BX_MEM_VECTOR_ALIGN 4096
+// alignment of a mapped memory vector, the size of a huge page
+#define BX_MEM_MAP_ALIGN (2*1024*1024)
 #define BX_MEM_HANDLERS   ((BX_CONST64(1) << BX_PHY_ADDRESS_WIDTH) >> 20) /* one per megabyte */
 
 BX_MEM_C::BX_MEM_C()
@@ -38,15 +51,34 @@ BX_MEM_C::BX_MEM_C()
 
   vector = NULL;
   actual_vector = NULL;
+  actual_len = 0;
   blocks = NULL;
   len    = 0;
   used_blocks = 0;
 
   memory_handlers = NULL;
+  memory_handler_list = NULL;
 }
 
 Bit8u* BX_MEM_C::alloc_vector_aligned(Bit32u bytes, Bit32u alignment)
 {
+#if BX_HAVE_SYS_MMAN_H
+  // Reserve the address space only.  The host commits the pages when the
+  // guest touches them first, so memory which is never used costs nothing.
+  if (alignment < BX_MEM_MAP_ALIGN) alignment = BX_MEM_MAP_ALIGN;
+  BX_MEM_THIS actual_len = bytes + alignment;
+  void *ptr = mmap(NULL, BX_MEM_THIS actual_len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (ptr != MAP_FAILED) {
+    BX_MEM_THIS actual_vector = (Bit8u *) ptr;
+    Bit8u *vector = (Bit8u *)((((bx_ptr_equiv_t) ptr) + alignment - 1) & ~((bx_ptr_equiv_t) alignment - 1));
+#ifdef MADV_HUGEPAGE
+    madvise(vector, bytes, MADV_HUGEPAGE);
+#endif
+    return vector;
+  }
+  BX_MEM_THIS actual_len = 0;
+#endif
   Bit64u test_mask = alignment - 1;
   BX_MEM_THIS actual_vector = new Bit8u [(Bit32u)(bytes + test_mask)];
   if (BX_MEM_THIS actual_vector == 0) {
@@ -64,6 +96,42 @@ Bit8u* BX_MEM_C::alloc_vector_aligned(Bit32u bytes, Bit32u alignment)
   return vector;
 }
 
+void BX_MEM_C::free_vector(void)
+{
+#if BX_HAVE_SYS_MMAN_H
+  if (BX_MEM_THIS actual_len > 0) {
+    munmap(BX_MEM_THIS actual_vector, BX_MEM_THIS actual_len);
+    BX_MEM_THIS actual_len = 0;
+  }
+  else
+#endif
+  delete [] BX_MEM_THIS actual_vector;
+  BX_MEM_THIS actual_vector = NULL;
+}
+
+#if BX_HAVE_SYS_MMAN_H
+// Back the guest RAM with a file (e.g. on a hugetlbfs or tmpfs mount)
+// instead of anonymous host memory.  The file starts out zero filled.
+void BX_MEM_C::map_ram_file(const char *path)
+{
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    BX_PANIC(("cannot open RAM file '%s'", path));
+    return;
+  }
+  if (ftruncate(fd, 0) < 0 || ftruncate(fd, (off_t) BX_MEM_THIS allocated) < 0 ||
+      mmap(BX_MEM_THIS vector, BX_MEM_THIS allocated, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+  {
+    BX_PANIC(("cannot map RAM file '%s'", path));
+  }
+  else {
+    BX_INFO(("guest RAM mapped from '%s'", path));
+  }
+  close(fd);
+}
+#endif
+
 BX_MEM_C::~BX_MEM_C()
 {
   cleanup_memory();
@@ -81,8 +149,7 @@ void BX_MEM_C::init_memory(Bit64u guest, Bit64u host)
 
   if (BX_MEM_THIS actual_vector != NULL) {
     BX_INFO(("freeing existing memory vector"));
-    delete [] BX_MEM_THIS actual_vector;
-    BX_MEM_THIS actual_vector = NULL;
+    free_vector();
     BX_MEM_THIS vector = NULL;
     BX_MEM_THIS blocks = NULL;
   }
@@ -95,6 +162,12 @@ void BX_MEM_C::init_memory(Bit64u guest, Bit64u host)
   BX_MEM_THIS rom = &BX_MEM_THIS vector[host];
   BX_MEM_THIS bogus = &BX_MEM_THIS vector[host + BIOSROMSZ + EXROMSIZE];
   memset(BX_MEM_THIS rom, 0xff, BIOSROMSZ + EXROMSIZE + 4096);
+#if BX_HAVE_SYS_MMAN_H
+  if (BX_MEM_THIS actual_len > 0) {
+    const char *ram_file = SIM->get_param_string(BXPN_MEM_FILE)->getptr();
+    if (strlen(ram_file) > 0) map_ram_file(ram_file);
+  }
+#endif
   for (idx = 0; idx < 65; idx++)
     BX_MEM_THIS rom_present[idx] = 0;
 
@@ -120,9 +193,10 @@ void BX_MEM_C::init_memory(Bit64u guest, Bit64u host)
     BX_MEM_THIS used_blocks = 0;
   }
 
-  BX_MEM_THIS memory_handlers = new struct memory_handler_struct *[BX_MEM_HANDLERS];
+  BX_MEM_THIS memory_handlers = new struct memory_handler_page *[BX_MEM_HANDLERS];
   for (idx = 0; idx < BX_MEM_HANDLERS; idx++)
     BX_MEM_THIS memory_handlers[idx] = NULL;
+  BX_MEM_THIS memory_handler_list = NULL;
 
   BX_MEM_THIS pci_enabled = SIM->get_param_bool(BXPN_I440FX_SUPPORT)->get();
   BX_MEM_THIS smram_available = 0;
@@ -199,8 +273,7 @@ void BX_MEM_C::cleanup_memory()
   unsigned idx;
 
   if (BX_MEM_THIS vector != NULL) {
-    delete [] BX_MEM_THIS actual_vector;
-    BX_MEM_THIS actual_vector = NULL;
+    free_vector();
     BX_MEM_THIS vector = NULL;
     BX_MEM_THIS rom = NULL;
     BX_MEM_THIS bogus = NULL;
@@ -209,17 +282,17 @@ void BX_MEM_C::cleanup_memory()
     BX_MEM_THIS used_blocks = 0;
     if (BX_MEM_THIS memory_handlers != NULL) {
       for (idx = 0; idx < BX_MEM_HANDLERS; idx++) {
-        struct memory_handler_struct *memory_handler = BX_MEM_THIS memory_handlers[idx];
-        struct memory_handler_struct *prev = NULL;
-        while (memory_handler) {
-          prev = memory_handler;
-          memory_handler = memory_handler->next;
-          delete prev;
-        }
+        if (BX_MEM_THIS memory_handlers[idx])
+          delete [] BX_MEM_THIS memory_handlers[idx];
       }
       delete [] BX_MEM_THIS memory_handlers;
       BX_MEM_THIS memory_handlers = NULL;
     }
+    while (BX_MEM_THIS memory_handler_list) {
+      struct memory_handler_struct *memory_handler = BX_MEM_THIS memory_handler_list;
+      BX_MEM_THIS memory_handler_list = memory_handler->next;
+      delete memory_handler;
+    }
   }
 }
 
@@ -591,13 +664,13 @@ Bit8u *BX_MEM_C::getHostMemAddr(BX_CPU_C *cpu, bx_phy_address addr, unsigned rw)
   }
 #endif
 
-  struct memory_handler_struct *memory_handler = BX_MEM_THIS memory_handlers[a20addr >> 20];
+  struct memory_handler_struct *memory_handler = BX_MEM_THIS get_memory_handlers(a20addr);
   while (memory_handler) {
     if (memory_handler->begin <= a20addr &&
         memory_handler->end >= a20addr) {
       return(NULL); // Vetoed! memory handler for i/o apic, vram, mmio and PCI PnP
     }
-    memory_handler = memory_handler->next;
+    memory_handler = BX_MEM_THIS next_memory_handler(memory_handler, a20addr);
   }
 
   if (! write) {
@@ -682,6 +755,10 @@ Bit8u *BX_MEM_C::getHostMemAddr(BX_CPU_C *cpu, bx_phy_address addr, unsigned rw)
 /*
  * One needs to provide both a read_handler and a write_handler.
  * XXX: maybe we should check for overlapping memory handlers
+ *
+ * The handlers are kept in one record per registration, every page of
+ * the range refers to it, so that the access to a physical address finds
+ * the handlers of its page directly.
  */
   bx_bool
 BX_MEM_C::registerMemoryHandlers(void *param, memory_handler_t read_handler,
@@ -692,15 +769,27 @@ BX_MEM_C::registerMemoryHandlers(void *param, memory_handler_t read_handler,
   if (!read_handler || !write_handler)
     return 0;
   BX_INFO(("Register memory access handlers: 0x" FMT_PHY_ADDRX " - 0x" FMT_PHY_ADDRX, begin_addr, end_addr));
-  for (unsigned page_idx = begin_addr >> 20; page_idx <= end_addr >> 20; page_idx++) {
-    struct memory_handler_struct *memory_handler = new struct memory_handler_struct;
-    memory_handler->next = BX_MEM_THIS memory_handlers[page_idx];
-    BX_MEM_THIS memory_handlers[page_idx] = memory_handler;
-    memory_handler->read_handler = read_handler;
-    memory_handler->write_handler = write_handler;
-    memory_handler->param = param;
-    memory_handler->begin = begin_addr;
-    memory_handler->end = end_addr;
+  struct memory_handler_struct *memory_handler = new struct memory_handler_struct;
+  memory_handler->next = BX_MEM_THIS memory_handler_list;
+  BX_MEM_THIS memory_handler_list = memory_handler;
+  memory_handler->read_handler = read_handler;
+  memory_handler->write_handler = write_handler;
+  memory_handler->param = param;
+  memory_handler->begin = begin_addr;
+  memory_handler->end = end_addr;
+  for (Bit64u page_idx = begin_addr >> 12; page_idx <= (Bit64u)(end_addr >> 12); page_idx++) {
+    struct memory_handler_page *pages = BX_MEM_THIS memory_handlers[page_idx / BX_MEM_HANDLER_PAGES];
+    if (! pages) {
+      pages = new struct memory_handler_page[BX_MEM_HANDLER_PAGES];
+      for (unsigned page = 0; page < BX_MEM_HANDLER_PAGES; page++) {
+        pages[page].handler = NULL;
+        pages[page].count = 0;
+      }
+      BX_MEM_THIS memory_handlers[page_idx / BX_MEM_HANDLER_PAGES] = pages;
+    }
+    // the new record is the newest one for every page of its range
+    pages[page_idx & (BX_MEM_HANDLER_PAGES-1)].handler = memory_handler;
+    pages[page_idx & (BX_MEM_HANDLER_PAGES-1)].count++;
   }
   return 1;
 }
@@ -709,31 +798,37 @@ BX_MEM_C::registerMemoryHandlers(void *param, memory_handler_t read_handler,
 BX_MEM_C::unregisterMemoryHandlers(memory_handler_t read_handler, memory_handler_t write_handler,
 		bx_phy_address begin_addr, bx_phy_address end_addr)
 {
-  bx_bool ret = 1;
   BX_INFO(("Memory access handlers unregistered: 0x" FMT_PHY_ADDRX " - 0x" FMT_PHY_ADDRX, begin_addr, end_addr));
-  for (unsigned page_idx = begin_addr >> 20; page_idx <= end_addr >> 20; page_idx++) {
-    struct memory_handler_struct *memory_handler = BX_MEM_THIS memory_handlers[page_idx];
-    struct memory_handler_struct *prev = NULL;
-    while (memory_handler &&
-         memory_handler->read_handler != read_handler &&
-         memory_handler->write_handler != write_handler &&
-         memory_handler->begin != begin_addr &&
-         memory_handler->end != end_addr)
-    {
-      prev = memory_handler;
-      memory_handler = memory_handler->next;
-    }
-    if (!memory_handler) {
-      ret = 0;  // we should have found it
-      continue; // anyway, try the other pages
-    }
-    if (prev)
-      prev->next = memory_handler->next;
-    else
-      BX_MEM_THIS memory_handlers[page_idx] = memory_handler->next;
-    delete memory_handler;
+  struct memory_handler_struct *memory_handler = BX_MEM_THIS memory_handler_list;
+  struct memory_handler_struct *prev = NULL;
+  while (memory_handler &&
+       (memory_handler->read_handler != read_handler ||
+        memory_handler->write_handler != write_handler ||
+        memory_handler->begin != begin_addr ||
+        memory_handler->end != end_addr))
+  {
+    prev = memory_handler;
+    memory_handler = memory_handler->next;
   }
-  return ret;
+  if (!memory_handler)
+    return 0;  // we should have found it
+  if (prev)
+    prev->next = memory_handler->next;
+  else
+    BX_MEM_THIS memory_handler_list = memory_handler->next;
+
+  for (Bit64u page_idx = begin_addr >> 12; page_idx <= (Bit64u)(end_addr >> 12); page_idx++) {
+    struct memory_handler_page *page = &BX_MEM_THIS memory_handlers[page_idx / BX_MEM_HANDLER_PAGES][page_idx & (BX_MEM_HANDLER_PAGES-1)];
+    page->count--;
+    if (page->handler != memory_handler) continue;
+    // refer the page to the next older record which still covers it
+    struct memory_handler_struct *older = page->count ? memory_handler->next : NULL;
+    while (older && (older->begin >> 12 > page_idx || older->end >> 12 < page_idx))
+      older = older->next;
+    page->handler = older;
+  }
+  delete memory_handler;
+  return 1;
 }
 
 void BX_MEM_C::enable_smram(bx_bool enable, bx_bool restricted)
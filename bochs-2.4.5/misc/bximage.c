@@ -19,6 +19,8 @@
 #include <string.h>
 #include <ctype.h>
 #include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include "config.h"
 
 #include <string.h>
@@ -28,12 +30,23 @@
 #define HDIMAGE_HEADERS_ONLY 1
 #include "../iodev/hdimage.h"
 
+#if BX_COMPRESSED_HD_SUPPORT
+#include <zlib.h>
+#endif
+
+#define BXIMAGE_FUNC_CREATE  0
+#define BXIMAGE_FUNC_CLONE   1
+#define BXIMAGE_FUNC_CONVERT 2
+#define BXIMAGE_FUNC_COMPACT 3
+
+int bx_func;
 int bx_hdimage;
 int bx_fdsize_idx;
 int bx_hdsize;
 int bx_hdimagemode;
 int bx_interactive;
 char bx_filename[256];
+char bx_filename2[256];
 
 typedef int (*WRITE_IMAGE)(FILE*, Bit64u);
 #ifdef WIN32
@@ -55,9 +68,13 @@ char *fdsize_choices[] = { "0.16","0.18","0.32","0.36","0.72","1.2","1.44","1.68
 int fdsize_n_choices = 10;
 
 /* menu data for choosing disk mode */
-char *hdmode_menu = "\nWhat kind of image should I create?\nPlease type flat, sparse or growing. ";
-                char *hdmode_choices[] = {"flat", "sparse", "growing" };
-int hdmode_n_choices = 3;
+char *hdmode_menu = "\nWhat kind of image should I create?\nPlease type flat, sparse, growing or dedup. ";
+                char *hdmode_choices[] = {"flat", "sparse", "growing", "dedup" };
+int hdmode_n_choices = 4;
+
+/* names of the -func option */
+char *func_choices[] = { "create", "clone", "convert", "compact" };
+int func_n_choices = 4;
 
 void myexit(int code)
 {
@@ -420,6 +437,394 @@ int make_growing_image(FILE *fp, Bit64u sec)
   return 0;
 }
 
+/* dedup images: the clusters of the image are kept in records, equal
+   clusters share one record. A dedup_file_t is used to read an image
+   (and its chain of base images) or to write a new one. */
+typedef struct {
+  Bit64u hash;
+  Bit64u offset;
+  Bit32u next;
+} dedup_index_t;
+
+typedef struct dedup_file {
+  FILE *fp;
+  dedup_header_t header;
+  Bit32u cluster_size;
+  Bit32u clusters;
+  Bit64u *map;              /* kept in little endian like on disk */
+  Bit64u file_size;
+  Bit8u *buffer;
+  Bit8u *compare;
+  struct dedup_file *base;
+  Bit32u *index_heads;
+  Bit32u index_mask;
+  dedup_index_t *index;
+  Bit32u index_count;
+  Bit32u index_size;
+} dedup_file_t;
+
+/* seek to a 64-bit offset, fseek() only takes a long */
+int fseek64(FILE *fp, Bit64u offset)
+{
+  if (fseek(fp, 0, SEEK_SET) != 0)
+    return -1;
+  while (offset > 0) {
+    long step = (long)((offset < 0x40000000) ? offset : 0x40000000);
+    if (fseek(fp, step, SEEK_CUR) != 0)
+      return -1;
+    offset -= step;
+  }
+  return 0;
+}
+
+Bit64u dedup_hash(const Bit8u *data, Bit32u size)
+{
+  Bit64u hash = DEDUP_HASH_INIT;
+  Bit32u i;
+
+  for (i=0; i<size; i++) {
+    hash ^= data[i];
+    hash *= DEDUP_HASH_PRIME;
+  }
+  return hash;
+}
+
+/* returns 1 if the file starts with a dedup image header, which is
+   copied to header */
+int is_dedup_image(const char *filename, dedup_header_t *header)
+{
+  FILE *fp = fopen(filename, "rb");
+  int ret = 0;
+
+  if (fp == NULL)
+    return 0;
+  if (fread(header, sizeof(dedup_header_t), 1, fp) == 1) {
+    ret = !strcmp((char*)header->standard.magic, STANDARD_HEADER_MAGIC) &&
+          !strcmp((char*)header->standard.type, DEDUP_TYPE) &&
+          !strcmp((char*)header->standard.subtype, DEDUP_SUBTYPE) &&
+          (dtoh32(header->standard.version) == STANDARD_HEADER_VERSION);
+  }
+  fclose(fp);
+  return ret;
+}
+
+/* name of the base image as seen from the current directory */
+void dedup_base_path(const char *filename, const char *basename, char *path)
+{
+  const char *dirend = strrchr(filename, '/');
+#ifdef WIN32
+  if (strrchr(filename, '\\') > dirend) dirend = strrchr(filename, '\\');
+#endif
+  if ((basename[0] == '/') || (basename[0] == '\\') ||
+      (basename[0] != 0 && basename[1] == ':') || (dirend == NULL)) {
+    strcpy(path, basename);
+  } else {
+    memcpy(path, filename, dirend - filename + 1);
+    strcpy(path + (dirend - filename + 1), basename);
+  }
+}
+
+void dedup_alloc(dedup_file_t *df)
+{
+  Bit32u i;
+
+  df->map = (Bit64u*)calloc(df->clusters, sizeof(Bit64u));
+  df->buffer = (Bit8u*)malloc(df->cluster_size);
+  df->compare = (Bit8u*)malloc(df->cluster_size);
+  for (df->index_mask = 255; df->index_mask < df->clusters; df->index_mask = (df->index_mask << 1) | 1);
+  df->index_heads = (Bit32u*)malloc((df->index_mask + 1) * sizeof(Bit32u));
+  if ((df->map == NULL) || (df->buffer == NULL) || (df->compare == NULL) || (df->index_heads == NULL))
+    fatal("ERROR: Out of memory!");
+  for (i=0; i<=df->index_mask; i++)
+    df->index_heads[i] = 0xffffffff;
+  df->index = NULL;
+  df->index_count = df->index_size = 0;
+}
+
+void dedup_close(dedup_file_t *df)
+{
+  if (df->base != NULL) {
+    dedup_close(df->base);
+    free(df->base);
+  }
+  fclose(df->fp);
+  free(df->map);
+  free(df->buffer);
+  free(df->compare);
+  free(df->index_heads);
+  free(df->index);
+}
+
+void dedup_add_record(dedup_file_t *df, Bit64u hash, Bit64u offset)
+{
+  Bit32u i;
+
+  for (i = df->index_heads[hash & df->index_mask]; i != 0xffffffff; i = df->index[i].next) {
+    if (df->index[i].offset == offset)
+      return;
+  }
+  if (df->index_count == df->index_size) {
+    df->index_size = (df->index_size == 0) ? 256 : df->index_size * 2;
+    df->index = (dedup_index_t*)realloc(df->index, df->index_size * sizeof(dedup_index_t));
+    if (df->index == NULL)
+      fatal("ERROR: Out of memory!");
+  }
+  i = df->index_count++;
+  df->index[i].hash = hash;
+  df->index[i].offset = offset;
+  df->index[i].next = df->index_heads[hash & df->index_mask];
+  df->index_heads[hash & df->index_mask] = i;
+}
+
+/* open an image with all of its base images */
+int dedup_open(dedup_file_t *df, const char *filename, const char *mode)
+{
+  char basepath[512];
+  Bit32u i;
+
+  memset(df, 0, sizeof(dedup_file_t));
+  df->fp = fopen(filename, mode);
+  if (df->fp == NULL) {
+    printf("ERROR: Could not open '%s'\n", filename);
+    return -1;
+  }
+  if ((fread(&df->header, sizeof(df->header), 1, df->fp) != 1) ||
+      strcmp((char*)df->header.standard.magic, STANDARD_HEADER_MAGIC) ||
+      strcmp((char*)df->header.standard.type, DEDUP_TYPE) ||
+      strcmp((char*)df->header.standard.subtype, DEDUP_SUBTYPE) ||
+      (dtoh32(df->header.standard.version) != STANDARD_HEADER_VERSION)) {
+    printf("ERROR: '%s' is not a dedup image\n", filename);
+    fclose(df->fp);
+    return -1;
+  }
+  df->cluster_size = dtoh32(df->header.specific.cluster);
+  df->clusters = dtoh32(df->header.specific.clusters);
+  df->header.specific.base[DEDUP_BASE_NAME_LEN - 1] = 0;
+  dedup_alloc(df);
+  if ((fseek64(df->fp, STANDARD_HEADER_SIZE) != 0) ||
+      (fread(df->map, sizeof(Bit64u), df->clusters, df->fp) != df->clusters)) {
+    printf("ERROR: Could not read the cluster map of '%s'\n", filename);
+    dedup_close(df);
+    return -1;
+  }
+  for (i=0; i<df->clusters; i++) {
+    Bit64u offset = dtoh64(df->map[i]);
+    dedup_record_t record;
+    if ((offset == DEDUP_CLUSTER_BASE) || (offset == DEDUP_CLUSTER_ZERO))
+      continue;
+    if ((fseek64(df->fp, offset) != 0) || (fread(&record, sizeof(record), 1, df->fp) != 1)) {
+      printf("ERROR: Could not read the record of cluster %u in '%s'\n", i, filename);
+      dedup_close(df);
+      return -1;
+    }
+    dedup_add_record(df, dtoh64(record.hash), offset);
+  }
+  if (df->header.specific.base[0] != 0) {
+    dedup_base_path(filename, (char*)df->header.specific.base, basepath);
+    df->base = (dedup_file_t*)malloc(sizeof(dedup_file_t));
+    if (dedup_open(df->base, basepath, "rb") < 0) {
+      free(df->base);
+      df->base = NULL;
+      dedup_close(df);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* read the data of a record, returns 0 on success */
+int dedup_read_record(dedup_file_t *df, Bit64u offset, Bit8u *data)
+{
+  dedup_record_t record;
+  Bit32u length;
+
+  if ((fseek64(df->fp, offset) != 0) || (fread(&record, sizeof(record), 1, df->fp) != 1))
+    return -1;
+  length = dtoh32(record.length);
+  if (dtoh32(record.flags) & DEDUP_RECORD_DEFLATED) {
+#if BX_COMPRESSED_HD_SUPPORT
+    uLongf size = df->cluster_size;
+    if ((length > df->cluster_size) || (fread(df->buffer, length, 1, df->fp) != 1) ||
+        (uncompress(data, &size, df->buffer, length) != Z_OK) || (size != df->cluster_size))
+      return -1;
+#else
+    fatal("ERROR: The image has compressed clusters, bximage was built without zlib support!");
+#endif
+  } else {
+    if ((length != df->cluster_size) || (fread(data, length, 1, df->fp) != 1))
+      return -1;
+  }
+  return 0;
+}
+
+/* read a cluster as the guest sees it */
+int dedup_read_cluster(dedup_file_t *df, Bit32u index, Bit8u *data)
+{
+  Bit64u offset = dtoh64(df->map[index]);
+
+  if (offset == DEDUP_CLUSTER_BASE) {
+    if (df->base != NULL)
+      return dedup_read_cluster(df->base, index, data);
+    memset(data, 0, df->cluster_size);
+    return 0;
+  }
+  if (offset == DEDUP_CLUSTER_ZERO) {
+    memset(data, 0, df->cluster_size);
+    return 0;
+  }
+  return dedup_read_record(df, offset, data);
+}
+
+/* Create a suited dedup header, returns the offset of the first record */
+Bit64u make_dedup_header(dedup_header_t *header, Bit32u cluster_size, Bit64u size)
+{
+  Bit32u clusters = (Bit32u)((size + cluster_size - 1) / cluster_size);
+  Bit64u data = STANDARD_HEADER_SIZE + (((Bit64u)clusters * sizeof(Bit64u) + 511) & ~BX_CONST64(511));
+
+  strcpy((char*)header->standard.magic, STANDARD_HEADER_MAGIC);
+  strcpy((char*)header->standard.type, DEDUP_TYPE);
+  strcpy((char*)header->standard.subtype, DEDUP_SUBTYPE);
+  header->standard.version = htod32(STANDARD_HEADER_VERSION);
+  header->standard.header = htod32(STANDARD_HEADER_SIZE);
+
+  header->specific.cluster = htod32(cluster_size);
+  header->specific.clusters = htod32(clusters);
+  header->specific.disk = htod64(size);
+  header->specific.data = htod64(data);
+
+  return data;
+}
+
+/* create a new image, which starts out with an empty cluster map */
+int dedup_create(dedup_file_t *df, const char *filename, Bit32u cluster_size, Bit64u disk, const char *basename)
+{
+  Bit64u data;
+
+  memset(df, 0, sizeof(dedup_file_t));
+  data = make_dedup_header(&df->header, cluster_size, disk);
+  df->cluster_size = cluster_size;
+  df->clusters = dtoh32(df->header.specific.clusters);
+  if (basename != NULL) {
+    if (strlen(basename) >= DEDUP_BASE_NAME_LEN) {
+      printf("ERROR: The base image name '%s' is too long\n", basename);
+      return -1;
+    }
+    strcpy((char*)df->header.specific.base, basename);
+  }
+
+  df->fp = fopen(filename, "w+b");
+  if (df->fp == NULL) {
+    printf("ERROR: Could not write '%s'\n", filename);
+    return -1;
+  }
+  dedup_alloc(df);
+  /* the zero filled cluster map is left as a hole in the file */
+  if ((fwrite(&df->header, sizeof(df->header), 1, df->fp) != 1) ||
+      (fseek64(df->fp, data - 1) != 0) || (fputc('\0', df->fp) == EOF)) {
+    dedup_close(df);
+    printf("ERROR: Could not write the header of '%s'\n", filename);
+    return -1;
+  }
+  df->file_size = data;
+  return 0;
+}
+
+/* store a cluster of a new image, sharing the record of an equal cluster */
+int dedup_write_cluster(dedup_file_t *df, Bit32u index, const Bit8u *data)
+{
+  dedup_record_t record;
+  const Bit8u *stored = data;
+  Bit64u hash, offset = DEDUP_CLUSTER_ZERO;
+  Bit32u i, length = df->cluster_size;
+
+  for (i=0; i<df->cluster_size; i++) {
+    if (data[i] != 0) break;
+  }
+  if (i < df->cluster_size) {
+    hash = dedup_hash(data, df->cluster_size);
+    for (i = df->index_heads[hash & df->index_mask]; i != 0xffffffff; i = df->index[i].next) {
+      if ((df->index[i].hash == hash) &&
+          (dedup_read_record(df, df->index[i].offset, df->compare) == 0) &&
+          !memcmp(df->compare, data, df->cluster_size)) {
+        df->map[index] = htod64(df->index[i].offset);
+        return 0;
+      }
+    }
+    record.hash = htod64(hash);
+    record.flags = 0;
+#if BX_COMPRESSED_HD_SUPPORT
+    {
+      uLongf size = df->cluster_size;
+      if ((compress2(df->buffer, &size, data, df->cluster_size, Z_BEST_COMPRESSION) == Z_OK) &&
+          (size < df->cluster_size)) {
+        stored = df->buffer;
+        length = size;
+        record.flags = htod32(DEDUP_RECORD_DEFLATED);
+      }
+    }
+#endif
+    record.length = htod32(length);
+    if ((fseek64(df->fp, df->file_size) != 0) ||
+        (fwrite(&record, sizeof(record), 1, df->fp) != 1) ||
+        (fwrite(stored, length, 1, df->fp) != 1))
+      return -1;
+    offset = df->file_size;
+    df->file_size += sizeof(record) + length;
+    dedup_add_record(df, hash, offset);
+  }
+  df->map[index] = htod64(offset);
+  return 0;
+}
+
+/* write the cluster map of a new image and close it */
+int dedup_finish(dedup_file_t *df)
+{
+  int ret = 0;
+
+  if ((fseek64(df->fp, STANDARD_HEADER_SIZE) != 0) ||
+      (fwrite(df->map, sizeof(Bit64u), df->clusters, df->fp) != df->clusters))
+    ret = -1;
+  dedup_close(df);
+  return ret;
+}
+
+/* produce an empty dedup image file */
+int make_dedup_image(FILE *fp, Bit64u sec)
+{
+  dedup_header_t header;
+  Bit64u data;
+
+  memset(&header, 0, sizeof(header));
+  data = make_dedup_header(&header, DEDUP_DEFAULT_CLUSTER_SIZE, sec * 512);
+
+  if (fwrite(&header, sizeof(header), 1, fp) != 1) {
+    fclose(fp);
+    fatal("ERROR: The disk image is not complete - could not write header!");
+  }
+
+  fileset(fp, 0, (size_t)(data - STANDARD_HEADER_SIZE));
+
+  return 0;
+}
+
+/* ask before replacing an existing file */
+void confirm_overwrite(const char *filename)
+{
+  FILE *fp;
+  char buffer[1024];
+
+  fp = fopen(filename, "r");
+  if (fp) {
+    int confirm;
+    sprintf(buffer, "\nThe disk image '%s' already exists.  Are you sure you want to replace it?\nPlease type yes or no. ", filename);
+    if (ask_yn(buffer, 0, &confirm) < 0)
+      fatal(EOF_ERR);
+    if (!confirm)
+      fatal("ERROR: Aborted");
+    fclose(fp);
+  }
+}
+
 /* produce the image file */
 #ifdef WIN32
 int make_image_win32 (Bit64u sec, char *filename, WRITE_IMAGE_WIN32 write_image)
@@ -467,16 +872,7 @@ int make_image(Bit64u sec, char *filename, WRITE_IMAGE write_image)
   char buffer[1024];
 
   // check if it exists before trashing someone's disk image
-  fp = fopen(filename, "r");
-  if (fp) {
-    int confirm;
-    sprintf(buffer, "\nThe disk image '%s' already exists.  Are you sure you want to replace it?\nPlease type yes or no. ", filename);
-    if (ask_yn(buffer, 0, &confirm) < 0)
-      fatal(EOF_ERR);
-    if (!confirm)
-      fatal("ERROR: Aborted");
-    fclose(fp);
-  }
+  confirm_overwrite(filename);
 
   // okay, now open it for writing
   fp = fopen(filename, "w");
@@ -499,17 +895,216 @@ int make_image(Bit64u sec, char *filename, WRITE_IMAGE write_image)
   return 0;
 }
 
+Bit64u get_file_size(const char *filename)
+{
+  struct stat stat_buf;
+
+  if (stat(filename, &stat_buf) != 0)
+    return 0;
+  return (Bit64u)stat_buf.st_size;
+}
+
+void print_bochsrc_line(const char *filename, const char *mode, Bit64u size)
+{
+  Bit64u cyl = size / (16 * 63 * 512);
+
+  printf("\nThe following line should appear in your bochsrc:\n");
+  if (cyl * 16 * 63 * 512 == size) {
+    printf("  ata0-master: type=disk, path=\"%s\", mode=%s, cylinders=" FMT_LL "u, heads=16, spt=63\n",
+           filename, mode, cyl);
+  } else {
+    printf("  ata0-master: type=disk, path=\"%s\", mode=%s, cylinders=..., heads=..., spt=...\n",
+           filename, mode);
+    printf("(the size of " FMT_LL "u sectors has to match the geometry)\n", size / 512);
+  }
+}
+
+/* create a dedup image that shares all clusters with its base image, only
+   the header is written, the empty cluster map is a hole in the file */
+void clone_image(const char *basename, const char *filename)
+{
+  dedup_header_t header;
+  dedup_file_t clone;
+  const char *stored = basename;
+  const char *dirend = strrchr(filename, '/');
+  Bit64u disk;
+
+#ifdef WIN32
+  if (strrchr(filename, '\\') > dirend) dirend = strrchr(filename, '\\');
+#endif
+  if (!is_dedup_image(basename, &header))
+    fatal("ERROR: The base image must be a dedup image!");
+  /* the base image is stored relative to the directory of the clone */
+  if ((dirend != NULL) && (basename[0] != '/') && (basename[0] != '\\') &&
+      (basename[0] == 0 || basename[1] != ':')) {
+    if (strncmp(basename, filename, dirend - filename + 1) != 0)
+      fatal("ERROR: The base image must be in the directory of the clone or given with an absolute path!");
+    stored = basename + (dirend - filename + 1);
+  }
+  disk = dtoh64(header.specific.disk);
+
+  confirm_overwrite(filename);
+  if (dedup_create(&clone, filename, dtoh32(header.specific.cluster), disk, stored) < 0)
+    fatal("ERROR: Could not create the clone!");
+  dedup_close(&clone);
+
+  printf("\nI created the clone '%s' of '%s'.\n", filename, basename);
+  print_bochsrc_line(filename, "dedup", disk);
+}
+
+/* copy a flat or dedup image into a new flat or dedup image */
+void convert_image(const char *srcname, const char *filename, int mode)
+{
+  dedup_file_t src, dst;
+  FILE *srcfp = NULL, *dstfp = NULL;
+  Bit8u *data;
+  Bit64u disk;
+  dedup_header_t header;
+  Bit32u i, clusters, cluster_size;
+  int src_dedup = is_dedup_image(srcname, &header);
+
+  if ((mode != 0) && (mode != 3))
+    fatal("ERROR: Images can only be converted to flat or dedup mode!");
+  if (src_dedup) {
+    if (dedup_open(&src, srcname, "rb") < 0)
+      fatal("ERROR: Could not open the source image!");
+    disk = dtoh64(src.header.specific.disk);
+    cluster_size = src.cluster_size;
+  } else {
+    srcfp = fopen(srcname, "rb");
+    if (srcfp == NULL)
+      fatal("ERROR: Could not open the source image!");
+    disk = get_file_size(srcname);
+    cluster_size = DEDUP_DEFAULT_CLUSTER_SIZE;
+    if ((disk == 0) || (disk % 512))
+      fatal("ERROR: The size of the source image is not a multiple of 512 bytes!");
+  }
+  clusters = (Bit32u)((disk + cluster_size - 1) / cluster_size);
+  data = (Bit8u*)malloc(cluster_size);
+  if (data == NULL)
+    fatal("ERROR: Out of memory!");
+
+  confirm_overwrite(filename);
+  if (mode == 3) {
+    if (dedup_create(&dst, filename, cluster_size, disk, NULL) < 0)
+      fatal("ERROR: Could not write the disk image!");
+  } else {
+    dstfp = fopen(filename, "wb");
+    if (dstfp == NULL)
+      fatal("ERROR: Could not write the disk image!");
+  }
+
+  printf("\nConverting: [");
+  for (i=0; i<clusters; i++) {
+    Bit32u len = cluster_size;
+    if ((Bit64u)(i + 1) * cluster_size > disk)
+      len = (Bit32u)(disk - (Bit64u)i * cluster_size);
+    if (src_dedup) {
+      if (dedup_read_cluster(&src, i, data) < 0)
+        fatal("\nERROR: Could not read the source image!");
+    } else {
+      memset(data, 0, cluster_size);
+      if (fread(data, len, 1, srcfp) != 1)
+        fatal("\nERROR: Could not read the source image!");
+    }
+    if (mode == 3) {
+      if (dedup_write_cluster(&dst, i, data) < 0)
+        fatal("\nERROR: The disk image is not complete!");
+    } else {
+      if (fwrite(data, len, 1, dstfp) != 1)
+        fatal("\nERROR: The disk image is not complete!");
+    }
+    if ((i % (clusters / 64 + 1)) == 0) printf(".");
+  }
+  printf("] Done.\n");
+
+  if (mode == 3) {
+    printf("\n%u clusters, %u stored in " FMT_LL "u bytes\n", clusters, dst.index_count, dst.file_size);
+    if (dedup_finish(&dst) < 0)
+      fatal("ERROR: The disk image is not complete!");
+  } else {
+    fclose(dstfp);
+  }
+  if (src_dedup)
+    dedup_close(&src);
+  else
+    fclose(srcfp);
+  free(data);
+
+  printf("\nI converted '%s' to the %s image '%s'.\n", srcname, hdmode_choices[mode], filename);
+  print_bochsrc_line(filename, hdmode_choices[mode], disk);
+}
+
+/* rewrite a dedup image without the records that are no longer used */
+void compact_image(const char *filename)
+{
+  dedup_file_t src, dst;
+  char tempname[512];
+  Bit8u *data;
+  Bit64u offset, old_size = get_file_size(filename);
+  Bit32u i;
+
+  if (strlen(filename) + 9 > sizeof(tempname))
+    fatal("ERROR: Illegal filename");
+  sprintf(tempname, "%s.compact", filename);
+  if (dedup_open(&src, filename, "rb") < 0)
+    fatal("ERROR: Could not open the disk image!");
+  if (dedup_create(&dst, tempname, src.cluster_size, dtoh64(src.header.specific.disk),
+                   (char*)src.header.specific.base) < 0)
+    fatal("ERROR: Could not write the compacted image!");
+  data = (Bit8u*)malloc(src.cluster_size);
+  if (data == NULL)
+    fatal("ERROR: Out of memory!");
+
+  printf("\nCompacting: [");
+  for (i=0; i<src.clusters; i++) {
+    offset = dtoh64(src.map[i]);
+    /* clusters of the base image stay in the base image */
+    if (offset == DEDUP_CLUSTER_BASE)
+      continue;
+    if ((offset != DEDUP_CLUSTER_ZERO) && (dedup_read_record(&src, offset, data) < 0))
+      fatal("\nERROR: Could not read the disk image!");
+    if (offset == DEDUP_CLUSTER_ZERO)
+      memset(data, 0, src.cluster_size);
+    if (dedup_write_cluster(&dst, i, data) < 0)
+      fatal("\nERROR: The compacted image is not complete!");
+    if ((i % (src.clusters / 64 + 1)) == 0) printf(".");
+  }
+  printf("] Done.\n");
+  free(data);
+  dedup_close(&src);
+  if (dedup_finish(&dst) < 0)
+    fatal("ERROR: The compacted image is not complete!");
+
+#ifdef WIN32
+  remove(filename);
+#endif
+  if (rename(tempname, filename) != 0)
+    fatal("ERROR: Could not replace the disk image!");
+
+  printf("\nI compacted '%s' from " FMT_LL "u to " FMT_LL "u bytes.\n", filename, old_size,
+         get_file_size(filename));
+}
+
 void print_usage()
 {
   fprintf(stderr,
-    "Usage: bximage [options] [filename]\n\n"
+    "Usage: bximage [options] [filename1] [filename2]\n\n"
     "Supported options:\n"
+    "  -func=...        operation: create (default), clone, convert or compact\n"
     "  -fd              create floppy image\n"
     "  -hd              create hard disk image\n"
     "  -mode=...        image mode (hard disks only)\n"
     "  -size=...        image size in megabytes\n"
     "  -q               quiet mode (don't prompt for user input)\n"
-    "  --help           display this help and exit\n\n");
+    "  --help           display this help and exit\n\n"
+    "Operations:\n"
+    "  create           create the empty image filename1\n"
+    "  clone            create the dedup image filename2 on top of the dedup\n"
+    "                   image filename1, which must not be modified later\n"
+    "  convert          copy the flat or dedup image filename1 to the new image\n"
+    "                   filename2 (-mode=flat or -mode=dedup, the default)\n"
+    "  compact          remove the unused cluster records of dedup image filename1\n\n");
 }
 
 int parse_cmdline(int argc, char *argv[])
@@ -517,18 +1112,29 @@ int parse_cmdline(int argc, char *argv[])
   int arg = 1;
   int ret = 1;
 
+  bx_func = BXIMAGE_FUNC_CREATE;
   bx_hdimage = -1;
   bx_fdsize_idx = -1;
   bx_hdsize = -1;
   bx_hdimagemode = -1;
   bx_interactive = 1;
   bx_filename[0] = 0;
+  bx_filename2[0] = 0;
   while ((arg < argc) && (ret == 1)) {
     // parse next arg
     if (!strcmp("--help", argv[arg]) || !strncmp("/?", argv[arg], 2)) {
       print_usage();
       ret = 0;
     }
+    else if (!strncmp("-func=", argv[arg], 6)) {
+      bx_func = get_menu_index(&argv[arg][6], func_n_choices, func_choices);
+      if (bx_func < 0) {
+        printf("Unknown operation: %s\n\n", &argv[arg][6]);
+        ret = 0;
+      } else if (bx_func != BXIMAGE_FUNC_CREATE) {
+        bx_hdimage = 1;
+      }
+    }
     else if (!strcmp("-fd", argv[arg])) {
       bx_hdimage = 0;
       bx_hdimagemode = 0;
@@ -574,11 +1180,18 @@ int parse_cmdline(int argc, char *argv[])
     else if (argv[arg][0] == '-') {
       printf("Unknown option: %s\n\n", argv[arg]);
       ret = 0;
-    } else {
+    } else if (!strlen(bx_filename)) {
       strcpy(bx_filename, argv[arg]);
+    } else {
+      strcpy(bx_filename2, argv[arg]);
     }
     arg++;
   }
+  if (bx_func != BXIMAGE_FUNC_CREATE) {
+    if (bx_hdimagemode == -1)
+      bx_hdimagemode = 3;
+    return ret;
+  }
   if (bx_hdimage == -1) {
     bx_hdimage = 1;
     bx_fdsize_idx = 6;
@@ -620,6 +1233,21 @@ int CDECL main(int argc, char *argv[])
     myexit(1);
 
   print_banner();
+  if (bx_func != BXIMAGE_FUNC_CREATE) {
+    if (!strlen(bx_filename) || ((bx_func != BXIMAGE_FUNC_COMPACT) && !strlen(bx_filename2)))
+      fatal("ERROR: Missing filename");
+    switch (bx_func) {
+      case BXIMAGE_FUNC_CLONE:
+        clone_image(bx_filename, bx_filename2);
+        break;
+      case BXIMAGE_FUNC_CONVERT:
+        convert_image(bx_filename, bx_filename2, bx_hdimagemode);
+        break;
+      default:
+        compact_image(bx_filename);
+    }
+    myexit(0);
+  }
   if (bx_interactive) {
     if (ask_menu(fdhd_menu, fdhd_n_choices, fdhd_choices, bx_hdimage, &bx_hdimage) < 0)
       fatal(EOF_ERR);
@@ -664,6 +1292,9 @@ int CDECL main(int argc, char *argv[])
       case 2:
         write_function=make_growing_image;
         break;
+      case 3:
+        write_function=make_dedup_image;
+        break;
       default:
 #ifdef WIN32
         writefn_win32=make_flat_image_win32;
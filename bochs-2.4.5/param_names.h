@@ -31,12 +31,17 @@
 #define BXPN_BOCHS_BENCHMARK             "general.benchmark"
 #define BXPN_RESTORE_FLAG                "general.restore"
 #define BXPN_RESTORE_PATH                "general.restore_path"
+#define BXPN_SNAPSHOT_TICKS              "general.snapshot_ticks"
+#define BXPN_SNAPSHOT_PATH               "general.snapshot_path"
 #define BXPN_DEBUG_RUNNING               "general.debug_running"
 #define BXPN_CPU_NPROCESSORS             "cpu.n_processors"
 #define BXPN_CPU_NCORES                  "cpu.n_cores"
 #define BXPN_CPU_NTHREADS                "cpu.n_threads"
 #define BXPN_IPS                         "cpu.ips"
 #define BXPN_SMP_QUANTUM                 "cpu.quantum"
+#define BXPN_SMP_MODE                    "cpu.smp_mode"
+#define BXPN_TRACE_POOL                  "cpu.trace_pool"
+#define BXPN_JIT_THRESHOLD               "cpu.jit_threshold"
 #define BXPN_RESET_ON_TRIPLE_FAULT       "cpu.reset_on_triple_fault"
 #define BXPN_IGNORE_BAD_MSRS             "cpu.ignore_bad_msrs"
 #define BXPN_CONFIGURABLE_MSRS_PATH      "cpu.msrs"
@@ -54,6 +59,7 @@
 #define BXPN_CPUID_1G_PAGES              "cpuid.1g_pages"
 #define BXPN_MEM_SIZE                    "memory.standard.ram.size"
 #define BXPN_HOST_MEM_SIZE               "memory.standard.ram.host_size"
+#define BXPN_MEM_FILE                    "memory.standard.ram.file"
 #define BXPN_ROM_PATH                    "memory.standard.rom.path"
 #define BXPN_ROM_ADDRESS                 "memory.standard.rom.addr"
 #define BXPN_VGA_ROM_PATH                "memory.standard.vgarom.path"
@@ -62,12 +62,19 @@ bx_pc_system_c::bx_pc_system_c()
   timer[0].funct      = nullTimer;
   timer[0].this_ptr   = this;
   numTimers = 1; // So far, only the nullTimer.
+  timerHeapSize = 0;
+  numFreeTimers = 0;
+#if BX_SUPPORT_ASYNC_DISK
+  timersPosted = 0;
+#endif
+  queueTimer(0);
 }
 
 void bx_pc_system_c::initialize(Bit32u ips)
 {
   ticksTotal = 0;
   timer[0].timeToFire = NullTimerInterval;
+  requeueTimer(0);
   currCountdown       = NullTimerInterval;
   currCountdownPeriod = NullTimerInterval;
   lastTimeUsec = 0;
@@ -171,8 +178,13 @@ bx_bool bx_pc_system_c::get_enable_a20(void)
 
 void bx_pc_system_c::MemoryMappingChanged(void)
 {
-  for (unsigned i=0; i<BX_SMP_PROCESSORS; i++)
+  for (unsigned i=0; i<BX_SMP_PROCESSORS; i++) {
+#if BX_SUPPORT_SMP_THREADS
+    // the TLB of a processor running on another thread is flushed by it
+    if (bx_smp_defer_TLB_flush(i)) continue;
+#endif
     BX_CPU(i)->TLB_flush();
+  }
 }
 
 void bx_pc_system_c::invlpg(bx_address addr)
@@ -184,6 +196,12 @@ void bx_pc_system_c::invlpg(bx_address addr)
 int bx_pc_system_c::Reset(unsigned type)
 {
   // type is BX_RESET_HARDWARE or BX_RESET_SOFTWARE
+#if BX_SUPPORT_SMP_THREADS
+  // the processor threads have to be stopped first, bx_smp_run() calls
+  // us again when they are
+  if (bx_smp_defer_reset(type)) return(0);
+#endif
+
   BX_INFO(("bx_pc_system_c::Reset(%s) called",type==BX_RESET_HARDWARE?"HARDWARE":"SOFTWARE"));
 
   set_enable_a20(1);
@@ -210,6 +228,7 @@ void bx_pc_system_c::exit(void)
 {
   // delete all registered timers (exception: null timer and APIC timer)
   numTimers = 1 + BX_SUPPORT_APIC;
+  rebuildTimerQueue();
   bx_devices.exit();
   if (bx_gui) {
     bx_gui->cleanup();
@@ -242,6 +261,11 @@ void bx_pc_system_c::register_state(void)
   }
 }
 
+void bx_pc_system_c::after_restore_state(void)
+{
+  rebuildTimerQueue();
+}
+
 // ================================================
 // Bochs internal timer delivery framework features
 // ================================================
@@ -268,16 +292,17 @@ int bx_pc_system_c::register_timer_ticks(void* this_ptr, bx_timer_handler_t func
     ticks = MinAllowableTimerPeriod;
   }
 
-  // search for new timer for i=1, i=0 is reserved for NullTimer
-  for (i=1; i < numTimers; i++) {
-    if (timer[i].inUse == 0)
-      break;
-  }
+  // reuse a released timer slot, otherwise take a new one at the end,
+  // i=0 is reserved for NullTimer
+  if (numFreeTimers > 0)
+    i = freeTimer[--numFreeTimers];
+  else
+    i = numTimers;
 
 #if BX_TIMER_DEBUG
   if (i==0)
     BX_PANIC(("register_timer: cannot register NullTimer again!"));
-  if (numTimers >= BX_MAX_TIMERS)
+  if (i >= BX_MAX_TIMERS)
     BX_PANIC(("register_timer: too many registered timers"));
   if (this_ptr == NULL)
     BX_PANIC(("register_timer_ticks: this_ptr is NULL!"));
@@ -293,10 +318,14 @@ int bx_pc_system_c::register_timer_ticks(void* this_ptr, bx_timer_handler_t func
   timer[i].continuous = continuous;
   timer[i].funct      = funct;
   timer[i].this_ptr   = this_ptr;
+#if BX_SUPPORT_ASYNC_DISK
+  timer[i].posted     = 0;
+#endif
   strncpy(timer[i].id, id, BxMaxTimerIDLen);
   timer[i].id[BxMaxTimerIDLen-1] = 0; // Null terminate if not already.
 
   if (active) {
+    queueTimer(i);
     if (ticks < Bit64u(currCountdown)) {
       // This new timer needs to fire before the current countdown.
       // Skew the current countdown and countdown period to be smaller
@@ -315,11 +344,87 @@ int bx_pc_system_c::register_timer_ticks(void* this_ptr, bx_timer_handler_t func
   return(i);
 }
 
+void bx_pc_system_c::siftTimerUp(unsigned pos)
+{
+  unsigned i = timerHeap[pos];
+
+  while (pos > 0) {
+    unsigned parent = (pos - 1) >> 1;
+    if (! timerBefore(i, timerHeap[parent])) break;
+    timerHeap[pos] = timerHeap[parent];
+    timer[timerHeap[pos]].heapIndex = pos;
+    pos = parent;
+  }
+  timerHeap[pos] = i;
+  timer[i].heapIndex = pos;
+}
+
+void bx_pc_system_c::siftTimerDown(unsigned pos)
+{
+  unsigned i = timerHeap[pos];
+
+  for (;;) {
+    unsigned child = 2*pos + 1;
+    if (child >= timerHeapSize) break;
+    if (child+1 < timerHeapSize && timerBefore(timerHeap[child+1], timerHeap[child]))
+      child++;
+    if (! timerBefore(timerHeap[child], i)) break;
+    timerHeap[pos] = timerHeap[child];
+    timer[timerHeap[pos]].heapIndex = pos;
+    pos = child;
+  }
+  timerHeap[pos] = i;
+  timer[i].heapIndex = pos;
+}
+
+// Insert a timer which just became active into the heap.
+void bx_pc_system_c::queueTimer(unsigned i)
+{
+  timerHeap[timerHeapSize] = i;
+  siftTimerUp(timerHeapSize++);
+}
+
+// Remove a timer which is no longer active from the heap.
+void bx_pc_system_c::dequeueTimer(unsigned i)
+{
+  unsigned pos = timer[i].heapIndex;
+
+  if (pos != --timerHeapSize) {
+    timerHeap[pos] = timerHeap[timerHeapSize];
+    timer[timerHeap[pos]].heapIndex = pos;
+    requeueTimer(timerHeap[pos]);
+  }
+}
+
+// Restore the heap order after the time to fire of an active timer changed.
+void bx_pc_system_c::requeueTimer(unsigned i)
+{
+  unsigned pos = timer[i].heapIndex;
+
+  if (pos > 0 && timerBefore(i, timerHeap[(pos - 1) >> 1]))
+    siftTimerUp(pos);
+  else
+    siftTimerDown(pos);
+}
+
+// Recreate the heap and the free slots from the timer array, after the
+// timers were truncated or their state was restored.
+void bx_pc_system_c::rebuildTimerQueue(void)
+{
+  timerHeapSize = 0;
+  numFreeTimers = 0;
+  for (unsigned i=0; i < numTimers; i++) {
+    if (! timer[i].inUse)
+      freeTimer[numFreeTimers++] = i;
+    else if (timer[i].active)
+      queueTimer(i);
+  }
+}
+
 void bx_pc_system_c::countdownEvent(void)
 {
-  unsigned i;
-  Bit64u   minTimeToFire;
-  bx_bool  triggered[BX_MAX_TIMERS];
+  unsigned i, n = 0;
+  unsigned triggered[BX_MAX_TIMERS];
 
   // The countdown decremented to 0.  We need to service all the active
   // timers, and invoke callbacks from those timers which have fired.
@@ -331,36 +436,29 @@ void bx_pc_system_c::countdownEvent(void)
   // Increment global ticks counter by number of ticks which have
   // elapsed since the last update.
   ticksTotal += Bit64u(currCountdownPeriod);
-  minTimeToFire = (Bit64u) -1;
 
-  for (i=0; i < numTimers; i++) {
-    triggered[i] = 0; // Reset triggered flag.
-    if (timer[i].active) {
 #if BX_TIMER_DEBUG
-      if (ticksTotal > timer[i].timeToFire)
-        BX_PANIC(("countdownEvent: ticksTotal > timeToFire[%u], D " FMT_LL "u", i,
-                  timer[i].timeToFire-ticksTotal));
+  if (ticksTotal > timer[timerHeap[0]].timeToFire)
+    BX_PANIC(("countdownEvent: ticksTotal > timeToFire[%u], D " FMT_LL "u", timerHeap[0],
+              timer[timerHeap[0]].timeToFire-ticksTotal));
 #endif
-      if (ticksTotal == timer[i].timeToFire) {
-        // This timer is ready to fire.
-        triggered[i] = 1;
-
-        if (timer[i].continuous==0) {
-          // If triggered timer is one-shot, deactive.
-          timer[i].active = 0;
-        }
-        else {
-          // Continuous timer, increment time-to-fire by period.
-          timer[i].timeToFire += timer[i].period;
-          if (timer[i].timeToFire < minTimeToFire)
-            minTimeToFire = timer[i].timeToFire;
-        }
-      }
-      else {
-        // This timer is not ready to fire yet.
-        if (timer[i].timeToFire < minTimeToFire)
-          minTimeToFire = timer[i].timeToFire;
-      }
+
+  // Take the timers which are ready to fire off the top of the heap, in
+  // order of their index.  The null timer is always active, so the heap
+  // never runs empty.
+  while (timer[timerHeap[0]].timeToFire == ticksTotal) {
+    i = timerHeap[0];
+    triggered[n++] = i;
+
+    if (timer[i].continuous==0) {
+      // If triggered timer is one-shot, deactive.
+      timer[i].active = 0;
+      dequeueTimer(i);
+    }
+    else {
+      // Continuous timer, increment time-to-fire by period.
+      timer[i].timeToFire += timer[i].period;
+      siftTimerDown(0);
     }
   }
 
@@ -368,18 +466,50 @@ void bx_pc_system_c::countdownEvent(void)
   // any of the callbacks, as they may call timer features, which need
   // to be advanced to the next countdown cycle.
   currCountdown = currCountdownPeriod =
-      Bit32u(minTimeToFire - ticksTotal);
+      Bit32u(timer[timerHeap[0]].timeToFire - ticksTotal);
 
-  for (i=0; i < numTimers; i++) {
+  for (unsigned t=0; t < n; t++) {
     // Call requested timer function.  It may request a different
     // timer period or deactivate etc.
-    if (triggered[i]) {
-      triggeredTimer = i;
-      timer[i].funct(timer[i].this_ptr);
-      triggeredTimer = 0;
+    i = triggered[t];
+    triggeredTimer = i;
+    timer[i].funct(timer[i].this_ptr);
+    triggeredTimer = 0;
+  }
+
+#if BX_SUPPORT_ASYNC_DISK
+  // also catches a post whose wake up of the processor got lost
+  if (timersPosted)
+    activate_posted_timers();
+#endif
+}
+
+#if BX_SUPPORT_ASYNC_DISK
+void bx_pc_system_c::post_timer(unsigned i)
+{
+  timer[i].posted = 1;
+  __sync_synchronize();
+  timersPosted = 1;
+  // The processor activates the timer when it handles the event.  The
+  // atomic OR can still be overwritten by a plain store of the processor
+  // thread, then the next countdown event activates it.
+  __sync_fetch_and_or(&BX_CPU(0)->async_event, 1);
+}
+
+void bx_pc_system_c::activate_posted_timers(void)
+{
+  // clear the summary flag first, a timer posted meanwhile sets it again
+  timersPosted = 0;
+  __sync_synchronize();
+  for (unsigned i=1; i < numTimers; i++) {
+    if (timer[i].posted) {
+      timer[i].posted = 0;
+      if (timer[i].inUse)
+        activate_timer_ticks(i, timer[i].period, 0);
     }
   }
 }
+#endif
 
 void bx_pc_system_c::nullTimer(void* this_ptr)
 {
@@ -455,6 +585,21 @@ Bit64u bx_pc_system_c::time_usec()
 
 void bx_pc_system_c::start_timers(void) { }
 
+bx_bool bx_pc_system_c::cpus_halted_idle(void)
+{
+  for (unsigned i=0; i<BX_SMP_PROCESSORS; i++) {
+    if (! BX_CPU(i)->is_halted_idle())
+      return 0;
+  }
+  return 1;
+}
+
+void bx_pc_system_c::skip_idle_quanta(Bit32u quantum)
+{
+  // no timer fires before the countdown reaches 0
+  currCountdown -= ((currCountdown - 1) / quantum) * quantum;
+}
+
 void bx_pc_system_c::activate_timer_ticks(unsigned i, Bit64u ticks, bx_bool continuous)
 {
 #if BX_TIMER_DEBUG
@@ -478,8 +623,14 @@ void bx_pc_system_c::activate_timer_ticks(unsigned i, Bit64u ticks, bx_bool cont
   timer[i].period = ticks;
   timer[i].timeToFire = (ticksTotal + Bit64u(currCountdownPeriod-currCountdown)) +
                         ticks;
-  timer[i].active     = 1;
   timer[i].continuous = continuous;
+  if (timer[i].active) {
+    requeueTimer(i);
+  }
+  else {
+    timer[i].active = 1;
+    queueTimer(i);
+  }
 
   if (ticks < Bit64u(currCountdown)) {
     // This new timer needs to fire before the current countdown.
@@ -533,7 +684,10 @@ void bx_pc_system_c::deactivate_timer(unsigned i)
     BX_PANIC(("deactivate_timer: timer 0 is the nullTimer!"));
 #endif
 
-  timer[i].active = 0;
+  if (timer[i].active) {
+    timer[i].active = 0;
+    dequeueTimer(i);
+  }
 }
 
 bx_bool bx_pc_system_c::unregisterTimer(unsigned timerIndex)
@@ -562,6 +716,7 @@ bx_bool bx_pc_system_c::unregisterTimer(unsigned timerIndex)
   memset(timer[timerIndex].id, 0, BxMaxTimerIDLen);
 
   if (timerIndex == (numTimers-1)) numTimers--;
+  else freeTimer[numFreeTimers++] = timerIndex;
 
   return(1); // OK
 }
@@ -47,6 +47,10 @@ private:
     Bit64u  timeToFire; // Time to fire next (in absolute ticks).
     bx_bool active;     // 0=inactive, 1=active.
     bx_bool continuous; // 0=one-shot timer, 1=continuous periodicity.
+    unsigned heapIndex; // Position in the timer heap while active.
+#if BX_SUPPORT_ASYNC_DISK
+    volatile bx_bool posted; // Activation requested by a host thread.
+#endif
     bx_timer_handler_t funct;  // A callback function for when the
                                //   timer fires.
     void *this_ptr;            // The this-> pointer for C++ callbacks
@@ -56,12 +60,23 @@ private:
   } timer[BX_MAX_TIMERS];
 
   unsigned   numTimers;  // Number of currently allocated timers.
+
+  // The active timers are kept in a binary min-heap ordered by time to
+  // fire (ties broken by timer index), so the next event is always at
+  // timerHeap[0].  Slots released below numTimers are kept on a stack.
+  unsigned   timerHeap[BX_MAX_TIMERS];
+  unsigned   timerHeapSize;
+  unsigned   freeTimer[BX_MAX_TIMERS];
+  unsigned   numFreeTimers;
   unsigned   triggeredTimer;  // ID of the actually triggered timer.
   Bit32u     currCountdown; // Current countdown ticks value (decrements to 0).
   Bit32u     currCountdownPeriod; // Length of current countdown period.
   Bit64u     ticksTotal; // Num ticks total since start of emulator execution.
   Bit64u     lastTimeUsec; // Last sequentially read time in usec.
   Bit64u     usecSinceLast; // Number of useconds claimed since then.
+#if BX_SUPPORT_ASYNC_DISK
+  volatile bx_bool timersPosted; // Some timer has been posted.
+#endif
 
   // A special null timer is always inserted in the timer[0] slot.  This
   // make sure that at least one timer is always active, and that the
@@ -81,6 +96,22 @@ private:
   // ticks finds that an event has occurred.
   void   countdownEvent(void);
 
+#if BX_SUPPORT_JIT
+  // translated traces keep the countdown in a host register
+  friend class bxJitCompiler;
+#endif
+
+  BX_CPP_INLINE bx_bool timerBefore(unsigned a, unsigned b) const {
+    return (timer[a].timeToFire < timer[b].timeToFire) ||
+           (timer[a].timeToFire == timer[b].timeToFire && a < b);
+  }
+  void   siftTimerUp(unsigned pos);
+  void   siftTimerDown(unsigned pos);
+  void   queueTimer(unsigned i);
+  void   dequeueTimer(unsigned i);
+  void   requeueTimer(unsigned i);
+  void   rebuildTimerQueue(void);
+
 public:
 
   // ==============================
@@ -94,6 +125,14 @@ public:
   void   start_timers(void);
   void   activate_timer(unsigned timer_index, Bit32u useconds, bx_bool continuous);
   void   deactivate_timer(unsigned timer_index);
+#if BX_SUPPORT_ASYNC_DISK
+  // A host thread cannot touch the timers, it posts a one-shot activation
+  // of the timer with its stored period instead.  The simulation thread
+  // activates the posted timers at its next event or timer check.
+  void   post_timer(unsigned timer_index);
+  BX_CPP_INLINE bx_bool timers_posted(void) const { return timersPosted; }
+  void   activate_posted_timers(void);
+#endif
   unsigned triggeredTimerID(void) {
     return triggeredTimer;
   }
@@ -128,6 +167,11 @@ public:
   static BX_CPP_INLINE Bit32u  getNumCpuTicksLeftNextEvent(void) {
     return bx_pc_system.currCountdown;
   }
+  // All processors wait for an interrupt, which only a timer event can
+  // raise.  The quanta passing before the one in which the next event
+  // fires can be skipped then, without changing the simulation.
+  bx_bool cpus_halted_idle(void);
+  void    skip_idle_quanta(Bit32u quantum);
 #if BX_DEBUGGER
   static void timebp_handler(void* this_ptr);
 #endif
@@ -173,6 +217,7 @@ public:
   void    invlpg(bx_address addr);    // flush TLB page in all CPUs
   void    exit(void);
   void    register_state(void);
+  void    after_restore_state(void);
 };
 
 #endif
@@ -0,0 +1,510 @@
+/////////////////////////////////////////////////////////////////////////
+// $Id$
+/////////////////////////////////////////////////////////////////////////
+//
+//  Copyright (C) 2010  The Bochs Project
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+//
+/////////////////////////////////////////////////////////////////////////
+
+//
+// Parallel SMP simulation: every processor runs cpu_loop() on its own host
+// thread, the bootstrap processor on the thread which called bx_smp_run().
+//
+// The threads share the guest memory without a lock.  Instructions with a
+// read-modify-write memory operand write their result back with a host
+// compare-and-swap (see BX_CPU_C::write_RMW_host_smp()), so LOCKed
+// instructions stay atomic between the processors.
+//
+// Everything else (devices, timers, local APIC registers, logging) is
+// serialized by one recursive big lock.  It is taken at the boundaries
+// between the processors and the rest of the simulator: port I/O, memory
+// handlers, local APIC accesses and interrupt acknowledge.
+//
+// The system time is advanced by the lowest numbered processor which is
+// not sleeping, by one quantum after each of its cpu loops, which gives
+// the same rate as the round robin simulation.  A halted processor sleeps
+// on a condition variable until an interrupt is sent to it, except the
+// last one which keeps the time running, skipping straight to the quantum
+// of the next timer event.
+//
+// State of a processor may only be changed by its own thread, so a SIPI,
+// a TLB flush requested by a device (A20 change) or a system reset are
+// handed over to the target thread and carried out between two cpu loops.
+//
+// Lock-step mode makes the parallel simulation reproducible.  The time is
+// divided into epochs of one quantum each, every epoch has two phases:
+//
+// - In the parallel phase the processors run their quantum at the same
+//   time.  A processor may only read the pages of the physical memory it
+//   owns or which are shared, and only write the pages it owns.  An access
+//   to any other page, to the devices or to a local APIC and the delivery
+//   of an interrupt or exception leave the cpu loop before the instruction
+//   changed anything (BX_CPU_C::smp_serialize()).
+//
+// - In the serial phase the processors which left the parallel phase early
+//   run the rest of their quantum one after another in the order of their
+//   numbers, while all other threads are parked.  A read of a page owned by
+//   another processor makes it shared, a write makes the page owned by the
+//   writer; the processors losing access to the page flush their TLB.
+//
+// The time advances only at the end of an epoch, by one quantum, the same
+// way as in the round robin mode.  Nothing a processor sees in the parallel
+// phase can be changed by the others, and everything else happens in a
+// fixed order, so the same configuration gives the same simulation in every
+// run, independently of the host scheduling.
+//
+
+#include "bochs.h"
+#include "cpu/cpu.h"
+#define LOG_THIS genlog->
+
+#if BX_SUPPORT_SMP_THREADS
+
+#include <pthread.h>
+
+bx_bool bx_smp_threads = 0;
+
+static pthread_mutex_t smp_mutex = PTHREAD_MUTEX_INITIALIZER;
+// signalled when a processor thread has left the simulation
+static pthread_cond_t smp_leave = PTHREAD_COND_INITIALIZER;
+// lock-step mode: signalled when the phase or the epoch changes
+static pthread_cond_t smp_step = PTHREAD_COND_INITIALIZER;
+
+static __thread unsigned smp_lock_depth = 0;
+// the processor simulated by the calling thread
+static __thread unsigned smp_self = 0;
+
+static struct {
+  pthread_t thread;
+  pthread_cond_t wakeup;
+  volatile bx_bool waiting;     // sleeping in smp_cpu_wait()
+  volatile bx_bool flush_tlb;   // TLB flush requested by another thread
+  volatile unsigned sipi;       // pending startup vector + 1, 0 if none
+  Bit32u ticks;                 // lock-step mode: ticks passed by BX_TICKN()
+} smp_cpu[BX_MAX_SMP_THREADS_SUPPORTED];
+
+static Bit32u smp_quantum;
+static volatile bx_bool smp_running = 0;
+static volatile bx_bool smp_stop_request = 0;
+static bx_bool smp_reset_request = 0;
+static unsigned smp_reset_type;
+static unsigned smp_waiting = 0;
+static unsigned smp_active = 0;
+
+bx_bool bx_smp_lockstep = 0;
+
+// lock-step mode: set on a processor thread in the parallel phase
+static __thread bx_bool smp_parallel = 0;
+static unsigned smp_arrived;    // threads done with the parallel phase
+static unsigned smp_turn;       // processor in the serial phase
+static Bit32u smp_epoch;
+// lock-step mode statistics
+static Bit64u smp_epochs = 0, smp_serial_runs = 0, smp_owner_changes = 0;
+
+// lock-step mode: the processor owning each page of the physical memory
+#define BX_SMP_PAGE_SHARED 0xff
+static Bit8u *smp_owner = NULL;
+static Bit32u smp_owner_pages = 0;
+
+// Wake up the sleeping processors which got something to do, called with
+// the big lock held.
+static void smp_wakeup(void)
+{
+  for (unsigned i=0; i<BX_SMP_PROCESSORS; i++) {
+    if (smp_cpu[i].waiting &&
+         (smp_stop_request || smp_cpu[i].sipi || !BX_CPU(i)->is_halted_idle()))
+      pthread_cond_signal(&smp_cpu[i].wakeup);
+  }
+}
+
+// Make all processors leave their cpu loops as soon as possible.
+static void smp_stop_all(void)
+{
+  smp_stop_request = 1;
+  for (unsigned i=0; i<BX_SMP_PROCESSORS; i++)
+    BX_CPU_SIGNAL_EVENT(BX_CPU(i), 1);
+  pthread_cond_broadcast(&smp_step);
+}
+
+bx_bool bx_smp_stop_pending(void)
+{
+  return smp_stop_request;
+}
+
+void bx_smp_lock(void)
+{
+  if (smp_lock_depth++ == 0)
+    pthread_mutex_lock(&smp_mutex);
+}
+
+void bx_smp_unlock(void)
+{
+  if (--smp_lock_depth == 0) {
+    if (smp_waiting > 0) smp_wakeup();
+    pthread_mutex_unlock(&smp_mutex);
+  }
+}
+
+void bx_smp_tickn(Bit32u n)
+{
+  if (bx_smp_lockstep) {
+    // the time stands still within an epoch, the ticks passed by the
+    // processor are added at its end
+    smp_cpu[smp_self].ticks += n;
+    return;
+  }
+
+  BX_SMP_LOCK();
+  bx_pc_system.tickn(n);
+  BX_SMP_UNLOCK();
+}
+
+bx_bool bx_smp_defer_reset(unsigned type)
+{
+  if (! smp_running) return 0;
+
+  BX_SMP_LOCK();
+  if (! smp_reset_request || type == BX_RESET_HARDWARE)
+    smp_reset_type = type;
+  smp_reset_request = 1;
+  smp_stop_all();
+  BX_SMP_UNLOCK();
+  return 1;
+}
+
+// In lock-step mode the other processors are parked whenever a device or
+// another processor could act on them, there is no need to defer.
+bx_bool bx_smp_defer_TLB_flush(unsigned cpu)
+{
+  if (! smp_running || bx_smp_lockstep || cpu == smp_self) return 0;
+
+  smp_cpu[cpu].flush_tlb = 1;
+  return 1;
+}
+
+bx_bool bx_smp_defer_SIPI(unsigned cpu, unsigned vector)
+{
+  if (! smp_running || cpu == smp_self) return 0;
+
+  if (bx_smp_lockstep) {
+    // A startup IPI sent right after an INIT could arrive before the
+    // processor took the INIT, keep it until then.
+    if (! BX_CPU(cpu)->pending_INIT) return 0;
+    smp_cpu[cpu].sipi = vector + 1;
+    return 1;
+  }
+
+  BX_SMP_LOCK();
+  smp_cpu[cpu].sipi = vector + 1;
+  BX_CPU_SIGNAL_EVENT(BX_CPU(cpu), 1);
+  BX_SMP_UNLOCK();
+  return 1;
+}
+
+// Sleep until the halted processor gets something to do, called with the
+// big lock held.
+static void smp_cpu_wait(unsigned n)
+{
+  BX_CPU_C *cpu = BX_CPU(n);
+
+  smp_cpu[n].waiting = 1;
+  smp_waiting++;
+  // the last processor still running a HLT loop keeps the time going
+  while (! smp_stop_request && ! smp_cpu[n].sipi && cpu->is_halted_idle() &&
+          (cpu->activity_state == BX_ACTIVITY_STATE_WAIT_FOR_SIPI ||
+           smp_waiting < (unsigned) BX_SMP_PROCESSORS))
+  {
+    pthread_cond_wait(&smp_cpu[n].wakeup, &smp_mutex);
+  }
+  smp_waiting--;
+  smp_cpu[n].waiting = 0;
+}
+
+static void smp_cpu_loop(unsigned n)
+{
+  BX_CPU_C *cpu = BX_CPU(n);
+  smp_self = n;
+
+  while (1) {
+    if (smp_cpu[n].flush_tlb) {
+      smp_cpu[n].flush_tlb = 0;
+      cpu->TLB_flush();
+    }
+
+    cpu->cpu_loop(smp_quantum);
+
+    if (cpu->smp_rmw_locked) {
+      cpu->smp_rmw_locked = 0;
+      bx_smp_unlock();
+    }
+
+    if (smp_stop_request || bx_pc_system.kill_bochs_request)
+      break;
+
+    // handleAsyncEvent() might have cleared async_event just after another
+    // thread raised an event for this processor
+    if (cpu->INTR || cpu->pending_NMI || cpu->pending_SMI || cpu->pending_INIT
+#if BX_SUPPORT_APIC
+        || cpu->lapic.INTR
+#endif
+       ) cpu->async_event = 1;
+
+    bx_bool ticker = 1;
+    for (unsigned i=0; i<n; i++) {
+      if (! smp_cpu[i].waiting) {
+        ticker = 0;
+        break;
+      }
+    }
+
+    if (ticker || smp_cpu[n].sipi || cpu->activity_state) {
+      bx_smp_lock();
+      if (smp_cpu[n].sipi) {
+        unsigned vector = smp_cpu[n].sipi - 1;
+        smp_cpu[n].sipi = 0;
+        cpu->deliver_SIPI(vector);
+      }
+      if (ticker) {
+        bx_pc_system.tickn(smp_quantum);
+        if (bx_pc_system.cpus_halted_idle())
+          bx_pc_system.skip_idle_quanta(smp_quantum);
+      }
+      if (cpu->is_halted_idle())
+        smp_cpu_wait(n);
+      bx_smp_unlock();
+    }
+  }
+
+  bx_smp_lock();
+  // one processor leaving takes all others with it
+  smp_stop_all();
+  smp_active--;
+  pthread_cond_signal(&smp_leave);
+  bx_smp_unlock();
+}
+
+void bx_smp_serialize(void)
+{
+  if (smp_parallel)
+    BX_CPU(smp_self)->smp_serialize();
+}
+
+void bx_smp_access(unsigned cpu, bx_phy_address addr, unsigned rw)
+{
+  Bit32u page = (Bit32u) (addr >> 12);
+  if (page >= smp_owner_pages) return;
+
+  unsigned owner = smp_owner[page];
+  bx_bool write = rw & 1;
+  if (owner == cpu || (owner == BX_SMP_PAGE_SHARED && ! write))
+    return;
+
+  // the other processors might use the page right now
+  if (smp_parallel)
+    BX_CPU(cpu)->smp_serialize();
+
+  // serial phase: the processors losing access to the page are parked and
+  // drop their translations for it before they run again
+  for (unsigned i=0; i<BX_SMP_PROCESSORS; i++) {
+    if (i != cpu && (owner == i || (write && owner == BX_SMP_PAGE_SHARED)))
+      smp_cpu[i].flush_tlb = 1;
+  }
+  smp_owner[page] = write ? cpu : BX_SMP_PAGE_SHARED;
+  smp_owner_changes++;
+}
+
+static void smp_release_rmw(BX_CPU_C *cpu)
+{
+  if (cpu->smp_rmw_locked) {
+    cpu->smp_rmw_locked = 0;
+    bx_smp_unlock();
+  }
+}
+
+// Lock-step mode: catch up with the requests of the other processors
+// before the processor runs again.
+static void smp_lockstep_prepare(unsigned n)
+{
+  BX_CPU_C *cpu = BX_CPU(n);
+
+  if (smp_cpu[n].flush_tlb) {
+    smp_cpu[n].flush_tlb = 0;
+    cpu->TLB_flush();
+  }
+
+  if (smp_cpu[n].sipi && ! cpu->pending_INIT) {
+    unsigned vector = smp_cpu[n].sipi - 1;
+    smp_cpu[n].sipi = 0;
+    cpu->deliver_SIPI(vector);
+  }
+}
+
+// Lock-step mode, see the top of this file.
+static void smp_lockstep_loop(unsigned n)
+{
+  BX_CPU_C *cpu = BX_CPU(n);
+  smp_self = n;
+
+  while (1) {
+    smp_lockstep_prepare(n);
+    smp_parallel = 1;
+    cpu->cpu_loop(smp_quantum);
+    smp_parallel = 0;
+    smp_release_rmw(cpu);
+
+    bx_smp_lock();
+    Bit32u epoch = smp_epoch;
+    if (++smp_arrived == (unsigned) BX_SMP_PROCESSORS) {
+      smp_turn = 0;
+      pthread_cond_broadcast(&smp_step);
+    }
+    while (! smp_stop_request && smp_turn != n)
+      pthread_cond_wait(&smp_step, &smp_mutex);
+
+    if (cpu->smp_serialized && ! smp_stop_request && ! bx_pc_system.kill_bochs_request) {
+      // restart at the instruction which left the parallel phase
+      cpu->smp_serialized = 0;
+      smp_serial_runs++;
+      smp_lockstep_prepare(n);
+      cpu->cpu_loop(cpu->smp_instr_left);
+      smp_release_rmw(cpu);
+    }
+
+    if (! smp_stop_request && ! bx_pc_system.kill_bochs_request) {
+      if (++smp_turn == (unsigned) BX_SMP_PROCESSORS) {
+        // the last one closes the epoch
+        Bit32u ticks = smp_quantum;
+        for (unsigned i=0; i<BX_SMP_PROCESSORS; i++) {
+          ticks += smp_cpu[i].ticks;
+          smp_cpu[i].ticks = 0;
+        }
+        bx_pc_system.tickn(ticks);
+        // epochs in which all processors stay halted can be skipped
+        if (bx_pc_system.cpus_halted_idle())
+          bx_pc_system.skip_idle_quanta(smp_quantum);
+        smp_arrived = 0;
+        smp_epoch++;
+        smp_epochs++;
+      }
+      pthread_cond_broadcast(&smp_step);
+      while (! smp_stop_request && smp_epoch == epoch)
+        pthread_cond_wait(&smp_step, &smp_mutex);
+    }
+    bx_smp_unlock();
+
+    if (smp_stop_request || bx_pc_system.kill_bochs_request)
+      break;
+  }
+
+  bx_smp_lock();
+  smp_stop_all();
+  smp_active--;
+  pthread_cond_signal(&smp_leave);
+  bx_smp_unlock();
+}
+
+static void *smp_cpu_thread(void *arg)
+{
+  unsigned n = (unsigned) (bx_ptr_equiv_t) arg;
+  if (bx_smp_lockstep)
+    smp_lockstep_loop(n);
+  else
+    smp_cpu_loop(n);
+  return NULL;
+}
+
+void bx_smp_run(Bit32u quantum, bx_bool lockstep)
+{
+  unsigned i;
+
+  if (lockstep) {
+    BX_INFO(("running %d processors on their own host threads in lock-step epochs of %d instructions",
+      BX_SMP_PROCESSORS, quantum));
+    smp_owner_pages = (Bit32u) (BX_MEM(0)->get_memory_len() >> 12);
+    smp_owner = new Bit8u[smp_owner_pages];
+  }
+  else {
+    BX_INFO(("running %d processors on their own host threads", BX_SMP_PROCESSORS));
+  }
+
+  for (i=0; i<BX_SMP_PROCESSORS; i++)
+    pthread_cond_init(&smp_cpu[i].wakeup, NULL);
+
+  smp_quantum = quantum;
+  bx_smp_threads = 1;
+  bx_smp_lockstep = lockstep;
+
+  while (1) {
+    for (i=0; i<BX_SMP_PROCESSORS; i++) {
+      smp_cpu[i].waiting = 0;
+      smp_cpu[i].flush_tlb = bx_smp_lockstep;
+      smp_cpu[i].sipi = 0;
+      smp_cpu[i].ticks = 0;
+      BX_CPU(i)->smp_serialized = 0;
+    }
+    smp_stop_request = 0;
+    smp_reset_request = 0;
+    smp_waiting = 0;
+    smp_active = BX_SMP_PROCESSORS;
+    // lock-step mode starts with all memory owned by the bootstrap processor
+    if (bx_smp_lockstep)
+      memset(smp_owner, BX_BOOTSTRAP_PROCESSOR, smp_owner_pages);
+    smp_arrived = 0;
+    smp_turn = BX_SMP_PROCESSORS;
+    smp_epoch = 0;
+    smp_running = 1;
+
+    for (i=1; i<BX_SMP_PROCESSORS; i++) {
+      if (pthread_create(&smp_cpu[i].thread, NULL, smp_cpu_thread, (void *) (bx_ptr_equiv_t) i) != 0)
+        BX_PANIC(("could not create the host thread of CPU%x", i));
+    }
+
+    smp_cpu_thread((void *) 0);
+
+    for (i=1; i<BX_SMP_PROCESSORS; i++)
+      pthread_join(smp_cpu[i].thread, NULL);
+
+    smp_running = 0;
+
+    if (! smp_reset_request || bx_pc_system.kill_bochs_request)
+      break;
+
+    // all processors are stopped now, do the reset they were asked for
+    bx_pc_system.Reset(smp_reset_type);
+  }
+}
+
+void bx_smp_stop(void)
+{
+  if (! smp_running) return;
+
+  // The lock is kept, the simulator is shut down by the calling thread.
+  bx_smp_lock();
+  smp_stop_all();
+  smp_wakeup();
+  smp_active--;
+  while (smp_active > 0)
+    pthread_cond_wait(&smp_leave, &smp_mutex);
+  smp_running = 0;
+
+  if (bx_smp_lockstep) {
+    BX_INFO(("lock-step SMP: " FMT_LL "u epochs, " FMT_LL "u serial phase runs, " FMT_LL "u page ownership changes",
+      smp_epochs, smp_serial_runs, smp_owner_changes));
+  }
+}
+
+#endif
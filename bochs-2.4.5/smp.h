@@ -0,0 +1,85 @@
+/////////////////////////////////////////////////////////////////////////
+// $Id$
+/////////////////////////////////////////////////////////////////////////
+//
+//  Copyright (C) 2010  The Bochs Project
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+//
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef BX_SMP_H
+#define BX_SMP_H
+
+#if BX_SUPPORT_SMP_THREADS
+
+// Every processor of an SMP configuration runs on its own host thread
+// (cpu: smp_mode=threads).  Guest memory is shared directly between the
+// threads; the devices, the timers, the local APIC registers and the
+// logging are serialized by one recursive big lock taken at the I/O
+// boundaries with BX_SMP_LOCK() / BX_SMP_UNLOCK().
+//
+// In lock-step mode (cpu: smp_mode=lockstep) the processors run in epochs
+// of one quantum.  Every epoch has a parallel phase, in which a processor
+// may only touch memory pages it owns or which are shared read-only, and a
+// serial phase, in which the processors finish the epoch one after another
+// starting at the instruction which would have left those bounds.  The
+// simulation is reproducible, as with the round robin mode.
+
+// set while the processor threads are in charge of the simulation
+BOCHSAPI extern bx_bool bx_smp_threads;
+// set while the processor threads run in lock-step mode
+BOCHSAPI extern bx_bool bx_smp_lockstep;
+
+void bx_smp_lock(void);
+void bx_smp_unlock(void);
+
+// run the processors until the simulation is stopped
+void bx_smp_run(Bit32u quantum, bx_bool lockstep);
+// stop the other processor threads before the simulator exits
+void bx_smp_stop(void);
+// set when the processors have to leave their cpu loops
+bx_bool bx_smp_stop_pending(void);
+void bx_smp_tickn(Bit32u n);
+
+// Requests which have to be carried out by the thread of the target
+// processor between two of its cpu loops.  They return 0 when the caller
+// may act directly (no threads running or the target is the caller).
+bx_bool bx_smp_defer_reset(unsigned type);
+bx_bool bx_smp_defer_TLB_flush(unsigned cpu);
+bx_bool bx_smp_defer_SIPI(unsigned cpu, unsigned vector);
+
+// Lock-step mode: leave the parallel phase for the serial one before an
+// access to the devices, and check the access of a processor to a page of
+// the physical memory.
+void bx_smp_serialize(void);
+void bx_smp_access(unsigned cpu, bx_phy_address addr, unsigned rw);
+
+#define BX_SMP_LOCK()   (bx_smp_threads ? bx_smp_lock() : (void) 0)
+#define BX_SMP_UNLOCK() (bx_smp_threads ? bx_smp_unlock() : (void) 0)
+#define BX_SMP_SERIALIZE() (bx_smp_lockstep ? bx_smp_serialize() : (void) 0)
+#define BX_SMP_ACCESS(cpu, addr, rw) \
+  (bx_smp_lockstep ? bx_smp_access(cpu, addr, rw) : (void) 0)
+
+#else
+
+#define BX_SMP_LOCK()
+#define BX_SMP_UNLOCK()
+#define BX_SMP_SERIALIZE()
+#define BX_SMP_ACCESS(cpu, addr, rw)
+
+#endif
+
+#endif